@@ -46,6 +46,7 @@ public:
         gboolean console{false};
         gboolean debug{false};
         gboolean icon_title{false};
+        gboolean input_thread{false};
         gboolean keep{false};
         gboolean no_argb_visual{false};
         gboolean no_bold{false};
@@ -379,6 +380,8 @@ public:
                           "Enable distinct highlight foreground color for selection", "COLOR" },
                         { "icon-title", 'i', 0, G_OPTION_ARG_NONE, &icon_title,
                           "Enable the setting of the icon title", nullptr },
+                        { "input-thread", 0, 0, G_OPTION_ARG_NONE, &input_thread,
+                          "Read from the child on a separate thread", nullptr },
                         { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
                           "Live on after the command exits", nullptr },
                         { "no-argb-visual", 0, 0, G_OPTION_ARG_NONE, &no_argb_visual,
@@ -1923,6 +1926,7 @@ vteapp_window_constructed(GObject *object)
         vte_terminal_set_cjk_ambiguous_width(window->terminal, options.cjk_ambiguous_width);
         vte_terminal_set_cursor_blink_mode(window->terminal, options.cursor_blink_mode);
         vte_terminal_set_cursor_shape(window->terminal, options.cursor_shape);
+        vte_terminal_set_enable_input_thread(window->terminal, options.input_thread);
         vte_terminal_set_mouse_autohide(window->terminal, true);
         vte_terminal_set_rewrap_on_resize(window->terminal, !options.no_rewrap);
         vte_terminal_set_scroll_on_output(window->terminal, false);
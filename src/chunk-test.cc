@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "chunk.hh"
+
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+
+using namespace vte::base;
+
+static void
+test_chunk_pool_reuse(void)
+{
+        ChunkPool pool{};
+
+        auto chunk = pool.get();
+        g_assert_nonnull(chunk.get());
+        g_assert_cmpuint(chunk->len, ==, 0);
+        g_assert_cmpuint(chunk->remaining_capacity(), ==, chunk->capacity());
+
+        chunk->len = 42;
+        auto const ptr = chunk.get();
+        chunk.reset();
+
+        auto stats = pool.stats();
+        g_assert_cmpuint(stats.in_flight, ==, 0);
+        g_assert_cmpuint(stats.peak_in_flight, ==, 1);
+        g_assert_cmpuint(stats.n_slabs, ==, 1);
+        g_assert_cmpuint(stats.n_free, ==, ChunkPool::k_slab_chunks);
+
+        /* The most recently freed chunk is handed out again, reset */
+        chunk = pool.get();
+        g_assert_true(chunk.get() == ptr);
+        g_assert_cmpuint(chunk->len, ==, 0);
+
+        stats = pool.stats();
+        g_assert_cmpuint(stats.n_gets, ==, 2);
+        g_assert_cmpuint(stats.n_reused, ==, 1);
+        g_assert_cmpuint(stats.n_slab_allocs, ==, 1);
+}
+
+static void
+test_chunk_pool_slabs(void)
+{
+        ChunkPool pool{};
+
+        std::vector<Chunk::unique_type> chunks;
+        for (auto i = 0u; i < 3 * ChunkPool::k_slab_chunks; ++i)
+                chunks.push_back(pool.get());
+
+        /* Chunks from one slab are contiguous */
+        for (auto i = 1u; i < ChunkPool::k_slab_chunks; ++i)
+                g_assert_true(reinterpret_cast<char*>(chunks[i].get()) ==
+                              reinterpret_cast<char*>(chunks[0].get()) + i * Chunk::k_chunk_size);
+
+        auto stats = pool.stats();
+        g_assert_cmpuint(stats.n_slabs, ==, 3);
+        g_assert_cmpuint(stats.n_slab_allocs, ==, 3);
+        g_assert_cmpuint(stats.n_free, ==, 0);
+        g_assert_cmpuint(stats.in_flight, ==, 3 * ChunkPool::k_slab_chunks);
+        g_assert_cmpuint(stats.memory_size(), ==, 3 * ChunkPool::k_slab_size);
+}
+
+static void
+test_chunk_pool_trim(void)
+{
+        ChunkPool pool{2 * ChunkPool::k_slab_size};
+
+        std::vector<Chunk::unique_type> chunks;
+        for (auto i = 0u; i < 4 * ChunkPool::k_slab_chunks; ++i)
+                chunks.push_back(pool.get());
+
+        /* Nothing can be released while all slabs are in use */
+        g_assert_cmpuint(pool.trim(), ==, 0);
+
+        /* Keep one chunk of the second slab in use */
+        for (auto i = 0u; i < chunks.size(); ++i) {
+                if (i != ChunkPool::k_slab_chunks)
+                        chunks[i].reset();
+        }
+
+        g_assert_cmpuint(pool.trim(), ==, 2);
+
+        auto stats = pool.stats();
+        g_assert_cmpuint(stats.n_slabs, ==, 2);
+        g_assert_cmpuint(stats.peak_slabs, ==, 4);
+        g_assert_cmpuint(stats.n_slab_frees, ==, 2);
+        g_assert_cmpuint(stats.n_free, ==, 2 * ChunkPool::k_slab_chunks - 1);
+        g_assert_cmpuint(stats.in_flight, ==, 1);
+
+        /* The remaining free chunks are still usable */
+        for (auto i = 0u; i < 2 * ChunkPool::k_slab_chunks - 1; ++i)
+                chunks[i] = pool.get();
+        g_assert_cmpuint(pool.stats().n_slab_allocs, ==, 4);
+
+        chunks.clear();
+        pool.set_budget(0);
+        g_assert_cmpuint(pool.trim(), ==, 2);
+        g_assert_cmpuint(pool.stats().memory_size(), ==, 0);
+        g_assert_cmpuint(pool.stats().n_free, ==, 0);
+}
+
+static void
+test_chunk_pool_threaded(void)
+{
+        ChunkPool pool{};
+        auto const n = 100000u;
+
+        auto worker = [&pool, n]() {
+                for (auto i = 0u; i < n; ++i) {
+                        auto a = pool.get();
+                        auto b = pool.get();
+                        a->len = b->len = i;
+                }
+        };
+
+        auto thread = std::thread{worker};
+        worker();
+        thread.join();
+
+        auto const stats = pool.stats();
+        g_assert_cmpuint(stats.in_flight, ==, 0);
+        g_assert_cmpuint(stats.n_gets, ==, 4 * n);
+        g_assert_cmpuint(stats.n_free, ==, stats.n_slabs * ChunkPool::k_slab_chunks);
+        g_assert_cmpuint(stats.peak_in_flight, <=, 4);
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/chunk-pool/reuse", test_chunk_pool_reuse);
+        g_test_add_func("/vte/chunk-pool/slabs", test_chunk_pool_slabs);
+        g_test_add_func("/vte/chunk-pool/trim", test_chunk_pool_trim);
+        g_test_add_func("/vte/chunk-pool/threaded", test_chunk_pool_threaded);
+
+        return g_test_run();
+}
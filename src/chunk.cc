@@ -19,45 +19,170 @@
 
 #include "chunk.hh"
 
-#include <cstddef> // offsetof
+#include <algorithm>
 #include <new>
 
+#include <glib.h>
+
 namespace vte {
 
 namespace base {
 
-static_assert(sizeof(Chunk) <= Chunk::k_chunk_size - 2 *sizeof(void*), "Chunk too large");
-static_assert(offsetof(Chunk, data) == offsetof(Chunk, dataminusone) + 1, "Chunk layout wrong");
+static_assert(sizeof(Chunk) == Chunk::k_chunk_size, "Chunk size wrong");
+
+struct ChunkSlab {
+        Chunk chunks[ChunkPool::k_slab_chunks];
+        ChunkPool* pool;
+        unsigned int n_used{0};
+        bool release{false};
+
+        ChunkSlab(ChunkPool* p) noexcept
+                : pool{p}
+        {
+        }
+};
 
 void
 Chunk::recycle() noexcept
 {
-        g_free_chunks.push(std::unique_ptr<Chunk>(this));
-        /* FIXME: bzero out the chunk for security? */
+        m_slab->pool->put(this);
+}
+
+ChunkPool::ChunkPool(size_t budget) noexcept
+        : m_budget{budget}
+{
 }
 
-std::stack<std::unique_ptr<Chunk>, std::list<std::unique_ptr<Chunk>>> Chunk::g_free_chunks;
+ChunkPool::~ChunkPool()
+{
+        g_warn_if_fail(m_stats.in_flight == 0);
+}
 
 Chunk::unique_type
-Chunk::get(void) noexcept
+ChunkPool::get() noexcept
 {
-        Chunk* chunk;
-        if (!g_free_chunks.empty()) {
-                chunk = g_free_chunks.top().release();
-                g_free_chunks.pop();
+        std::lock_guard<std::mutex> lock{m_mutex};
+
+        ++m_stats.n_gets;
 
-                chunk->reset();
+        Chunk* chunk;
+        if (m_free != nullptr) {
+                chunk = m_free;
+                m_free = chunk->m_next_free;
+                --m_stats.n_free;
+                ++m_stats.n_reused;
         } else {
-                chunk = new Chunk();
+                /* Carve a new slab: hand out its first chunk, and put the rest on the free list */
+                m_slabs.push_back(std::make_unique<ChunkSlab>(this));
+                auto slab = m_slabs.back().get();
+                for (auto& slab_chunk : slab->chunks)
+                        slab_chunk.m_slab = slab;
+                for (auto i = k_slab_chunks - 1; i > 0; --i) {
+                        slab->chunks[i].m_next_free = m_free;
+                        m_free = &slab->chunks[i];
+                }
+                chunk = &slab->chunks[0];
+
+                m_stats.n_free += k_slab_chunks - 1;
+                ++m_stats.n_slab_allocs;
+                m_stats.n_slabs = m_slabs.size();
+                m_stats.peak_slabs = std::max(m_stats.peak_slabs, m_stats.n_slabs);
         }
 
+        chunk->m_next_free = nullptr;
+        chunk->reset();
+        ++chunk->m_slab->n_used;
+
+        ++m_stats.in_flight;
+        m_stats.peak_in_flight = std::max(m_stats.peak_in_flight, m_stats.in_flight);
+
         return Chunk::unique_type(chunk);
 }
+
+void
+ChunkPool::put(Chunk* chunk) noexcept
+{
+        std::lock_guard<std::mutex> lock{m_mutex};
+
+        /* FIXME: bzero out the chunk for security? */
+        chunk->m_next_free = m_free;
+        m_free = chunk;
+        --chunk->m_slab->n_used;
+
+        ++m_stats.n_free;
+        --m_stats.in_flight;
+}
+
+/*
+ * ChunkPool::trim:
+ *
+ * Releases unused slabs until the pool's memory is within its budget,
+ * or no more unused slabs remain.
+ *
+ * Returns: the number of slabs released
+ */
+size_t
+ChunkPool::trim() noexcept
+{
+        std::lock_guard<std::mutex> lock{m_mutex};
+
+        auto const budget_slabs = m_budget / k_slab_size;
+        if (m_slabs.size() <= budget_slabs)
+                return 0;
+
+        auto n_release = m_slabs.size() - budget_slabs;
+        auto n_marked = size_t{0};
+        for (auto& slab : m_slabs) {
+                if (n_marked == n_release)
+                        break;
+                if (slab->n_used != 0)
+                        continue;
+
+                slab->release = true;
+                ++n_marked;
+        }
+        if (n_marked == 0)
+                return 0;
+
+        /* Unlink the released slabs' chunks from the free list */
+        auto link = &m_free;
+        while (*link != nullptr) {
+                if ((*link)->m_slab->release)
+                        *link = (*link)->m_next_free;
+                else
+                        link = &(*link)->m_next_free;
+        }
+
+        m_slabs.erase(std::remove_if(m_slabs.begin(), m_slabs.end(),
+                                     [](auto const& slab) { return slab->release; }),
+                      m_slabs.end());
+
+        m_stats.n_free -= n_marked * k_slab_chunks;
+        m_stats.n_slab_frees += n_marked;
+        m_stats.n_slabs = m_slabs.size();
+
+        return n_marked;
+}
+
 void
-Chunk::prune(unsigned int max_size) noexcept
+ChunkPool::set_budget(size_t budget) noexcept
+{
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_budget = budget;
+}
+
+size_t
+ChunkPool::budget() const noexcept
+{
+        std::lock_guard<std::mutex> lock{m_mutex};
+        return m_budget;
+}
+
+ChunkPool::Stats
+ChunkPool::stats() const noexcept
 {
-        while (g_free_chunks.size() > max_size)
-                g_free_chunks.pop();
+        std::lock_guard<std::mutex> lock{m_mutex};
+        return m_stats;
 }
 
 } // namespace base
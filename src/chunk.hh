@@ -17,15 +17,19 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
-#include <list>
 #include <memory>
-#include <stack>
+#include <mutex>
+#include <vector>
 
 namespace vte {
 
 namespace base {
 
+class ChunkPool;
+struct ChunkSlab;
+
 class Chunk {
 private:
         class Recycler {
@@ -39,16 +43,20 @@ private:
 
         void recycle() noexcept;
 
-        static unsigned int const k_max_free_chunks = 16;
-
 public:
         using unique_type = std::unique_ptr<Chunk, Recycler>;
 
         static unsigned int const k_chunk_size = 0x2000;
 
+        /* Private to ChunkPool: the slab this chunk was allocated from,
+         * and the next chunk on the pool's free list while this chunk is free.
+         * (Not declared private, to keep Chunk a standard-layout type.)
+         */
+        ChunkSlab* m_slab{nullptr};
+        Chunk* m_next_free{nullptr};
+
         unsigned int len{0};
-        uint8_t dataminusone;    /* Hack: Keep it right before data, so that data[-1] is valid and usable */
-        uint8_t data[k_chunk_size - 2 * sizeof(void*) - 1 - sizeof(unsigned int)];
+        uint8_t data[k_chunk_size - 2 * sizeof(void*) - sizeof(unsigned int)];
 
         Chunk() = default;
         Chunk(Chunk const&) = delete;
@@ -65,14 +73,68 @@ public:
 
         inline constexpr size_t capacity() const noexcept { return sizeof(data); }
         inline constexpr size_t remaining_capacity() const noexcept { return capacity() - len; }
+};
 
-        static unique_type get() noexcept;
-        static void prune(unsigned int max_size = k_max_free_chunks) noexcept;
+/*
+ * ChunkPool:
+ *
+ * Hands out chunks carved from slabs of k_slab_chunks contiguous chunks,
+ * and takes them back when their unique_type goes out of scope. Freed
+ * chunks are kept on an intrusive free list and reused most-recently-freed
+ * first; trim() releases wholly unused slabs while the pool holds more
+ * than its memory budget.
+ *
+ * Each terminal has its own pool, so the counters reflect that terminal's
+ * input. get() and the chunk deleter may be called from any thread (chunks
+ * are read into on the PTY reader thread and released on the main thread);
+ * all chunks must be returned before the pool is destroyed.
+ */
+class ChunkPool {
+public:
+        static unsigned int const k_slab_chunks = 4;
+        static size_t const k_slab_size = k_slab_chunks * Chunk::k_chunk_size;
+
+        struct Stats {
+                size_t n_slabs{0};         /* slabs currently allocated */
+                size_t peak_slabs{0};      /* high-water mark of n_slabs */
+                size_t n_free{0};          /* chunks on the free list */
+                size_t in_flight{0};       /* chunks handed out and not yet returned */
+                size_t peak_in_flight{0};  /* high-water mark of in_flight */
+                uint64_t n_gets{0};        /* chunks handed out */
+                uint64_t n_reused{0};      /* ... of which were taken from the free list */
+                uint64_t n_slab_allocs{0}; /* slabs allocated */
+                uint64_t n_slab_frees{0};  /* slabs released by trim() */
+
+                inline constexpr size_t memory_size() const noexcept { return n_slabs * k_slab_size; }
+        };
+
+        explicit ChunkPool(size_t budget = k_slab_size) noexcept;
+        ChunkPool(ChunkPool const&) = delete;
+        ChunkPool(ChunkPool&&) = delete;
+        ~ChunkPool();
+
+        ChunkPool& operator= (ChunkPool const&) = delete;
+        ChunkPool& operator= (ChunkPool&&) = delete;
+
+        Chunk::unique_type get() noexcept;
+
+        size_t trim() noexcept;
+
+        void set_budget(size_t budget) noexcept;
+        size_t budget() const noexcept;
+
+        Stats stats() const noexcept;
 
 private:
+        friend class Chunk;
+
+        void put(Chunk* chunk) noexcept;
 
-        /* Note that this is using the standard deleter, not Recycler */
-        static std::stack<std::unique_ptr<Chunk>, std::list<std::unique_ptr<Chunk>>> g_free_chunks;
+        mutable std::mutex m_mutex{};
+        size_t m_budget;
+        Chunk* m_free{nullptr};
+        std::vector<std::unique_ptr<ChunkSlab>> m_slabs{};
+        Stats m_stats{};
 };
 
 } // namespace base
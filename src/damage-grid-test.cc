@@ -0,0 +1,239 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "damage-grid.hh"
+
+#include <utility>
+#include <vector>
+
+#include <glib.h>
+
+using namespace vte::base;
+
+using Spans = std::vector<std::pair<long, long>>;
+
+static std::vector<DamageGrid::Cell>
+make_row(char const* text)
+{
+        std::vector<DamageGrid::Cell> cells;
+        for (auto p = text; *p; p++)
+                cells.push_back({uint32_t(*p), 0, 256, 257, 256});
+        return cells;
+}
+
+static Spans
+update(DamageGrid& grid,
+       long row,
+       std::vector<DamageGrid::Cell> const& cells)
+{
+        g_assert_cmpint(long(cells.size()), ==, grid.columns());
+
+        Spans spans;
+        grid.update(row, cells.data(), [&](long start, long end) {
+                        g_assert_cmpint(start, <, end);
+                        spans.emplace_back(start, end);
+                });
+        return spans;
+}
+
+static void
+test_damage_grid_unknown(void)
+{
+        DamageGrid grid{};
+        grid.set_view(0, 0, 8, 2);
+
+        auto row = make_row("abcdefgh");
+        g_assert_true((update(grid, 0, row) == Spans{{0, 8}}));
+        g_assert_true((update(grid, 1, row) == Spans{{0, 8}}));
+        g_assert_true(update(grid, 0, row).empty());
+
+        /* Invalidating forgets all rows */
+        grid.invalidate();
+        g_assert_true((update(grid, 1, row) == Spans{{0, 8}}));
+        g_assert_true(update(grid, 1, row).empty());
+}
+
+static void
+test_damage_grid_spans(void)
+{
+        DamageGrid grid{};
+        grid.set_view(0, 0, 20, 1);
+
+        update(grid, 0, make_row("00000000000000000000"));
+
+        /* A single cell */
+        g_assert_true((update(grid, 0, make_row("00000x00000000000000")) == Spans{{5, 6}}));
+
+        /* Far apart cells make separate spans */
+        g_assert_true((update(grid, 0, make_row("y0000x0000000000000y")) == Spans{{0, 1}, {19, 20}}));
+
+        /* Close ones are merged */
+        g_assert_true((update(grid, 0, make_row("z00z0x0000000000000y")) == Spans{{0, 4}}));
+
+        /* Only the colours changing counts too */
+        auto row = make_row("z00z0x0000000000000y");
+        row[10].back = 1;
+        row[11].fore = 2;
+        g_assert_true((update(grid, 0, row) == Spans{{10, 12}}));
+        row[11].deco = 3;
+        g_assert_true((update(grid, 0, row) == Spans{{11, 12}}));
+        row[19].attr = 4;
+        g_assert_true((update(grid, 0, row) == Spans{{19, 20}}));
+}
+
+static void
+test_damage_grid_view(void)
+{
+        DamageGrid grid{};
+        auto row = make_row("abcd");
+
+        grid.set_view(10, 0, 4, 3);
+        update(grid, 0, row);
+        update(grid, 2, row);
+
+        /* The same view keeps the rows */
+        grid.set_view(10, 0, 4, 3);
+        g_assert_true(update(grid, 2, row).empty());
+
+        /* Scrolling, also by pixels, forgets them */
+        grid.set_view(11, 0, 4, 3);
+        g_assert_true((update(grid, 0, row) == Spans{{0, 4}}));
+        grid.set_view(11, 3, 4, 3);
+        g_assert_true((update(grid, 0, row) == Spans{{0, 4}}));
+
+        /* And so does resizing */
+        grid.set_view(11, 3, 5, 3);
+        g_assert_cmpint(grid.columns(), ==, 5);
+        g_assert_true((update(grid, 0, make_row("abcde")) == Spans{{0, 5}}));
+        g_assert_cmpuint(grid.memory(), >=, 15 * sizeof(DamageGrid::Cell));
+}
+
+static void
+test_damage_grid_scroll(void)
+{
+        DamageGrid grid{};
+        grid.set_view(10, 160, 3, 4);
+        update(grid, 0, make_row("aaa"));
+        update(grid, 1, make_row("bbb"));
+        update(grid, 2, make_row("ccc"));
+        update(grid, 3, make_row("ddd"));
+
+        /* Scrolling the view down by a row keeps the shadow of the rows still in view */
+        grid.scroll_view(11, 176);
+        g_assert_cmpint(grid.top_row(), ==, 11);
+        g_assert_cmpint(grid.offset(), ==, 176);
+        g_assert_true(update(grid, 0, make_row("bbb")).empty());
+        g_assert_true(update(grid, 1, make_row("ccc")).empty());
+        g_assert_true(update(grid, 2, make_row("ddd")).empty());
+        g_assert_false(grid.is_known(3));
+        g_assert_true((update(grid, 3, make_row("eee")) == Spans{{0, 3}}));
+
+        /* And up */
+        grid.scroll_view(9, 144);
+        g_assert_false(grid.is_known(0));
+        g_assert_false(grid.is_known(1));
+        g_assert_true(update(grid, 2, make_row("bbb")).empty());
+        g_assert_true(update(grid, 3, make_row("ccc")).empty());
+
+        /* Too far keeps nothing */
+        grid.scroll_view(20, 320);
+        for (auto row = 0; row < 4; row++)
+                g_assert_false(grid.is_known(row));
+}
+
+static void
+test_damage_grid_scroll_rows(void)
+{
+        DamageGrid grid{};
+        grid.set_view(0, 0, 3, 5);
+        update(grid, 0, make_row("aaa"));
+        update(grid, 1, make_row("bbb"));
+        update(grid, 2, make_row("ccc"));
+        update(grid, 3, make_row("ddd"));
+        update(grid, 4, make_row("eee"));
+
+        /* Scrolling the region of rows 1..3 up by one */
+        grid.scroll_rows(1, 3, -1);
+        g_assert_true(update(grid, 0, make_row("aaa")).empty());
+        g_assert_true(update(grid, 1, make_row("ccc")).empty());
+        g_assert_true(update(grid, 2, make_row("ddd")).empty());
+        g_assert_false(grid.is_known(3));
+        g_assert_true(update(grid, 4, make_row("eee")).empty());
+        update(grid, 3, make_row("   "));
+
+        /* And down by two */
+        grid.scroll_rows(1, 3, 2);
+        g_assert_false(grid.is_known(1));
+        g_assert_false(grid.is_known(2));
+        g_assert_true(update(grid, 3, make_row("ccc")).empty());
+
+        /* Forgetting rows */
+        grid.forget_rows(-1, 0);
+        g_assert_false(grid.is_known(0));
+        g_assert_true(grid.is_known(4));
+}
+
+static void
+test_damage_grid_overhang(void)
+{
+        DamageGrid grid{1};
+        grid.set_view(0, 0, 12, 1);
+        g_assert_cmpint(grid.overhang(), ==, 1);
+
+        /* An italic glyph in cell 4, whose ink reaches into cell 5 */
+        auto row = make_row("abcdefghijkl");
+        row[4].attr = 1;
+        g_assert_true((update(grid, 0, row) == Spans{{0, 12}}));
+
+        /* Changing cell 5 repaints cell 4, restoring the ink it loses, and
+         * cell 6, clearing what the old glyph in cell 5 left there.
+         */
+        row[5].c = 'X';
+        g_assert_true((update(grid, 0, row) == Spans{{4, 7}}));
+
+        /* Spans are clamped to the row */
+        row[0].c = 'Y';
+        row[11].c = 'Z';
+        g_assert_true((update(grid, 0, row) == Spans{{0, 2}, {10, 12}}));
+
+        /* and merged if they come close after widening */
+        row[3].c = 'V';
+        row[8].c = 'W';
+        g_assert_true((update(grid, 0, row) == Spans{{2, 10}}));
+
+        /* A row damaged as a whole stays so */
+        grid.invalidate();
+        g_assert_true((update(grid, 0, row) == Spans{{0, 12}}));
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/damage-grid/unknown", test_damage_grid_unknown);
+        g_test_add_func("/vte/damage-grid/spans", test_damage_grid_spans);
+        g_test_add_func("/vte/damage-grid/view", test_damage_grid_view);
+        g_test_add_func("/vte/damage-grid/scroll", test_damage_grid_scroll);
+        g_test_add_func("/vte/damage-grid/scroll-rows", test_damage_grid_scroll_rows);
+        g_test_add_func("/vte/damage-grid/overhang", test_damage_grid_overhang);
+
+        return g_test_run();
+}
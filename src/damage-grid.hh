@@ -0,0 +1,256 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vte {
+
+namespace base {
+
+/*
+ * DamageGrid:
+ *
+ * A shadow of what each cell of the view was last painted with: its
+ * character, attributes and resolved colours, as the caller puts them in
+ * a Cell.
+ *
+ * update() replaces a row's shadow with its current cells, and reports the
+ * spans of cells that differ as damaged, widened by the overhang on each
+ * side, merging spans that are less than k_merge_gap cells apart. A row
+ * without a known shadow, as all rows are after invalidate() or after the
+ * view moved or changed size, is damaged as a whole.
+ *
+ * The overhang is for glyphs whose ink extends into the neighbouring cells,
+ * like italic, bold or oversized ones: when a cell changes, its old ink in
+ * the neighbours has to be cleared, and the neighbours' ink in it redrawn.
+ *
+ * When the painted pixels are moved along with the rows, scroll_view() and
+ * scroll_rows() move the shadow likewise, keeping it for the rows that
+ * stay in view.
+ */
+class DamageGrid {
+public:
+        struct Cell {
+                uint32_t c;
+                uint32_t attr;
+                uint32_t fore;
+                uint32_t back;
+                uint32_t deco;
+
+                inline bool operator==(Cell const& other) const noexcept
+                {
+                        return c == other.c &&
+                                attr == other.attr &&
+                                fore == other.fore &&
+                                back == other.back &&
+                                deco == other.deco;
+                }
+
+                inline bool operator!=(Cell const& other) const noexcept
+                {
+                        return !operator==(other);
+                }
+        };
+
+        /* Damaged spans closer than this many unchanged cells are merged */
+        static constexpr long const k_merge_gap = 4;
+
+        explicit DamageGrid(long overhang = 0) noexcept
+                : m_overhang{overhang}
+        {
+                assert(overhang >= 0);
+        }
+
+        DamageGrid(DamageGrid const&) = delete;
+        DamageGrid(DamageGrid&&) = delete;
+        ~DamageGrid() = default;
+
+        DamageGrid& operator= (DamageGrid const&) = delete;
+        DamageGrid& operator= (DamageGrid&&) = delete;
+
+        inline long top_row() const noexcept { return m_top_row; }
+        inline long offset() const noexcept { return m_offset; }
+        inline long columns() const noexcept { return m_columns; }
+        inline long rows() const noexcept { return m_rows; }
+        inline long overhang() const noexcept { return m_overhang; }
+
+        /* Sets the view the rows are counted from: its top row, its pixel
+         * offset for smooth scrolling, and its size. If that's not the view
+         * the shadow is of, all rows are forgotten.
+         */
+        void set_view(long top_row,
+                      long offset,
+                      long columns,
+                      long rows)
+        {
+                assert(columns >= 0 && rows >= 0);
+
+                if (top_row == m_top_row &&
+                    offset == m_offset &&
+                    columns == m_columns &&
+                    rows == m_rows)
+                        return;
+
+                m_top_row = top_row;
+                m_offset = offset;
+                if (columns != m_columns || rows != m_rows) {
+                        m_columns = columns;
+                        m_rows = rows;
+                        m_cells.resize(columns * rows);
+                        m_known.resize(rows);
+                }
+                invalidate();
+        }
+
+        /* Forgets all rows, e.g. because all of the view gets repainted */
+        void invalidate() noexcept
+        {
+                std::fill(m_known.begin(), m_known.end(), false);
+        }
+
+        /* Forgets rows @start to @end inclusive of the view */
+        void forget_rows(long start,
+                         long end) noexcept
+        {
+                start = std::max(start, 0L);
+                end = std::min(end, m_rows - 1);
+                for (auto row = start; row <= end; row++)
+                        m_known[row] = false;
+        }
+
+        inline bool is_known(long row) const noexcept
+        {
+                return row >= 0 && row < m_rows && m_known[row];
+        }
+
+        /* Moves the view to @top_row and pixel @offset, keeping the shadow
+         * of the rows that stay in view.
+         */
+        void scroll_view(long top_row,
+                         long offset)
+        {
+                auto const delta = top_row - m_top_row;
+                move_rows(0, m_rows - 1, -delta);
+                m_top_row = top_row;
+                m_offset = offset;
+        }
+
+        /* Moves the shadow of rows @start to @end inclusive of the view by
+         * @amount rows, down if positive, like the text in a scrolling region.
+         * The rows scrolled in from outside the region or view are forgotten.
+         */
+        void scroll_rows(long start,
+                         long end,
+                         long amount)
+        {
+                move_rows(start, end, amount);
+        }
+
+        /* Stores the columns() @cells as the shadow of @row of the view, and
+         * calls @damage(start, end) for each span of changed cells, from
+         * column @start up to but not including column @end.
+         */
+        template<typename F>
+        void update(long row,
+                    Cell const* cells,
+                    F&& damage)
+        {
+                assert(row >= 0 && row < m_rows);
+
+                auto shadow = m_cells.data() + row * m_columns;
+                if (!m_known[row]) {
+                        std::copy(cells, cells + m_columns, shadow);
+                        m_known[row] = true;
+                        if (m_columns > 0)
+                                damage(0L, m_columns);
+                        return;
+                }
+
+                auto const report = [&](long start, long end) {
+                        damage(std::max(start - m_overhang, 0L),
+                               std::min(end + m_overhang, m_columns));
+                };
+
+                long start = -1, end = -1;
+                for (long col = 0; col < m_columns; col++) {
+                        if (cells[col] == shadow[col])
+                                continue;
+
+                        shadow[col] = cells[col];
+                        /* The gap between the spans as reported */
+                        if (start != -1 && col - end - 2 * m_overhang < k_merge_gap) {
+                                end = col + 1;
+                                continue;
+                        }
+                        if (start != -1)
+                                report(start, end);
+                        start = col;
+                        end = col + 1;
+                }
+                if (start != -1)
+                        report(start, end);
+        }
+
+        /* The memory taken by the shadow, in bytes */
+        inline size_t memory() const noexcept
+        {
+                return m_cells.capacity() * sizeof(Cell) + (m_known.capacity() + 7) / 8;
+        }
+
+private:
+        long m_overhang;
+        long m_top_row{-1};
+        long m_offset{0};
+        long m_columns{0};
+        long m_rows{0};
+        std::vector<Cell> m_cells;
+        std::vector<bool> m_known;
+
+        void move_rows(long start,
+                       long end,
+                       long amount)
+        {
+                auto const first = std::max(start, 0L);
+                auto const last = std::min(end, m_rows - 1);
+                if (amount == 0 || first > last)
+                        return;
+
+                /* Walk away from where the rows move to, so as not to overwrite any before moving it */
+                auto const step = amount > 0 ? -1L : 1L;
+                for (auto row = amount > 0 ? last : first; row >= first && row <= last; row += step) {
+                        auto const src = row - amount;
+                        if (src < start || src > end || src < 0 || src >= m_rows || !m_known[src]) {
+                                m_known[row] = false;
+                                continue;
+                        }
+                        std::copy(m_cells.begin() + src * m_columns,
+                                  m_cells.begin() + (src + 1) * m_columns,
+                                  m_cells.begin() + row * m_columns);
+                        m_known[row] = true;
+                }
+        }
+};
+
+} // namespace base
+
+} // namespace vte
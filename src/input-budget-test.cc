@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "input-budget.hh"
+
+#include <glib.h>
+
+using namespace vte::terminal;
+
+static void
+test_input_budget_classify(void)
+{
+        g_assert_true(InputBudget::classify(8192, 0) == InputBudget::Class::TEXT);
+        /* 80 column lines with CR LF */
+        g_assert_true(InputBudget::classify(82 * 100, 2 * 100) == InputBudget::Class::TEXT);
+        g_assert_true(InputBudget::classify(8192, 8192 / 16) == InputBudget::Class::MIXED);
+        g_assert_true(InputBudget::classify(8192, 8192 / 8) == InputBudget::Class::CONTROL);
+        g_assert_true(InputBudget::classify(8192, 8192 / 3) == InputBudget::Class::CONTROL);
+}
+
+static void
+test_input_budget_initial(void)
+{
+        InputBudget budget{16, 4};
+
+        g_assert_cmpuint(budget.max_bytes(), ==, InputBudget::k_min_bytes);
+        g_assert_cmpfloat(budget.parse_time(), ==, 16);
+        g_assert_cmpint(budget.deadline(1000), ==, 1000 + 16000);
+}
+
+static void
+test_input_budget_rate(void)
+{
+        InputBudget budget{16, 4};
+
+        /* 1 MiB of text in 10 ms */
+        budget.parse_sample(1 << 20, 0, 10000, false);
+        auto state = budget.state();
+        g_assert_cmpfloat(state.rate[size_t(InputBudget::Class::TEXT)], ==, (1 << 20) / 10.);
+        g_assert_cmpuint(budget.max_bytes(), ==, size_t((1 << 20) / 10. * 16));
+
+        /* Control-heavy input is predicted from its own rate */
+        budget.parse_sample(1 << 16, 1 << 14, 16000, false);
+        state = budget.state();
+        g_assert_true(state.last_class == InputBudget::Class::CONTROL);
+        g_assert_cmpfloat(state.rate[size_t(InputBudget::Class::CONTROL)], ==, (1 << 16) / 16.);
+        g_assert_cmpuint(budget.max_bytes(), ==, 1 << 16);
+
+        /* ... without disturbing the text rate */
+        budget.parse_sample(1 << 20, 0, 10000, false);
+        state = budget.state();
+        g_assert_cmpfloat(state.rate[size_t(InputBudget::Class::TEXT)], ==, (1 << 20) / 10.);
+
+        /* New samples move the rate by k_alpha */
+        budget.parse_sample(1 << 20, 0, 20000, false);
+        state = budget.state();
+        auto const expected = (1 << 20) / 10. + InputBudget::k_alpha * ((1 << 20) / 20. - (1 << 20) / 10.);
+        g_assert_cmpfloat_with_epsilon(state.rate[size_t(InputBudget::Class::TEXT)], expected, 1e-6);
+        g_assert_cmpuint(state.n_samples, ==, 4);
+}
+
+static void
+test_input_budget_short_samples(void)
+{
+        InputBudget budget{16, 4};
+
+        budget.parse_sample(1 << 20, 0, 10000, false);
+        auto const rate = budget.state().rate[size_t(InputBudget::Class::TEXT)];
+
+        /* Too short to be measured reliably */
+        budget.parse_sample(16, 0, 1, false);
+        g_assert_cmpfloat(budget.state().rate[size_t(InputBudget::Class::TEXT)], ==, rate);
+        g_assert_cmpuint(budget.state().n_samples, ==, 1);
+}
+
+static void
+test_input_budget_draw(void)
+{
+        InputBudget budget{16, 4};
+
+        budget.parse_sample(1 << 20, 0, 10000, false);
+
+        /* Drawing eats into the time left for processing */
+        for (auto i = 0; i < 100; ++i)
+                budget.draw_sample(8000);
+        g_assert_cmpfloat_with_epsilon(budget.parse_time(), 8., 1e-3);
+        g_assert_cmpuint(budget.max_bytes(), <, size_t((1 << 20) / 10. * 9));
+
+        /* ... but processing always gets its minimum */
+        for (auto i = 0; i < 100; ++i)
+                budget.draw_sample(30000);
+        g_assert_cmpfloat(budget.parse_time(), ==, 4.);
+        g_assert_cmpint(budget.deadline(0), ==, 4000);
+}
+
+static void
+test_input_budget_clamp(void)
+{
+        InputBudget budget{16, 4};
+
+        budget.parse_sample(1 << 12, 1 << 10, 1000000, true);
+        g_assert_cmpuint(budget.max_bytes(), ==, InputBudget::k_min_bytes);
+        g_assert_cmpuint(budget.state().n_deadlines_missed, ==, 1);
+
+        budget.parse_sample(InputBudget::k_max_bytes, 0, 1000, false);
+        g_assert_cmpuint(budget.max_bytes(), ==, InputBudget::k_max_bytes);
+}
+
+static void
+test_input_budget_frame_time(void)
+{
+        InputBudget budget{16, 4};
+
+        for (auto i = 0; i < 100; ++i)
+                budget.draw_sample(30000);
+        g_assert_cmpfloat(budget.parse_time(), ==, 4.);
+
+        /* A short frame time clamps the minimum ... */
+        budget.set_frame_time(2);
+        g_assert_cmpfloat(budget.parse_time(), ==, 2.);
+
+        /* ... but only for as long as it lasts */
+        budget.set_frame_time(16);
+        g_assert_cmpfloat(budget.parse_time(), ==, 4.);
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/input-budget/classify", test_input_budget_classify);
+        g_test_add_func("/vte/input-budget/initial", test_input_budget_initial);
+        g_test_add_func("/vte/input-budget/rate", test_input_budget_rate);
+        g_test_add_func("/vte/input-budget/short-samples", test_input_budget_short_samples);
+        g_test_add_func("/vte/input-budget/draw", test_input_budget_draw);
+        g_test_add_func("/vte/input-budget/clamp", test_input_budget_clamp);
+        g_test_add_func("/vte/input-budget/frame-time", test_input_budget_frame_time);
+
+        return g_test_run();
+}
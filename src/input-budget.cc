@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "input-budget.hh"
+
+#include <algorithm>
+#include <iterator>
+
+namespace vte {
+
+namespace terminal {
+
+InputBudget::InputBudget(double frame_time,
+                         double min_parse_time) noexcept
+        : m_frame_time{frame_time},
+          m_configured_min_parse_time{min_parse_time},
+          m_min_parse_time{std::min(min_parse_time, frame_time)}
+{
+}
+
+InputBudget::Class
+InputBudget::classify(size_t bytes,
+                      size_t n_sequences) noexcept
+{
+        if (n_sequences * k_text_density < bytes)
+                return Class::TEXT;
+        if (n_sequences * k_control_density < bytes)
+                return Class::MIXED;
+        return Class::CONTROL;
+}
+
+void
+InputBudget::parse_sample(size_t bytes,
+                          size_t n_sequences,
+                          int64_t elapsed,
+                          bool cut_short) noexcept
+{
+        if (bytes == 0)
+                return;
+
+        auto const cls = classify(bytes, n_sequences);
+        m_last_class = cls;
+        if (cut_short)
+                ++m_n_deadlines_missed;
+
+        auto& rate = m_rate[size_t(cls)];
+        if (elapsed >= k_min_sample_time || rate == 0.) {
+                auto const sample = double(bytes) * 1000. / double(std::max(elapsed, int64_t{1}));
+                rate = rate == 0. ? sample : rate + k_alpha * (sample - rate);
+                ++m_n_samples;
+        }
+
+        update_max_bytes();
+}
+
+void
+InputBudget::draw_sample(int64_t elapsed) noexcept
+{
+        auto const sample = double(elapsed) / 1000.;
+        m_draw_time += k_alpha * (sample - m_draw_time);
+
+        update_max_bytes();
+}
+
+double
+InputBudget::parse_time() const noexcept
+{
+        return std::max(m_frame_time - m_draw_time, m_min_parse_time);
+}
+
+void
+InputBudget::update_max_bytes() noexcept
+{
+        auto const rate = m_rate[size_t(m_last_class)];
+        if (rate == 0.) {
+                m_max_bytes = k_min_bytes;
+                return;
+        }
+
+        auto const bytes = rate * parse_time();
+        m_max_bytes = size_t(std::clamp(bytes, double(k_min_bytes), double(k_max_bytes)));
+}
+
+void
+InputBudget::set_frame_time(double frame_time) noexcept
+{
+        m_frame_time = frame_time;
+        m_min_parse_time = std::min(m_configured_min_parse_time, frame_time);
+        update_max_bytes();
+}
+
+void
+InputBudget::set_min_parse_time(double min_parse_time) noexcept
+{
+        m_configured_min_parse_time = min_parse_time;
+        m_min_parse_time = std::min(min_parse_time, m_frame_time);
+        update_max_bytes();
+}
+
+InputBudget::State
+InputBudget::state() const noexcept
+{
+        auto state = State{};
+        std::copy(std::begin(m_rate), std::end(m_rate), std::begin(state.rate));
+        state.draw_time = m_draw_time;
+        state.frame_time = m_frame_time;
+        state.parse_time = parse_time();
+        state.last_class = m_last_class;
+        state.max_bytes = m_max_bytes;
+        state.n_samples = m_n_samples;
+        state.n_deadlines_missed = m_n_deadlines_missed;
+        return state;
+}
+
+} // namespace terminal
+
+} // namespace vte
@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "vtedefines.hh"
+
+namespace vte {
+
+namespace terminal {
+
+/*
+ * InputBudget:
+ *
+ * Decides how much input to read and process between two frames.
+ *
+ * The processing rate depends heavily on the kind of input: plain text
+ * goes through the parser much faster than output dense with control
+ * functions and escape sequences. So the rate (bytes/ms) is tracked as an
+ * exponentially weighted moving average separately for each input class,
+ * and the class of the last processing pass predicts the next one.
+ *
+ * The time available for processing is what is left of the frame time
+ * after drawing, whose duration is tracked the same way; it never drops
+ * below a minimum share of the frame, so input is never starved.
+ *
+ * Since a prediction can be wrong when the kind of input changes,
+ * processing also checks deadline() between chunks and stops when it
+ * has passed, leaving the rest for the next frame.
+ */
+class InputBudget {
+public:
+        enum class Class {
+                TEXT,     /* mostly graphic characters */
+                MIXED,    /* text interspersed with controls and sequences */
+                CONTROL,  /* dominated by controls and sequences */
+                N
+        };
+
+        /* Less than one control or sequence every k_text_density bytes is TEXT */
+        static unsigned int const k_text_density = 32;
+        /* At least one control or sequence every k_control_density bytes is CONTROL */
+        static unsigned int const k_control_density = 8;
+
+        /* Weight of a new sample in the moving averages */
+        static constexpr double const k_alpha = 0.25;
+        /* Samples shorter than this (in µs) are too noisy to update the rate */
+        static int64_t const k_min_sample_time = 100;
+
+        static size_t const k_min_bytes = VTE_MAX_INPUT_READ;
+        static size_t const k_max_bytes = 0x1000000;
+
+        struct State {
+                double rate[size_t(Class::N)];  /* bytes/ms, or 0 if not yet measured */
+                double draw_time;               /* ms */
+                double frame_time;              /* ms */
+                double parse_time;              /* ms available for processing per frame */
+                Class last_class;
+                size_t max_bytes;
+                uint64_t n_samples;
+                uint64_t n_deadlines_missed;    /* passes cut short by the deadline */
+        };
+
+        InputBudget(double frame_time = VTE_FRAME_TIME,
+                    double min_parse_time = VTE_MIN_PROCESS_TIME) noexcept;
+        ~InputBudget() = default;
+
+        InputBudget(InputBudget const&) = delete;
+        InputBudget(InputBudget&&) = delete;
+        InputBudget& operator= (InputBudget const&) = delete;
+        InputBudget& operator= (InputBudget&&) = delete;
+
+        static Class classify(size_t bytes,
+                              size_t n_sequences) noexcept;
+
+        /* Records that @bytes containing @n_sequences controls and sequences
+         * were processed in @elapsed µs; @cut_short if the deadline was hit.
+         */
+        void parse_sample(size_t bytes,
+                          size_t n_sequences,
+                          int64_t elapsed,
+                          bool cut_short) noexcept;
+
+        /* Records that drawing a frame took @elapsed µs */
+        void draw_sample(int64_t elapsed) noexcept;
+
+        /* The number of bytes to read for the next processing pass */
+        inline size_t max_bytes() const noexcept { return m_max_bytes; }
+
+        /* The time (in µs) at which a processing pass starting at @start must stop */
+        inline int64_t deadline(int64_t start) const noexcept { return start + int64_t(parse_time() * 1000.); }
+
+        double parse_time() const noexcept;
+        inline double frame_time() const noexcept { return m_frame_time; }
+
+        void set_frame_time(double frame_time) noexcept;
+        void set_min_parse_time(double min_parse_time) noexcept;
+
+        State state() const noexcept;
+
+private:
+        double m_frame_time;
+        double m_configured_min_parse_time;
+        double m_min_parse_time;  /* m_configured_min_parse_time, clamped to the frame time */
+
+        double m_rate[size_t(Class::N)]{};
+        double m_draw_time{0.};
+        Class m_last_class{Class::TEXT};
+        size_t m_max_bytes{k_min_bytes};
+
+        uint64_t m_n_samples{0};
+        uint64_t m_n_deadlines_missed{0};
+
+        void update_max_bytes() noexcept;
+};
+
+} // namespace terminal
+
+} // namespace vte
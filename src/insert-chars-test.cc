@@ -0,0 +1,180 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cstring>
+#include <string>
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include "vteinternal.hh"
+
+using namespace vte::terminal;
+
+static constexpr long const k_columns = 10;
+static constexpr long const k_rows = 4;
+
+static bool s_have_display = false;
+
+static VteTerminal*
+make_terminal(bool autowrap,
+              long columns)
+{
+        auto terminal = VTE_TERMINAL(vte_terminal_new());
+        g_object_ref_sink(terminal);
+        vte_terminal_set_size(terminal, columns, k_rows);
+        _vte_terminal_get_impl(terminal)->m_modes_private.set_DEC_AUTOWRAP(autowrap);
+        return terminal;
+}
+
+static VteRowData const*
+find_row_data(Terminal* terminal,
+              vte::grid::row_t row)
+{
+        auto const ring = terminal->m_screen->row_data;
+        return _vte_ring_contains(ring, row) ? _vte_ring_index(ring, row) : nullptr;
+}
+
+static void
+assert_same_state(Terminal* a,
+                  Terminal* b)
+{
+        g_assert_cmpint(a->m_screen->cursor.row, ==, b->m_screen->cursor.row);
+        g_assert_cmpint(a->m_screen->cursor.col, ==, b->m_screen->cursor.col);
+        g_assert_cmpuint(a->m_last_graphic_character, ==, b->m_last_graphic_character);
+
+        for (auto row = a->m_screen->insert_delta; row < a->m_screen->insert_delta + k_rows; row++) {
+                auto const a_data = find_row_data(a, row);
+                auto const b_data = find_row_data(b, row);
+                g_assert_true((a_data == nullptr) == (b_data == nullptr));
+                if (a_data == nullptr)
+                        continue;
+
+                g_assert_cmpuint(_vte_row_data_length(a_data), ==, _vte_row_data_length(b_data));
+                g_assert_cmpuint(a_data->attr.soft_wrapped, ==, b_data->attr.soft_wrapped);
+                for (gulong col = 0; col < _vte_row_data_length(a_data); col++)
+                        g_assert_true(memcmp(_vte_row_data_get(a_data, col),
+                                             _vte_row_data_get(b_data, col),
+                                             sizeof(VteCell)) == 0);
+        }
+}
+
+/* Inserts @text at @col of a row holding @prefix, with insert_chars() into
+ * one terminal and character by character with insert_char() into another,
+ * and checks that both end up the same.
+ */
+static void
+check_insert_chars(char const* prefix,
+                   long col,
+                   char const* text,
+                   bool autowrap,
+                   bool irm,
+                   long columns = k_columns)
+{
+        auto a_terminal = make_terminal(autowrap, columns);
+        auto b_terminal = make_terminal(autowrap, columns);
+        auto a = _vte_terminal_get_impl(a_terminal);
+        auto b = _vte_terminal_get_impl(b_terminal);
+
+        for (auto p = prefix; *p; p++) {
+                a->insert_char(*p, false, false);
+                b->insert_char(*p, false, false);
+        }
+        a->m_screen->cursor.col = b->m_screen->cursor.col = col;
+        a->m_modes_ecma.set_IRM(irm);
+        b->m_modes_ecma.set_IRM(irm);
+
+        a->insert_chars(reinterpret_cast<uint8_t const*>(text), strlen(text));
+        for (auto p = text; *p; p++)
+                b->insert_char(*p, false, false);
+
+        assert_same_state(a, b);
+
+        g_object_unref(a_terminal);
+        g_object_unref(b_terminal);
+}
+
+static void
+test_insert_chars_autowrap(void)
+{
+        if (!s_have_display) {
+                g_test_skip("No display");
+                return;
+        }
+
+        check_insert_chars("", 0, "The quick brown fox jumps", true, false);
+        check_insert_chars("abcdefg", 7, "hijklmnop", true, false);
+        check_insert_chars("", 0, "0123456789abc", true, false);
+        check_insert_chars("abcdefghij", 4, "XY", true, false);
+}
+
+static void
+test_insert_chars_no_autowrap(void)
+{
+        if (!s_have_display) {
+                g_test_skip("No display");
+                return;
+        }
+
+        check_insert_chars("", 0, "The quick brown fox jumps", false, false);
+        check_insert_chars("abc", 3, "defghijklmnop", false, false);
+        check_insert_chars("", 0, "0123456789abc", false, false);
+}
+
+static void
+test_insert_chars_irm(void)
+{
+        if (!s_have_display) {
+                g_test_skip("No display");
+                return;
+        }
+
+        check_insert_chars("abcdefgh", 2, "XYZ", true, true);
+        check_insert_chars("abcdefghij", 8, "XYZ", true, true);
+        check_insert_chars("abcdefghij", 8, "XYZ", false, true);
+}
+
+static void
+test_insert_chars_long_row(void)
+{
+        if (!s_have_display) {
+                g_test_skip("No display");
+                return;
+        }
+
+        /* Longer than what insert_chars() resolves at a time */
+        auto const text = std::string(700, 'x');
+        check_insert_chars("", 0, text.c_str(), true, false, 300);
+        check_insert_chars("ab", 2, text.c_str(), false, false, 300);
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+        s_have_display = gtk_init_check(&argc, &argv);
+
+        g_test_add_func("/vte/insert-chars/autowrap", test_insert_chars_autowrap);
+        g_test_add_func("/vte/insert-chars/no-autowrap", test_insert_chars_no_autowrap);
+        g_test_add_func("/vte/insert-chars/irm", test_insert_chars_irm);
+        g_test_add_func("/vte/insert-chars/long-row", test_insert_chars_long_row);
+
+        return g_test_run();
+}
@@ -58,6 +58,11 @@ public:
                 vte_parser_reset(&m_parser);
         }
 
+        inline bool is_ground() const noexcept
+        {
+                return vte_parser_is_ground(&m_parser);
+        }
+
 protected:
         vte_parser_t m_parser;
 }; // class Parser
@@ -304,6 +304,31 @@ test_seq_control(void)
         }
 }
 
+static void
+test_seq_ground(void)
+{
+        /* Printable ASCII in the ground state is GRAPHIC and stays in ground */
+        parser.reset();
+        g_assert_true(parser.is_ground());
+        for (uint32_t c = 0x20; c < 0x7f; c++) {
+                auto rv = parser.feed(c);
+                g_assert_cmpuint(rv, ==, VTE_SEQ_GRAPHIC);
+                g_assert_cmpuint(seq.terminator(), ==, c);
+                g_assert_true(parser.is_ground());
+        }
+
+        parser.feed(0x1b /* ESC */);
+        g_assert_false(parser.is_ground());
+        parser.feed('c');
+        g_assert_true(parser.is_ground());
+
+        parser.feed(0x9d /* OSC */);
+        parser.feed('0');
+        g_assert_false(parser.is_ground());
+        parser.feed(0x9c /* ST */);
+        g_assert_true(parser.is_ground());
+}
+
 static void
 test_seq_esc_invalid(void)
 {
@@ -1489,6 +1514,7 @@ main(int argc,
         g_test_add_func("/vte/parser/sequences/glue/sequence-builder", test_seq_glue_sequence_builder);
         g_test_add_func("/vte/parser/sequences/glue/reply-builder", test_seq_glue_reply_builder);
         g_test_add_func("/vte/parser/sequences/control", test_seq_control);
+        g_test_add_func("/vte/parser/sequences/ground", test_seq_ground);
         g_test_add_func("/vte/parser/sequences/escape/invalid", test_seq_esc_invalid);
         g_test_add_func("/vte/parser/sequences/escape/charset/94", test_seq_esc_charset_94);
         g_test_add_func("/vte/parser/sequences/escape/charset/96", test_seq_esc_charset_96);
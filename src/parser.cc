@@ -515,6 +515,8 @@ enum parser_state_t {
         STATE_N,
 };
 
+static_assert(STATE_GROUND == 0, "vte_parser_is_ground() depends on STATE_GROUND being 0");
+
 /* Parser state transitioning */
 
 typedef int (* parser_action_func)(vte_parser_t* parser, uint32_t raw);
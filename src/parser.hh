@@ -207,3 +207,12 @@ void vte_parser_deinit(vte_parser_t* parser);
 int vte_parser_feed(vte_parser_t* parser,
                     uint32_t raw);
 void vte_parser_reset(vte_parser_t* parser);
+
+/* In the ground state, printable ASCII produces VTE_SEQ_GRAPHIC and leaves
+ * the state unchanged. Must match STATE_GROUND in parser.cc.
+ */
+static inline bool
+vte_parser_is_ground(vte_parser_t const* parser)
+{
+        return parser->state == 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reads a stream of data from a PTY in TIOCPKT mode, the way the terminal
+ * does, and reports the number of read syscalls and chunks used per MiB,
+ * comparing the single-chunk read() loop with pty_read_chunks().
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <list>
+#include <queue>
+
+#include <glib.h>
+
+#include "chunk.hh"
+#include "pty-reader.hh"
+
+using namespace vte::base;
+
+using chunk_queue = std::queue<Chunk::unique_type, std::list<Chunk::unique_type>>;
+
+static ChunkPool g_chunk_pool{};
+
+struct Stats {
+        size_t syscalls{0};
+        size_t bytes{0};
+        size_t chunks{0};
+        int64_t time{0};
+};
+
+static int
+open_pty(int* slave)
+{
+        auto master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master == -1 ||
+            grantpt(master) == -1 ||
+            unlockpt(master) == -1)
+                return -1;
+
+        int one = 1;
+        if (ioctl(master, TIOCPKT, &one) == -1)
+                return -1;
+
+        *slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+        if (*slave == -1)
+                return -1;
+
+        struct termios tio;
+        tcgetattr(*slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(*slave, TCSANOW, &tio);
+
+        auto flags = fcntl(master, F_GETFL);
+        fcntl(master, F_SETFL, flags | O_NONBLOCK);
+
+        return master;
+}
+
+static pid_t
+spawn_writer(int master,
+             int slave,
+             size_t size)
+{
+        auto pid = fork();
+        if (pid != 0)
+                return pid;
+
+        close(master);
+
+        char buf[0x4000];
+        for (size_t i = 0; i < sizeof(buf); ++i)
+                buf[i] = 'a' + i % 26;
+
+        while (size > 0) {
+                auto n = write(slave, buf, std::min(size, sizeof(buf)));
+                if (n == -1 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        _exit(EXIT_FAILURE);
+                size -= n;
+        }
+
+        /* Let the reader drain the PTY before hanging up */
+        tcdrain(slave);
+        _exit(EXIT_SUCCESS);
+}
+
+/* The single-chunk read() loop pty_io_read() used before pty_read_chunks() */
+static bool
+read_legacy(int fd,
+            chunk_queue& queue,
+            Stats& stats)
+{
+        Chunk* chunk = queue.empty() ? nullptr : queue.back().get();
+
+        while (true) {
+                if (!chunk || chunk->len >= 3 * chunk->capacity() / 4) {
+                        queue.push(g_chunk_pool.get());
+                        chunk = queue.back().get();
+                        ++stats.chunks;
+                }
+
+                auto bp = chunk->data + chunk->len;
+                auto save = bp[-1];
+                auto ret = read(fd, bp - 1, chunk->remaining_capacity() + 1);
+                bp[-1] = save;
+                ++stats.syscalls;
+
+                if (ret == -1)
+                        return errno == EAGAIN || errno == EINTR;
+                if (ret == 0)
+                        return false;
+
+                chunk->len += ret - 1;
+                stats.bytes += ret - 1;
+        }
+}
+
+static bool
+read_scatter(int fd,
+             chunk_queue& queue,
+             Stats& stats)
+{
+        Chunk::unique_type spare[k_pty_read_max_chunks];
+
+        while (true) {
+                for (auto& chunk : spare) {
+                        if (!chunk)
+                                chunk = g_chunk_pool.get();
+                }
+
+                auto tail = queue.empty() ? nullptr : queue.back().get();
+
+                uint8_t pkt_header;
+                auto ret = pty_read_chunks(fd, &pkt_header, tail, spare, G_N_ELEMENTS(spare));
+                ++stats.syscalls;
+
+                if (ret == -1)
+                        return errno == EAGAIN;
+                if (ret == 0)
+                        return false;
+
+                for (size_t i = 0; i < G_N_ELEMENTS(spare) && spare[i]->len > 0; ++i) {
+                        queue.push(std::move(spare[i]));
+                        ++stats.chunks;
+                }
+                stats.bytes += ret - 1;
+        }
+}
+
+static bool
+run(bool scatter,
+    size_t size,
+    Stats& stats)
+{
+        int slave;
+        auto master = open_pty(&slave);
+        if (master == -1) {
+                g_printerr("Failed to open PTY: %s\n", g_strerror(errno));
+                return false;
+        }
+
+        auto pid = spawn_writer(master, slave, size);
+        close(slave);
+        if (pid == -1)
+                return false;
+
+        chunk_queue queue{};
+        auto const start_time = g_get_monotonic_time();
+
+        auto more = true;
+        while (more && stats.bytes < size) {
+                struct pollfd pfd = { master, POLLIN, 0 };
+                if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+                        break;
+
+                more = scatter ? read_scatter(master, queue, stats)
+                               : read_legacy(master, queue, stats);
+
+                /* Consume the data, as processing would */
+                while (!queue.empty())
+                        queue.pop();
+        }
+
+        stats.time = g_get_monotonic_time() - start_time;
+
+        close(master);
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+
+        return stats.bytes == size;
+}
+
+static void
+print_stats(char const* name,
+            Stats const& stats)
+{
+        auto const mib = double(stats.bytes) / (1 << 20);
+        g_print("%-8s %8.1f MiB  %8.1f syscalls/MiB  %8.1f chunks/MiB  %6.0f%% chunk fill  %8.1f MiB/s\n",
+                name,
+                mib,
+                stats.syscalls / mib,
+                stats.chunks / mib,
+                stats.chunks ? 100. * stats.bytes / (stats.chunks * sizeof(Chunk::data)) : 0.,
+                mib / (double(stats.time) / G_USEC_PER_SEC));
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        int size_mib = 64;
+        GOptionEntry const entries[] = {
+                { "size", 's', 0, G_OPTION_ARG_INT, &size_mib,
+                  "Amount of data to read in MiB", "MIB" },
+                { nullptr },
+        };
+
+        auto context = g_option_context_new("— PTY read benchmark");
+        g_option_context_add_main_entries(context, entries, nullptr);
+
+        GError* error = nullptr;
+        auto rv = g_option_context_parse(context, &argc, &argv, &error);
+        g_option_context_free(context);
+        if (!rv) {
+                g_printerr("Failed to parse arguments: %s\n", error->message);
+                g_error_free(error);
+                return EXIT_FAILURE;
+        }
+
+        auto const size = size_t(std::max(size_mib, 1)) << 20;
+
+        Stats legacy{}, scatter{};
+        if (!run(false, size, legacy) ||
+            !run(true, size, scatter)) {
+                g_printerr("Short read\n");
+                return EXIT_FAILURE;
+        }
+
+        print_stats("read", legacy);
+        print_stats("readv", scatter);
+
+        return EXIT_SUCCESS;
+}
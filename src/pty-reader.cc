@@ -0,0 +1,357 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "pty-reader.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_TERMIOS_H
+#include <sys/termios.h>
+#endif
+
+#include <algorithm>
+#include <system_error>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+namespace vte {
+
+namespace base {
+
+static void
+drain_pipe(int fd) noexcept
+{
+        char buf[64];
+        while (read(fd, buf, sizeof(buf)) > 0)
+                ;
+}
+
+static void
+close_pipe(int (&fds)[2]) noexcept
+{
+        for (auto& fd : fds) {
+                if (fd != -1)
+                        close(fd);
+                fd = -1;
+        }
+}
+
+static bool
+open_pipe(int (&fds)[2]) noexcept
+{
+        if (!g_unix_open_pipe(fds, FD_CLOEXEC, nullptr))
+                return false;
+
+        if (!g_unix_set_fd_nonblocking(fds[0], true, nullptr) ||
+            !g_unix_set_fd_nonblocking(fds[1], true, nullptr)) {
+                close_pipe(fds);
+                return false;
+        }
+
+        return true;
+}
+
+/*
+ * pty_read_chunks:
+ * @fd: the PTY master, in TIOCPKT mode
+ * @pkt_header: location to store the packet header byte
+ * @tail: (nullable): a chunk to append data to, before using @chunks
+ * @chunks: chunks to read into after @tail is full
+ * @n_chunks: the number of chunks in @chunks, at most %k_pty_read_max_chunks
+ *
+ * Reads from @fd with a single readv() call, scattering the data over the
+ * remaining capacity of @tail and then of @chunks, in order. Due to TIOCPKT
+ * mode, each read returns an extra byte at the beginning; it is read into
+ * its own iovec, so the data proper is contiguous over the chunks.
+ *
+ * The len of each chunk is updated to reflect the data read into it.
+ *
+ * Returns: the number of bytes read including the packet header byte,
+ *   0 on EOF, or -1 on error with errno set
+ */
+ssize_t
+pty_read_chunks(int fd,
+                uint8_t* pkt_header,
+                Chunk* tail,
+                Chunk::unique_type const* chunks,
+                size_t n_chunks) noexcept
+{
+        g_assert(n_chunks <= k_pty_read_max_chunks);
+
+        struct iovec iov[2 + k_pty_read_max_chunks];
+        auto n_iov = 0;
+
+        iov[n_iov].iov_base = pkt_header;
+        iov[n_iov++].iov_len = 1;
+        if (tail != nullptr && tail->remaining_capacity() > 0) {
+                iov[n_iov].iov_base = tail->data + tail->len;
+                iov[n_iov++].iov_len = tail->remaining_capacity();
+        }
+        for (size_t i = 0; i < n_chunks; ++i) {
+                iov[n_iov].iov_base = chunks[i]->data + chunks[i]->len;
+                iov[n_iov++].iov_len = chunks[i]->remaining_capacity();
+        }
+
+        ssize_t ret;
+        do {
+                ret = readv(fd, iov, n_iov);
+        } while (ret == -1 && errno == EINTR);
+
+        if (ret <= 0)
+                return ret;
+
+        auto len = size_t(ret - 1);
+        if (tail != nullptr) {
+                auto n = std::min(len, tail->remaining_capacity());
+                tail->len += n;
+                len -= n;
+        }
+        for (size_t i = 0; i < n_chunks && len > 0; ++i) {
+                auto n = std::min(len, chunks[i]->remaining_capacity());
+                chunks[i]->len += n;
+                len -= n;
+        }
+
+        return ret;
+}
+
+PtyReader::PtyReader(int fd,
+                     ChunkPool& pool) noexcept
+        : m_fd{fd},
+          m_pool{pool}
+{
+}
+
+PtyReader::~PtyReader()
+{
+        stop();
+
+        close_pipe(m_notify_pipe);
+        close_pipe(m_wakeup_pipe);
+}
+
+/*
+ * PtyReader::start:
+ *
+ * Creates the notification pipes and starts the reader thread.
+ *
+ * Returns: %true on success
+ */
+bool
+PtyReader::start() noexcept
+{
+        g_assert(!m_thread.joinable());
+
+        if (!open_pipe(m_notify_pipe))
+                return false;
+        if (!open_pipe(m_wakeup_pipe)) {
+                close_pipe(m_notify_pipe);
+                return false;
+        }
+
+        try {
+                m_thread = std::thread{&PtyReader::run, this};
+        } catch (std::system_error const&) {
+                close_pipe(m_notify_pipe);
+                close_pipe(m_wakeup_pipe);
+                return false;
+        }
+
+        return true;
+}
+
+/*
+ * PtyReader::stop:
+ *
+ * Stops the reader thread and waits for it to exit. Chunks already
+ * queued stay available through pop().
+ */
+void
+PtyReader::stop() noexcept
+{
+        if (!m_thread.joinable())
+                return;
+
+        m_stop.store(true, std::memory_order_release);
+        wakeup();
+        m_thread.join();
+}
+
+void
+PtyReader::acknowledge() noexcept
+{
+        drain_pipe(m_notify_pipe[0]);
+
+        /* This synchronises with the reader's exchange in notify(), so that
+         * any chunk pushed before that is visible to the following pop().
+         */
+        m_notify_pending.exchange(false, std::memory_order_acq_rel);
+}
+
+Chunk::unique_type
+PtyReader::pop() noexcept
+{
+        auto chunk = Chunk::unique_type{};
+        if (!m_queue.pop(chunk))
+                return chunk;
+
+        /* Pairs with the fence in wait_for_space() */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiting_for_space.load(std::memory_order_relaxed) &&
+            m_waiting_for_space.exchange(false))
+                wakeup();
+
+        return chunk;
+}
+
+void
+PtyReader::wakeup() noexcept
+{
+        char c = 1;
+        while (write(m_wakeup_pipe[1], &c, 1) == -1 && errno == EINTR)
+                ;
+}
+
+void
+PtyReader::notify() noexcept
+{
+        /* Only write to the pipe if the main thread hasn't been notified yet
+         * since it last called acknowledge(); so a pending flag always
+         * corresponds to a byte in the pipe.
+         */
+        if (m_notify_pending.exchange(true, std::memory_order_acq_rel))
+                return;
+
+        char c = 1;
+        while (write(m_notify_pipe[1], &c, 1) == -1 && errno == EINTR)
+                ;
+}
+
+void
+PtyReader::add_packet_flags(unsigned int flags) noexcept
+{
+        auto old_flags = m_packet_flags.load(std::memory_order_relaxed);
+        unsigned int new_flags;
+        do {
+                new_flags = old_flags | (flags & TIOCPKT_IOCTL);
+                if (flags & TIOCPKT_STOP)
+                        new_flags = (new_flags & ~TIOCPKT_START) | TIOCPKT_STOP;
+                else if (flags & TIOCPKT_START)
+                        new_flags = (new_flags & ~TIOCPKT_STOP) | TIOCPKT_START;
+        } while (!m_packet_flags.compare_exchange_weak(old_flags, new_flags));
+}
+
+/* Blocks until the main thread has popped a chunk from the full queue,
+ * or until stop() is called.
+ */
+bool
+PtyReader::wait_for_space() noexcept
+{
+        m_waiting_for_space.store(true, std::memory_order_relaxed);
+        /* Pairs with the fence in pop() */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_queue.full() && !m_stop.load(std::memory_order_acquire)) {
+                struct pollfd pfd = { m_wakeup_pipe[0], POLLIN, 0 };
+                if (poll(&pfd, 1, -1) > 0)
+                        drain_pipe(m_wakeup_pipe[0]);
+        }
+
+        m_waiting_for_space.store(false, std::memory_order_relaxed);
+        return !m_queue.full();
+}
+
+void
+PtyReader::run() noexcept
+{
+        Chunk::unique_type chunks[k_pty_read_max_chunks];
+
+        while (!m_stop.load(std::memory_order_acquire)) {
+                if (m_queue.full()) {
+                        wait_for_space();
+                        continue;
+                }
+
+                struct pollfd pfds[2] = {
+                        { m_wakeup_pipe[0], POLLIN, 0 },
+                        { m_fd, POLLIN, 0 },
+                };
+                if (poll(pfds, G_N_ELEMENTS(pfds), -1) == -1) {
+                        if (errno == EINTR)
+                                continue;
+
+                        m_errno.store(errno, std::memory_order_release);
+                        notify();
+                        break;
+                }
+
+                if (pfds[0].revents & POLLIN)
+                        drain_pipe(m_wakeup_pipe[0]);
+                if (!(pfds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+                        continue;
+
+                /* Read into as many chunks as there are free slots in the queue */
+                auto const n_chunks = std::min(size_t(k_pty_read_max_chunks),
+                                               m_queue.capacity() - m_queue.size());
+                for (size_t i = 0; i < n_chunks; ++i) {
+                        if (!chunks[i])
+                                chunks[i] = m_pool.get();
+                }
+
+                uint8_t pkt_header;
+                auto ret = pty_read_chunks(m_fd, &pkt_header, nullptr, chunks, n_chunks);
+                if (ret == -1) {
+                        auto const errsv = errno;
+                        if (errsv == EAGAIN || errsv == EBUSY)
+                                continue;
+
+                        if (errsv == EIO)
+                                m_eof.store(true, std::memory_order_release); /* Fake an EOF */
+                        else
+                                m_errno.store(errsv, std::memory_order_release);
+                        notify();
+                        break;
+                }
+                if (ret == 0) {
+                        m_eof.store(true, std::memory_order_release);
+                        notify();
+                        break;
+                }
+
+                auto const pkt_flags = pkt_header & (TIOCPKT_IOCTL | TIOCPKT_STOP | TIOCPKT_START);
+                if (pkt_flags)
+                        add_packet_flags(pkt_flags);
+
+                /* The chunks are filled in order, so the ones with data are a prefix */
+                for (size_t i = 0; i < n_chunks && chunks[i]->len > 0; ++i)
+                        m_queue.push(std::move(chunks[i]));
+
+                if (ret > 1 || pkt_flags)
+                        notify();
+        }
+}
+
+} // namespace base
+
+} // namespace vte
@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include <sys/types.h>
+
+#include "chunk.hh"
+#include "spsc-queue.hh"
+
+namespace vte {
+
+namespace base {
+
+/* The maximum number of chunks to read into with a single pty_read_chunks() */
+static constexpr unsigned int const k_pty_read_max_chunks = 4;
+
+ssize_t pty_read_chunks(int fd,
+                        uint8_t* pkt_header,
+                        Chunk* tail,
+                        Chunk::unique_type const* chunks,
+                        size_t n_chunks) noexcept;
+
+/*
+ * PtyReader:
+ *
+ * Reads from the PTY master (in TIOCPKT mode) on a dedicated thread,
+ * and hands the filled chunks to the main thread through a lock-free
+ * queue. The main thread is woken up via notify_fd() only when the
+ * queue goes from empty to non-empty, or when an event (packet
+ * header flags, EOF, or an error) is pending.
+ *
+ * When the queue is full, the reader stops reading until the main
+ * thread has consumed some chunks, so that a slow consumer applies
+ * back-pressure to the child the same way the main loop reader does.
+ */
+class PtyReader {
+public:
+        static unsigned int const k_queue_length = 32;
+
+        PtyReader(int fd,
+                  ChunkPool& pool) noexcept;
+        PtyReader(PtyReader const&) = delete;
+        PtyReader(PtyReader&&) = delete;
+        ~PtyReader();
+
+        PtyReader& operator= (PtyReader const&) = delete;
+        PtyReader& operator= (PtyReader&&) = delete;
+
+        /* Main thread API */
+
+        bool start() noexcept;
+        void stop() noexcept;
+
+        inline constexpr int notify_fd() const noexcept { return m_notify_pipe[0]; }
+        void acknowledge() noexcept;
+
+        Chunk::unique_type pop() noexcept;
+        inline bool empty() const noexcept { return m_queue.empty(); }
+
+        /* Returns the TIOCPKT_IOCTL, TIOCPKT_STOP and TIOCPKT_START flags
+         * seen since the last call. At most one of TIOCPKT_STOP and
+         * TIOCPKT_START is set, corresponding to the last one read.
+         */
+        inline unsigned int take_packet_flags() noexcept { return m_packet_flags.exchange(0); }
+
+        inline bool eof() const noexcept { return m_eof.load(std::memory_order_acquire); }
+        inline int error() const noexcept { return m_errno.load(std::memory_order_acquire); }
+
+private:
+        int m_fd;
+        ChunkPool& m_pool;
+        int m_notify_pipe[2]{-1, -1};
+        int m_wakeup_pipe[2]{-1, -1};
+
+        std::thread m_thread{};
+        SPSCQueue<Chunk::unique_type, k_queue_length> m_queue{};
+
+        std::atomic<bool> m_stop{false};
+        std::atomic<bool> m_eof{false};
+        std::atomic<int> m_errno{0};
+        std::atomic<bool> m_notify_pending{false};
+        std::atomic<bool> m_waiting_for_space{false};
+        std::atomic<unsigned int> m_packet_flags{0};
+
+        /* Reader thread */
+        void run() noexcept;
+        bool wait_for_space() noexcept;
+        void notify() noexcept;
+        void add_packet_flags(unsigned int flags) noexcept;
+        void wakeup() noexcept;
+};
+
+} // namespace base
+
+} // namespace vte
@@ -0,0 +1,363 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Scrolls a region of the screen line by line, removing its top row and
+ * inserting a new one at its bottom, and reports the time per scrolled
+ * line for the ring, and for the row shifting the ring did before it
+ * stored its rows through slots.
+ *
+ * Then scrolls the region by many lines at once (as for CSI S), comparing
+ * the removals and insertions scroll_text() used to do with a single
+ * Ring::rotate_region().
+ *
+ * Finally, scrolls back through the frozen rows a few lines per frame,
+ * the way the mouse wheel does, reading each displayed row every frame,
+ * and reports the time per frame, the hit rate of the thaw cache, and that
+ * of the streams' caches of decoded blocks that its misses read through.
+ *
+ * Then rewraps the scrollback to a new width, and reports how long the
+ * resize itself blocks, and how long the background rewrapping of the
+ * rest takes until done.
+ *
+ * Last, writes many hyperlinked cells, a new link every few cells as with
+ * ls --hyperlink, and reports the time per cell, including looking up or
+ * allocating the idx of each link and collecting the unused ones.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <glib.h>
+
+#include "ring.hh"
+#include "vterowdata.hh"
+
+using namespace vte::base;
+
+/* The writable part of the ring as it was before the slots: the rows
+ * between the position and the end are shifted one by one.
+ */
+class LegacyRing {
+public:
+        LegacyRing(Ring::row_t rows)
+        {
+                while (m_mask < rows)
+                        m_mask = (m_mask << 1) + 1;
+                m_array = g_new0(VteRowData, m_mask + 1);
+        }
+
+        ~LegacyRing()
+        {
+                for (size_t i = 0; i <= m_mask; i++)
+                        _vte_row_data_fini(&m_array[i]);
+                g_free(m_array);
+        }
+
+        inline VteRowData* get_writable_index(Ring::row_t position) const { return &m_array[position & m_mask]; }
+
+        VteRowData* insert(Ring::row_t position)
+        {
+                auto tmp = *get_writable_index(m_end);
+                for (auto i = m_end; i > position; i--)
+                        *get_writable_index(i) = *get_writable_index(i - 1);
+                *get_writable_index(position) = tmp;
+
+                auto row = get_writable_index(position);
+                _vte_row_data_clear(row);
+                m_end++;
+                return row;
+        }
+
+        void remove(Ring::row_t position)
+        {
+                auto tmp = *get_writable_index(position);
+                for (auto i = position; i < m_end - 1; i++)
+                        *get_writable_index(i) = *get_writable_index(i + 1);
+                *get_writable_index(m_end - 1) = tmp;
+                m_end--;
+        }
+
+private:
+        VteRowData* m_array;
+        Ring::row_t m_mask{31};
+        Ring::row_t m_end{0};
+};
+
+static void
+fill(Ring& ring,
+     Ring::row_t rows)
+{
+        for (Ring::row_t i = 0; i < rows; i++)
+                _vte_row_data_fill(ring.insert(i), &basic_cell, 80);
+}
+
+static double
+scroll_by(Ring& ring,
+          Ring::row_t top,
+          Ring::row_t bottom,
+          long n,
+          bool rotate,
+          size_t n_times)
+{
+        auto const start_time = g_get_monotonic_time();
+
+        for (size_t i = 0; i < n_times; i++) {
+                if (rotate) {
+                        ring.rotate_region(top, bottom, -n);
+                } else {
+                        for (auto j = 0; j < n; j++) {
+                                ring.remove(top);
+                                ring.insert(bottom);
+                        }
+                }
+        }
+
+        auto const elapsed = g_get_monotonic_time() - start_time;
+        return double(elapsed) * 1000. / double(n_times);
+}
+
+static double
+scroll_back(Ring& ring,
+            Ring::row_t rows,
+            Ring::row_t n_frozen,
+            Ring::row_t lines_per_frame)
+{
+        VteCell cell = basic_cell;
+        for (Ring::row_t i = 0; i < n_frozen + rows; i++) {
+                cell.c = 'a' + i % 26;
+                _vte_row_data_fill(ring.append(), &cell, 80);
+        }
+
+        auto const start_time = g_get_monotonic_time();
+
+        size_t n_frames = 0;
+        for (auto top = ring.next() - rows; top > ring.delta() + lines_per_frame; top -= lines_per_frame) {
+                for (auto i = top; i < top + rows; i++)
+                        (void)ring.index(i);
+                n_frames++;
+        }
+
+        auto const elapsed = g_get_monotonic_time() - start_time;
+        return double(elapsed) / double(std::max(n_frames, size_t{1}));
+}
+
+template<class T>
+static double
+scroll(T& ring,
+       Ring::row_t rows,
+       Ring::row_t top,
+       Ring::row_t bottom,
+       size_t n_lines)
+{
+        for (Ring::row_t i = 0; i < rows; i++)
+                _vte_row_data_fill(ring.insert(i), &basic_cell, 80);
+
+        auto const start_time = g_get_monotonic_time();
+
+        for (size_t i = 0; i < n_lines; i++) {
+                ring.remove(top);
+                ring.insert(bottom);
+        }
+
+        auto const elapsed = g_get_monotonic_time() - start_time;
+        return double(elapsed) * 1000. / double(n_lines);
+}
+
+static void
+rewrap(Ring& ring,
+       Ring::row_t rows,
+       Ring::row_t n_frozen,
+       Ring::column_t columns,
+       double* resize_time,
+       double* background_time)
+{
+        VteCell cell = basic_cell;
+        for (Ring::row_t i = 0; i < n_frozen + rows; i++) {
+                auto row = ring.append();
+                cell.c = 'a' + i % 26;
+                _vte_row_data_fill(row, &cell, 80);
+                /* Paragraphs of 1 to 4 rows */
+                row->attr.soft_wrapped = i % 4 != 3 && i % 7 != 0;
+        }
+
+        VteVisualPosition cursor{long(ring.next()) - 1, 0};
+        VteVisualPosition* markers[] = { &cursor, nullptr };
+
+        auto start_time = g_get_monotonic_time();
+        ring.rewrap(columns, markers);
+        *resize_time = double(g_get_monotonic_time() - start_time) / 1000.;
+
+        start_time = g_get_monotonic_time();
+        Ring::row_t split, shift;
+        while (!ring.rewrap_step(g_get_monotonic_time() + 4000, &split, &shift))
+                ;
+        *background_time = double(g_get_monotonic_time() - start_time) / 1000.;
+}
+
+static double
+hyperlinks(Ring& ring,
+           size_t n_cells,
+           size_t cells_per_link,
+           size_t n_links)
+{
+        VteCell cell = basic_cell;
+        char hyperlink[64];
+        auto row = ring.append();
+
+        auto const start_time = g_get_monotonic_time();
+
+        for (size_t i = 0; i < n_cells; i++) {
+                if (i % cells_per_link == 0) {
+                        auto const link = i / cells_per_link % n_links;
+                        g_snprintf(hyperlink, sizeof(hyperlink), "id%zu;https://example.com/%zu", link, link);
+                        cell.attr.hyperlink_idx = ring.get_hyperlink_idx(hyperlink);
+                }
+                if (row->len == 80)
+                        row = ring.append();
+                cell.c = 'a' + i % 26;
+                _vte_row_data_append(row, &cell);
+        }
+
+        auto const elapsed = g_get_monotonic_time() - start_time;
+        return double(elapsed) * 1000. / double(n_cells);
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        int rows = 80;
+        int n_lines = 1000000;
+        int scroll_lines = 40;
+        int scrollback = 100000;
+        GOptionEntry const entries[] = {
+                { "rows", 'r', 0, G_OPTION_ARG_INT, &rows,
+                  "Number of rows on the screen", "ROWS" },
+                { "lines", 'n', 0, G_OPTION_ARG_INT, &n_lines,
+                  "Number of lines to scroll", "LINES" },
+                { "scroll", 's', 0, G_OPTION_ARG_INT, &scroll_lines,
+                  "Number of lines to scroll at once", "LINES" },
+                { "scrollback", 'b', 0, G_OPTION_ARG_INT, &scrollback,
+                  "Number of scrollback lines to scroll back through", "LINES" },
+                { nullptr },
+        };
+
+        auto context = g_option_context_new("— ring scrolling benchmark");
+        g_option_context_add_main_entries(context, entries, nullptr);
+
+        GError* error = nullptr;
+        auto rv = g_option_context_parse(context, &argc, &argv, &error);
+        g_option_context_free(context);
+        if (!rv) {
+                g_printerr("Failed to parse arguments: %s\n", error->message);
+                g_error_free(error);
+                return EXIT_FAILURE;
+        }
+
+        rows = std::max(rows, 8);
+        n_lines = std::max(n_lines, 1);
+
+        struct {
+                char const* name;
+                Ring::row_t top, bottom;
+        } const regions[] = {
+                { "top",    0,                     Ring::row_t(rows * 3 / 4 - 1) },
+                { "middle", Ring::row_t(rows / 8), Ring::row_t(rows * 7 / 8 - 1) },
+                { "bottom", Ring::row_t(rows / 4), Ring::row_t(rows - 1) },
+        };
+
+        g_print("%-8s %12s %12s\n", "region", "legacy", "ring");
+        for (auto const& region : regions) {
+                LegacyRing legacy{Ring::row_t(rows)};
+                auto const legacy_time = scroll(legacy, rows, region.top, region.bottom, n_lines);
+
+                Ring ring{Ring::row_t(rows), false};
+                ring.set_visible_rows(rows);
+                auto const ring_time = scroll(ring, rows, region.top, region.bottom, n_lines);
+
+                g_print("%-8s %9.1f ns %9.1f ns\n",
+                        region.name, legacy_time, ring_time);
+        }
+
+        scroll_lines = std::max(scroll_lines, 1);
+        auto const n_times = std::max(size_t(n_lines) / size_t(scroll_lines), size_t{1});
+
+        g_print("\nScrolling by %d lines at once\n", scroll_lines);
+        g_print("%-8s %12s %12s\n", "region", "remove+insert", "rotate");
+        for (auto const& region : regions) {
+                Ring ring{Ring::row_t(rows), false};
+                ring.set_visible_rows(rows);
+                fill(ring, rows);
+
+                auto const loop_time = scroll_by(ring, region.top, region.bottom, scroll_lines, false, n_times);
+                auto const rotate_time = scroll_by(ring, region.top, region.bottom, scroll_lines, true, n_times);
+
+                g_print("%-8s %10.1f µs %9.1f µs\n",
+                        region.name, loop_time / 1000., rotate_time / 1000.);
+        }
+
+        g_print("\nScrolling back through %d lines\n", scrollback);
+        for (auto lines_per_frame : {1, 3, rows}) {
+                Ring ring{Ring::row_t(scrollback + rows), true};
+                ring.set_visible_rows(rows);
+
+                auto const frame_time = scroll_back(ring, rows, std::max(scrollback, rows), lines_per_frame);
+                auto const& stats = ring.thaw_cache_stats();
+                auto const stream_stats = ring.stream_cache_stats();
+                g_print("%3d lines/frame %9.1f µs/frame %6.1f%% hits, %" G_GUINT64_FORMAT " evictions, "
+                        "streams %6.1f%% hits\n",
+                        lines_per_frame, frame_time,
+                        100. * stats.hits / std::max(stats.hits + stats.misses, guint64{1}),
+                        stats.evictions,
+                        100. * stream_stats.hits / std::max(stream_stats.hits + stream_stats.misses, guint64{1}));
+        }
+
+        g_print("\nRewrapping %d lines\n", scrollback);
+        for (auto columns : {Ring::column_t(60), Ring::column_t(120)}) {
+                Ring ring{Ring::row_t(scrollback + rows) * 2, true};
+                ring.set_visible_rows(rows);
+
+                double resize_time, background_time;
+                rewrap(ring, rows, std::max(scrollback, rows), columns, &resize_time, &background_time);
+                g_print("to %3ld columns %9.1f ms resize %9.1f ms in the background\n",
+                        columns, resize_time, background_time);
+        }
+
+        size_t const n_cells = 1000000;
+        g_print("\nWriting %zu hyperlinked cells\n", n_cells);
+        struct {
+                size_t cells_per_link, n_links;
+        } const link_runs[] = {
+                { 1, n_cells },
+                { 16, n_cells },
+                { 16, 64 },
+        };
+        for (auto const& run : link_runs) {
+                Ring ring{Ring::row_t(scrollback + rows), true};
+                ring.set_visible_rows(rows);
+
+                auto const cell_time = hyperlinks(ring, n_cells, run.cells_per_link, run.n_links);
+                g_print("%2zu cells/link %7zu links %9.1f ns/cell\n",
+                        run.cells_per_link, std::min(run.n_links, n_cells / run.cells_per_link), cell_time);
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -22,6 +22,7 @@
 
 #include "debug.h"
 #include "ring.hh"
+#include "scan.hh"
 #include "vterowdata.hh"
 
 #include <string.h>
@@ -60,27 +61,54 @@ Ring::validate() const
 #define validate(...) do { } while(0)
 #endif
 
+static Ring::StreamBackend s_default_stream_backend =
+#if VTE_STREAM_BACKEND_MEMORY
+        Ring::StreamBackend::eMemory;
+#else
+        Ring::StreamBackend::eFile;
+#endif
+
+Ring::StreamBackend
+Ring::default_stream_backend()
+{
+	return s_default_stream_backend;
+}
+
+void
+Ring::set_default_stream_backend(StreamBackend backend)
+{
+	s_default_stream_backend = backend;
+}
+
 Ring::Ring(row_t max_rows,
-           bool has_streams)
+           bool has_streams,
+           StreamBackend stream_backend)
         : m_max{MAX(max_rows, 3)},
           m_has_streams{has_streams},
+          m_stream_backend{stream_backend},
           m_last_attr{basic_cell.attr}
 {
 	_vte_debug_print(VTE_DEBUG_RING, "New ring %p.\n", this);
 
 	m_array = (VteRowData* ) g_malloc0 (sizeof (m_array[0]) * (m_mask + 1));
+	m_slots = g_new (guint32, m_mask + 1);
+	for (size_t i = 0; i <= m_mask; i++)
+		m_slots[i] = i;
 
 	if (has_streams) {
-		m_attr_stream = _vte_file_stream_new ();
-		m_text_stream = _vte_file_stream_new ();
-		m_row_stream = _vte_file_stream_new ();
+		m_attr_stream = new_stream();
+		m_text_stream = new_stream();
+		m_row_stream = new_stream();
+		if (m_stream_backend == StreamBackend::eFile)
+			_vte_file_stream_set_cache_size (m_text_stream, kTextStreamCacheBlocks);
 	} else {
 		m_attr_stream = m_text_stream = m_row_stream = nullptr;
 	}
 
 	m_utf8_buffer = g_string_sized_new (128);
 
-	_vte_row_data_init (&m_cached_row);
+	_vte_row_data_init (&m_hyperlink_row);
+	thaw_cache_resize(kThawCacheMinRows);
 
         m_hyperlinks = g_ptr_array_new();
         auto empty_str = g_string_new_len("", 0);
@@ -95,8 +123,18 @@ Ring::~Ring()
 		_vte_row_data_fini (&m_array[i]);
 
 	g_free (m_array);
+	g_free (m_slots);
+
+	rewrap_cancel();
 
 	if (m_has_streams) {
+		_VTE_DEBUG_IF(VTE_DEBUG_RING) {
+			auto const stats = stream_cache_stats();
+			g_printerr("Stream caches: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, "
+				   "%" G_GUINT64_FORMAT " evictions.\n",
+				   stats.hits, stats.misses, stats.evictions);
+		}
+
 		g_object_unref (m_attr_stream);
 		g_object_unref (m_text_stream);
 		g_object_unref (m_row_stream);
@@ -108,28 +146,206 @@ Ring::~Ring()
                 g_string_free (hyperlink_get(i), TRUE);
         g_ptr_array_free (m_hyperlinks, TRUE);
 
-	_vte_row_data_fini(&m_cached_row);
+	_vte_debug_print(VTE_DEBUG_RING,
+			 "Thaw cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, "
+			 "%" G_GUINT64_FORMAT " evictions, %" G_GUINT64_FORMAT " invalidations.\n",
+			 m_thaw_cache_stats.hits, m_thaw_cache_stats.misses,
+			 m_thaw_cache_stats.evictions, m_thaw_cache_stats.invalidations);
+
+	thaw_cache_resize(0);
+	_vte_row_data_fini(&m_hyperlink_row);
+}
+
+VteStream*
+Ring::new_stream() const
+{
+	switch (m_stream_backend) {
+	case StreamBackend::eMemory:
+		return _vte_mem_stream_new (VTE_STREAM_CODEC_DEFAULT, VTE_STREAM_CODEC_LEVEL);
+	case StreamBackend::eFile:
+	default:
+		return _vte_file_stream_new ();
+	}
+}
+
+/* The read caches of the three file streams together */
+VteStreamCacheStats
+Ring::stream_cache_stats() const
+{
+	VteStreamCacheStats total{};
+
+	if (!m_has_streams || m_stream_backend != StreamBackend::eFile)
+		return total;
+
+	for (auto stream : {m_attr_stream, m_text_stream, m_row_stream}) {
+		VteStreamCacheStats stats;
+		_vte_file_stream_get_cache_stats (stream, &stats);
+		total.hits += stats.hits;
+		total.misses += stats.misses;
+		total.evictions += stats.evictions;
+	}
+
+	return total;
+}
+
+size_t
+Ring::writable_bytes() const
+{
+	size_t bytes = (m_mask + 1) * (sizeof (m_array[0]) + sizeof (m_slots[0]));
+
+	for (row_t i = 0; i <= m_mask; i++)
+		bytes += _vte_row_data_get_memory_size (&m_array[i]);
+
+	return bytes;
+}
+
+size_t
+Ring::stream_bytes() const
+{
+	size_t bytes = 0;
+
+	if (!m_has_streams)
+		return bytes;
+
+	for (auto stream : {m_attr_stream, m_text_stream, m_row_stream})
+		bytes += _vte_stream_head (stream) - _vte_stream_tail (stream);
+
+	return bytes;
+}
+
+/*
+ * The thaw cache: the most recently thawed frozen rows, so that drawing
+ * the same scrolled back page again doesn't need to read and decode the
+ * streams again.
+ */
+
+void
+Ring::thaw_cache_resize(row_t size)
+{
+	row_t i;
+
+	if (size == m_thaw_cache_size)
+		return;
+
+	_vte_debug_print(VTE_DEBUG_RING, "Resizing thaw cache from %lu to %lu rows.\n",
+			 m_thaw_cache_size, size);
+
+	m_thaw_cache_map.clear();
+	for (i = 0; i < m_thaw_cache_size; i++)
+		_vte_row_data_fini(&m_thaw_cache[i].row);
+	g_free(m_thaw_cache);
+
+	m_thaw_cache = nullptr;
+	m_thaw_cache_mru = m_thaw_cache_lru = nullptr;
+	m_thaw_cache_size = size;
+	if (size == 0)
+		return;
+
+	m_thaw_cache = g_new0(ThawedRow, size);
+	for (i = 0; i < size; i++) {
+		auto entry = &m_thaw_cache[i];
+		_vte_row_data_init(&entry->row);
+		entry->position = (row_t)-1;
+		entry->prev = i > 0 ? entry - 1 : nullptr;
+		entry->next = i + 1 < size ? entry + 1 : nullptr;
+	}
+	m_thaw_cache_mru = &m_thaw_cache[0];
+	m_thaw_cache_lru = &m_thaw_cache[size - 1];
+	m_thaw_cache_map.reserve(size);
+}
+
+/* Moves @entry to the front of the list */
+void
+Ring::thaw_cache_use(ThawedRow* entry)
+{
+	if (entry == m_thaw_cache_mru)
+		return;
+
+	entry->prev->next = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		m_thaw_cache_lru = entry->prev;
+
+	entry->prev = nullptr;
+	entry->next = m_thaw_cache_mru;
+	m_thaw_cache_mru->prev = entry;
+	m_thaw_cache_mru = entry;
+}
+
+/* Drops @entry's row and moves @entry to the back of the list */
+void
+Ring::thaw_cache_remove(ThawedRow* entry)
+{
+	m_thaw_cache_map.erase(entry->position);
+	entry->position = (row_t)-1;
+	m_thaw_cache_stats.invalidations++;
+
+	if (entry == m_thaw_cache_lru)
+		return;
+
+	entry->next->prev = entry->prev;
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		m_thaw_cache_mru = entry->next;
+
+	entry->next = nullptr;
+	entry->prev = m_thaw_cache_lru;
+	m_thaw_cache_lru->next = entry;
+	m_thaw_cache_lru = entry;
+}
+
+void
+Ring::thaw_cache_invalidate(row_t position)
+{
+	auto it = m_thaw_cache_map.find(position);
+	if (it != m_thaw_cache_map.end())
+		thaw_cache_remove(it->second);
+}
+
+/* Drops the rows whose hyperlink idxs depend on the hover idx */
+void
+Ring::thaw_cache_invalidate_hyperlinks()
+{
+	for (row_t i = 0; i < m_thaw_cache_size; i++) {
+		auto entry = &m_thaw_cache[i];
+		if (entry->position != (row_t)-1 && entry->has_hyperlinks)
+			thaw_cache_remove(entry);
+	}
+}
+
+void
+Ring::thaw_cache_clear()
+{
+	for (row_t i = 0; i < m_thaw_cache_size; i++) {
+		auto entry = &m_thaw_cache[i];
+		if (entry->position != (row_t)-1)
+			thaw_cache_remove(entry);
+	}
 }
 
 #define SET_BIT(buf, n) buf[(n) / 8] |= (1 << ((n) % 8))
 #define GET_BIT(buf, n) ((buf[(n) / 8] >> ((n) % 8)) & 1)
 
 /*
- * Do a round of garbage collection. Hyperlinks that no longer occur in the ring are wiped out.
+ * Do a round of garbage collection. Hyperlinks that no longer occur in the ring are wiped out,
+ * and their slots in the pool are left for reuse.
  */
 void
 Ring::hyperlink_gc()
 {
         row_t i, j;
-        hyperlink_idx_t idx;
+        hyperlink_idx_t idx, live;
         VteRowData* row;
-        char *used;
+        guint8 *used;
 
         _vte_debug_print (VTE_DEBUG_HYPERLINK,
                           "hyperlink: GC starting (highest used idx is %d)\n",
                           m_hyperlink_highest_used_idx);
 
         m_hyperlink_maybe_gc_counter = 0;
+        m_hyperlink_allocs_since_gc = 0;
 
         if (m_hyperlink_highest_used_idx == 0) {
                 _vte_debug_print (VTE_DEBUG_HYPERLINK,
@@ -138,7 +354,8 @@ Ring::hyperlink_gc()
         }
 
         /* One bit for each idx to see if it's used. */
-        used = (char *) g_malloc0 (m_hyperlink_highest_used_idx / 8 + 1);
+        m_hyperlink_gc_used.assign(m_hyperlink_highest_used_idx / 8 + 1, 0);
+        used = m_hyperlink_gc_used.data();
 
         /* A few special values not to be garbage collected. */
         SET_BIT(used, m_hyperlink_current_idx);
@@ -153,26 +370,35 @@ Ring::hyperlink_gc()
                 }
         }
 
+        live = 0;
         for (idx = 1; idx <= m_hyperlink_highest_used_idx; idx++) {
-                if (!GET_BIT(used, idx) && hyperlink_get(idx)->len != 0) {
-                        _vte_debug_print (VTE_DEBUG_HYPERLINK,
-                                          "hyperlink: GC purging link %d to id;uri=\"%s\"\n",
-                                          idx, hyperlink_get(idx)->str);
-                        /* Wipe out the ID and URI itself so it doesn't linger on in the memory for a long time */
-                        memset(hyperlink_get(idx)->str, 0, hyperlink_get(idx)->len);
-                        g_string_truncate (hyperlink_get(idx), 0);
+                if (hyperlink_get(idx)->len == 0)
+                        continue;
+                if (GET_BIT(used, idx)) {
+                        live++;
+                        continue;
                 }
+
+                _vte_debug_print (VTE_DEBUG_HYPERLINK,
+                                  "hyperlink: GC purging link %d to id;uri=\"%s\"\n",
+                                  idx, hyperlink_get(idx)->str);
+                m_hyperlink_map.erase(std::string_view{hyperlink_get(idx)->str, hyperlink_get(idx)->len});
+                /* Wipe out the ID and URI itself so it doesn't linger on in the memory for a long time */
+                memset(hyperlink_get(idx)->str, 0, hyperlink_get(idx)->len);
+                g_string_truncate (hyperlink_get(idx), 0);
+                m_hyperlink_free_idxs.push_back(idx);
         }
 
         while (m_hyperlink_highest_used_idx >= 1 && hyperlink_get(m_hyperlink_highest_used_idx)->len == 0) {
                m_hyperlink_highest_used_idx--;
         }
 
-        _vte_debug_print (VTE_DEBUG_HYPERLINK,
-                          "hyperlink: GC done (highest used idx is now %d)\n",
-                          m_hyperlink_highest_used_idx);
+        /* Scanning the screen is paid for by at least as many allocations as there are links left */
+        m_hyperlink_gc_allocs = MAX(live, kHyperlinkGCMinAllocations);
 
-        g_free (used);
+        _vte_debug_print (VTE_DEBUG_HYPERLINK,
+                          "hyperlink: GC done (highest used idx is now %d, %d in use)\n",
+                          m_hyperlink_highest_used_idx, live);
 }
 
 /*
@@ -198,67 +424,64 @@ Ring::hyperlink_maybe_gc(row_t increment)
  * Returns the idx (either already existing or newly allocated) from 1 up to
  * VTE_HYPERLINK_COUNT_MAX inclusive otherwise.
  *
- * FIXME do something more effective than a linear search
+ * Links no longer in use are only collected every so often, when enough new
+ * ones were allocated since the last GC, or when the pool is full.
  */
 Ring::hyperlink_idx_t
 Ring::get_hyperlink_idx_no_update_current(char const* hyperlink)
 {
         hyperlink_idx_t idx;
         gsize len;
-        GString *str;
 
         if (!hyperlink || !hyperlink[0])
                 return 0;
 
         len = strlen(hyperlink);
 
-        /* Linear search for this particular URI */
-        auto const last_idx = m_hyperlink_highest_used_idx + 1;
-        for (idx = 1; idx < last_idx; ++idx) {
-                if (strcmp(hyperlink_get(idx)->str, hyperlink) == 0) {
-                        _vte_debug_print (VTE_DEBUG_HYPERLINK,
-                                          "get_hyperlink_idx: already existing idx %d for id;uri=\"%s\"\n",
-                                          idx, hyperlink);
-                        return idx;
-                }
+        auto const it = m_hyperlink_map.find(std::string_view{hyperlink, len});
+        if (it != m_hyperlink_map.end()) {
+                _vte_debug_print (VTE_DEBUG_HYPERLINK,
+                                  "get_hyperlink_idx: already existing idx %d for id;uri=\"%s\"\n",
+                                  it->second, hyperlink);
+                return it->second;
         }
 
-        /* FIXME it's the second time we're GCing if coming from get_hyperlink_idx */
-        hyperlink_gc();
+        if (m_hyperlink_allocs_since_gc >= m_hyperlink_gc_allocs ||
+            (m_hyperlink_free_idxs.empty() && m_hyperlinks->len > VTE_HYPERLINK_COUNT_MAX))
+                hyperlink_gc();
 
-        /* Another linear search for an empty slot where a GString is already allocated */
-        for (idx = 1; idx < m_hyperlinks->len; idx++) {
-                if (hyperlink_get(idx)->len == 0) {
+        if (!m_hyperlink_free_idxs.empty()) {
+                /* Reuse an empty slot where a GString is already allocated */
+                idx = m_hyperlink_free_idxs.back();
+                m_hyperlink_free_idxs.pop_back();
+                _vte_debug_print (VTE_DEBUG_HYPERLINK,
+                                  "get_hyperlink_idx: reassigning old idx %d for id;uri=\"%s\"\n",
+                                  idx, hyperlink);
+                /* Grow size if required, however, never shrink to avoid long-term memory fragmentation. */
+                g_string_append_len (hyperlink_get(idx), hyperlink, len);
+                m_hyperlink_highest_used_idx = MAX (m_hyperlink_highest_used_idx, idx);
+        } else {
+                /* All allocated slots are in use. Gotta allocate a new one */
+                g_assert_cmpuint(m_hyperlink_highest_used_idx + 1, ==, m_hyperlinks->len);
+
+                /* VTE_HYPERLINK_COUNT_MAX should be big enough for this not to happen under
+                   normal circumstances. Anyway, it's cheap to protect against extreme ones. */
+                if (m_hyperlink_highest_used_idx == VTE_HYPERLINK_COUNT_MAX) {
                         _vte_debug_print (VTE_DEBUG_HYPERLINK,
-                                          "get_hyperlink_idx: reassigning old idx %d for id;uri=\"%s\"\n",
-                                          idx, hyperlink);
-                        /* Grow size if required, however, never shrink to avoid long-term memory fragmentation. */
-                        g_string_append_len (hyperlink_get(idx), hyperlink, len);
-                        m_hyperlink_highest_used_idx = MAX (m_hyperlink_highest_used_idx, idx);
-                        return idx;
+                                          "get_hyperlink_idx: idx 0 (ran out of available idxs) for id;uri=\"%s\"\n",
+                                          hyperlink);
+                        return 0;
                 }
-        }
 
-        /* All allocated slots are in use. Gotta allocate a new one */
-        g_assert_cmpuint(m_hyperlink_highest_used_idx + 1, ==, m_hyperlinks->len);
-
-        /* VTE_HYPERLINK_COUNT_MAX should be big enough for this not to happen under
-           normal circumstances. Anyway, it's cheap to protect against extreme ones. */
-        if (m_hyperlink_highest_used_idx == VTE_HYPERLINK_COUNT_MAX) {
+                idx = ++m_hyperlink_highest_used_idx;
                 _vte_debug_print (VTE_DEBUG_HYPERLINK,
-                                  "get_hyperlink_idx: idx 0 (ran out of available idxs) for id;uri=\"%s\"\n",
-                                  hyperlink);
-                return 0;
+                                  "get_hyperlink_idx: brand new idx %d for id;uri=\"%s\"\n",
+                                  idx, hyperlink);
+                g_ptr_array_add(m_hyperlinks, g_string_new_len (hyperlink, len));
         }
 
-        idx = ++m_hyperlink_highest_used_idx;
-        _vte_debug_print (VTE_DEBUG_HYPERLINK,
-                          "get_hyperlink_idx: brand new idx %d for id;uri=\"%s\"\n",
-                          idx, hyperlink);
-        str = g_string_new_len (hyperlink, len);
-        g_ptr_array_add(m_hyperlinks, str);
-
-        g_assert_cmpuint(m_hyperlink_highest_used_idx + 1, ==, m_hyperlinks->len);
+        m_hyperlink_allocs_since_gc++;
+        m_hyperlink_map.emplace(std::string_view{hyperlink_get(idx)->str, len}, idx);
 
         return idx;
 }
@@ -275,10 +498,8 @@ Ring::get_hyperlink_idx_no_update_current(char const* hyperlink)
 Ring::hyperlink_idx_t
 Ring::get_hyperlink_idx(char const* hyperlink)
 {
-        /* Release current idx and do a round of GC to possibly purge its hyperlink,
-         * even if new hyperlink is nullptr or empty. */
+        /* Release current idx, for a later GC to purge its hyperlink if it's no longer on the screen. */
         m_hyperlink_current_idx = 0;
-        hyperlink_gc();
 
         m_hyperlink_current_idx = get_hyperlink_idx_no_update_current(hyperlink);
         return m_hyperlink_current_idx;
@@ -570,6 +791,8 @@ Ring::reset_streams(row_t position)
 {
 	_vte_debug_print (VTE_DEBUG_RING, "Reseting streams to %lu.\n", position);
 
+	rewrap_cancel();
+
 	if (m_has_streams) {
 		_vte_stream_reset(m_row_stream, position * sizeof(RowRecord));
                 _vte_stream_reset(m_text_stream, _vte_stream_head(m_text_stream));
@@ -578,6 +801,8 @@ Ring::reset_streams(row_t position)
 
 	m_last_attr_text_start_offset = 0;
 	m_last_attr = basic_cell.attr;
+
+	thaw_cache_clear();
 }
 
 Ring::row_t
@@ -587,7 +812,6 @@ Ring::reset()
 
         reset_streams(m_end);
         m_start = m_writable = m_end;
-        m_cached_row_num = (row_t)-1;
 
         return m_end;
 }
@@ -598,13 +822,47 @@ Ring::index(row_t position)
 	if (G_LIKELY (position >= m_writable))
 		return get_writable_index(position);
 
-	if (m_cached_row_num != position) {
+	ThawedRow* entry;
+	auto it = m_thaw_cache_map.find(position);
+	if (G_LIKELY (it != m_thaw_cache_map.end())) {
+		entry = it->second;
+		m_thaw_cache_stats.hits++;
+	} else {
 		_vte_debug_print(VTE_DEBUG_RING, "Caching row %lu.\n", position);
-                thaw_row(position, &m_cached_row, false, -1, nullptr);
-		m_cached_row_num = position;
+
+		/* Reuse the least recently used entry */
+		entry = m_thaw_cache_lru;
+		if (entry->position != (row_t)-1) {
+			m_thaw_cache_map.erase(entry->position);
+			m_thaw_cache_stats.evictions++;
+		}
+		m_thaw_cache_stats.misses++;
+
+                thaw_row(position, &entry->row, false, -1, nullptr);
+		entry->position = position;
+		entry->has_hyperlinks = false;
+		for (row_t i = 0; i < entry->row.len; i++) {
+			if (entry->row.cells[i].attr.hyperlink_idx != 0) {
+				entry->has_hyperlinks = true;
+				break;
+			}
+		}
+		m_thaw_cache_map.emplace(position, entry);
 	}
 
-	return &m_cached_row;
+	thaw_cache_use(entry);
+	return &entry->row;
+}
+
+void
+Ring::set_hyperlink_hover_idx(hyperlink_idx_t idx)
+{
+	if (idx == m_hyperlink_hover_idx)
+		return;
+
+	/* The new hover idx results in new idxs to report for the thawed rows */
+	thaw_cache_invalidate_hyperlinks();
+	m_hyperlink_hover_idx = idx;
 }
 
 /*
@@ -633,14 +891,9 @@ Ring::get_hyperlink_at_position(row_t position,
                 hyperlink = &hp;
         *hyperlink = nullptr;
 
-        if (update_hover_idx) {
-                /* Invalidate the cache because new hover idx might result in new idxs to report. */
-                m_cached_row_num = (row_t)-1;
-        }
-
         if (G_UNLIKELY (!contains(position) || col < 0)) {
                 if (update_hover_idx)
-                        m_hyperlink_hover_idx = 0;
+                        set_hyperlink_hover_idx(0);
                 return 0;
         }
 
@@ -648,21 +901,21 @@ Ring::get_hyperlink_at_position(row_t position,
                 VteRowData* row = get_writable_index(position);
                 if (col >= _vte_row_data_length(row)) {
                         if (update_hover_idx)
-                                m_hyperlink_hover_idx = 0;
+                                set_hyperlink_hover_idx(0);
                         return 0;
                 }
                 *hyperlink = hyperlink_get(row->cells[col].attr.hyperlink_idx)->str;
                 idx = row->cells[col].attr.hyperlink_idx;
         } else {
-                thaw_row(position, &m_cached_row, false, col, hyperlink);
-                /* Note: Intentionally don't set cached_row_num. We're about to update
+                /* Note: Intentionally don't use the thaw cache. We're about to update
                  * m_hyperlink_hover_idx which makes some idxs no longer valid. */
+                thaw_row(position, &m_hyperlink_row, false, col, hyperlink);
                 idx = get_hyperlink_idx_no_update_current(*hyperlink);
         }
         if (**hyperlink == '\0')
                 *hyperlink = nullptr;
         if (update_hover_idx)
-                m_hyperlink_hover_idx = idx;
+                set_hyperlink_hover_idx(idx);
         return idx;
 }
 
@@ -698,8 +951,11 @@ Ring::thaw_one_row()
 
 	m_writable--;
 
-	if (m_writable == m_cached_row_num)
-		m_cached_row_num = (row_t)-1; /* Invalidate cached row */
+	/* The rows left to rewrap end where the rewrapped ones start */
+	if (G_UNLIKELY(m_writable <= m_rewrap_split))
+		rewrap_cancel();
+
+	thaw_cache_invalidate(m_writable);
 
 	row = get_writable_index(m_writable);
         thaw_row(m_writable, row, true, -1, nullptr);
@@ -745,7 +1001,9 @@ void
 Ring::ensure_writable_room()
 {
 	row_t new_mask, old_mask, i, end;
-	VteRowData* old_array, *new_array;;
+	VteRowData* old_array;
+	guint32* old_slots;
+	guint32 free_slot;
 
         if (G_LIKELY(m_mask >= m_visible_rows &&
                      m_writable + m_mask + 1 > m_end))
@@ -753,6 +1011,7 @@ Ring::ensure_writable_room()
 
 	old_mask = m_mask;
 	old_array = m_array;
+	old_slots = m_slots;
 
 	do {
 		m_mask = (m_mask << 1) + 1;
@@ -761,15 +1020,59 @@ Ring::ensure_writable_room()
 	_vte_debug_print(VTE_DEBUG_RING, "Enlarging writable array from %lu to %lu\n", old_mask, m_mask);
 
 	m_array = (VteRowData* ) g_malloc0(sizeof (m_array[0]) * (m_mask + 1));
+	m_slots = g_new (guint32, m_mask + 1);
 
 	new_mask = m_mask;
-	new_array = m_array;
+
+	/* The rows keep their place in the array; the new part of the
+	 * array goes to the slots past the old ones. */
+	memcpy (m_array, old_array, sizeof (m_array[0]) * (old_mask + 1));
 
 	end = m_writable + old_mask + 1;
 	for (i = m_writable; i < end; i++)
-		new_array[i & new_mask] = old_array[i & old_mask];
+		m_slots[i & new_mask] = old_slots[(i + m_slot_offset) & old_mask];
+	free_slot = old_mask + 1;
+	for (i = end; i <= m_writable + new_mask; i++)
+		m_slots[i & new_mask] = free_slot++;
+	m_slot_offset = 0;
 
 	g_free (old_array);
+	g_free (old_slots);
+}
+
+/* Reverses the order of the slots of the rows from @from to @to */
+void
+Ring::reverse_slots(row_t from,
+                    row_t to)
+{
+	guint32 tmp;
+
+	while (from + 1 < to) {
+		to--;
+		tmp = m_slots[slot(from)];
+		m_slots[slot(from)] = m_slots[slot(to)];
+		m_slots[slot(to)] = tmp;
+		from++;
+	}
+}
+
+/* Moves the slots of @count rows from position @from to position @to,
+ * which may overlap, like memmove().
+ */
+void
+Ring::move_slots(row_t from,
+                 row_t to,
+                 row_t count)
+{
+	row_t i;
+
+	if (gssize (to - from) < 0) {
+		for (i = 0; i < count; i++)
+			m_slots[slot(to + i)] = m_slots[slot(from + i)];
+	} else {
+		for (i = count; i > 0; i--)
+			m_slots[slot(to + i - 1)] = m_slots[slot(from + i - 1)];
+	}
 }
 
 void
@@ -846,8 +1149,8 @@ Ring::shrink(row_t max_len)
 VteRowData*
 Ring::insert(row_t position)
 {
-	row_t i;
-	VteRowData* row, tmp;
+	VteRowData* row;
+	guint32 free_slot;
 
 	_vte_debug_print(VTE_DEBUG_RING, "Inserting at position %lu.\n", position);
 	validate();
@@ -859,11 +1162,19 @@ Ring::insert(row_t position)
 	g_assert_cmpuint (position, >=, m_writable);
 	g_assert_cmpuint (position, <=, m_end);
 
-        //FIXMEchpe WTF use better data structures!
-	tmp = *get_writable_index(m_end);
-	for (i = m_end; i > position; i--)
-		*get_writable_index(i) = *get_writable_index(i - 1);
-	*get_writable_index(position) = tmp;
+	/* There is room for one more row, either at m_end or, which is
+	 * the same slot, just before m_writable. Move the shorter side
+	 * of the rows around @position to make space there. */
+	if (position - m_writable < m_end - position) {
+		free_slot = m_slots[slot(m_writable - 1)];
+		move_slots(m_writable, m_writable - 1, position - m_writable);
+		m_slots[slot(position - 1)] = free_slot;
+		m_slot_offset--;
+	} else {
+		free_slot = m_slots[slot(m_end)];
+		move_slots(position, position + 1, m_end - position);
+		m_slots[slot(position)] = free_slot;
+	}
 
 	row = get_writable_index(position);
 	_vte_row_data_clear (row);
@@ -883,8 +1194,7 @@ Ring::insert(row_t position)
 void
 Ring::remove(row_t position)
 {
-	row_t i;
-	VteRowData tmp;
+	guint32 removed_slot;
 
 	_vte_debug_print(VTE_DEBUG_RING, "Removing item at position %lu.\n", position);
         validate();
@@ -894,11 +1204,17 @@ Ring::remove(row_t position)
 
 	ensure_writable(position);
 
-        //FIXMEchpe WTF as above
-	tmp = *get_writable_index(position);
-	for (i = position; i < m_end - 1; i++)
-		*get_writable_index(i) = *get_writable_index(i + 1);
-	*get_writable_index(m_end - 1) = tmp;
+	/* Close the gap from the shorter side; the removed row's slot
+	 * becomes the free one past the end (or before m_writable). */
+	removed_slot = m_slots[slot(position)];
+	if (position - m_writable < m_end - 1 - position) {
+		move_slots(m_writable, m_writable + 1, position - m_writable);
+		m_slots[slot(m_writable)] = removed_slot;
+		m_slot_offset++;
+	} else {
+		move_slots(position + 1, position, m_end - 1 - position);
+		m_slots[slot(m_end - 1)] = removed_slot;
+	}
 
 	if (m_end > m_writable)
 		m_end--;
@@ -907,6 +1223,60 @@ Ring::remove(row_t position)
 }
 
 
+/**
+ * Ring::rotate_region:
+ * @start: the first row of the region
+ * @end: the last row of the region
+ * @n: the number of rows to scroll by
+ *
+ * Scrolls the rows from @start to @end (inclusive), which must be in the
+ * ring, down by @n rows if @n is positive, or up by -@n rows if negative.
+ * The rows scrolled out of the region are cleared and reused for the rows
+ * scrolled in, so this is like calling remove() and insert() @n times,
+ * but in one pass over the region.
+ */
+void
+Ring::rotate_region(row_t start,
+                    row_t end,
+                    long n)
+{
+	row_t count, len, i;
+
+	_vte_debug_print(VTE_DEBUG_RING, "Rotating rows %lu..%lu by %ld.\n", start, end, n);
+	validate();
+
+	if (G_UNLIKELY(n == 0 || start > end))
+		return;
+
+	ensure_writable(start);
+
+	g_assert_cmpuint (start, >=, m_writable);
+	g_assert_cmpuint (end, <, m_end);
+
+	len = end - start + 1;
+	count = MIN((row_t) ABS(n), len);
+
+	/* Rotate the slots by reversing both parts and then the whole region */
+	if (count < len) {
+		if (n > 0) {
+			reverse_slots(start, end + 1 - count);
+			reverse_slots(end + 1 - count, end + 1);
+		} else {
+			reverse_slots(start, start + count);
+			reverse_slots(start + count, end + 1);
+		}
+		reverse_slots(start, end + 1);
+	}
+
+	/* The rows scrolled in */
+	if (n < 0)
+		start = end + 1 - count;
+	for (i = start; i < start + count; i++)
+		_vte_row_data_clear (get_writable_index(i));
+
+        validate();
+}
+
 /**
  * Ring::append:
  * @data: the new item
@@ -939,6 +1309,40 @@ Ring::drop_scrollback(row_t position)
         reset_streams(position);
 }
 
+/**
+ * Ring::drop_frozen_rows:
+ * @count: the number of rows to drop
+ *
+ * Drop up to @count of the oldest rows, but only frozen ones, like the ring
+ * does one at a time when it's full.
+ *
+ * Returns: the number of rows dropped
+ */
+Ring::row_t
+Ring::drop_frozen_rows(row_t count)
+{
+	RowRecord record;
+
+	count = MIN(count, frozen_rows());
+	if (count == 0)
+		return 0;
+
+	_vte_debug_print (VTE_DEBUG_RING, "Dropping %lu frozen rows from %lu.\n", count, m_start);
+
+	m_start += count;
+	if (m_start == m_writable) {
+		reset_streams(m_writable);
+	} else {
+		_vte_stream_advance_tail(m_row_stream, m_start * sizeof (record));
+		if (G_LIKELY(read_row_record(&record, m_start))) {
+			_vte_stream_advance_tail(m_text_stream, record.text_start_offset);
+			_vte_stream_advance_tail(m_attr_stream, record.attr_start_offset);
+		}
+	}
+
+	return count;
+}
+
 /**
  * Ring::set_visible_rows:
  * @rows: the number of visible rows
@@ -951,6 +1355,8 @@ void
 Ring::set_visible_rows(row_t rows)
 {
         m_visible_rows = rows;
+
+        thaw_cache_resize(MAX(rows * kThawCacheScreens, kThawCacheMinRows));
 }
 
 
@@ -966,7 +1372,8 @@ Ring::frozen_row_column_to_text_offset(row_t position,
 	VteCell *cell;
 	GString *buffer = m_utf8_buffer;
 	VteRowData const* row;
-	unsigned int i, num_chars, off;
+	unsigned int i, num_chars;
+	gsize off, n;
 
 	if (position >= m_end) {
 		offset->text_offset = _vte_stream_head(m_text_stream) + position - m_end;
@@ -1021,11 +1428,8 @@ Ring::frozen_row_column_to_text_offset(row_t position,
 	}
 
 	/* count the number of UTF-8 bytes for the given number of characters */
-	off = 0;
-	while (num_chars > 0 && off < buffer->len) {
-		off++;
-		if ((buffer->str[off] & 0xC0) != 0x80) num_chars--;
-	}
+	n = num_chars;
+	off = utf8_skip_chars((uint8_t const*) buffer->str, buffer->len, &n);
 	offset->text_offset = records[0].text_start_offset + off;
 	return true;
 }
@@ -1083,10 +1487,7 @@ Ring::frozen_row_text_offset_to_column(row_t position,
 
 	/* count the number of characters for the given UTF-8 text offset */
 	off = offset->text_offset - records[0].text_start_offset;
-	num_chars = 0;
-	for (i = 0; i < off && i < buffer->len; i++) {
-		if ((buffer->str[i] & 0xC0) != 0x80) num_chars++;
-	}
+	num_chars = utf8_count_chars((uint8_t const*) buffer->str, MIN(off, buffer->len));
 
 	/* count the number of columns for the given number of characters */
 	for (i = 0, cell = row->cells; i < row->len; i++, cell++) {
@@ -1107,6 +1508,229 @@ Ring::frozen_row_text_offset_to_column(row_t position,
 }
 
 
+/* Starts rewrapping at @position, which should be the first row of a paragraph */
+bool
+Ring::rewrap_begin(RewrapCursor* cursor,
+                   row_t position)
+{
+	cursor->old_row = position;
+	cursor->new_rows = 0;
+	if (!read_row_record(&cursor->old_record, position))
+		return false;
+
+	cursor->attr_offset = cursor->old_record.attr_start_offset;
+	if (!_vte_stream_read(m_attr_stream, cursor->attr_offset, (char *) &cursor->attr_change, sizeof (cursor->attr_change))) {
+                _attrcpy(&cursor->attr_change.attr, &m_last_attr);
+                cursor->attr_change.attr.hyperlink_length = hyperlink_get(m_last_attr.hyperlink_idx)->len;
+		cursor->attr_change.text_end_offset = _vte_stream_head(m_text_stream);
+	}
+
+	return true;
+}
+
+/* Rewraps the paragraph starting at @cursor's row to @columns, appending the
+ * records of its new rows to @new_row_stream, where the first row written
+ * from @cursor will be at @new_row_base, and moves @cursor to the next one.
+ * The new rows of the @markers in this paragraph go to @new_markers. */
+bool
+Ring::rewrap_paragraph(RewrapCursor* cursor,
+                       column_t columns,
+                       VteStream* new_row_stream,
+                       row_t new_row_base,
+                       int num_markers,
+                       CellTextOffset const* marker_text_offsets,
+                       VteVisualPosition* new_markers)
+{
+	gboolean prev_record_was_soft_wrapped = FALSE;
+	gboolean paragraph_is_ascii = TRUE;
+	gsize paragraph_start_text_offset = cursor->old_record.text_start_offset;
+	gsize paragraph_end_text_offset = _vte_stream_head(m_text_stream);  /* initialized to silence gcc */
+	gsize paragraph_len;  /* excluding trailing '\n' */
+	gsize text_offset = paragraph_start_text_offset;
+	row_t old_row_index = cursor->old_row + 1;
+	CellAttrChange& attr_change = cursor->attr_change;
+	RowRecord new_record;
+	column_t col = 0;
+	int i;
+
+	auto next_attr = [&] {
+                cursor->attr_offset += sizeof (attr_change) + attr_change.attr.hyperlink_length + 2;
+		if (!_vte_stream_read(m_attr_stream, cursor->attr_offset, (char *) &attr_change, sizeof (attr_change))) {
+                        _attrcpy(&attr_change.attr, &m_last_attr);
+                        attr_change.attr.hyperlink_length = hyperlink_get(m_last_attr.hyperlink_idx)->len;
+			attr_change.text_end_offset = _vte_stream_head(m_text_stream);
+		}
+	};
+
+	/* Find the boundaries of the paragraph */
+	_vte_debug_print(VTE_DEBUG_RING,
+			"  Old paragraph:  row %lu  (text_offset %" G_GSIZE_FORMAT ")  up to (exclusive)  ",  /* no '\n' */
+                         cursor->old_row,
+                         paragraph_start_text_offset);
+	while (old_row_index <= m_end) {
+		prev_record_was_soft_wrapped = cursor->old_record.soft_wrapped;
+		paragraph_is_ascii = paragraph_is_ascii && cursor->old_record.is_ascii;
+		if (G_LIKELY (old_row_index < m_end)) {
+			if (!read_row_record(&cursor->old_record, old_row_index))
+				return false;
+			paragraph_end_text_offset = cursor->old_record.text_start_offset;
+		} else {
+			paragraph_end_text_offset = _vte_stream_head (m_text_stream);
+		}
+		old_row_index++;
+		if (!prev_record_was_soft_wrapped)
+			break;
+	}
+	cursor->old_row = old_row_index - 1;
+
+	paragraph_len = paragraph_end_text_offset - paragraph_start_text_offset;
+	if (!prev_record_was_soft_wrapped)  /* The last paragraph can be soft wrapped! */
+		paragraph_len--;  /* Strip trailing '\n' */
+	_vte_debug_print(VTE_DEBUG_RING,
+			"row %lu  (text_offset %" G_GSIZE_FORMAT ")%s  len %" G_GSIZE_FORMAT "  is_ascii %d\n",
+                         cursor->old_row,
+                         paragraph_end_text_offset,
+			prev_record_was_soft_wrapped ? "  soft_wrapped" : "",
+			paragraph_len, paragraph_is_ascii);
+
+	/* Wrap the paragraph */
+	if (attr_change.text_end_offset <= text_offset) {
+		/* Attr change at paragraph boundary, advance to next attr. */
+		next_attr();
+	}
+	memset(&new_record, 0, sizeof (new_record));
+	new_record.text_start_offset = text_offset;
+	new_record.attr_start_offset = cursor->attr_offset;
+	new_record.is_ascii = paragraph_is_ascii;
+
+	while (paragraph_len > 0) {
+		/* Wrap one continuous run of identical attributes within the paragraph. */
+		gsize runlength;  /* number of bytes we process in one run: identical attributes, within paragraph */
+		if (attr_change.text_end_offset <= text_offset) {
+			/* Attr change at line boundary, advance to next attr. */
+			next_attr();
+		}
+		runlength = MIN(paragraph_len, attr_change.text_end_offset - text_offset);
+
+		if (G_UNLIKELY (attr_change.attr.columns() == 0)) {
+			/* Combining characters all fit in the current row */
+			text_offset += runlength;
+			paragraph_len -= runlength;
+		} else {
+			while (runlength) {
+				if (col >= columns - attr_change.attr.columns() + 1) {
+					/* Wrap now, write the soft wrapped row's record */
+					new_record.soft_wrapped = 1;
+					_vte_stream_append(new_row_stream, (char const* ) &new_record, sizeof (new_record));
+					_vte_debug_print(VTE_DEBUG_RING,
+							"    New row %ld  text_offset %" G_GSIZE_FORMAT "  attr_offset %" G_GSIZE_FORMAT "  soft_wrapped\n",
+							new_row_base + cursor->new_rows,
+							new_record.text_start_offset, new_record.attr_start_offset);
+					for (i = 0; i < num_markers; i++) {
+						if (G_UNLIKELY (marker_text_offsets[i].text_offset >= new_record.text_start_offset &&
+								marker_text_offsets[i].text_offset < text_offset)) {
+							new_markers[i].row = new_row_base + cursor->new_rows;
+							_vte_debug_print(VTE_DEBUG_RING,
+									"      Marker #%d will be here in row %lu\n", i, new_row_base + cursor->new_rows);
+						}
+					}
+					cursor->new_rows++;
+					new_record.text_start_offset = text_offset;
+					new_record.attr_start_offset = cursor->attr_offset;
+					col = 0;
+				}
+				if (paragraph_is_ascii) {
+					/* Shortcut for quickly wrapping ASCII (excluding TAB) text.
+					   Don't read text_stream, and advance by a whole row of characters. */
+					int len = MIN(runlength, (gsize) (columns - col));
+					col += len;
+					text_offset += len;
+					paragraph_len -= len;
+					runlength -= len;
+				} else {
+					/* Advance by as many characters as fit in the row; within the run
+					   they all take the same number of columns, so it's a matter of
+					   counting UTF-8 characters in the text, read a block at a time. */
+					char textbuf[4096];
+					gsize textbuf_len = MIN(runlength, sizeof (textbuf));
+					gsize n_chars = (columns - col) / attr_change.attr.columns();
+					gsize len, last;
+					if (!_vte_stream_read(m_text_stream, text_offset, textbuf, textbuf_len))
+						return false;
+					if (textbuf_len < runlength) {
+						/* Leave the character that might be cut in half for the next block */
+						last = textbuf_len - 1;
+						while (last > 0 && (textbuf[last] & 0xC0) == 0x80)
+							last--;
+						if (last > 0)
+							textbuf_len = last;
+					}
+					len = utf8_skip_chars((uint8_t const*) textbuf, textbuf_len, &n_chars);
+					col += n_chars * attr_change.attr.columns();
+					text_offset += len;
+					paragraph_len -= len;
+					runlength -= len;
+				}
+			}
+		}
+	}
+
+	/* Write the record of the paragraph's last row. */
+	/* Hard wrapped, except maybe at the end of the very last paragraph */
+	new_record.soft_wrapped = prev_record_was_soft_wrapped;
+	_vte_stream_append(new_row_stream, (char const* ) &new_record, sizeof (new_record));
+	_vte_debug_print(VTE_DEBUG_RING,
+			"    New row %ld  text_offset %" G_GSIZE_FORMAT "  attr_offset %" G_GSIZE_FORMAT "\n",
+			new_row_base + cursor->new_rows,
+			new_record.text_start_offset, new_record.attr_start_offset);
+	for (i = 0; i < num_markers; i++) {
+		if (G_UNLIKELY (marker_text_offsets[i].text_offset >= new_record.text_start_offset &&
+				marker_text_offsets[i].text_offset < paragraph_end_text_offset)) {
+			new_markers[i].row = new_row_base + cursor->new_rows;
+			_vte_debug_print(VTE_DEBUG_RING,
+					"      Marker #%d will be here in row %lu\n", i, new_row_base + cursor->new_rows);
+		}
+	}
+	cursor->new_rows++;
+
+	return true;
+}
+
+/* Appends the @count records from @position on of the row stream @from to @to */
+bool
+Ring::copy_row_records(VteStream* from,
+                       row_t position,
+                       row_t count,
+                       VteStream* to)
+{
+	RowRecord records[64];
+
+	while (count > 0) {
+		row_t n = MIN(count, G_N_ELEMENTS(records));
+		if (!_vte_stream_read(from, position * sizeof (records[0]), (char *) records, n * sizeof (records[0])))
+			return false;
+		_vte_stream_append(to, (char const*) records, n * sizeof (records[0]));
+		position += n;
+		count -= n;
+	}
+
+	return true;
+}
+
+void
+Ring::rewrap_cancel()
+{
+	if (!m_rewrap_pending)
+		return;
+
+	_vte_debug_print(VTE_DEBUG_RING, "Cancelling the rewrapping of rows %lu to %lu.\n",
+			 m_start, m_rewrap_split);
+
+	m_rewrap_pending = false;
+	g_object_unref(m_rewrap_stream);
+	m_rewrap_stream = nullptr;
+}
+
 /**
  * Ring::rewrap:
  * @columns: new number of columns
@@ -1115,31 +1739,32 @@ Ring::frozen_row_text_offset_to_column(row_t position,
  * Reflow the @ring to match the new number of @columns.
  * For all @markers, find the cell at that position and update them to
  * reflect the cell's new position.
+ *
+ * Only the paragraphs from a screenful above the topmost marker on are
+ * rewrapped right away; the rows above them keep the old wrapping until
+ * rewrap_step() is done with them. A pending rewrap is cancelled, and its
+ * rows are left to the new one.
  */
 /* See ../doc/rewrap.txt for design and implementation details. */
 void
 Ring::rewrap(column_t columns,
              VteVisualPosition** markers)
 {
-	row_t old_row_index, new_row_index;
 	int i;
 	int num_markers = 0;
 	CellTextOffset *marker_text_offsets;
 	VteVisualPosition *new_markers;
-	RowRecord old_record;
-	CellAttrChange attr_change;
-	VteStream *new_row_stream;
-	gsize paragraph_start_text_offset;
-	gsize paragraph_end_text_offset;
-	gsize paragraph_len;  /* excluding trailing '\n' */
-	gsize attr_offset;
-	gsize old_ring_end;
+	VteStream *new_row_stream = nullptr;
+	RewrapCursor cursor;
+	RowRecord record;
+	row_t split, eager_rows, top_marker_row, old_ring_end;
 
 	if (G_UNLIKELY(length() == 0))
 		return;
 	_vte_debug_print(VTE_DEBUG_RING, "Ring before rewrapping:\n");
         validate();
-	new_row_stream = _vte_file_stream_new();
+
+	rewrap_cancel();
 
 	/* Freeze everything, because rewrapping is really complicated and we don't want to
 	   duplicate the code for frozen and thawed rows. */
@@ -1152,180 +1777,84 @@ Ring::rewrap(column_t columns,
 		num_markers++;
 	marker_text_offsets = (CellTextOffset *) g_malloc(num_markers * sizeof (marker_text_offsets[0]));
 	new_markers = (VteVisualPosition *) g_malloc(num_markers * sizeof (new_markers[0]));
+	top_marker_row = m_end;
 	for (i = 0; i < num_markers; i++) {
 		/* Convert visual column into byte offset */
 		if (!frozen_row_column_to_text_offset(markers[i]->row, markers[i]->col, &marker_text_offsets[i]))
 			goto err;
-		new_markers[i].row = new_markers[i].col = -1;
+		top_marker_row = MIN(top_marker_row, (row_t) MAX(markers[i]->row, (long) m_start));
 		_vte_debug_print(VTE_DEBUG_RING,
 				"Marker #%d old coords:  row %ld  col %ld  ->  text_offset %" G_GSIZE_FORMAT " fragment_cells %d  eol_cells %d\n",
 				i, markers[i]->row, markers[i]->col, marker_text_offsets[i].text_offset,
 				marker_text_offsets[i].fragment_cells, marker_text_offsets[i].eol_cells);
 	}
 
-	/* Prepare for rewrapping */
-	if (!read_row_record(&old_record, m_start))
-		goto err;
-	paragraph_start_text_offset = old_record.text_start_offset;
-	paragraph_end_text_offset = _vte_stream_head(m_text_stream);  /* initialized to silence gcc */
-	new_row_index = 0;
-
-	attr_offset = old_record.attr_start_offset;
-	if (!_vte_stream_read(m_attr_stream, attr_offset, (char *) &attr_change, sizeof (attr_change))) {
-                _attrcpy(&attr_change.attr, &m_last_attr);
-                attr_change.attr.hyperlink_length = hyperlink_get(m_last_attr.hyperlink_idx)->len;
-		attr_change.text_end_offset = _vte_stream_head(m_text_stream);
-	}
-
-	old_row_index = m_start + 1;
-	while (paragraph_start_text_offset < _vte_stream_head(m_text_stream)) {
-		/* Find the boundaries of the next paragraph */
-		gboolean prev_record_was_soft_wrapped = FALSE;
-		gboolean paragraph_is_ascii = TRUE;
-		gsize text_offset = paragraph_start_text_offset;
-		RowRecord new_record;
-		column_t col = 0;
-
-		_vte_debug_print(VTE_DEBUG_RING,
-				"  Old paragraph:  row %lu  (text_offset %" G_GSIZE_FORMAT ")  up to (exclusive)  ",  /* no '\n' */
-                                 old_row_index - 1,
-                                 paragraph_start_text_offset);
-		while (old_row_index <= m_end) {
-			prev_record_was_soft_wrapped = old_record.soft_wrapped;
-			paragraph_is_ascii = paragraph_is_ascii && old_record.is_ascii;
-			if (G_LIKELY (old_row_index < m_end)) {
-				if (!read_row_record(&old_record, old_row_index))
-					goto err;
-				paragraph_end_text_offset = old_record.text_start_offset;
-			} else {
-				paragraph_end_text_offset = _vte_stream_head (m_text_stream);
-			}
-			old_row_index++;
-			if (!prev_record_was_soft_wrapped)
+	/* Rewrap the paragraphs from a screenful above the topmost marker on. If
+	   at the new width they don't make a screenful above every marker, in
+	   case the viewport is there, start further up, until the top. */
+	eager_rows = MAX(m_visible_rows, kRewrapMinEagerRows);
+	for (;;) {
+		bool covered = true;
+
+		split = top_marker_row - MIN(eager_rows, top_marker_row - m_start);
+		while (split > m_start) {
+			if (!read_row_record(&record, split - 1))
+				goto err;
+			if (!record.soft_wrapped)
 				break;
+			split--;
 		}
 
-		paragraph_len = paragraph_end_text_offset - paragraph_start_text_offset;
-		if (!prev_record_was_soft_wrapped)  /* The last paragraph can be soft wrapped! */
-			paragraph_len--;  /* Strip trailing '\n' */
-		_vte_debug_print(VTE_DEBUG_RING,
-				"row %lu  (text_offset %" G_GSIZE_FORMAT ")%s  len %" G_GSIZE_FORMAT "  is_ascii %d\n",
-                                 old_row_index - 1,
-                                 paragraph_end_text_offset,
-				prev_record_was_soft_wrapped ? "  soft_wrapped" : "",
-				paragraph_len, paragraph_is_ascii);
-
-		/* Wrap the paragraph */
-		if (attr_change.text_end_offset <= text_offset) {
-			/* Attr change at paragraph boundary, advance to next attr. */
-                        attr_offset += sizeof (attr_change) + attr_change.attr.hyperlink_length + 2;
-			if (!_vte_stream_read(m_attr_stream, attr_offset, (char *) &attr_change, sizeof (attr_change))) {
-                                _attrcpy(&attr_change.attr, &m_last_attr);
-                                attr_change.attr.hyperlink_length = hyperlink_get(m_last_attr.hyperlink_idx)->len;
-				attr_change.text_end_offset = _vte_stream_head(m_text_stream);
-			}
-		}
-		memset(&new_record, 0, sizeof (new_record));
-		new_record.text_start_offset = text_offset;
-		new_record.attr_start_offset = attr_offset;
-		new_record.is_ascii = paragraph_is_ascii;
-
-		while (paragraph_len > 0) {
-			/* Wrap one continuous run of identical attributes within the paragraph. */
-			gsize runlength;  /* number of bytes we process in one run: identical attributes, within paragraph */
-			if (attr_change.text_end_offset <= text_offset) {
-				/* Attr change at line boundary, advance to next attr. */
-                                attr_offset += sizeof (attr_change) + attr_change.attr.hyperlink_length + 2;
-				if (!_vte_stream_read(m_attr_stream, attr_offset, (char *) &attr_change, sizeof (attr_change))) {
-                                        _attrcpy(&attr_change.attr, &m_last_attr);
-                                        attr_change.attr.hyperlink_length = hyperlink_get(m_last_attr.hyperlink_idx)->len;
-					attr_change.text_end_offset = _vte_stream_head(m_text_stream);
-				}
-			}
-			runlength = MIN(paragraph_len, attr_change.text_end_offset - text_offset);
-
-			if (G_UNLIKELY (attr_change.attr.columns() == 0)) {
-				/* Combining characters all fit in the current row */
-				text_offset += runlength;
-				paragraph_len -= runlength;
-			} else {
-				while (runlength) {
-					if (col >= columns - attr_change.attr.columns() + 1) {
-						/* Wrap now, write the soft wrapped row's record */
-						new_record.soft_wrapped = 1;
-						_vte_stream_append(new_row_stream, (char const* ) &new_record, sizeof (new_record));
-						_vte_debug_print(VTE_DEBUG_RING,
-								"    New row %ld  text_offset %" G_GSIZE_FORMAT "  attr_offset %" G_GSIZE_FORMAT "  soft_wrapped\n",
-								new_row_index,
-								new_record.text_start_offset, new_record.attr_start_offset);
-						for (i = 0; i < num_markers; i++) {
-							if (G_UNLIKELY (marker_text_offsets[i].text_offset >= new_record.text_start_offset &&
-									marker_text_offsets[i].text_offset < text_offset)) {
-								new_markers[i].row = new_row_index;
-								_vte_debug_print(VTE_DEBUG_RING,
-										"      Marker #%d will be here in row %lu\n", i, new_row_index);
-							}
-						}
-						new_row_index++;
-						new_record.text_start_offset = text_offset;
-						new_record.attr_start_offset = attr_offset;
-						col = 0;
-					}
-					if (paragraph_is_ascii) {
-						/* Shortcut for quickly wrapping ASCII (excluding TAB) text.
-						   Don't read text_stream, and advance by a whole row of characters. */
-						int len = MIN(runlength, (gsize) (columns - col));
-						col += len;
-						text_offset += len;
-						paragraph_len -= len;
-						runlength -= len;
-					} else {
-						/* Process one character only. */
-						char textbuf[6];  /* fits at least one UTF-8 character */
-						int textbuf_len;
-						col += attr_change.attr.columns();
-						/* Find beginning of next UTF-8 character */
-						text_offset++; paragraph_len--; runlength--;
-						textbuf_len = MIN(runlength, sizeof (textbuf));
-						if (!_vte_stream_read(m_text_stream, text_offset, textbuf, textbuf_len))
-							goto err;
-						for (i = 0; i < textbuf_len && (textbuf[i] & 0xC0) == 0x80; i++) {
-							text_offset++; paragraph_len--; runlength--;
-						}
-					}
-				}
-			}
+		new_row_stream = new_stream();
+		if (!rewrap_begin(&cursor, split))
+			goto err;
+		for (i = 0; i < num_markers; i++)
+			new_markers[i].row = new_markers[i].col = -1;
+		while (cursor.old_row < m_end) {
+			if (!rewrap_paragraph(&cursor, columns, new_row_stream, split,
+					      num_markers, marker_text_offsets, new_markers))
+				goto err;
 		}
 
-		/* Write the record of the paragraph's last row. */
-		/* Hard wrapped, except maybe at the end of the very last paragraph */
-		new_record.soft_wrapped = prev_record_was_soft_wrapped;
-		_vte_stream_append(new_row_stream, (char const* ) &new_record, sizeof (new_record));
-		_vte_debug_print(VTE_DEBUG_RING,
-				"    New row %ld  text_offset %" G_GSIZE_FORMAT "  attr_offset %" G_GSIZE_FORMAT "\n",
-				new_row_index,
-				new_record.text_start_offset, new_record.attr_start_offset);
 		for (i = 0; i < num_markers; i++) {
-			if (G_UNLIKELY (marker_text_offsets[i].text_offset >= new_record.text_start_offset &&
-					marker_text_offsets[i].text_offset < paragraph_end_text_offset)) {
-				new_markers[i].row = new_row_index;
-				_vte_debug_print(VTE_DEBUG_RING,
-						"      Marker #%d will be here in row %lu\n", i, new_row_index);
-			}
+			/* Markers beyond the ring end up below all of it */
+			row_t row = new_markers[i].row != -1 ? new_markers[i].row : split + cursor.new_rows;
+			if (row - split < m_visible_rows)
+				covered = false;
 		}
-		new_row_index++;
-		paragraph_start_text_offset = paragraph_end_text_offset;
+		if (covered || split == m_start)
+			break;
+
+		g_object_unref(new_row_stream);
+		new_row_stream = nullptr;
+		eager_rows *= 2;
 	}
 
+	_vte_debug_print(VTE_DEBUG_RING,
+			"Rewrapped rows %lu to %lu into %lu rows, rows %lu to %lu left for later.\n",
+			split, m_end, cursor.new_rows, m_start, split);
+
 	/* Update the ring. */
 	old_ring_end = m_end;
-	g_object_unref(m_row_stream);
-	m_row_stream = new_row_stream;
-	m_writable = m_end = new_row_index;
-	m_start = 0;
-	if (m_end > m_max)
+	_vte_stream_truncate(m_row_stream, split * sizeof (record));
+	if (!copy_row_records(new_row_stream, 0, cursor.new_rows, m_row_stream))
+		goto err;
+	g_object_unref(new_row_stream);
+	new_row_stream = nullptr;
+
+	m_writable = m_end = split + cursor.new_rows;
+	if (m_end - m_start > m_max)
 		m_start = m_end - m_max;
-	m_cached_row_num = (row_t) -1;
+	thaw_cache_clear();
+
+	if (m_start < split) {
+		m_rewrap_pending = true;
+		m_rewrap_split = split;
+		m_rewrap_columns = columns;
+		m_rewrap_stream = new_stream();
+		if (!rewrap_begin(&m_rewrap_cursor, m_start))
+			rewrap_cancel();
+	}
 
 	/* Find the markers. This requires that the ring is already updated. */
 	for (i = 0; i < num_markers; i++) {
@@ -1355,11 +1884,124 @@ err:
 			"Error while rewrapping\n");
 	g_assert_not_reached();
 #endif
-	g_object_unref(new_row_stream);
+	if (new_row_stream != nullptr)
+		g_object_unref(new_row_stream);
 	g_free(marker_text_offsets);
 	g_free(new_markers);
 }
 
+/**
+ * Ring::rewrap_step:
+ * @deadline: the monotonic time at which to stop
+ * @split: (out): the first row that rewrap() already rewrapped
+ * @shift: (out): how many rows the rows from @split on moved down
+ *
+ * Goes on rewrapping the rows that rewrap() left with the old wrapping,
+ * until done or @deadline has passed. When done, these rows are replaced
+ * with the rewrapped ones, which can be more or fewer: the rows from @split
+ * on keep their positions and the start of the ring moves, unless there
+ * isn't room above them, in which case they move down by @shift.
+ *
+ * Returns: %true if there's nothing left to do
+ */
+bool
+Ring::rewrap_step(gint64 deadline,
+                  row_t* split,
+                  row_t* shift)
+{
+	RowRecord record;
+	VteStream *new_row_stream;
+	gsize text_tail;
+	row_t skip, count, start, low, high;
+	unsigned int n;
+
+	*split = m_rewrap_split;
+	*shift = 0;
+
+	if (!m_rewrap_pending)
+		return true;
+
+	/* Rows might have been scrolled out meanwhile; start over below them */
+	if (m_start >= m_rewrap_split) {
+		rewrap_cancel();
+		return true;
+	}
+	if (m_rewrap_cursor.old_row < m_start) {
+		_vte_stream_reset(m_rewrap_stream, 0);
+		if (!rewrap_begin(&m_rewrap_cursor, m_start)) {
+			rewrap_cancel();
+			return true;
+		}
+	}
+
+	for (n = 1; m_rewrap_cursor.old_row < m_rewrap_split; n++) {
+		if (!rewrap_paragraph(&m_rewrap_cursor, m_rewrap_columns, m_rewrap_stream, 0,
+				      0, nullptr, nullptr)) {
+			rewrap_cancel();
+			return true;
+		}
+		if (n % 64 == 0 && g_get_monotonic_time() >= deadline)
+			return false;
+	}
+
+	/* Skip the new rows whose text was scrolled out meanwhile */
+	if (!read_row_record(&record, m_start)) {
+		rewrap_cancel();
+		return true;
+	}
+	text_tail = record.text_start_offset;
+	low = 0;
+	high = m_rewrap_cursor.new_rows;
+	while (low < high) {
+		row_t mid = low + (high - low) / 2;
+		if (!_vte_stream_read(m_rewrap_stream, mid * sizeof (record), (char *) &record, sizeof (record))) {
+			rewrap_cancel();
+			return true;
+		}
+		if (record.text_start_offset < text_tail)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	skip = low;
+	count = m_rewrap_cursor.new_rows - skip;
+
+	start = count <= m_rewrap_split ? m_rewrap_split - count : 0;
+	new_row_stream = new_stream();
+	_vte_stream_reset(new_row_stream, start * sizeof (record));
+	if (!copy_row_records(m_rewrap_stream, skip, count, new_row_stream) ||
+	    !copy_row_records(m_row_stream, m_rewrap_split, m_writable - m_rewrap_split, new_row_stream)) {
+		g_object_unref(new_row_stream);
+		rewrap_cancel();
+		return true;
+	}
+
+	_vte_debug_print(VTE_DEBUG_RING,
+			"Rewrapped rows %lu to %lu into %lu rows.\n",
+			m_start, m_rewrap_split, count);
+
+	*shift = start + count - m_rewrap_split;
+	g_object_unref(m_row_stream);
+	m_row_stream = new_row_stream;
+	m_start = start;
+	m_writable += *shift;
+	m_end += *shift;
+	m_slot_offset -= *shift;
+	if (length() > m_max) {
+		m_start = m_end - m_max;
+		if (m_start >= m_writable) {
+			reset_streams(m_writable);
+			m_writable = m_start;
+		}
+	}
+
+	rewrap_cancel();
+	thaw_cache_clear();
+
+	validate();
+	return true;
+}
+
 
 bool
 Ring::write_row(GOutputStream* stream,
@@ -28,7 +28,10 @@
 #include "vterowdata.hh"
 #include "vtestream.h"
 
+#include <string_view>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 typedef struct _VteVisualPosition {
 	long row, col;
@@ -50,10 +53,41 @@ public:
 
         static const row_t kDefaultMaxRows = VTE_SCROLLBACK_INIT;
 
+        /* The thaw cache holds this many screenfuls of frozen rows... */
+        static const row_t kThawCacheScreens = 3;
+        /* ... but at least this many rows */
+        static const row_t kThawCacheMinRows = 32;
+        /* Blocks of the text stream to keep decoded; the text of a block
+         * spans fewer rows than the attributes or the row records do. */
+        static const unsigned kTextStreamCacheBlocks = 8;
+        /* Allocate at least this many new hyperlink idxs between GCs */
+        static const hyperlink_idx_t kHyperlinkGCMinAllocations = 256;
+        /* rewrap() rewraps at least this many rows above the topmost
+         * marker right away, or a screenful if that is more */
+        static const row_t kRewrapMinEagerRows = 32;
+
+        struct ThawCacheStats {
+                guint64 hits;
+                guint64 misses;
+                guint64 evictions;
+                guint64 invalidations;
+        };
+
+        /* Where the frozen rows are kept */
+        enum class StreamBackend {
+                eFile,    /* compressed and encrypted, in an unlinked temporary file */
+                eMemory,  /* compressed, in memory */
+        };
+
         Ring(row_t max_rows = kDefaultMaxRows,
-             bool has_streams = false);
+             bool has_streams = false,
+             StreamBackend stream_backend = default_stream_backend());
         ~Ring();
 
+        /* The backend of the rings created with streams from now on, unless given */
+        static StreamBackend default_stream_backend();
+        static void set_default_stream_backend(StreamBackend backend);
+
         // prevent accidents
         Ring(Ring& o) = delete;
         Ring(Ring const& o) = delete;
@@ -88,15 +122,35 @@ public:
         VteRowData* insert(row_t position);
         VteRowData* append();
         void remove(row_t position);
+        void rotate_region(row_t start,
+                           row_t end /* inclusive */,
+                           long n);
         void drop_scrollback(row_t position);
         void set_visible_rows(row_t rows);
         void rewrap(column_t columns,
                     VteVisualPosition** markers);
+        inline bool rewrap_pending() const { return m_rewrap_pending; }
+        bool rewrap_step(gint64 deadline,
+                         row_t* split,
+                         row_t* shift);
         bool write_contents(GOutputStream* stream,
                             VteWriteFlags flags,
                             GCancellable* cancellable,
                             GError** error);
 
+        inline ThawCacheStats const& thaw_cache_stats() const { return m_thaw_cache_stats; }
+        VteStreamCacheStats stream_cache_stats() const;
+
+        /* The scrollback that is frozen into the streams, and can be dropped */
+        inline row_t frozen_rows() const { return m_writable - m_start; }
+        row_t drop_frozen_rows(row_t count);
+
+        /* What the ring takes: the writable rows in memory, and the frozen
+         * rows in the streams, which are on disk unless the backend is eMemory */
+        size_t writable_bytes() const;
+        size_t stream_bytes() const;
+        inline StreamBackend stream_backend() const { return m_stream_backend; }
+
 private:
 
         #ifdef VTE_DEBUG
@@ -105,7 +159,8 @@ private:
 
         inline GString* hyperlink_get(hyperlink_idx_t idx) const { return (GString*)g_ptr_array_index(m_hyperlinks, idx); }
 
-        inline VteRowData* get_writable_index(row_t position) const { return &m_array[position & m_mask]; }
+        inline row_t slot(row_t position) const { return (position + m_slot_offset) & m_mask; }
+        inline VteRowData* get_writable_index(row_t position) const { return &m_array[m_slots[slot(position)]]; }
 
         void hyperlink_gc();
         hyperlink_idx_t get_hyperlink_idx_no_update_current(char const* hyperlink);
@@ -165,6 +220,11 @@ private:
 
         void ensure_writable(row_t position);
         void ensure_writable_room();
+        void move_slots(row_t from,
+                        row_t to,
+                        row_t count);
+        void reverse_slots(row_t from,
+                           row_t to /* exclusive */);
 
         void freeze_one_row();
         void maybe_freeze_one_row();
@@ -180,6 +240,47 @@ private:
                       int hyperlink_column,
                       char const** hyperlink);
         void reset_streams(row_t position);
+        VteStream* new_stream() const;
+
+        /* Where rewrapping is at, see rewrap_paragraph() */
+        typedef struct _RewrapCursor {
+                row_t old_row;                /* the first row of the next paragraph */
+                row_t new_rows;               /* the number of rows written so far */
+                RowRecord old_record;         /* the record of old_row */
+                size_t attr_offset;
+                CellAttrChange attr_change;
+        } RewrapCursor;
+
+        bool rewrap_begin(RewrapCursor* cursor,
+                          row_t position);
+        bool rewrap_paragraph(RewrapCursor* cursor,
+                              column_t columns,
+                              VteStream* new_row_stream,
+                              row_t new_row_base,
+                              int num_markers,
+                              CellTextOffset const* marker_text_offsets,
+                              VteVisualPosition* new_markers);
+        bool copy_row_records(VteStream* from,
+                              row_t position,
+                              row_t count,
+                              VteStream* to);
+        void rewrap_cancel();
+
+        typedef struct _ThawedRow {
+                VteRowData row;
+                row_t position;           /* (row_t)-1 if unused */
+                bool has_hyperlinks;      /* depends on the hover idx */
+                struct _ThawedRow* prev;  /* more recently used */
+                struct _ThawedRow* next;  /* less recently used */
+        } ThawedRow;
+
+        void thaw_cache_resize(row_t size);
+        void thaw_cache_use(ThawedRow* entry);
+        void thaw_cache_remove(ThawedRow* entry);
+        void thaw_cache_invalidate(row_t position);
+        void thaw_cache_invalidate_hyperlinks();
+        void thaw_cache_clear();
+        void set_hyperlink_hover_idx(hyperlink_idx_t idx);
 
 	row_t m_max;
 	row_t m_start{0};
@@ -190,6 +291,15 @@ private:
         row_t m_mask{31};
 	VteRowData *m_array;
 
+        /* The writable rows are stored in m_array, in no particular order:
+         * the row at position is m_array[m_slots[slot(position)]]. Inserting
+         * or removing a row then only moves the 32-bit slots, and only those
+         * on the shorter side of the position, adjusting m_slot_offset when
+         * the rows before the position are the ones that move.
+         */
+        guint32* m_slots;
+        row_t m_slot_offset{0};
+
         /* Storage:
          *
          * row_stream contains records of VteRowRecord for each physical row.
@@ -205,16 +315,38 @@ private:
          *  - 2 bytes repeating attr.hyperlink_length so that we can walk backwards.
          */
 	bool m_has_streams;
+	StreamBackend m_stream_backend;
 	VteStream *m_attr_stream, *m_text_stream, *m_row_stream;
 	size_t m_last_attr_text_start_offset{0};
 	VteCellAttr m_last_attr;
 	GString *m_utf8_buffer;
 
-	VteRowData m_cached_row;
-	row_t m_cached_row_num{(row_t)-1};
+        /* Recently thawed frozen rows, for index(). The entries are kept
+         * in a list from the most to the least recently used, unused ones
+         * last, and found by position in m_thaw_cache_map.
+         */
+        ThawedRow* m_thaw_cache{nullptr};
+        row_t m_thaw_cache_size{0};
+        ThawedRow* m_thaw_cache_mru{nullptr};
+        ThawedRow* m_thaw_cache_lru{nullptr};
+        std::unordered_map<row_t, ThawedRow*> m_thaw_cache_map;
+        ThawCacheStats m_thaw_cache_stats{};
+
+        VteRowData m_hyperlink_row;  /* scratch row for get_hyperlink_at_position() */
 
         row_t m_visible_rows{0};  /* to keep at least a screenful of lines in memory, bug 646098 comment 12 */
 
+        /* Lazy rewrapping: the rows from m_rewrap_split on are wrapped to
+         * the new width, those before it keep the old wrapping until
+         * rewrap_step() has rewrapped them into m_rewrap_stream, see
+         * ../doc/rewrap.txt
+         */
+        bool m_rewrap_pending{false};
+        row_t m_rewrap_split{0};
+        column_t m_rewrap_columns{0};
+        VteStream* m_rewrap_stream{nullptr};
+        RewrapCursor m_rewrap_cursor;
+
         GPtrArray *m_hyperlinks;  /* The hyperlink pool. Contains GString* items.
                                    [0] points to an empty GString, [1] to [VTE_HYPERLINK_COUNT_MAX] contain the id;uri pairs. */
         char m_hyperlink_buf[VTE_HYPERLINK_TOTAL_LENGTH_MAX + 1];  /* One more hyperlink buffer to get the value if it's not placed in the pool. */
@@ -224,6 +356,13 @@ private:
         hyperlink_idx_t m_hyperlink_hover_idx{0};  /* The hyperlink idx of the hovered cell.
                                                  An idx is allocated on hover even if the cell is scrolled out to the streams. */
         row_t m_hyperlink_maybe_gc_counter{0};  /* Do a GC when it reaches 65536. */
+        std::unordered_map<std::string_view, hyperlink_idx_t> m_hyperlink_map;  /* The idx of each id;uri in the pool.
+                                                                                The keys point into the pool's GStrings. */
+        std::vector<hyperlink_idx_t> m_hyperlink_free_idxs;  /* The pool's empty slots, to be reused. */
+        std::vector<guint8> m_hyperlink_gc_used;  /* The GC's bitmap of the idxs in use, kept to be reused. */
+        hyperlink_idx_t m_hyperlink_allocs_since_gc{0};
+        hyperlink_idx_t m_hyperlink_gc_allocs{kHyperlinkGCMinAllocations};  /* Do a GC before allocating more new idxs than this,
+                                                                             which is as many as were in use after the last one. */
 };
 
 }; /* namespace base */
@@ -251,6 +390,7 @@ static inline void _vte_ring_shrink (VteRing *ring, gulong max_len) { ring->shri
 static inline VteRowData *_vte_ring_insert (VteRing *ring, gulong position) { return ring->insert(position); }
 static inline VteRowData *_vte_ring_append (VteRing *ring) { return ring->append(); }
 static inline void _vte_ring_remove (VteRing *ring, gulong position) { ring->remove(position); }
+static inline void _vte_ring_rotate_region (VteRing *ring, gulong start, gulong end, glong n) { ring->rotate_region(start, end, n); }
 static inline void _vte_ring_drop_scrollback (VteRing *ring, gulong position) { ring->drop_scrollback(position); }
 static inline void _vte_ring_set_visible_rows (VteRing *ring, gulong rows) { ring->set_visible_rows(rows); }
 static inline void _vte_ring_rewrap (VteRing *ring, glong columns, VteVisualPosition **markers) { ring->rewrap(columns, markers); }
@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Counts and skips the UTF-8 characters of rows of ASCII, and of mostly
+ * ASCII, text, the way rewrapping and the marker conversions of the ring
+ * do, with each implementation, and reports the throughput, with memcpy()
+ * of the same text for comparison.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "scan.hh"
+
+using namespace vte::base;
+
+/* Rows of @columns characters, of which every @every-th one is not ASCII */
+static std::string
+make_text(size_t size,
+          size_t columns,
+          size_t every)
+{
+        static char const* const chars[] = { "\xc3\xa9", "\xe2\x82\xac", "\xe4\xb8\x80" };
+
+        std::string text;
+        size_t i = 0;
+        while (text.size() < size) {
+                if (i % columns == columns - 1)
+                        text += '\n';
+                else if (every != 0 && i % every == every - 1)
+                        text += chars[i / every % G_N_ELEMENTS(chars)];
+                else
+                        text += char('a' + i % 26);
+                ++i;
+        }
+        return text;
+}
+
+template<class F>
+static double
+throughput(std::string const& text,
+           size_t n_times,
+           F&& func)
+{
+        auto const data = reinterpret_cast<uint8_t const*>(text.data());
+        size_t sum = 0;
+
+        auto const start_time = g_get_monotonic_time();
+        for (size_t i = 0; i < n_times; i++)
+                sum += func(data, text.size());
+        auto const elapsed = g_get_monotonic_time() - start_time;
+
+        /* Keep the result alive */
+        if (sum == size_t(-1))
+                g_print("%" G_GSIZE_FORMAT "\n", sum);
+
+        return double(text.size()) * double(n_times) / double(std::max(elapsed, gint64{1})) / 1000.;
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        int size = 1 << 20;
+        int n_times = 200;
+        int columns = 200;
+        GOptionEntry const entries[] = {
+                { "size", 's', 0, G_OPTION_ARG_INT, &size,
+                  "Size of the text", "BYTES" },
+                { "times", 'n', 0, G_OPTION_ARG_INT, &n_times,
+                  "Number of times to scan it", "TIMES" },
+                { "columns", 'c', 0, G_OPTION_ARG_INT, &columns,
+                  "Length of the rows", "COLUMNS" },
+                { nullptr },
+        };
+
+        auto context = g_option_context_new("— UTF-8 scanning benchmark");
+        g_option_context_add_main_entries(context, entries, nullptr);
+
+        GError* error = nullptr;
+        auto rv = g_option_context_parse(context, &argc, &argv, &error);
+        g_option_context_free(context);
+        if (!rv) {
+                g_printerr("Failed to parse arguments: %s\n", error->message);
+                g_error_free(error);
+                return EXIT_FAILURE;
+        }
+
+        size = std::max(size, 64);
+        n_times = std::max(n_times, 1);
+        columns = std::max(columns, 2);
+
+        typedef size_t (* CountFunc)(uint8_t const*, size_t);
+        typedef size_t (* SkipFunc)(uint8_t const*, size_t, size_t*);
+        struct {
+                char const* name;
+                CountFunc count;
+                SkipFunc skip;
+        } const impls[] = {
+                { "scalar", scan_impl::utf8_count_chars_scalar, scan_impl::utf8_skip_chars_scalar },
+#ifdef VTE_SCAN_HAVE_SSE2
+                { "sse2", scan_impl::utf8_count_chars_sse2, scan_impl::utf8_skip_chars_sse2 },
+#endif
+#ifdef VTE_SCAN_HAVE_AVX2
+                { "avx2", scan_impl::have_avx2() ? scan_impl::utf8_count_chars_avx2 : nullptr,
+                  scan_impl::utf8_skip_chars_avx2 },
+#endif
+        };
+
+        struct {
+                char const* name;
+                size_t every;
+        } const texts[] = {
+                { "ascii", 0 },
+                { "1/20", 20 },
+                { "1/2", 2 },
+        };
+
+        g_print("%-8s %-8s %12s %12s\n", "text", "impl", "count", "skip");
+        for (auto const& t : texts) {
+                auto const text = make_text(size, columns, t.every);
+                std::vector<char> copy(text.size());
+
+                for (auto const& impl : impls) {
+                        if (impl.count == nullptr)
+                                continue;
+
+                        auto const count = throughput(text, n_times, impl.count);
+                        /* Skip a row's worth of characters at a time, as rewrapping does */
+                        auto const skip = throughput(text, n_times, [&](uint8_t const* data, size_t len) {
+                                        size_t offset = 0, n = 0;
+                                        while (offset < len) {
+                                                size_t n_chars = columns;
+                                                offset += impl.skip(data + offset, len - offset, &n_chars);
+                                                n += n_chars;
+                                        }
+                                        return n;
+                                });
+
+                        g_print("%-8s %-8s %7.2f GB/s %7.2f GB/s\n",
+                                t.name, impl.name, count, skip);
+                }
+
+                auto const memcpy_rate = throughput(text, n_times, [&](uint8_t const* data, size_t len) {
+                                memcpy(copy.data(), data, len);
+                                return size_t(copy[len / 2]);
+                        });
+                g_print("%-8s %-8s %7.2f GB/s\n", t.name, "memcpy", memcpy_rate);
+        }
+
+        return EXIT_SUCCESS;
+}
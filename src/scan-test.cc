@@ -0,0 +1,230 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "scan.hh"
+
+#include <cstring>
+#include <vector>
+
+#include <glib.h>
+
+using namespace vte::base;
+
+typedef size_t (* RunFunc)(uint8_t const*, size_t);
+
+static void
+check_printable_ascii_run(RunFunc func)
+{
+        uint8_t buf[200];
+
+        /* Every byte value, at every position and alignment */
+        for (auto c = 0; c < 0x100; ++c) {
+                auto const printable = c >= 0x20 && c < 0x7f;
+
+                for (auto pos = 0u; pos < 80; ++pos) {
+                        for (auto offset = 0u; offset < 4; ++offset) {
+                                memset(buf, 'x', sizeof(buf));
+                                buf[offset + pos] = uint8_t(c);
+
+                                auto const len = sizeof(buf) - offset;
+                                g_assert_cmpuint(func(buf + offset, len), ==, printable ? len : pos);
+                        }
+                }
+        }
+
+        /* Short and empty input */
+        memset(buf, 'x', sizeof(buf));
+        for (auto len = 0u; len < 70; ++len)
+                g_assert_cmpuint(func(buf, len), ==, len);
+
+        /* Bytes past the end are not looked at */
+        buf[40] = '\n';
+        g_assert_cmpuint(func(buf, 40), ==, 40);
+        g_assert_cmpuint(func(buf, 41), ==, 40);
+}
+
+typedef size_t (* CountFunc)(uint8_t const*, size_t);
+typedef size_t (* SkipFunc)(uint8_t const*, size_t, size_t*);
+
+/* ASCII, and 2, 3 and 4 byte characters, with runs of each longer than a vector */
+static size_t
+make_utf8(uint8_t* buf,
+          size_t size,
+          std::vector<size_t>& starts)
+{
+        static char const* const chars[] = { "a", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80" };
+
+        size_t len = 0;
+        starts.clear();
+        for (auto i = 0u; ; ++i) {
+                auto const c = chars[(i / 37 + i % 5) % 4];
+                auto const n = strlen(c);
+                if (len + n > size)
+                        break;
+                starts.push_back(len);
+                memcpy(buf + len, c, n);
+                len += n;
+        }
+        return len;
+}
+
+static void
+check_utf8_count_chars(CountFunc func)
+{
+        uint8_t buf[300];
+        std::vector<size_t> starts;
+        auto const len = make_utf8(buf, sizeof(buf), starts);
+
+        /* Every prefix, from every character */
+        for (auto first = 0u; first < starts.size(); ++first) {
+                auto const start = starts[first];
+                for (auto end = first; end <= starts.size(); ++end) {
+                        auto const stop = end < starts.size() ? starts[end] : len;
+                        g_assert_cmpuint(func(buf + start, stop - start), ==, end - first);
+                }
+        }
+
+        g_assert_cmpuint(func(buf, 0), ==, 0);
+}
+
+static void
+check_utf8_skip_chars(SkipFunc func)
+{
+        uint8_t buf[300];
+        std::vector<size_t> starts;
+        auto const len = make_utf8(buf, sizeof(buf), starts);
+
+        for (auto first = 0u; first < starts.size(); first += 3) {
+                auto const start = starts[first];
+                auto const n_left = starts.size() - first;
+
+                for (auto n = 0u; n < n_left + 3; ++n) {
+                        size_t n_chars = n;
+                        auto const offset = func(buf + start, len - start, &n_chars);
+                        if (n < n_left) {
+                                g_assert_cmpuint(n_chars, ==, n);
+                                g_assert_cmpuint(start + offset, ==, starts[first + n]);
+                        } else {
+                                g_assert_cmpuint(n_chars, ==, n_left);
+                                g_assert_cmpuint(start + offset, ==, len);
+                        }
+                }
+        }
+
+        /* Bytes past the end are not looked at */
+        size_t n_chars = 100;
+        g_assert_cmpuint(func(buf, 0, &n_chars), ==, 0);
+        g_assert_cmpuint(n_chars, ==, 0);
+}
+
+static void
+test_scan_printable_ascii_run_scalar(void)
+{
+        check_printable_ascii_run(scan_impl::printable_ascii_run_scalar);
+}
+
+#ifdef VTE_SCAN_HAVE_SSE2
+static void
+test_scan_printable_ascii_run_sse2(void)
+{
+        check_printable_ascii_run(scan_impl::printable_ascii_run_sse2);
+}
+#endif
+
+#ifdef VTE_SCAN_HAVE_AVX2
+static void
+test_scan_printable_ascii_run_avx2(void)
+{
+        if (!scan_impl::have_avx2()) {
+                g_test_skip("AVX2 not supported");
+                return;
+        }
+
+        check_printable_ascii_run(scan_impl::printable_ascii_run_avx2);
+}
+#endif
+
+static void
+test_scan_printable_ascii_run(void)
+{
+        check_printable_ascii_run(printable_ascii_run);
+}
+
+static void
+test_scan_utf8_scalar(void)
+{
+        check_utf8_count_chars(scan_impl::utf8_count_chars_scalar);
+        check_utf8_skip_chars(scan_impl::utf8_skip_chars_scalar);
+}
+
+#ifdef VTE_SCAN_HAVE_SSE2
+static void
+test_scan_utf8_sse2(void)
+{
+        check_utf8_count_chars(scan_impl::utf8_count_chars_sse2);
+        check_utf8_skip_chars(scan_impl::utf8_skip_chars_sse2);
+}
+#endif
+
+#ifdef VTE_SCAN_HAVE_AVX2
+static void
+test_scan_utf8_avx2(void)
+{
+        if (!scan_impl::have_avx2()) {
+                g_test_skip("AVX2 not supported");
+                return;
+        }
+
+        check_utf8_count_chars(scan_impl::utf8_count_chars_avx2);
+        check_utf8_skip_chars(scan_impl::utf8_skip_chars_avx2);
+}
+#endif
+
+static void
+test_scan_utf8(void)
+{
+        check_utf8_count_chars(utf8_count_chars);
+        check_utf8_skip_chars(utf8_skip_chars);
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/scan/printable-ascii-run/scalar", test_scan_printable_ascii_run_scalar);
+#ifdef VTE_SCAN_HAVE_SSE2
+        g_test_add_func("/vte/scan/printable-ascii-run/sse2", test_scan_printable_ascii_run_sse2);
+#endif
+#ifdef VTE_SCAN_HAVE_AVX2
+        g_test_add_func("/vte/scan/printable-ascii-run/avx2", test_scan_printable_ascii_run_avx2);
+#endif
+        g_test_add_func("/vte/scan/printable-ascii-run", test_scan_printable_ascii_run);
+        g_test_add_func("/vte/scan/utf8/scalar", test_scan_utf8_scalar);
+#ifdef VTE_SCAN_HAVE_SSE2
+        g_test_add_func("/vte/scan/utf8/sse2", test_scan_utf8_sse2);
+#endif
+#ifdef VTE_SCAN_HAVE_AVX2
+        g_test_add_func("/vte/scan/utf8/avx2", test_scan_utf8_avx2);
+#endif
+        g_test_add_func("/vte/scan/utf8", test_scan_utf8);
+
+        return g_test_run();
+}
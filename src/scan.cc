@@ -0,0 +1,311 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "scan.hh"
+
+#ifdef VTE_SCAN_HAVE_SSE2
+#include <immintrin.h>
+#endif
+
+namespace vte {
+
+namespace base {
+
+namespace scan_impl {
+
+static inline constexpr bool
+is_printable_ascii(uint8_t c) noexcept
+{
+        return c >= 0x20 && c < 0x7f;
+}
+
+size_t
+printable_ascii_run_scalar(uint8_t const* data,
+                           size_t len) noexcept
+{
+        size_t i = 0;
+        while (i < len && is_printable_ascii(data[i]))
+                ++i;
+        return i;
+}
+
+static inline constexpr bool
+is_utf8_lead(uint8_t c) noexcept
+{
+        return (c & 0xc0) != 0x80;
+}
+
+size_t
+utf8_count_chars_scalar(uint8_t const* data,
+                        size_t len) noexcept
+{
+        size_t n = 0;
+        for (size_t i = 0; i < len; ++i)
+                n += is_utf8_lead(data[i]);
+        return n;
+}
+
+size_t
+utf8_skip_chars_scalar(uint8_t const* data,
+                       size_t len,
+                       size_t* n_chars) noexcept
+{
+        size_t seen = 0;
+        size_t i = 0;
+        for ( ; i < len; ++i) {
+                if (!is_utf8_lead(data[i]))
+                        continue;
+                if (seen == *n_chars)
+                        break;
+                ++seen;
+        }
+
+        *n_chars = seen;
+        return i;
+}
+
+/* The offset of the set bit of @mask after its @n lowest ones */
+static inline unsigned
+nth_bit(uint32_t mask,
+        size_t n) noexcept
+{
+        while (n--)
+                mask &= mask - 1;
+        return __builtin_ctz(mask);
+}
+
+/* In the vector implementations, the bytes are compared as signed, so that
+ * 0x80..0xff are negative and fail the lower bound together with the C0
+ * controls; DEL fails the upper bound.
+ *
+ * Likewise the UTF-8 continuation bytes 0x80..0xbf are the ones not greater
+ * than (int8_t)0xbf, so the lead bytes are found with a single comparison;
+ * they're counted by subtracting its -1s bytewise, or by a popcount of its
+ * mask where the position of the n-th one is needed.
+ */
+
+#ifdef VTE_SCAN_HAVE_SSE2
+
+size_t
+printable_ascii_run_sse2(uint8_t const* data,
+                         size_t len) noexcept
+{
+        auto const lo = _mm_set1_epi8(0x1f);
+        auto const hi = _mm_set1_epi8(0x7f);
+
+        size_t i = 0;
+        for ( ; i + 16 <= len; i += 16) {
+                auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i));
+                auto const ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo),
+                                              _mm_cmplt_epi8(v, hi));
+                auto const mask = ~unsigned(_mm_movemask_epi8(ok)) & 0xffffu;
+                if (mask != 0)
+                        return i + __builtin_ctz(mask);
+        }
+
+        return i + printable_ascii_run_scalar(data + i, len - i);
+}
+
+size_t
+utf8_count_chars_sse2(uint8_t const* data,
+                      size_t len) noexcept
+{
+        auto const cont = _mm_set1_epi8(int8_t(0xbf));
+
+        auto const zero = _mm_setzero_si128();
+
+        /* Count in bytes, and sum those up before they can overflow */
+        auto sums = zero;
+        size_t i = 0;
+        while (i + 16 <= len) {
+                auto counts = zero;
+                for (auto j = 0; j < 255 && i + 16 <= len; ++j, i += 16) {
+                        auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i));
+                        counts = _mm_sub_epi8(counts, _mm_cmpgt_epi8(v, cont));
+                }
+                sums = _mm_add_epi64(sums, _mm_sad_epu8(counts, zero));
+        }
+
+        alignas(16) uint64_t lanes[2];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), sums);
+        return size_t(lanes[0] + lanes[1]) + utf8_count_chars_scalar(data + i, len - i);
+}
+
+size_t
+utf8_skip_chars_sse2(uint8_t const* data,
+                     size_t len,
+                     size_t* n_chars) noexcept
+{
+        auto const cont = _mm_set1_epi8(int8_t(0xbf));
+        auto const n = *n_chars;
+
+        size_t seen = 0;
+        size_t i = 0;
+        for ( ; i + 16 <= len; i += 16) {
+                auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i));
+                auto const mask = unsigned(_mm_movemask_epi8(_mm_cmpgt_epi8(v, cont)));
+                /* No continuation bytes, as in ASCII text, is the common case */
+                auto const count = mask == 0xffffu ? size_t{16} : size_t(__builtin_popcount(mask));
+                if (seen + count > n)
+                        return i + nth_bit(mask, n - seen);
+                seen += count;
+        }
+
+        auto rest = n - seen;
+        auto const offset = utf8_skip_chars_scalar(data + i, len - i, &rest);
+        *n_chars = seen + rest;
+        return i + offset;
+}
+
+#endif /* VTE_SCAN_HAVE_SSE2 */
+
+#ifdef VTE_SCAN_HAVE_AVX2
+
+bool
+have_avx2() noexcept
+{
+        static bool const have = __builtin_cpu_supports("avx2");
+        return have;
+}
+
+__attribute__((target("avx2")))
+size_t
+printable_ascii_run_avx2(uint8_t const* data,
+                         size_t len) noexcept
+{
+        auto const lo = _mm256_set1_epi8(0x1f);
+        auto const hi = _mm256_set1_epi8(0x7f);
+
+        size_t i = 0;
+        for ( ; i + 32 <= len; i += 32) {
+                auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + i));
+                auto const ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo),
+                                                 _mm256_cmpgt_epi8(hi, v));
+                auto const mask = ~unsigned(_mm256_movemask_epi8(ok));
+                if (mask != 0)
+                        return i + __builtin_ctz(mask);
+        }
+
+        return i + printable_ascii_run_sse2(data + i, len - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t
+utf8_count_chars_avx2(uint8_t const* data,
+                      size_t len) noexcept
+{
+        auto const cont = _mm256_set1_epi8(int8_t(0xbf));
+
+        auto const zero = _mm256_setzero_si256();
+
+        auto sums = zero;
+        size_t i = 0;
+        while (i + 32 <= len) {
+                auto counts = zero;
+                for (auto j = 0; j < 255 && i + 32 <= len; ++j, i += 32) {
+                        auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + i));
+                        counts = _mm256_sub_epi8(counts, _mm256_cmpgt_epi8(v, cont));
+                }
+                sums = _mm256_add_epi64(sums, _mm256_sad_epu8(counts, zero));
+        }
+
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sums);
+        return size_t(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + utf8_count_chars_sse2(data + i, len - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t
+utf8_skip_chars_avx2(uint8_t const* data,
+                     size_t len,
+                     size_t* n_chars) noexcept
+{
+        auto const cont = _mm256_set1_epi8(int8_t(0xbf));
+        auto const n = *n_chars;
+
+        size_t seen = 0;
+        size_t i = 0;
+        for ( ; i + 32 <= len; i += 32) {
+                auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + i));
+                auto const mask = unsigned(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, cont)));
+                auto const count = mask == 0xffffffffu ? size_t{32} : size_t(__builtin_popcount(mask));
+                if (seen + count > n)
+                        return i + nth_bit(mask, n - seen);
+                seen += count;
+        }
+
+        auto rest = n - seen;
+        auto const offset = utf8_skip_chars_sse2(data + i, len - i, &rest);
+        *n_chars = seen + rest;
+        return i + offset;
+}
+
+#endif /* VTE_SCAN_HAVE_AVX2 */
+
+} // namespace scan_impl
+
+size_t
+printable_ascii_run(uint8_t const* data,
+                    size_t len) noexcept
+{
+#ifdef VTE_SCAN_HAVE_AVX2
+        if (scan_impl::have_avx2())
+                return scan_impl::printable_ascii_run_avx2(data, len);
+#endif
+#ifdef VTE_SCAN_HAVE_SSE2
+        return scan_impl::printable_ascii_run_sse2(data, len);
+#else
+        return scan_impl::printable_ascii_run_scalar(data, len);
+#endif
+}
+
+size_t
+utf8_count_chars(uint8_t const* data,
+                 size_t len) noexcept
+{
+#ifdef VTE_SCAN_HAVE_AVX2
+        if (scan_impl::have_avx2())
+                return scan_impl::utf8_count_chars_avx2(data, len);
+#endif
+#ifdef VTE_SCAN_HAVE_SSE2
+        return scan_impl::utf8_count_chars_sse2(data, len);
+#else
+        return scan_impl::utf8_count_chars_scalar(data, len);
+#endif
+}
+
+size_t
+utf8_skip_chars(uint8_t const* data,
+                size_t len,
+                size_t* n_chars) noexcept
+{
+#ifdef VTE_SCAN_HAVE_AVX2
+        if (scan_impl::have_avx2())
+                return scan_impl::utf8_skip_chars_avx2(data, len, n_chars);
+#endif
+#ifdef VTE_SCAN_HAVE_SSE2
+        return scan_impl::utf8_skip_chars_sse2(data, len, n_chars);
+#else
+        return scan_impl::utf8_skip_chars_scalar(data, len, n_chars);
+#endif
+}
+
+} // namespace base
+
+} // namespace vte
@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define VTE_SCAN_HAVE_SSE2 1
+#define VTE_SCAN_HAVE_AVX2 1
+#endif
+
+namespace vte {
+
+namespace base {
+
+/*
+ * Vectorised scanning of the input bytes, and of the UTF-8 text of the
+ * scrollback.
+ *
+ * Each function has a portable scalar implementation, and on x86 an SSE2
+ * and an AVX2 one; the best one the CPU supports is chosen at runtime.
+ * The implementations are exposed only so they can be tested against
+ * each other.
+ */
+
+/* Returns the length of the run of printable ASCII (0x20..0x7e) at the start of @data */
+size_t printable_ascii_run(uint8_t const* data,
+                           size_t len) noexcept;
+
+/* Returns the number of UTF-8 characters in @data, that is, the number of
+ * bytes that aren't continuation bytes; @data is assumed to be valid UTF-8,
+ * as the text of the scrollback is.
+ */
+size_t utf8_count_chars(uint8_t const* data,
+                        size_t len) noexcept;
+
+/* Returns the offset of the first byte after the first *@n_chars UTF-8
+ * characters of @data, or @len if it has no more than that many, and sets
+ * *@n_chars to the number of characters skipped.
+ */
+size_t utf8_skip_chars(uint8_t const* data,
+                       size_t len,
+                       size_t* n_chars) noexcept;
+
+namespace scan_impl {
+
+size_t printable_ascii_run_scalar(uint8_t const* data,
+                                  size_t len) noexcept;
+size_t utf8_count_chars_scalar(uint8_t const* data,
+                               size_t len) noexcept;
+size_t utf8_skip_chars_scalar(uint8_t const* data,
+                              size_t len,
+                              size_t* n_chars) noexcept;
+
+#ifdef VTE_SCAN_HAVE_SSE2
+size_t printable_ascii_run_sse2(uint8_t const* data,
+                                size_t len) noexcept;
+size_t utf8_count_chars_sse2(uint8_t const* data,
+                             size_t len) noexcept;
+size_t utf8_skip_chars_sse2(uint8_t const* data,
+                            size_t len,
+                            size_t* n_chars) noexcept;
+#endif
+
+#ifdef VTE_SCAN_HAVE_AVX2
+bool have_avx2() noexcept;
+
+size_t printable_ascii_run_avx2(uint8_t const* data,
+                                size_t len) noexcept;
+size_t utf8_count_chars_avx2(uint8_t const* data,
+                             size_t len) noexcept;
+size_t utf8_skip_chars_avx2(uint8_t const* data,
+                            size_t len,
+                            size_t* n_chars) noexcept;
+#endif
+
+} // namespace scan_impl
+
+} // namespace base
+
+} // namespace vte
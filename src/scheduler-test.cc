@@ -0,0 +1,217 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "scheduler.hh"
+
+#include <vector>
+
+#include <glib.h>
+
+using namespace vte::base;
+
+struct Item {
+        int id;
+        Scheduler<Item>::Node node{this};
+
+        Item(int i) : id{i} { }
+};
+
+static std::vector<int>
+order(Scheduler<Item>& scheduler)
+{
+        std::vector<int> ids;
+        scheduler.for_each([&ids](Item* item) { ids.push_back(item->id); });
+        return ids;
+}
+
+static void
+test_scheduler_membership(void)
+{
+        Scheduler<Item> scheduler{};
+        Item a{1}, b{2}, c{3};
+
+        g_assert_true(scheduler.empty());
+        g_assert_false(a.node.is_scheduled());
+
+        scheduler.add(a.node);
+        scheduler.add(b.node);
+        scheduler.add(c.node);
+        scheduler.add(b.node);
+        g_assert_cmpuint(scheduler.size(), ==, 3);
+        g_assert_cmpuint(scheduler.total_weight(), ==, 3);
+        g_assert_true(b.node.is_scheduled());
+        g_assert_true((order(scheduler) == std::vector<int>{1, 2, 3}));
+
+        scheduler.remove(b.node);
+        scheduler.remove(b.node);
+        g_assert_false(b.node.is_scheduled());
+        g_assert_cmpuint(scheduler.size(), ==, 2);
+        g_assert_true((order(scheduler) == std::vector<int>{1, 3}));
+
+        scheduler.remove(a.node);
+        scheduler.remove(c.node);
+        g_assert_true(scheduler.empty());
+        g_assert_null(scheduler.first());
+}
+
+static void
+test_scheduler_rotate(void)
+{
+        Scheduler<Item> scheduler{};
+        Item a{1}, b{2}, c{3};
+
+        scheduler.add(a.node);
+        scheduler.add(b.node);
+        scheduler.add(c.node);
+
+        scheduler.rotate();
+        g_assert_true((order(scheduler) == std::vector<int>{2, 3, 1}));
+        scheduler.rotate();
+        g_assert_true((order(scheduler) == std::vector<int>{3, 1, 2}));
+        g_assert_true(scheduler.first() == &c);
+
+        scheduler.remove(a.node);
+        scheduler.rotate();
+        g_assert_true((order(scheduler) == std::vector<int>{2, 3}));
+}
+
+static void
+test_scheduler_remove_during_iteration(void)
+{
+        Scheduler<Item> scheduler{};
+        Item a{1}, b{2}, c{3};
+
+        scheduler.add(a.node);
+        scheduler.add(b.node);
+        scheduler.add(c.node);
+
+        std::vector<int> visited;
+        scheduler.for_each([&](Item* item) {
+                        visited.push_back(item->id);
+                        scheduler.remove(item->node);
+                });
+        g_assert_true((visited == std::vector<int>{1, 2, 3}));
+        g_assert_true(scheduler.empty());
+}
+
+static void
+test_scheduler_deficit(void)
+{
+        Scheduler<Item> scheduler{};
+        Item a{1}, b{2};
+
+        /* Not scheduled: the whole budget */
+        g_assert_cmpuint(scheduler.quantum(a.node, 1000), ==, 1000);
+
+        scheduler.add(a.node);
+        scheduler.add(b.node);
+        g_assert_cmpuint(scheduler.quantum(a.node, 1000), ==, 500);
+
+        scheduler.replenish(a.node, 1000);
+        g_assert_cmpuint(a.node.deficit(), ==, 500);
+        scheduler.charge(a.node, 200);
+        g_assert_cmpuint(a.node.deficit(), ==, 300);
+
+        /* Unused deficit carries over, up to k_max_quanta quanta */
+        scheduler.replenish(a.node, 1000);
+        g_assert_cmpuint(a.node.deficit(), ==, 800);
+        scheduler.replenish(a.node, 1000);
+        g_assert_cmpuint(a.node.deficit(), ==, Scheduler<Item>::k_max_quanta * 500);
+
+        scheduler.charge(a.node, 5000);
+        g_assert_cmpuint(a.node.deficit(), ==, 0);
+
+        /* ... and is forfeited when going idle */
+        scheduler.replenish(a.node, 1000);
+        scheduler.remove(a.node);
+        g_assert_cmpuint(a.node.deficit(), ==, 0);
+}
+
+static void
+test_scheduler_weights(void)
+{
+        Scheduler<Item> scheduler{};
+        Item a{1}, b{2}, c{3};
+
+        scheduler.add(a.node);
+        scheduler.add(b.node);
+        scheduler.add(c.node);
+
+        scheduler.set_weight(a.node, 4);
+        g_assert_cmpuint(scheduler.total_weight(), ==, 6);
+        g_assert_cmpuint(scheduler.quantum(a.node, 6000), ==, 4000);
+        g_assert_cmpuint(scheduler.quantum(b.node, 6000), ==, 1000);
+
+        scheduler.remove(a.node);
+        g_assert_cmpuint(scheduler.total_weight(), ==, 2);
+
+        /* The weight is kept while not scheduled */
+        scheduler.set_weight(a.node, 2);
+        g_assert_cmpuint(scheduler.total_weight(), ==, 2);
+        scheduler.add(a.node);
+        g_assert_cmpuint(scheduler.total_weight(), ==, 4);
+
+        /* Weights are at least 1 */
+        scheduler.set_weight(b.node, 0);
+        g_assert_cmpuint(b.node.weight(), ==, 1);
+}
+
+static void
+test_scheduler_fairness(void)
+{
+        Scheduler<Item> scheduler{};
+        Item chatty{1}, quiet{2};
+        size_t read[2] = {0, 0};
+
+        scheduler.add(chatty.node);
+        scheduler.add(quiet.node);
+
+        /* The chatty item always has data, and would read all it can;
+         * the quiet item only reads a little each turn.
+         */
+        for (auto round = 0; round < 100; ++round) {
+                scheduler.for_each([&](Item* item) {
+                                scheduler.replenish(item->node, 4096);
+                                auto const n = item->id == 1 ? item->node.deficit()
+                                                             : std::min(item->node.deficit(), size_t{100});
+                                scheduler.charge(item->node, n);
+                                read[item->id - 1] += n;
+                        });
+                scheduler.rotate();
+        }
+
+        g_assert_cmpuint(read[0], ==, 100 * 2048);
+        g_assert_cmpuint(read[1], ==, 100 * 100);
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/scheduler/membership", test_scheduler_membership);
+        g_test_add_func("/vte/scheduler/rotate", test_scheduler_rotate);
+        g_test_add_func("/vte/scheduler/remove-during-iteration", test_scheduler_remove_during_iteration);
+        g_test_add_func("/vte/scheduler/deficit", test_scheduler_deficit);
+        g_test_add_func("/vte/scheduler/weights", test_scheduler_weights);
+        g_test_add_func("/vte/scheduler/fairness", test_scheduler_fairness);
+
+        return g_test_run();
+}
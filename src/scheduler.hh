@@ -0,0 +1,221 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+
+namespace vte {
+
+namespace base {
+
+/*
+ * Scheduler:
+ *
+ * The set of active items (terminals with data to read, process or draw),
+ * shared between them by deficit round robin.
+ *
+ * Each item embeds a Node, so that adding, removing and testing membership
+ * are O(1). The items are visited in a circular order; rotate() moves the
+ * first item to the end, so that no item is always served first.
+ *
+ * On each of its turns, an item's deficit is increased by its quantum, its
+ * weighted share of the byte budget given to replenish(); the item then
+ * consumes bytes from its deficit with charge(). An item's unused deficit
+ * carries over to its next turn (up to k_max_quanta quanta), and is
+ * forfeited when the item becomes idle and is removed.
+ */
+template<typename T>
+class Scheduler {
+public:
+        class Node {
+        public:
+                Node(T* owner) noexcept
+                        : m_owner{owner}
+                {
+                }
+
+                Node(Node const&) = delete;
+                Node(Node&&) = delete;
+                ~Node() = default;
+
+                Node& operator= (Node const&) = delete;
+                Node& operator= (Node&&) = delete;
+
+                inline T* owner() const noexcept { return m_owner; }
+                inline bool is_scheduled() const noexcept { return m_scheduled; }
+                inline unsigned int weight() const noexcept { return m_weight; }
+                inline size_t deficit() const noexcept { return m_deficit; }
+
+        private:
+                friend class Scheduler;
+
+                T* m_owner;
+                Node* m_prev{nullptr};
+                Node* m_next{nullptr};
+                size_t m_deficit{0};
+                unsigned int m_weight{1};
+                bool m_scheduled{false};
+        };
+
+        static unsigned int const k_max_quanta = 2;
+
+        Scheduler() noexcept = default;
+        Scheduler(Scheduler const&) = delete;
+        Scheduler(Scheduler&&) = delete;
+        ~Scheduler() = default;
+
+        Scheduler& operator= (Scheduler const&) = delete;
+        Scheduler& operator= (Scheduler&&) = delete;
+
+        inline bool empty() const noexcept { return m_head == nullptr; }
+        inline size_t size() const noexcept { return m_size; }
+        inline unsigned int total_weight() const noexcept { return m_total_weight; }
+
+        /* Appends @node at the end of the round; no-op if already scheduled */
+        void add(Node& node) noexcept
+        {
+                if (node.m_scheduled)
+                        return;
+
+                node.m_scheduled = true;
+                node.m_deficit = 0;
+                node.m_next = nullptr;
+                node.m_prev = m_tail;
+                if (m_tail)
+                        m_tail->m_next = &node;
+                else
+                        m_head = &node;
+                m_tail = &node;
+
+                ++m_size;
+                m_total_weight += node.m_weight;
+        }
+
+        /* Removes @node and forfeits its deficit; no-op if not scheduled */
+        void remove(Node& node) noexcept
+        {
+                if (!node.m_scheduled)
+                        return;
+
+                if (node.m_prev)
+                        node.m_prev->m_next = node.m_next;
+                else
+                        m_head = node.m_next;
+                if (node.m_next)
+                        node.m_next->m_prev = node.m_prev;
+                else
+                        m_tail = node.m_prev;
+
+                node.m_prev = node.m_next = nullptr;
+                node.m_scheduled = false;
+                node.m_deficit = 0;
+
+                assert(m_size > 0);
+                --m_size;
+                m_total_weight -= node.m_weight;
+        }
+
+        void set_weight(Node& node,
+                        unsigned int weight) noexcept
+        {
+                weight = std::max(weight, 1u);
+                if (node.m_scheduled)
+                        m_total_weight = m_total_weight - node.m_weight + weight;
+                node.m_weight = weight;
+        }
+
+        /* The share of @budget bytes that @node gets per turn */
+        size_t quantum(Node const& node,
+                       size_t budget) const noexcept
+        {
+                if (!node.m_scheduled || m_total_weight == 0)
+                        return budget;
+
+                return std::max(budget * node.m_weight / m_total_weight, size_t{1});
+        }
+
+        /* Starts a turn of @node, adding its quantum of @budget to its deficit */
+        void replenish(Node& node,
+                       size_t budget) noexcept
+        {
+                if (!node.m_scheduled)
+                        return;
+
+                auto const q = quantum(node, budget);
+                node.m_deficit = std::min(node.m_deficit + q, k_max_quanta * q);
+        }
+
+        /* Consumes @bytes from @node's deficit */
+        void charge(Node& node,
+                    size_t bytes) noexcept
+        {
+                node.m_deficit -= std::min(node.m_deficit, bytes);
+        }
+
+        /* Moves the first item to the end of the round */
+        void rotate() noexcept
+        {
+                if (m_head == m_tail)
+                        return;
+
+                auto node = m_head;
+                m_head = node->m_next;
+                m_head->m_prev = nullptr;
+                node->m_prev = m_tail;
+                node->m_next = nullptr;
+                m_tail->m_next = node;
+                m_tail = node;
+        }
+
+        /* Calls @func on each scheduled item, in order. @func may remove
+         * the item it is called on from the scheduler.
+         */
+        template<typename F>
+        void for_each(F&& func)
+        {
+                for (auto node = m_head; node != nullptr; ) {
+                        auto next = node->m_next;
+                        func(node->m_owner);
+                        node = next;
+                }
+        }
+
+        template<typename P>
+        bool any_of(P&& pred) const
+        {
+                for (auto node = m_head; node != nullptr; node = node->m_next) {
+                        if (pred(node->m_owner))
+                                return true;
+                }
+                return false;
+        }
+
+        inline T* first() const noexcept { return m_head ? m_head->m_owner : nullptr; }
+
+private:
+        Node* m_head{nullptr};
+        Node* m_tail{nullptr};
+        size_t m_size{0};
+        unsigned int m_total_weight{0};
+};
+
+} // namespace base
+
+} // namespace vte
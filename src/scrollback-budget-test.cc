@@ -0,0 +1,213 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "scrollback-budget.hh"
+
+#include <vector>
+
+#include <glib.h>
+
+using namespace vte::base;
+
+struct Item {
+        int id;
+        size_t memory;
+        size_t disk;
+        size_t reclaimable;  /* of the disk */
+        ScrollbackBudget<Item>::Node node{this};
+
+        Item(int i,
+             size_t m,
+             size_t d,
+             size_t r)
+                : id{i}, memory{m}, disk{d}, reclaimable{r}
+        {
+        }
+};
+
+static void
+reclaim(ScrollbackBudget<Item>& budget,
+        std::vector<int>& reclaimed,
+        Item* item,
+        size_t memory,
+        size_t disk)
+{
+        reclaimed.push_back(item->id);
+
+        auto const bytes = std::min(std::max(memory, disk), item->reclaimable);
+        item->disk -= bytes;
+        item->reclaimable -= bytes;
+        budget.update(item->node, item->memory, item->disk);
+}
+
+static void
+test_scrollback_budget_totals(void)
+{
+        ScrollbackBudget<Item> budget{};
+        Item a{1, 100, 1000, 0}, b{2, 200, 2000, 0};
+
+        budget.update(a.node, a.memory, a.disk);
+        budget.add(a.node);
+        budget.add(b.node);
+        budget.add(a.node);
+        g_assert_cmpuint(budget.size(), ==, 2);
+        g_assert_cmpuint(budget.memory(), ==, 100);
+        g_assert_cmpuint(budget.disk(), ==, 1000);
+
+        budget.update(b.node, b.memory, b.disk);
+        g_assert_cmpuint(budget.memory(), ==, 300);
+        g_assert_cmpuint(budget.disk(), ==, 3000);
+
+        budget.update(a.node, 50, 500);
+        g_assert_cmpuint(budget.memory(), ==, 250);
+        g_assert_cmpuint(budget.disk(), ==, 2500);
+
+        budget.remove(b.node);
+        budget.remove(b.node);
+        g_assert_false(b.node.is_added());
+        g_assert_cmpuint(budget.size(), ==, 1);
+        g_assert_cmpuint(budget.memory(), ==, 50);
+        g_assert_cmpuint(budget.disk(), ==, 500);
+
+        /* Updating a removed node doesn't count */
+        budget.update(b.node, 1, 1);
+        g_assert_cmpuint(budget.memory(), ==, 50);
+
+        budget.remove(a.node);
+        g_assert_true(budget.empty());
+        g_assert_cmpuint(budget.memory(), ==, 0);
+        g_assert_cmpuint(budget.disk(), ==, 0);
+}
+
+static void
+test_scrollback_budget_unlimited(void)
+{
+        ScrollbackBudget<Item> budget{};
+        Item a{1, 100, 1000000, 1000000};
+
+        budget.add(a.node);
+        budget.update(a.node, a.memory, a.disk);
+        g_assert_false(budget.over());
+
+        std::vector<int> reclaimed;
+        g_assert_true(budget.enforce([&](Item* item, size_t memory, size_t disk) {
+                                reclaim(budget, reclaimed, item, memory, disk);
+                        }));
+        g_assert_true(reclaimed.empty());
+}
+
+static void
+test_scrollback_budget_lru(void)
+{
+        ScrollbackBudget<Item> budget{};
+        Item a{1, 0, 4000, 4000}, b{2, 0, 4000, 4000}, c{3, 0, 4000, 4000};
+
+        for (auto item : {&a, &b, &c}) {
+                budget.add(item->node);
+                budget.update(item->node, item->memory, item->disk);
+        }
+
+        /* Viewed order: a, c, b */
+        budget.viewed(c.node);
+        budget.viewed(b.node);
+        g_assert_true(budget.first() == &a);
+
+        /* Over by 2000; reclaimed down to the low water mark from a alone */
+        budget.set_limits(0, 10000);
+        g_assert_true(budget.over());
+
+        std::vector<int> reclaimed;
+        auto func = [&](Item* item, size_t memory, size_t disk) {
+                reclaim(budget, reclaimed, item, memory, disk);
+        };
+        g_assert_true(budget.enforce(func));
+        g_assert_true((reclaimed == std::vector<int>{1}));
+        g_assert_cmpuint(budget.disk(), ==, size_t(10000 * ScrollbackBudget<Item>::k_low_water));
+        g_assert_cmpuint(b.disk, ==, 4000);
+        g_assert_cmpuint(c.disk, ==, 4000);
+
+        /* a has too little left, so c is asked next */
+        reclaimed.clear();
+        budget.set_limits(0, 5000);
+        g_assert_true(budget.enforce(func));
+        g_assert_true((reclaimed == std::vector<int>{1, 3}));
+        g_assert_cmpuint(a.disk, ==, 0);
+        g_assert_cmpuint(b.disk, ==, 4000);
+        g_assert_cmpuint(budget.disk(), ==, size_t(5000 * ScrollbackBudget<Item>::k_low_water));
+}
+
+static void
+test_scrollback_budget_unreclaimable(void)
+{
+        ScrollbackBudget<Item> budget{};
+        Item a{1, 3000, 0, 0}, b{2, 3000, 0, 0};
+
+        budget.add(a.node);
+        budget.add(b.node);
+        budget.update(a.node, a.memory, a.disk);
+        budget.update(b.node, b.memory, b.disk);
+        budget.set_limits(5000, 0);
+
+        /* Everyone is asked, and nobody can help */
+        std::vector<int> reclaimed;
+        g_assert_false(budget.enforce([&](Item* item, size_t memory, size_t disk) {
+                                g_assert_cmpuint(memory, ==, 6000 - size_t(5000 * ScrollbackBudget<Item>::k_low_water));
+                                g_assert_cmpuint(disk, ==, 0);
+                                reclaim(budget, reclaimed, item, memory, disk);
+                        }));
+        g_assert_true((reclaimed == std::vector<int>{1, 2}));
+        g_assert_true(budget.over());
+}
+
+static void
+test_scrollback_budget_reentrancy(void)
+{
+        ScrollbackBudget<Item> budget{};
+        Item a{1, 0, 2000, 2000};
+
+        budget.add(a.node);
+        budget.update(a.node, a.memory, a.disk);
+        budget.set_limits(0, 1000);
+
+        /* Enforcing from within the reclaim callback is a no-op */
+        auto n_calls = 0;
+        budget.enforce([&](Item* item, size_t, size_t) {
+                        ++n_calls;
+                        g_assert_false(budget.enforce([&](Item*, size_t, size_t) { ++n_calls; }));
+                        item->disk = 0;
+                        budget.update(item->node, item->memory, item->disk);
+                });
+        g_assert_cmpint(n_calls, ==, 1);
+        g_assert_false(budget.over());
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/scrollback-budget/totals", test_scrollback_budget_totals);
+        g_test_add_func("/vte/scrollback-budget/unlimited", test_scrollback_budget_unlimited);
+        g_test_add_func("/vte/scrollback-budget/lru", test_scrollback_budget_lru);
+        g_test_add_func("/vte/scrollback-budget/unreclaimable", test_scrollback_budget_unreclaimable);
+        g_test_add_func("/vte/scrollback-budget/reentrancy", test_scrollback_budget_reentrancy);
+
+        return g_test_run();
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+
+namespace vte {
+
+namespace base {
+
+/*
+ * ScrollbackBudget:
+ *
+ * The memory and disk that the scrollback of all items (terminals) may take
+ * together, with 0 meaning no limit.
+ *
+ * Each item embeds a Node, which records what the item takes, as last
+ * reported with update(). The nodes are kept in the order they were last
+ * viewed in, the least recently viewed first.
+ *
+ * When the total exceeds a limit, enforce() asks the items to reclaim the
+ * excess, starting with the least recently viewed one, which drops its
+ * oldest scrollback and reports its new usage, until the total is down to
+ * k_low_water of the limit; so that once over, not every little bit of
+ * output leads to dropping a few rows again.
+ */
+template<typename T>
+class ScrollbackBudget {
+public:
+        class Node {
+        public:
+                Node(T* owner) noexcept
+                        : m_owner{owner}
+                {
+                }
+
+                Node(Node const&) = delete;
+                Node(Node&&) = delete;
+                ~Node() = default;
+
+                Node& operator= (Node const&) = delete;
+                Node& operator= (Node&&) = delete;
+
+                inline T* owner() const noexcept { return m_owner; }
+                inline bool is_added() const noexcept { return m_added; }
+                inline size_t memory() const noexcept { return m_memory; }
+                inline size_t disk() const noexcept { return m_disk; }
+
+        private:
+                friend class ScrollbackBudget;
+
+                T* m_owner;
+                Node* m_prev{nullptr};
+                Node* m_next{nullptr};
+                size_t m_memory{0};
+                size_t m_disk{0};
+                bool m_added{false};
+        };
+
+        /* Reclaim down to this share of a limit once it's exceeded */
+        static constexpr double const k_low_water = 0.875;
+
+        ScrollbackBudget() noexcept = default;
+        ScrollbackBudget(ScrollbackBudget const&) = delete;
+        ScrollbackBudget(ScrollbackBudget&&) = delete;
+        ~ScrollbackBudget() = default;
+
+        ScrollbackBudget& operator= (ScrollbackBudget const&) = delete;
+        ScrollbackBudget& operator= (ScrollbackBudget&&) = delete;
+
+        inline bool empty() const noexcept { return m_head == nullptr; }
+        inline size_t size() const noexcept { return m_size; }
+        inline size_t memory() const noexcept { return m_memory; }
+        inline size_t disk() const noexcept { return m_disk; }
+        inline size_t memory_limit() const noexcept { return m_memory_limit; }
+        inline size_t disk_limit() const noexcept { return m_disk_limit; }
+
+        inline bool over() const noexcept
+        {
+                return (m_memory_limit != 0 && m_memory > m_memory_limit) ||
+                        (m_disk_limit != 0 && m_disk > m_disk_limit);
+        }
+
+        void set_limits(size_t memory_limit,
+                        size_t disk_limit) noexcept
+        {
+                m_memory_limit = memory_limit;
+                m_disk_limit = disk_limit;
+        }
+
+        /* Adds @node as the most recently viewed; no-op if already added */
+        void add(Node& node) noexcept
+        {
+                if (node.m_added)
+                        return;
+
+                node.m_added = true;
+                link(node);
+
+                ++m_size;
+                m_memory += node.m_memory;
+                m_disk += node.m_disk;
+        }
+
+        /* Removes @node and its usage; no-op if not added */
+        void remove(Node& node) noexcept
+        {
+                if (!node.m_added)
+                        return;
+
+                unlink(node);
+                node.m_added = false;
+
+                assert(m_size > 0);
+                --m_size;
+                m_memory -= node.m_memory;
+                m_disk -= node.m_disk;
+        }
+
+        /* Records that @node now takes @memory and @disk bytes */
+        void update(Node& node,
+                    size_t memory,
+                    size_t disk) noexcept
+        {
+                if (node.m_added) {
+                        m_memory = m_memory - node.m_memory + memory;
+                        m_disk = m_disk - node.m_disk + disk;
+                }
+                node.m_memory = memory;
+                node.m_disk = disk;
+        }
+
+        /* Makes @node the most recently viewed */
+        void viewed(Node& node) noexcept
+        {
+                if (!node.m_added || m_tail == &node)
+                        return;
+
+                unlink(node);
+                link(node);
+        }
+
+        /* If over a limit, calls @reclaim(owner, memory, disk) on the items
+         * from the least recently viewed one, with the number of bytes of
+         * memory and disk still to reclaim, until enough is reclaimed.
+         * @reclaim must update() the item's node with what it now takes; it
+         * may reclaim less than asked, or nothing. Returns whether the total
+         * is back within the limits.
+         */
+        template<typename F>
+        bool enforce(F&& reclaim)
+        {
+                if (!over() || m_enforcing)
+                        return !over();
+
+                m_enforcing = true;
+
+                auto const memory_target = size_t(m_memory_limit * k_low_water);
+                auto const disk_target = size_t(m_disk_limit * k_low_water);
+                for (auto node = m_head; node != nullptr; ) {
+                        auto const memory_excess = m_memory_limit != 0 && m_memory > memory_target ? m_memory - memory_target : 0;
+                        auto const disk_excess = m_disk_limit != 0 && m_disk > disk_target ? m_disk - disk_target : 0;
+                        if (memory_excess == 0 && disk_excess == 0)
+                                break;
+
+                        auto next = node->m_next;
+                        reclaim(node->m_owner, memory_excess, disk_excess);
+                        node = next;
+                }
+
+                m_enforcing = false;
+
+                return !over();
+        }
+
+        template<typename F>
+        void for_each(F&& func)
+        {
+                for (auto node = m_head; node != nullptr; ) {
+                        auto next = node->m_next;
+                        func(node->m_owner);
+                        node = next;
+                }
+        }
+
+        /* The least recently viewed item */
+        inline T* first() const noexcept { return m_head ? m_head->m_owner : nullptr; }
+
+private:
+        Node* m_head{nullptr};
+        Node* m_tail{nullptr};
+        size_t m_size{0};
+        size_t m_memory{0};
+        size_t m_disk{0};
+        size_t m_memory_limit{0};
+        size_t m_disk_limit{0};
+        bool m_enforcing{false};
+
+        void link(Node& node) noexcept
+        {
+                node.m_next = nullptr;
+                node.m_prev = m_tail;
+                if (m_tail)
+                        m_tail->m_next = &node;
+                else
+                        m_head = &node;
+                m_tail = &node;
+        }
+
+        void unlink(Node& node) noexcept
+        {
+                if (node.m_prev)
+                        node.m_prev->m_next = node.m_next;
+                else
+                        m_head = node.m_next;
+                if (node.m_next)
+                        node.m_next->m_prev = node.m_prev;
+                else
+                        m_tail = node.m_prev;
+
+                node.m_prev = node.m_next = nullptr;
+        }
+};
+
+} // namespace base
+
+} // namespace vte
@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "spsc-queue.hh"
+
+#include <memory>
+#include <thread>
+
+#include <glib.h>
+
+using namespace vte::base;
+
+static void
+test_spsc_queue_basic(void)
+{
+        SPSCQueue<int, 4> queue{};
+        int v = 0;
+
+        g_assert_true(queue.empty());
+        g_assert_false(queue.pop(v));
+
+        for (int i = 0; i < 4; ++i)
+                g_assert_true(queue.push(int{i}));
+        g_assert_true(queue.full());
+        g_assert_cmpuint(queue.size(), ==, 4);
+        g_assert_false(queue.push(int{4}));
+
+        for (int i = 0; i < 4; ++i) {
+                g_assert_true(queue.pop(v));
+                g_assert_cmpint(v, ==, i);
+        }
+        g_assert_true(queue.empty());
+        g_assert_false(queue.pop(v));
+}
+
+static void
+test_spsc_queue_move(void)
+{
+        SPSCQueue<std::unique_ptr<int>, 2> queue{};
+
+        auto p = std::make_unique<int>(42);
+        g_assert_true(queue.push(std::move(p)));
+        g_assert_null(p.get());
+
+        auto q = std::make_unique<int>(23);
+        auto r = std::make_unique<int>(7);
+        g_assert_true(queue.push(std::move(q)));
+        /* Failed push must not move from the value */
+        g_assert_false(queue.push(std::move(r)));
+        g_assert_nonnull(r.get());
+
+        auto v = std::unique_ptr<int>{};
+        g_assert_true(queue.pop(v));
+        g_assert_cmpint(*v, ==, 42);
+        g_assert_true(queue.pop(v));
+        g_assert_cmpint(*v, ==, 23);
+}
+
+static void
+test_spsc_queue_threaded(void)
+{
+        auto const n = 1000000u;
+        SPSCQueue<unsigned int, 64> queue{};
+
+        auto producer = std::thread{[&queue, n] {
+                for (auto i = 0u; i < n; ) {
+                        if (queue.push(unsigned{i}))
+                                ++i;
+                        else
+                                std::this_thread::yield();
+                }
+        }};
+
+        auto expected = 0u;
+        while (expected < n) {
+                unsigned int v;
+                if (!queue.pop(v)) {
+                        std::this_thread::yield();
+                        continue;
+                }
+
+                g_assert_cmpuint(v, ==, expected);
+                ++expected;
+        }
+
+        producer.join();
+        g_assert_true(queue.empty());
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/spsc-queue/basic", test_spsc_queue_basic);
+        g_test_add_func("/vte/spsc-queue/move", test_spsc_queue_move);
+        g_test_add_func("/vte/spsc-queue/threaded", test_spsc_queue_threaded);
+
+        return g_test_run();
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace vte {
+
+namespace base {
+
+/*
+ * SPSCQueue:
+ *
+ * A bounded, lock-free queue with exactly one producer thread
+ * and exactly one consumer thread.
+ *
+ * push() may only be called from the producer, pop() only from
+ * the consumer; empty(), full() and size() may be called from
+ * either, but are only a snapshot.
+ */
+template<typename T, size_t N>
+class SPSCQueue {
+        static_assert(N > 1 && (N & (N - 1)) == 0, "N must be a power of 2");
+
+public:
+        SPSCQueue() noexcept = default;
+        SPSCQueue(SPSCQueue const&) = delete;
+        SPSCQueue(SPSCQueue&&) = delete;
+        ~SPSCQueue() = default;
+
+        SPSCQueue& operator= (SPSCQueue const&) = delete;
+        SPSCQueue& operator= (SPSCQueue&&) = delete;
+
+        inline constexpr size_t capacity() const noexcept { return N; }
+
+        /* Producer only. Returns false if the queue is full, in which
+         * case @value is not moved from.
+         */
+        bool push(T&& value) noexcept
+        {
+                auto const tail = m_tail.load(std::memory_order_relaxed);
+                if (tail - m_head.load(std::memory_order_acquire) == N)
+                        return false;
+
+                m_slots[tail & (N - 1)] = std::move(value);
+                m_tail.store(tail + 1, std::memory_order_release);
+                return true;
+        }
+
+        /* Consumer only. Returns false if the queue is empty. */
+        bool pop(T& value) noexcept
+        {
+                auto const head = m_head.load(std::memory_order_relaxed);
+                if (head == m_tail.load(std::memory_order_acquire))
+                        return false;
+
+                value = std::move(m_slots[head & (N - 1)]);
+                m_head.store(head + 1, std::memory_order_release);
+                return true;
+        }
+
+        inline size_t size() const noexcept
+        {
+                auto const head = m_head.load(std::memory_order_acquire);
+                return m_tail.load(std::memory_order_acquire) - head;
+        }
+
+        inline bool empty() const noexcept { return size() == 0; }
+        inline bool full() const noexcept { return size() >= N; }
+
+private:
+        /* Keep producer and consumer indices on separate cache lines */
+        alignas(64) std::atomic<size_t> m_head{0};
+        alignas(64) std::atomic<size_t> m_tail{0};
+        alignas(64) std::array<T, N> m_slots{};
+};
+
+} // namespace base
+
+} // namespace vte
@@ -0,0 +1,161 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Appends log-like lines to each kind of stream, the way the ring appends
+ * the text of the rows it freezes, then reads it all back in order and
+ * reads random lines of it, and reports the throughput of each.
+ *
+ * The file stream encrypts and compresses its blocks and writes them with
+ * system calls; the memory streams skip all of that, compressing or not.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "vtestream.h"
+
+static std::string
+make_text(size_t size)
+{
+        std::string text;
+        text.reserve(size + 200);
+
+        auto rand = g_rand_new_with_seed(42);
+        for (unsigned i = 0; text.size() < size; i++) {
+                char line[200];
+                auto const len = g_snprintf(line, sizeof(line),
+                                            "%06u 2019-10-17 12:%02u:%02u worker-%u: processed %u items in %u ms\n",
+                                            i, (i / 60) % 60, i % 60,
+                                            g_rand_int_range(rand, 0, 16),
+                                            g_rand_int_range(rand, 0, 100000),
+                                            g_rand_int_range(rand, 0, 1000));
+                text.append(line, len);
+        }
+        g_rand_free(rand);
+
+        return text;
+}
+
+static void
+bench_stream(char const* name,
+             VteStream* stream,
+             std::string const& text,
+             size_t n_random_reads)
+{
+        /* Append line by line */
+        std::vector<size_t> line_offsets;
+        auto const append_start = g_get_monotonic_time();
+        for (size_t start = 0; start < text.size(); ) {
+                auto const end = text.find('\n', start) + 1;
+                line_offsets.push_back(_vte_stream_head(stream));
+                _vte_stream_append(stream, text.data() + start, end - start);
+                start = end;
+        }
+        auto const append_time = g_get_monotonic_time() - append_start;
+
+        /* Read it all back, a page at a time */
+        std::vector<char> buf(4096);
+        auto const read_start = g_get_monotonic_time();
+        for (size_t offset = 0; offset < text.size(); offset += buf.size()) {
+                auto const len = std::min(buf.size(), text.size() - offset);
+                if (!_vte_stream_read(stream, offset, buf.data(), len) ||
+                    memcmp(buf.data(), text.data() + offset, len) != 0) {
+                        g_printerr("%s: failed to read back offset %" G_GSIZE_FORMAT "\n", name, offset);
+                        exit(EXIT_FAILURE);
+                }
+        }
+        auto const read_time = g_get_monotonic_time() - read_start;
+
+        /* Read random lines, as when scrolling around or searching */
+        auto rand = g_rand_new_with_seed(42);
+        auto const random_start = g_get_monotonic_time();
+        for (size_t i = 0; i < n_random_reads; i++) {
+                auto const line = size_t(g_rand_int_range(rand, 0, line_offsets.size() - 1));
+                auto const len = line_offsets[line + 1] - line_offsets[line];
+                if (!_vte_stream_read(stream, line_offsets[line], buf.data(), len)) {
+                        g_printerr("%s: failed to read line %" G_GSIZE_FORMAT "\n", name, line);
+                        exit(EXIT_FAILURE);
+                }
+        }
+        auto const random_time = g_get_monotonic_time() - random_start;
+        g_rand_free(rand);
+
+        /* bytes per µs is MB/s */
+        g_print("%-12s %10.1f %10.1f %10.2f\n",
+                name,
+                double(text.size()) / std::max(append_time, gint64{1}),
+                double(text.size()) / std::max(read_time, gint64{1}),
+                double(random_time) / double(std::max(n_random_reads, size_t{1})));
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        int size = 64;
+        int n_random_reads = 100000;
+        GOptionEntry const entries[] = {
+                { "size", 's', 0, G_OPTION_ARG_INT, &size,
+                  "Megabytes of text to append", "MB" },
+                { "reads", 'n', 0, G_OPTION_ARG_INT, &n_random_reads,
+                  "Number of random lines to read", "READS" },
+                { nullptr },
+        };
+
+        auto context = g_option_context_new("— scrollback stream benchmark");
+        g_option_context_add_main_entries(context, entries, nullptr);
+
+        GError* error = nullptr;
+        auto rv = g_option_context_parse(context, &argc, &argv, &error);
+        g_option_context_free(context);
+        if (!rv) {
+                g_printerr("Failed to parse arguments: %s\n", error->message);
+                g_error_free(error);
+                return EXIT_FAILURE;
+        }
+
+        auto const text = make_text(size_t(std::max(size, 1)) * 1024 * 1024);
+
+        g_print("%d MB of text, %d random reads\n", std::max(size, 1), n_random_reads);
+        g_print("%-12s %10s %10s %10s\n", "stream", "app MB/s", "read MB/s", "µs/line");
+
+        auto stream = _vte_file_stream_new();
+        bench_stream("file", stream, text, n_random_reads);
+        g_object_unref(stream);
+
+        for (auto codec : {VTE_STREAM_CODEC_NONE, VTE_STREAM_CODEC_LZ4, VTE_STREAM_CODEC_ZSTD, VTE_STREAM_CODEC_ZLIB}) {
+                if (!_vte_stream_codec_is_available(codec))
+                        continue;
+
+                auto name = g_strdup_printf("memory-%s", _vte_stream_codec_get_name(codec));
+                stream = _vte_mem_stream_new(codec, 0);
+                bench_stream(name, stream, text, n_random_reads);
+                g_object_unref(stream);
+                g_free(name);
+        }
+
+        return EXIT_SUCCESS;
+}
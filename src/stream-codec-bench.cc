@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compresses the given files (by default, the ones in perf/) in blocks of
+ * the size the scrollback streams use, with each available codec at a few
+ * levels, and reports the compression and decompression throughput, and
+ * the compression ratio.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "vtestream-codec.h"
+
+/* VTE_BOA_BLOCKSIZE with encryption */
+static constexpr size_t const k_block_size = 65536 - 4 - 4 - 16;
+
+static bool
+read_corpus(char const* path,
+            std::string& corpus)
+{
+        char* contents;
+        gsize len;
+        GError* error = nullptr;
+        if (!g_file_get_contents(path, &contents, &len, &error)) {
+                g_printerr("Failed to read %s: %s\n", path, error->message);
+                g_error_free(error);
+                return false;
+        }
+
+        corpus.append(contents, len);
+        g_free(contents);
+        return true;
+}
+
+static bool
+read_perf_corpora(std::string& corpus)
+{
+        GError* error = nullptr;
+        auto dir = g_dir_open(VTE_PERF_DIR, 0, &error);
+        if (dir == nullptr) {
+                g_printerr("Failed to open %s: %s\n", VTE_PERF_DIR, error->message);
+                g_error_free(error);
+                return false;
+        }
+
+        std::vector<std::string> names;
+        while (auto name = g_dir_read_name(dir))
+                names.emplace_back(name);
+        g_dir_close(dir);
+
+        /* Read them in a stable order, so that the results are comparable */
+        std::sort(names.begin(), names.end());
+        for (auto const& name : names) {
+                auto path = g_build_filename(VTE_PERF_DIR, name.c_str(), nullptr);
+                auto const rv = read_corpus(path, corpus);
+                g_free(path);
+                if (!rv)
+                        return false;
+        }
+
+        return true;
+}
+
+static void
+bench_codec(VteStreamCodec codec,
+            int level,
+            std::string const& corpus,
+            int n_rounds)
+{
+        auto const n_blocks = (corpus.size() + k_block_size - 1) / k_block_size;
+        auto const bound = _vte_stream_codec_compress_bound(codec, k_block_size);
+        std::vector<char> compressed(n_blocks * bound);
+        std::vector<gsize> compressed_len(n_blocks);
+        std::vector<char> block(k_block_size);
+
+        gsize total_compressed = 0;
+        auto const compress_start = g_get_monotonic_time();
+        for (auto round = 0; round < n_rounds; round++) {
+                total_compressed = 0;
+                for (size_t i = 0; i < n_blocks; i++) {
+                        /* The streams compress whole blocks; pad the last one like they do */
+                        auto const len = std::min(k_block_size, corpus.size() - i * k_block_size);
+                        memcpy(block.data(), corpus.data() + i * k_block_size, len);
+                        memset(block.data() + len, 0, k_block_size - len);
+
+                        auto clen = _vte_stream_codec_compress(codec, level,
+                                                               compressed.data() + i * bound, bound,
+                                                               block.data(), k_block_size);
+                        /* Stored as is if it doesn't compress */
+                        if (clen == 0 || clen >= k_block_size)
+                                clen = k_block_size;
+                        compressed_len[i] = clen;
+                        total_compressed += clen;
+                }
+        }
+        auto const compress_time = g_get_monotonic_time() - compress_start;
+
+        auto const uncompress_start = g_get_monotonic_time();
+        for (auto round = 0; round < n_rounds; round++) {
+                for (size_t i = 0; i < n_blocks; i++) {
+                        if (compressed_len[i] >= k_block_size)
+                                continue;
+
+                        auto const len = _vte_stream_codec_uncompress(codec, block.data(), k_block_size,
+                                                                      compressed.data() + i * bound,
+                                                                      compressed_len[i]);
+                        if (len != k_block_size) {
+                                g_printerr("%s level %d: block %" G_GSIZE_FORMAT " failed to uncompress\n",
+                                           _vte_stream_codec_get_name(codec), level, i);
+                                exit(EXIT_FAILURE);
+                        }
+                }
+        }
+        auto const uncompress_time = g_get_monotonic_time() - uncompress_start;
+
+        /* bytes per µs is MB/s */
+        auto const total = double(n_blocks * k_block_size) * n_rounds;
+        g_print("%-6s %5d %10.1f %10.1f %8.2f\n",
+                _vte_stream_codec_get_name(codec), level,
+                total / std::max(compress_time, gint64{1}),
+                total / std::max(uncompress_time, gint64{1}),
+                double(n_blocks * k_block_size) / double(std::max(total_compressed, gsize{1})));
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        int n_rounds = 100;
+        GOptionEntry const entries[] = {
+                { "rounds", 'n', 0, G_OPTION_ARG_INT, &n_rounds,
+                  "Number of times to compress the corpus", "ROUNDS" },
+                { nullptr },
+        };
+
+        auto context = g_option_context_new("[FILE…] — scrollback compression benchmark");
+        g_option_context_add_main_entries(context, entries, nullptr);
+
+        GError* error = nullptr;
+        auto rv = g_option_context_parse(context, &argc, &argv, &error);
+        g_option_context_free(context);
+        if (!rv) {
+                g_printerr("Failed to parse arguments: %s\n", error->message);
+                g_error_free(error);
+                return EXIT_FAILURE;
+        }
+
+        std::string corpus;
+        if (argc > 1) {
+                for (auto i = 1; i < argc; i++)
+                        if (!read_corpus(argv[i], corpus))
+                                return EXIT_FAILURE;
+        } else if (!read_perf_corpora(corpus)) {
+                return EXIT_FAILURE;
+        }
+
+        if (corpus.empty()) {
+                g_printerr("Empty corpus\n");
+                return EXIT_FAILURE;
+        }
+
+        n_rounds = std::max(n_rounds, 1);
+
+        struct {
+                VteStreamCodec codec;
+                int level;
+        } const configs[] = {
+                { VTE_STREAM_CODEC_NONE, 0 },
+                { VTE_STREAM_CODEC_ZLIB, 1 },
+                { VTE_STREAM_CODEC_ZLIB, 6 },
+                { VTE_STREAM_CODEC_LZ4,  -8 },
+                { VTE_STREAM_CODEC_LZ4,  1 },
+                { VTE_STREAM_CODEC_LZ4,  9 },
+                { VTE_STREAM_CODEC_ZSTD, -5 },
+                { VTE_STREAM_CODEC_ZSTD, 1 },
+                { VTE_STREAM_CODEC_ZSTD, 3 },
+        };
+
+        g_print("Corpus of %" G_GSIZE_FORMAT " bytes, %d rounds\n", corpus.size(), n_rounds);
+        g_print("%-6s %5s %10s %10s %8s\n", "codec", "level", "comp MB/s", "dec MB/s", "ratio");
+        for (auto const& config : configs) {
+                if (!_vte_stream_codec_is_available(config.codec))
+                        continue;
+
+                bench_codec(config.codec, config.level, corpus, n_rounds);
+        }
+
+        return EXIT_SUCCESS;
+}
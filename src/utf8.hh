@@ -52,6 +52,9 @@ public:
 
         inline constexpr uint32_t codepoint() const noexcept { return m_codepoint; }
 
+        /* Whether the decoder is in the middle of a multi-byte sequence */
+        inline constexpr bool in_sequence() const noexcept { return m_state != ACCEPT; }
+
         inline uint32_t decode(uint32_t byte) noexcept {
                 uint32_t type = kTable[byte];
                 m_codepoint = (m_state != ACCEPT) ?
@@ -32,6 +32,7 @@
 #endif
 
 #include <glib.h>
+#include <glib-unix.h>
 #include <glib/gi18n-lib.h>
 
 #include <vte/vte.h>
@@ -41,6 +42,7 @@
 #include "vtedraw.hh"
 #include "reaper.hh"
 #include "ring.hh"
+#include "scan.hh"
 #include "caps.hh"
 #include "widget.hh"
 
@@ -88,18 +90,22 @@ static int _vte_unichar_width(gunichar c, int utf8_ambiguous_width);
 static void stop_processing(vte::terminal::Terminal* that);
 static void add_process_timeout(vte::terminal::Terminal* that);
 static void add_update_timeout(vte::terminal::Terminal* that);
+static void add_update_timer(void);
 static void remove_update_timeout(vte::terminal::Terminal* that);
 
 static gboolean process_timeout (gpointer data);
 static gboolean update_timeout (gpointer data);
-static cairo_region_t *vte_cairo_get_clip_region (cairo_t *cr);
+static gboolean frame_tick_cb(GtkWidget* widget,
+                              GdkFrameClock* frame_clock,
+                              gpointer data);
 
 /* these static variables are guarded by the GDK mutex */
 static guint process_timeout_tag = 0;
 static gboolean in_process_timeout;
 static guint update_timeout_tag = 0;
 static gboolean in_update_timeout;
-static GList *g_active_terminals;
+static vte::base::Scheduler<vte::terminal::Terminal> g_scheduler;
+static vte::base::ScrollbackBudget<vte::terminal::Terminal> g_scrollback_budget;
 
 static int
 _vte_unichar_width(gunichar c, int utf8_ambiguous_width)
@@ -163,6 +169,38 @@ Terminal::ring_remove(vte::grid::row_t position)
 	_vte_ring_remove(m_screen->row_data, position);
 }
 
+/*
+ * Terminal::ring_rotate_region:
+ *
+ * Scrolls the rows from @start to @end (inclusive) down by @n rows if @n
+ * is positive, or up by -@n rows if negative, like removing a row at one
+ * end of the region and inserting one at the other @n times.
+ * The rows scrolled in are filled with the fill defaults.
+ *
+ * Doesn't invalidate; the caller should invalidate the region once.
+ */
+void
+Terminal::ring_rotate_region(vte::grid::row_t start,
+                             vte::grid::row_t end,
+                             vte::grid::row_t n)
+{
+	VteRing *ring = m_screen->row_data;
+
+	while (_vte_ring_next(ring) <= end)
+		ring_append(false);
+
+	_vte_ring_rotate_region(ring, start, end, n);
+
+        if (m_fill_defaults.attr.back() == VTE_DEFAULT_BG)
+                return;
+
+        auto const count = std::min(vte::grid::row_t(ABS(n)), end - start + 1);
+        if (n < 0)
+                start = end + 1 - count;
+        for (auto i = start; i < start + count; i++)
+                _vte_row_data_fill(_vte_ring_index_writable(ring, i), &m_fill_defaults, m_column_count);
+}
+
 /* Reset defaults for character insertion. */
 void
 Terminal::reset_default_attributes(bool reset_hyperlink)
@@ -229,7 +267,11 @@ Terminal::last_displayed_row() const
 }
 
 /* Note that end_row is inclusive. This is not as nice as end-exclusive,
- * but saves us from a +1 almost everywhere where this method is called. */
+ * but saves us from a +1 almost everywhere where this method is called.
+ *
+ * Only the cells of the rows that changed since they were last painted
+ * are repainted; they're found out when the updates are processed, see
+ * invalidate_damaged_rows(). */
 void
 Terminal::invalidate_rows(vte::grid::row_t row_start,
                           vte::grid::row_t row_end /* inclusive */)
@@ -259,6 +301,33 @@ Terminal::invalidate_rows(vte::grid::row_t row_start,
 		return;
 	}
 
+        m_damaged_rows.emplace_back(row_start, row_end);
+        /* Even when not processing, wait for the update, so that the
+         * changes made right after invalidating are in too. */
+        add_update_timeout(this);
+
+	_vte_debug_print (VTE_DEBUG_WORK, "!");
+}
+
+/* Invalidates the rows as a whole, even if their cells didn't change;
+ * for what's painted over the cells, like the cursor. */
+void
+Terminal::invalidate_rows_fully(vte::grid::row_t row_start,
+                                vte::grid::row_t row_end /* inclusive */)
+{
+	if (G_UNLIKELY (!widget_realized()))
+                return;
+
+        if (m_invalidated_all)
+		return;
+
+        if (G_UNLIKELY (row_end < row_start))
+                return;
+
+        /* Scrolled back, visible parts didn't change. */
+        if (row_start > last_displayed_row())
+                return;
+
         cairo_rectangle_int_t rect;
 	/* Convert the column and row start and end to pixel values
 	 * by multiplying by the size of a character cell.
@@ -277,12 +346,13 @@ Terminal::invalidate_rows(vte::grid::row_t row_start,
 			"Invalidating pixels at (%d,%d)x(%d,%d).\n",
 			rect.x, rect.y, rect.width, rect.height);
 
-	if (m_active_terminals_link != nullptr) {
+	if (is_processing()) {
                 g_array_append_val(m_update_rects, rect);
 		/* Wait a bit before doing any invalidation, just in
 		 * case updates are coming in really soon. */
 		add_update_timeout(this);
 	} else {
+                cairo_region_union_rectangle(m_frame_damage, &rect);
                 auto allocation = get_allocated_rect();
                 rect.x += allocation.x + m_padding.left;
                 rect.y += allocation.y + m_padding.top;
@@ -290,8 +360,254 @@ Terminal::invalidate_rows(vte::grid::row_t row_start,
 		gtk_widget_queue_draw_region(m_widget, region);
                 cairo_region_destroy(region);
 	}
+}
 
-	_vte_debug_print (VTE_DEBUG_WORK, "!");
+void
+Terminal::invalidate_row_fully(vte::grid::row_t row)
+{
+        invalidate_rows_fully(row, row);
+}
+
+/* Resolves the cells of @row_data, the row @row, from @start_column up to
+ * but not including @end_column into the runs of cells that draw_rows()
+ * paints alike, appending them to m_style_runs. */
+void
+Terminal::resolve_style_runs(vte::grid::row_t row,
+                             VteRowData const* row_data,
+                             vte::grid::column_t start_column,
+                             vte::grid::column_t end_column)
+{
+        VteCell const* prev = nullptr;
+        bool prev_selected = false;
+        StyleRun style{};
+        auto const first_run = m_style_runs.size();
+
+        for (auto col = start_column; col < end_column; col++) {
+                auto const cell = row_data ? _vte_row_data_get(row_data, col) : nullptr;
+                bool const selected = cell_is_selected(col, row);
+
+                /* The colours only depend on the attributes and the selection,
+                 * which mostly stay the same along a row. */
+                if (col == start_column ||
+                    selected != prev_selected ||
+                    (cell == nullptr) != (prev == nullptr) ||
+                    (cell != nullptr &&
+                     (cell->attr.attr != prev->attr.attr ||
+                      cell->attr.colors() != prev->attr.colors()))) {
+                        determine_colors(cell, selected, &style.fore, &style.back, &style.deco);
+                }
+                prev = cell;
+                prev_selected = selected;
+
+                style.start = col;
+                style.len = 1;
+                style.attr = cell ? cell->attr.attr : 0;
+                style.hyperlink = cell != nullptr && m_allow_hyperlink && cell->attr.hyperlink_idx != 0;
+                style.hilite = (style.hyperlink && cell->attr.hyperlink_idx == m_hyperlink_hover_idx) ||
+                               (!style.hyperlink && m_match != nullptr && m_match_span.contains(row, col));
+
+                if (m_style_runs.size() > first_run && m_style_runs.back().same_style(style))
+                        m_style_runs.back().len++;
+                else
+                        m_style_runs.push_back(style);
+        }
+}
+
+/* Resolves the cells of @row into m_damage_cells, as draw_rows() would paint them */
+void
+Terminal::resolve_damage_cells(vte::grid::row_t row)
+{
+        /* Deco colours take at most 25 bits, leaving room for these */
+        uint32_t const deco_hyperlink = 1u << 30;
+        uint32_t const deco_hilite = 1u << 31;
+
+        auto const row_data = find_row_data(row);
+        m_style_runs.clear();
+        resolve_style_runs(row, row_data, 0, m_column_count);
+        for (auto const& style : m_style_runs) {
+                for (auto col = style.start; col < style.start + style.len; col++) {
+                        auto const cell = row_data ? _vte_row_data_get(row_data, col) : nullptr;
+                        auto& damage_cell = m_damage_cells[col];
+
+                        damage_cell.c = cell ? cell->c : 0;
+                        damage_cell.attr = cell ? cell->attr.attr : 0;
+                        damage_cell.fore = style.fore;
+                        damage_cell.back = style.back;
+                        damage_cell.deco = style.deco |
+                                (style.hyperlink ? deco_hyperlink : 0) |
+                                (style.hilite ? deco_hilite : 0);
+                }
+        }
+}
+
+/* Diffs the visible ones of the rows invalidated since the last update
+ * against what they were last painted with, and adds the changed cells
+ * to @region, in view coordinates. */
+void
+Terminal::invalidate_damaged_rows(cairo_region_t* region)
+{
+        if (m_damaged_rows.empty())
+                return;
+
+        auto const first_row = first_displayed_row();
+        auto const last_row = last_displayed_row();
+        if (last_row < first_row) {
+                m_damaged_rows.clear();
+                return;
+        }
+
+        m_damage_grid.set_view(first_row, scroll_delta_pixel(), m_column_count, last_row - first_row + 1);
+        m_damage_cells.resize(m_column_count);
+
+        /* Don't diff any row twice */
+        std::sort(m_damaged_rows.begin(), m_damaged_rows.end());
+        auto row = first_row;
+        for (auto const& range : m_damaged_rows) {
+                auto const end = std::min(range.second, last_row);
+                for (row = std::max(row, range.first); row <= end; row++) {
+                        resolve_damage_cells(row);
+                        m_damage_grid.update(row - first_row, m_damage_cells.data(),
+                                             [&](long start_col, long end_col) {
+                                cairo_rectangle_int_t rect;
+                                /* Include the extra pixel border and overlap pixel */
+                                rect.x = start_col * m_cell_width - 1;
+                                rect.width = (end_col - start_col) * m_cell_width + 2;
+                                rect.y = row_to_pixel(row) - 1;
+                                rect.height = m_cell_height + 2;
+                                cairo_region_union_rectangle(region, &rect);
+                                cairo_region_union_rectangle(m_frame_damage, &rect);
+                        });
+                }
+        }
+        m_damaged_rows.clear();
+}
+
+/* Records that the text of rows @start to @end scrolled by @amount rows,
+ * down if positive, so that the frame is moved along at the next update
+ * instead of being repainted. */
+void
+Terminal::queue_frame_scroll(vte::grid::row_t start,
+                             vte::grid::row_t end,
+                             vte::grid::row_t amount)
+{
+        if (!m_frame_valid || m_invalidated_all)
+                return;
+
+        if (!m_frame_scrolls.empty()) {
+                auto& last = m_frame_scrolls.back();
+                if (last.start == start && last.end == end) {
+                        last.amount += amount;
+                        return;
+                }
+        }
+        m_frame_scrolls.push_back({start, end, amount});
+}
+
+/* Moves the pending damage in the band of @height pixels from @y by @dy
+ * pixels, as the frame is moved there. */
+void
+Terminal::shift_frame_damage(int y,
+                             int height,
+                             int dy)
+{
+        cairo_rectangle_int_t band = { -m_padding.left, y, int(get_allocated_width()), height };
+        auto moved = cairo_region_copy(m_frame_damage);
+        cairo_region_intersect_rectangle(moved, &band);
+        cairo_region_translate(moved, 0, dy);
+        cairo_region_intersect_rectangle(moved, &band);
+        cairo_region_subtract_rectangle(m_frame_damage, &band);
+        cairo_region_union(m_frame_damage, moved);
+        cairo_region_destroy(moved);
+}
+
+/* Moves the frame along with the text that scrolled since the last update,
+ * in scrolling regions and by moving the view, leaving only the rows that
+ * scrolled in to be painted. Adds what needs copying onto the widget again
+ * to @region, in view coordinates. */
+void
+Terminal::scroll_frame(cairo_region_t* region)
+{
+        m_frame_scrolled = false;
+
+        if (!m_frame_valid) {
+                m_frame_scrolls.clear();
+                return;
+        }
+
+        int const allocated_width = get_allocated_width();
+        int const view_height = m_view_usable_extents.height();
+        auto const top_row = m_damage_grid.top_row();
+        auto const old_offset = m_damage_grid.offset();
+        cairo_rectangle_int_t rect;
+
+        for (auto const& scroll : m_frame_scrolls) {
+                int const y = scroll.start * m_cell_height - old_offset;
+                int const height = (scroll.end - scroll.start + 1) * m_cell_height;
+                int const dy = scroll.amount * m_cell_height;
+
+                /* Only move whole rows, within the view */
+                if (old_offset % m_cell_height != 0 ||
+                    y < 0 || y + height > view_height ||
+                    std::abs(dy) >= height) {
+                        m_damage_grid.forget_rows(scroll.start - top_row, scroll.end - top_row);
+                        continue;
+                }
+
+                _vte_debug_print(VTE_DEBUG_UPDATES,
+                                 "Scrolling rows %ld..%ld of the frame by %ld.\n",
+                                 scroll.start, scroll.end, scroll.amount);
+
+                m_damage_grid.scroll_rows(scroll.start - top_row, scroll.end - top_row, scroll.amount);
+                shift_frame_damage(y, height, dy);
+                m_frame_shifts.push_back({y, height, dy});
+
+                /* The rows scrolled in are blank, but get painted as they're damaged anyway */
+                rect = { -m_padding.left, y, allocated_width, height };
+                cairo_region_union_rectangle(region, &rect);
+        }
+        m_frame_scrolls.clear();
+
+        int const dp = scroll_delta_pixel() - old_offset;
+        if (dp == 0)
+                return;
+
+        if (std::abs(dp) >= view_height) {
+                /* Nothing to keep */
+                m_frame_valid = false;
+                m_frame_shifts.clear();
+                rect = { -m_padding.left, -m_padding.top, allocated_width, int(get_allocated_height()) };
+                cairo_region_union_rectangle(region, &rect);
+                return;
+        }
+
+        _vte_debug_print(VTE_DEBUG_UPDATES,
+                         "Scrolling the frame by %d pixels.\n", dp);
+
+        m_damage_grid.scroll_view(first_displayed_row(), scroll_delta_pixel());
+        shift_frame_damage(0, view_height, -dp);
+        m_frame_shifts.push_back({0, view_height, -dp});
+
+        /* Paint the rows scrolled into view, including the bits of partially
+         * visible ones that weren't visible before. */
+        rect = { -m_padding.left, dp > 0 ? view_height - dp : 0, allocated_width, std::abs(dp) };
+        cairo_region_union_rectangle(m_frame_damage, &rect);
+        auto const start = pixel_to_row(rect.y);
+        auto const end = pixel_to_row(rect.y + rect.height - 1);
+        m_damage_grid.forget_rows(start - m_damage_grid.top_row(), end - m_damage_grid.top_row());
+        m_damaged_rows.emplace_back(start, end);
+
+        rect = { -m_padding.left, 0, allocated_width, view_height };
+        cairo_region_union_rectangle(region, &rect);
+}
+
+void
+Terminal::drop_frame()
+{
+        if (m_frame_surface != nullptr) {
+                cairo_surface_destroy(m_frame_surface);
+                m_frame_surface = nullptr;
+        }
+        m_frame_valid = false;
 }
 
 /* Convenience method */
@@ -352,7 +668,7 @@ Terminal::invalidate_all()
 	reset_update_rects();
 	m_invalidated_all = TRUE;
 
-        if (m_active_terminals_link != nullptr) {
+        if (is_processing()) {
                 auto allocation = get_allocated_rect();
                 cairo_rectangle_int_t rect;
                 rect.x = -m_padding.left;
@@ -521,7 +837,7 @@ Terminal::invalidate_cursor_once(bool periodic)
 		_vte_debug_print(VTE_DEBUG_UPDATES,
                                  "Invalidating cursor in row %ld.\n",
                                  row);
-                invalidate_row(row);
+                invalidate_row_fully(row);
 	}
 }
 
@@ -2685,9 +3001,9 @@ Terminal::cursor_down(bool explicit_sequence)
 				/* If we're at the bottom of the scrolling
 				 * region, add a line at the top to scroll the
 				 * bottom off. */
-				ring_remove(start);
-				ring_insert(end, true);
+				ring_rotate_region(start, end, -1);
 				/* Update the display. */
+                                queue_frame_scroll(start, end, -1);
                                 invalidate_rows(start, end);
 			}
 		} else {
@@ -2724,6 +3040,79 @@ Terminal::drop_scrollback()
                 queue_adjustment_value_changed(m_normal_screen.insert_delta);
                 adjust_adjustments_full();
         }
+
+        update_scrollback_usage();
+}
+
+void
+Terminal::set_scrollback_budget(size_t memory,
+                                size_t disk)
+{
+        g_scrollback_budget.set_limits(memory, disk);
+        g_scrollback_budget.enforce([](Terminal* that, size_t memory, size_t disk) {
+                        that->reclaim_scrollback(memory, disk);
+                });
+}
+
+/* The memory and disk taken by the rows of both screens; the frozen rows
+ * of the normal screen are on disk unless its streams are in memory. */
+void
+Terminal::get_scrollback_usage(size_t* memory,
+                               size_t* disk) const
+{
+        auto const ring = m_normal_screen.row_data;
+        auto const stream_bytes = ring->stream_bytes();
+        auto const in_memory = ring->stream_backend() == vte::base::Ring::StreamBackend::eMemory;
+
+        *memory = ring->writable_bytes() + m_alternate_screen.row_data->writable_bytes() +
+                (in_memory ? stream_bytes : 0);
+        *disk = in_memory ? 0 : stream_bytes;
+}
+
+void
+Terminal::update_scrollback_usage()
+{
+        size_t memory, disk;
+        get_scrollback_usage(&memory, &disk);
+        g_scrollback_budget.update(m_scrollback_budget_node, memory, disk);
+
+        g_scrollback_budget.enforce([](Terminal* that, size_t memory, size_t disk) {
+                        that->reclaim_scrollback(memory, disk);
+                });
+}
+
+/* Drops the oldest frozen rows of the normal screen until @memory bytes of
+ * memory or @disk bytes of disk, whichever its streams take, are reclaimed,
+ * estimating the rows to drop from the average size of a frozen row. Only
+ * the streams can be reclaimed; the writable rows are what's on screen. */
+void
+Terminal::reclaim_scrollback(size_t memory,
+                             size_t disk)
+{
+        auto const ring = m_normal_screen.row_data;
+        auto const bytes = ring->stream_backend() == vte::base::Ring::StreamBackend::eMemory ? memory : disk;
+        auto const stream_bytes = ring->stream_bytes();
+        auto const frozen = ring->frozen_rows();
+
+        if (bytes != 0 && stream_bytes != 0 && frozen != 0) {
+                auto const rows = std::min((guint64(bytes) * frozen + stream_bytes - 1) / stream_bytes,
+                                           guint64(frozen));
+                auto const dropped = ring->drop_frozen_rows(rows);
+
+                _vte_debug_print(VTE_DEBUG_RING,
+                                 "Scrollback budget: dropped %lu of %lu frozen rows to reclaim %" G_GSIZE_FORMAT " bytes.\n",
+                                 dropped, frozen, bytes);
+
+                if (m_screen == &m_normal_screen) {
+                        if (m_screen->scroll_delta < ring->delta())
+                                queue_adjustment_value_changed(ring->delta());
+                        adjust_adjustments_full();
+                }
+        }
+
+        size_t memory_usage, disk_usage;
+        get_scrollback_usage(&memory_usage, &disk_usage);
+        g_scrollback_budget.update(m_scrollback_budget_node, memory_usage, disk_usage);
 }
 
 /* Restore cursor on a screen. */
@@ -2767,6 +3156,56 @@ Terminal::save_cursor(VteScreen *screen__)
         screen__->saved.character_replacement = m_character_replacement;
 }
 
+/* DEC Special Character and Line Drawing Set.  VT100 and higher (per XTerm docs). */
+static gunichar const line_drawing_map[31] = {
+        0x25c6,  /* ` => diamond */
+        0x2592,  /* a => checkerboard */
+        0x2409,  /* b => HT symbol */
+        0x240c,  /* c => FF symbol */
+        0x240d,  /* d => CR symbol */
+        0x240a,  /* e => LF symbol */
+        0x00b0,  /* f => degree */
+        0x00b1,  /* g => plus/minus */
+        0x2424,  /* h => NL symbol */
+        0x240b,  /* i => VT symbol */
+        0x2518,  /* j => downright corner */
+        0x2510,  /* k => upright corner */
+        0x250c,  /* l => upleft corner */
+        0x2514,  /* m => downleft corner */
+        0x253c,  /* n => cross */
+        0x23ba,  /* o => scan line 1/9 */
+        0x23bb,  /* p => scan line 3/9 */
+        0x2500,  /* q => horizontal line (also scan line 5/9) */
+        0x23bc,  /* r => scan line 7/9 */
+        0x23bd,  /* s => scan line 9/9 */
+        0x251c,  /* t => left t */
+        0x2524,  /* u => right t */
+        0x2534,  /* v => bottom t */
+        0x252c,  /* w => top t */
+        0x2502,  /* x => vertical line */
+        0x2264,  /* y => <= */
+        0x2265,  /* z => >= */
+        0x03c0,  /* { => pi */
+        0x2260,  /* | => not equal */
+        0x00a3,  /* } => pound currency sign */
+        0x00b7,  /* ~ => bullet */
+};
+
+static inline gunichar
+replace_character(VteCharacterReplacement replacement,
+                  gunichar c)
+{
+        if (G_UNLIKELY (replacement == VTE_CHARACTER_REPLACEMENT_LINE_DRAWING)) {
+                if (c >= 96 && c <= 126)
+                        c = line_drawing_map[c - 96];
+        } else if (G_UNLIKELY (replacement == VTE_CHARACTER_REPLACEMENT_BRITISH)) {
+                if (G_UNLIKELY (c == '#'))
+                        c = 0x00a3;  /* pound sign */
+        }
+
+        return c;
+}
+
 /* Insert a single character into the stored data array. */
 void
 Terminal::insert_char(gunichar c,
@@ -2780,53 +3219,12 @@ Terminal::insert_char(gunichar c,
 	bool line_wrapped = false; /* cursor moved before char inserted */
         gunichar c_unmapped = c;
 
-        /* DEC Special Character and Line Drawing Set.  VT100 and higher (per XTerm docs). */
-        static const gunichar line_drawing_map[31] = {
-                0x25c6,  /* ` => diamond */
-                0x2592,  /* a => checkerboard */
-                0x2409,  /* b => HT symbol */
-                0x240c,  /* c => FF symbol */
-                0x240d,  /* d => CR symbol */
-                0x240a,  /* e => LF symbol */
-                0x00b0,  /* f => degree */
-                0x00b1,  /* g => plus/minus */
-                0x2424,  /* h => NL symbol */
-                0x240b,  /* i => VT symbol */
-                0x2518,  /* j => downright corner */
-                0x2510,  /* k => upright corner */
-                0x250c,  /* l => upleft corner */
-                0x2514,  /* m => downleft corner */
-                0x253c,  /* n => cross */
-                0x23ba,  /* o => scan line 1/9 */
-                0x23bb,  /* p => scan line 3/9 */
-                0x2500,  /* q => horizontal line (also scan line 5/9) */
-                0x23bc,  /* r => scan line 7/9 */
-                0x23bd,  /* s => scan line 9/9 */
-                0x251c,  /* t => left t */
-                0x2524,  /* u => right t */
-                0x2534,  /* v => bottom t */
-                0x252c,  /* w => top t */
-                0x2502,  /* x => vertical line */
-                0x2264,  /* y => <= */
-                0x2265,  /* z => >= */
-                0x03c0,  /* { => pi */
-                0x2260,  /* | => not equal */
-                0x00a3,  /* } => pound currency sign */
-                0x00b7,  /* ~ => bullet */
-        };
-
         insert |= m_modes_ecma.IRM();
 	invalidate_now |= insert;
 
 	/* If we've enabled the special drawing set, map the characters to
 	 * Unicode. */
-        if (G_UNLIKELY (*m_character_replacement == VTE_CHARACTER_REPLACEMENT_LINE_DRAWING)) {
-                if (c >= 96 && c <= 126)
-                        c = line_drawing_map[c - 96];
-        } else if (G_UNLIKELY (*m_character_replacement == VTE_CHARACTER_REPLACEMENT_BRITISH)) {
-                if (G_UNLIKELY (c == '#'))
-                        c = 0x00a3;  /* pound sign */
-        }
+        c = replace_character(*m_character_replacement, c);
 
 	/* Figure out how many columns this character should occupy. */
         columns = _vte_unichar_width(c, m_utf8_ambiguous_width);
@@ -2985,6 +3383,157 @@ not_inserted:
         m_line_wrapped = line_wrapped;
 }
 
+/*
+ * Terminal::insert_chars:
+ * @chars: the characters
+ * @n_chars: the number of characters in @chars
+ *
+ * Inserts a run of characters with the current attributes, like calling
+ * insert_char(c, false, false) on each of them, but writing each row
+ * segment of the run at once: its cells are cleaned up, filled and
+ * shrunk only once, and the widths are computed in one pass.
+ *
+ * Combining marks, NULs and insert mode take the slow path through
+ * insert_char().
+ *
+ * Doesn't invalidate; the caller should invalidate all rows from the
+ * cursor row before the call to the cursor row after it.
+ */
+template<typename T>
+void
+Terminal::insert_chars(T const* chars,
+                       size_t n_chars)
+{
+        bool line_wrapped = false;
+
+        if (G_UNLIKELY(m_modes_ecma.IRM())) {
+                for (size_t i = 0; i < n_chars; ++i) {
+                        insert_char(chars[i], false, false);
+                        line_wrapped |= m_line_wrapped;
+                }
+                m_line_wrapped = line_wrapped;
+                return;
+        }
+
+        auto const replacement = *m_character_replacement;
+
+        VteCellAttr attr = m_defaults.attr;
+        attr.copy_colors(m_color_defaults.attr);
+
+        /* The characters of the current segment, replaced and with their
+         * widths resolved, so that's done only once per character.
+         */
+        struct {
+                gunichar c;
+                int columns;
+        } segment[256];
+
+        /* The character at @resolved, carried over from the previous segment */
+        gunichar c = 0;
+        int columns = 0;
+        size_t resolved = n_chars;
+
+        size_t i = 0;
+        while (i < n_chars) {
+                if (resolved != i) {
+                        c = replace_character(replacement, chars[i]);
+                        columns = _vte_unichar_width(c, m_utf8_ambiguous_width);
+                }
+
+                /* Combining and wider than the whole row need the full treatment */
+                if (G_UNLIKELY(columns == 0 || c == 0 || columns > m_column_count)) {
+                        insert_char(chars[i++], false, false);
+                        line_wrapped |= m_line_wrapped;
+                        continue;
+                }
+
+                /* If we're autowrapping here, do it. */
+                long col = m_screen->cursor.col;
+                if (G_UNLIKELY(col + columns > m_column_count)) {
+                        if (m_modes_private.DEC_AUTOWRAP()) {
+                                _vte_debug_print(VTE_DEBUG_ADJ,
+                                                 "Autowrapping before character\n");
+                                col = m_screen->cursor.col = 0;
+                                /* Mark this line as soft-wrapped. */
+                                auto row = ensure_row();
+                                row->attr.soft_wrapped = 1;
+                                cursor_down(false);
+                        } else {
+                                /* Don't wrap, stay at the rightmost column. */
+                                col = m_screen->cursor.col =
+                                        m_column_count - columns;
+                        }
+                        line_wrapped = true;
+                }
+
+                /* Find the segment of the run that fits in this row */
+                segment[0] = {c, columns};
+                auto end_col = col + columns;
+                auto end = i + 1;
+                while (end < n_chars && end - i < G_N_ELEMENTS(segment)) {
+                        c = replace_character(replacement, chars[end]);
+                        columns = _vte_unichar_width(c, m_utf8_ambiguous_width);
+                        resolved = end;
+                        if (columns == 0 || c == 0 ||
+                            end_col + columns > m_column_count)
+                                break;
+
+                        segment[end - i] = {c, columns};
+                        end_col += columns;
+                        ++end;
+                }
+
+                _vte_debug_print(VTE_DEBUG_PARSER,
+                                 "Inserting %" G_GSIZE_FORMAT " characters (colors %" G_GUINT64_FORMAT ") (%ld..%ld, %ld), delta = %ld\n",
+                                 end - i,
+                                 m_color_defaults.attr.colors(),
+                                 col, end_col, (long)m_screen->cursor.row,
+                                 (long)m_screen->insert_delta);
+
+                /* Make sure we have enough rows to hold this data. */
+                auto row = ensure_cursor();
+                g_assert(row != NULL);
+
+                cleanup_fragments(col, end_col);
+                _vte_row_data_fill(row, &basic_cell, end_col);
+
+                auto cell = _vte_row_data_get_writable(row, col);
+                for (auto k = size_t{0}; k < end - i; ++k) {
+                        auto const seg_c = segment[k].c;
+                        auto const seg_columns = segment[k].columns;
+
+                        attr.set_columns(seg_columns);
+                        attr.set_fragment(false);
+                        cell->c = seg_c;
+                        cell->attr = attr;
+                        ++cell;
+
+                        /* insert wide-char fragments */
+                        attr.set_fragment(true);
+                        for (auto j = 1; j < seg_columns; ++j) {
+                                cell->c = seg_c;
+                                cell->attr = attr;
+                                ++cell;
+                        }
+                }
+
+                if (_vte_row_data_length (row) > m_column_count)
+                        cleanup_fragments(m_column_count, _vte_row_data_length (row));
+                _vte_row_data_shrink (row, m_column_count);
+
+                i = end;
+                m_screen->cursor.col = end_col;
+                m_last_graphic_character = chars[end - 1];
+
+                /* We added text, so make a note of it. */
+                m_text_inserted_flag = TRUE;
+        }
+
+        m_line_wrapped = line_wrapped;
+}
+
+template void Terminal::insert_chars(uint8_t const*, size_t);
+
 static void
 reaper_child_exited_cb(VteReaper *reaper,
                        int ipid,
@@ -3062,12 +3611,45 @@ io_read_cb(GIOChannel *channel,
         return that->pty_io_read(channel, condition);
 }
 
+/* The PTY reader thread has queued data, or has an event pending. */
+static gboolean
+pty_reader_notify_cb(int fd,
+                     GIOCondition condition,
+                     vte::terminal::Terminal* that)
+{
+        return that->pty_reader_notify();
+}
+
 void
 Terminal::connect_pty_read()
 {
 	if (m_pty_channel == NULL)
 		return;
 
+        if (m_enable_input_thread && !m_pty_reader) {
+                m_pty_reader = std::make_unique<vte::base::PtyReader>(vte_pty_get_fd(m_pty),
+                                                                     m_chunk_pool);
+                if (!m_pty_reader->start()) {
+                        g_warning("Failed to start the PTY reader thread, reading on the main thread instead.\n");
+                        m_pty_reader.reset();
+                        m_enable_input_thread = false;
+                }
+        }
+
+        if (m_pty_reader) {
+                if (m_pty_input_source == 0) {
+                        _vte_debug_print (VTE_DEBUG_IO, "polling PTY reader thread notifications\n");
+                        m_pty_input_source =
+                                g_unix_fd_add_full(VTE_CHILD_INPUT_PRIORITY,
+                                                   m_pty_reader->notify_fd(),
+                                                   G_IO_IN,
+                                                   (GUnixFDSourceFunc)pty_reader_notify_cb,
+                                                   this,
+                                                   (GDestroyNotify)mark_input_source_invalid_cb);
+                }
+                return;
+        }
+
 	if (m_pty_input_source == 0) {
 		_vte_debug_print (VTE_DEBUG_IO, "polling vte_terminal_io_read\n");
 		m_pty_input_source =
@@ -3478,7 +4060,7 @@ Terminal::convert_incoming() noexcept
         while (outlen > 0) {
                 outbuf = (char*)unibuf->data;
                 while (outlen > 0) {
-                        m_incoming_queue.push(vte::base::Chunk::get());
+                        m_incoming_queue.push(m_chunk_pool.get());
                         auto chunk = m_incoming_queue.back().get();
                         auto len = std::min(size_t(outlen), chunk->capacity());
                         memcpy(chunk->data, outbuf, len);
@@ -3493,8 +4075,15 @@ Terminal::convert_incoming() noexcept
 
 #endif /* WITH_ICONV */
 
+/*
+ * Terminal::process_incoming:
+ * @deadline: monotonic time (in µs) after which to stop processing
+ *
+ * Processes the queued incoming data. When @deadline has passed, the
+ * chunks not processed yet are left in the queue for the next pass.
+ */
 void
-Terminal::process_incoming()
+Terminal::process_incoming(gint64 deadline)
 {
 	VteVisualPosition saved_cursor;
 	gboolean saved_cursor_visible;
@@ -3510,6 +4099,8 @@ Terminal::process_incoming()
                          m_incoming_queue.size());
 	_vte_debug_print (VTE_DEBUG_WORK, "(");
 
+        auto const start_time = g_get_monotonic_time();
+
         auto previous_screen = m_screen;
 
         bottom = m_screen->insert_delta == (long)m_screen->scroll_delta;
@@ -3548,8 +4139,47 @@ Terminal::process_incoming()
         m_line_wrapped = false;
 
         size_t bytes_processed = 0;
+        size_t n_sequences = 0;
+        bool cut_short = false;
+
+        /* Updates the bbox after inserting a graphic character */
+        auto graphic_inserted = [&]() {
+                if (m_line_wrapped) {
+                        m_line_wrapped = false;
+                        /* line wrapped, correct bbox */
+                        if (invalidated_text &&
+                            (m_screen->cursor.row > bbox_bottom + VTE_CELL_BBOX_SLACK ||
+                             m_screen->cursor.row < bbox_top - VTE_CELL_BBOX_SLACK)) {
+                                /* Clip off any part of the box which isn't already on-screen. */
+                                bbox_top = std::max(bbox_top, top_row);
+                                bbox_bottom = std::min(bbox_bottom, bottom_row);
+
+                                invalidate_rows(bbox_top, bbox_bottom);
+                                bbox_bottom = -G_MAXINT;
+                                bbox_top = G_MAXINT;
+
+                        }
+                        bbox_top = std::min(bbox_top,
+                                            m_screen->cursor.row);
+                }
+                /* Add the cells over which we have moved to the region
+                 * which we need to refresh for the user. */
+                bbox_bottom = std::max(bbox_bottom,
+                                       m_screen->cursor.row);
+                invalidated_text = TRUE;
+
+                /* We *don't* emit flush pending signals here. */
+                modified = TRUE;
+        };
 
         while (!m_incoming_queue.empty()) {
+                /* Leave the rest for the next frame once the deadline has passed */
+                if (bytes_processed > 0 &&
+                    g_get_monotonic_time() >= deadline) {
+                        cut_short = true;
+                        break;
+                }
+
                 auto chunk = std::move(m_incoming_queue.front());
                 m_incoming_queue.pop();
 
@@ -3566,6 +4196,49 @@ Terminal::process_incoming()
 
                 for ( ; ip < iend; ++ip) {
 
+                        /* Fast path for runs of printable ASCII: in the ground state
+                         * and outside of a UTF-8 sequence, each of these bytes would
+                         * decode to itself and make the parser return VTE_SEQ_GRAPHIC,
+                         * leaving both in the state they are in now. So find the
+                         * whole run and insert it at once without going through either.
+                         */
+                        if (*ip >= 0x20 && *ip < 0x7f &&
+                            !m_utf8_decoder.in_sequence() &&
+                            m_parser.is_ground()) {
+                                auto const run = vte::base::printable_ascii_run(ip, iend - ip);
+
+                                _vte_debug_print(VTE_DEBUG_PARSER,
+                                                 "Printable ASCII run of %" G_GSIZE_FORMAT " bytes\n",
+                                                 run);
+
+                                /* If the run starts far from the current bbox, flush it */
+                                if (invalidated_text &&
+                                    (m_screen->cursor.row > bbox_bottom + VTE_CELL_BBOX_SLACK ||
+                                     m_screen->cursor.row < bbox_top - VTE_CELL_BBOX_SLACK)) {
+                                        /* Clip off any part of the box which isn't already on-screen. */
+                                        bbox_top = std::max(bbox_top, top_row);
+                                        bbox_bottom = std::min(bbox_bottom, bottom_row);
+
+                                        invalidate_rows(bbox_top, bbox_bottom);
+                                        bbox_bottom = -G_MAXINT;
+                                        bbox_top = G_MAXINT;
+                                }
+
+                                bbox_top = std::min(bbox_top,
+                                                    m_screen->cursor.row);
+
+                                insert_chars(ip, run);
+
+                                /* The bbox spans all rows the run was written to,
+                                 * even if it wrapped.
+                                 */
+                                m_line_wrapped = false;
+                                graphic_inserted();
+
+                                ip += run - 1;
+                                continue;
+                        }
+
                         switch (m_utf8_decoder.decode(*ip)) {
                         case vte::base::UTF8Decoder::REJECT_REWIND:
                                 /* Rewind the stream.
@@ -3618,33 +4291,7 @@ Terminal::process_incoming()
                                                          m_last_graphic_character,
                                                          g_unichar_isprint(m_last_graphic_character) ? m_last_graphic_character : 0xfffd);
 
-                                        if (m_line_wrapped) {
-                                                m_line_wrapped = false;
-                                                /* line wrapped, correct bbox */
-                                                if (invalidated_text &&
-                                                    (m_screen->cursor.row > bbox_bottom + VTE_CELL_BBOX_SLACK ||
-                                                     m_screen->cursor.row < bbox_top - VTE_CELL_BBOX_SLACK)) {
-                                                        /* Clip off any part of the box which isn't already on-screen. */
-                                                        bbox_top = std::max(bbox_top, top_row);
-                                                        bbox_bottom = std::min(bbox_bottom, bottom_row);
-
-                                                        invalidate_rows(bbox_top, bbox_bottom);
-                                                        bbox_bottom = -G_MAXINT;
-                                                        bbox_top = G_MAXINT;
-
-                                                }
-                                                bbox_top = std::min(bbox_top,
-                                                                    m_screen->cursor.row);
-                                        }
-                                        /* Add the cells over which we have moved to the region
-                                         * which we need to refresh for the user. */
-                                        bbox_bottom = std::max(bbox_bottom,
-                                                               m_screen->cursor.row);
-                                        invalidated_text = TRUE;
-
-                                        /* We *don't* emit flush pending signals here. */
-                                        modified = TRUE;
-
+                                        graphic_inserted();
                                         break;
                                 }
 
@@ -3666,6 +4313,7 @@ Terminal::process_incoming()
                                         }
 
                                         m_last_graphic_character = 0;
+                                        ++n_sequences;
 
                                         modified = TRUE;
 
@@ -3759,14 +4407,14 @@ Terminal::process_incoming()
             (saved_cursor.row != m_screen->cursor.row)) {
 		/* invalidate the old and new cursor positions */
 		if (saved_cursor_visible)
-                        invalidate_row(saved_cursor.row);
+                        invalidate_row_fully(saved_cursor.row);
 		invalidate_cursor_once();
 		check_cursor_blink();
 		/* Signal that the cursor moved. */
 		queue_cursor_moved();
         } else if ((saved_cursor_visible != m_modes_private.DEC_TEXT_CURSOR()) ||
                    (saved_cursor_style != m_cursor_style)) {
-                invalidate_row(saved_cursor.row);
+                invalidate_row_fully(saved_cursor.row);
 		check_cursor_blink();
 	}
 
@@ -3776,6 +4424,35 @@ Terminal::process_incoming()
         /* After processing some data, do a hyperlink GC. The multiplier is totally arbitrary, feel free to fine tune. */
         _vte_ring_hyperlink_maybe_gc(m_screen->row_data, bytes_processed * 8);
 
+        /* Count the scrollback the data added against the budget of all terminals */
+        update_scrollback_usage();
+
+        /* Data fed directly isn't accounted for in m_input_bytes */
+        if (m_incoming_queue.empty())
+                m_input_bytes = 0;
+        else
+                m_input_bytes -= std::min(m_input_bytes, bytes_processed);
+
+        m_input_budget.parse_sample(bytes_processed, n_sequences,
+                                    g_get_monotonic_time() - start_time,
+                                    cut_short);
+
+        _VTE_DEBUG_IF(VTE_DEBUG_IO) {
+                auto const state = m_input_budget.state();
+                g_printerr("Input budget: %s%s pass, %.0f/%.0f/%.0f bytes/ms text/mixed/control, "
+                           "draw %.1f ms, parse %.1f ms, next %" G_GSIZE_FORMAT " bytes, "
+                           "%" G_GUINT64_FORMAT " deadlines missed\n",
+                           state.last_class == vte::terminal::InputBudget::Class::TEXT ? "text" :
+                           state.last_class == vte::terminal::InputBudget::Class::MIXED ? "mixed" : "control",
+                           cut_short ? " (cut short)" : "",
+                           state.rate[size_t(vte::terminal::InputBudget::Class::TEXT)],
+                           state.rate[size_t(vte::terminal::InputBudget::Class::MIXED)],
+                           state.rate[size_t(vte::terminal::InputBudget::Class::CONTROL)],
+                           state.draw_time, state.parse_time,
+                           state.max_bytes,
+                           state.n_deadlines_missed);
+        }
+
 	_vte_debug_print (VTE_DEBUG_WORK, ")");
 	_vte_debug_print (VTE_DEBUG_IO,
                           "%" G_GSIZE_FORMAT " bytes in %" G_GSIZE_FORMAT " chunks left to process.\n",
@@ -3783,6 +4460,30 @@ Terminal::process_incoming()
                           m_incoming_queue.size());
 }
 
+/*
+ * Terminal::pty_read_budget:
+ *
+ * Limit the amount read between updates, so as to
+ * 1. maintain fairness between multiple terminals: while the terminal
+ *    is active, what it reads is charged against its deficit in the
+ *    scheduler, which is replenished on each of its turns;
+ * 2. prevent reading the entire output of a command in one
+ *    pass, i.e. we always try to refresh the terminal every frame.
+ *    See InputBudget where we estimate the maximum number of
+ *    bytes we can read/process in between frames.
+ *
+ * Returns: the maximum number of bytes to queue for processing
+ */
+size_t
+Terminal::pty_read_budget() const
+{
+        auto const max_bytes = m_input_budget.max_bytes();
+        if (!is_processing())
+                return max_bytes;
+
+        return std::min(max_bytes, m_input_bytes + m_scheduler_node.deficit());
+}
+
 bool
 Terminal::pty_io_read(GIOChannel *channel,
                                 GIOCondition condition)
@@ -3798,99 +4499,75 @@ Terminal::pty_io_read(GIOChannel *channel,
 	/* Read some data in from this channel. */
 	if (condition & (G_IO_IN | G_IO_PRI)) {
 		const int fd = g_io_channel_unix_get_fd (channel);
-		guchar *bp;
-		int rem, len;
-		guint bytes, max_bytes;
-
-		/* Limit the amount read between updates, so as to
-		 * 1. maintain fairness between multiple terminals;
-		 * 2. prevent reading the entire output of a command in one
-		 *    pass, i.e. we always try to refresh the terminal ~40Hz.
-		 *    See time_process_incoming() where we estimate the
-		 *    maximum number of bytes we can read/process in between
-		 *    updates.
-		 */
-		max_bytes = m_active_terminals_link != nullptr ?
-		            g_list_length(g_active_terminals) - 1 : 0;
-		if (max_bytes) {
-			max_bytes = m_max_input_bytes / max_bytes;
-		} else {
-			max_bytes = m_max_input_bytes;
-		}
+		size_t bytes, max_bytes;
+
+		max_bytes = pty_read_budget();
 		bytes = m_input_bytes;
 
-                vte::base::Chunk* chunk = nullptr;
-                /* If possible, try adding more data to the chunk at the back of the queue */
-                if (!m_incoming_queue.empty())
-                        chunk = m_incoming_queue.back().get();
+                /* Chunks to read into once the chunk at the back of the queue is full.
+                 * Any not used at the end are returned to the pool.
+                 */
+                vte::base::Chunk::unique_type spare[vte::base::k_pty_read_max_chunks];
+                auto const capacity = sizeof(vte::base::Chunk::data);
 
 		do {
-                        /* No chunk, or chunk at least ¾ full? Get a new chunk */
-			if (!chunk ||
-                            chunk->len >= 3 * chunk->capacity() / 4) {
-                                m_incoming_queue.push(vte::base::Chunk::get());
+                        /* If possible, try adding more data to the chunk at the back of the queue */
+                        vte::base::Chunk* tail = nullptr;
+                        size_t room = 0;
+                        if (!m_incoming_queue.empty()) {
+                                tail = m_incoming_queue.back().get();
+                                room = tail->remaining_capacity();
+                        }
 
-                                chunk = m_incoming_queue.back().get();
-			}
+                        /* Offer enough room to read up to the budget in one go */
+                        auto want = max_bytes > bytes ? max_bytes - bytes : 1;
+                        auto n_spare = want > room ? (want - room + capacity - 1) / capacity : 0;
+                        n_spare = std::min(n_spare, size_t(vte::base::k_pty_read_max_chunks));
+                        for (size_t i = 0; i < n_spare; ++i) {
+                                if (!spare[i])
+                                        spare[i] = m_chunk_pool.get();
+                        }
 
-			rem = chunk->remaining_capacity();
-			bp = chunk->data + chunk->len;
-			len = 0;
-			do {
-                                /* We'd like to read (fd, bp, rem); but due to TIOCPKT mode
-                                 * there's an extra input byte returned at the beginning.
-                                 * We need to see what that byte is, but otherwise drop it
-                                 * and write continuously to chunk->data.
+                        uint8_t pkt_header;
+                        auto ret = vte::base::pty_read_chunks(fd, &pkt_header, tail, spare, n_spare);
+                        if (ret == -1) {
+                                err = errno;
+                                break;
+                        }
+                        if (ret == 0) {
+                                eof = TRUE;
+                                break;
+                        }
+
+                        if (pkt_header & TIOCPKT_IOCTL) {
+                                /* We'd like to always be informed when the termios change,
+                                 * so we can e.g. detect when no-echo is en/disabled and
+                                 * change the cursor/input method/etc., but unfortunately
+                                 * the kernel only sends this flag when (old or new) 'local flags'
+                                 * include EXTPROC, which is not used often, and due to its side
+                                 * effects, cannot be enabled by vte by default.
+                                 *
+                                 * FIXME: improve the kernel! see discussion in bug 755371
+                                 * starting at comment 12
                                  */
-                                char pkt_header;
-                                char save = bp[-1];
-                                int ret = read (fd, bp - 1, rem + 1);
-                                pkt_header = bp[-1];
-                                bp[-1] = save;
-				switch (ret){
-					case -1:
-						err = errno;
-						goto out;
-					case 0:
-						eof = TRUE;
-						goto out;
-					default:
-                                                ret--;
-
-                                                if (pkt_header & TIOCPKT_IOCTL) {
-                                                        /* We'd like to always be informed when the termios change,
-                                                         * so we can e.g. detect when no-echo is en/disabled and
-                                                         * change the cursor/input method/etc., but unfortunately
-                                                         * the kernel only sends this flag when (old or new) 'local flags'
-                                                         * include EXTPROC, which is not used often, and due to its side
-                                                         * effects, cannot be enabled by vte by default.
-                                                         *
-                                                         * FIXME: improve the kernel! see discussion in bug 755371
-                                                         * starting at comment 12
-                                                         */
-                                                        pty_termios_changed();
-                                                }
-                                                if (pkt_header & TIOCPKT_STOP) {
-                                                        pty_scroll_lock_changed(true);
-                                                } else if (pkt_header & TIOCPKT_START) {
-                                                        pty_scroll_lock_changed(false);
-                                                }
+                                pty_termios_changed();
+                        }
+                        if (pkt_header & TIOCPKT_STOP) {
+                                pty_scroll_lock_changed(true);
+                        } else if (pkt_header & TIOCPKT_START) {
+                                pty_scroll_lock_changed(false);
+                        }
 
-						bp += ret;
-						rem -= ret;
-						len += ret;
-						break;
-				}
-			} while (rem);
-out:
-			chunk->len += len;
-			bytes += len;
-		} while (bytes < max_bytes &&
-		         chunk->len == chunk->capacity());
-
-                /* We may have an empty chunk at the back of the queue, but
-                 * that doesn't matter, we'll fill it next time.
-                 */
+                        /* The chunks are filled in order, so the ones with data are a prefix */
+                        for (size_t i = 0; i < n_spare && spare[i]->len > 0; ++i)
+                                m_incoming_queue.push(std::move(spare[i]));
+
+                        bytes += ret - 1;
+
+                        /* A short read means the PTY is drained for now */
+                        if (size_t(ret - 1) < room + n_spare * capacity)
+                                break;
+		} while (bytes < max_bytes);
 
 		if (!is_processing()) {
                         G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
@@ -3903,11 +4580,12 @@ out:
 			gdk_threads_leave ();
                         G_GNUC_END_IGNORE_DEPRECATIONS;
 		}
-		m_pty_input_active = len != 0;
+		m_pty_input_active = bytes != m_input_bytes;
+                g_scheduler.charge(m_scheduler_node, bytes - m_input_bytes);
 		m_input_bytes = bytes;
 		again = bytes < max_bytes;
 
-		_vte_debug_print (VTE_DEBUG_IO, "read %d/%d bytes, again? %s, active? %s\n",
+		_vte_debug_print (VTE_DEBUG_IO, "read %" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT " bytes, again? %s, active? %s\n",
 				bytes, max_bytes,
 				again ? "yes" : "no",
 				m_pty_input_active ? "yes" : "no");
@@ -3953,6 +4631,128 @@ out:
 	return again;
 }
 
+bool
+Terminal::pty_reader_notify()
+{
+	_vte_debug_print (VTE_DEBUG_WORK, ".");
+
+        m_pty_reader->acknowledge();
+
+        /* The data itself is moved over in pty_reader_pull() when processing */
+        if (!is_processing()) {
+                G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
+                gdk_threads_enter ();
+                G_GNUC_END_IGNORE_DEPRECATIONS;
+
+                add_process_timeout(this);
+
+                G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
+                gdk_threads_leave ();
+                G_GNUC_END_IGNORE_DEPRECATIONS;
+        }
+
+        return true;
+}
+
+/*
+ * Terminal::pty_reader_pull:
+ *
+ * Moves chunks read by the PTY reader thread into the incoming queue,
+ * up to the same budget that pty_io_read() observes, and handles the
+ * packet mode events and EOF it encountered.
+ */
+void
+Terminal::pty_reader_pull()
+{
+        g_assert(m_pty_reader);
+
+        auto const pkt_flags = m_pty_reader->take_packet_flags();
+        if (pkt_flags & TIOCPKT_IOCTL) {
+                /* See the comment in pty_io_read() */
+                pty_termios_changed();
+        }
+        if (pkt_flags & TIOCPKT_STOP) {
+                pty_scroll_lock_changed(true);
+        } else if (pkt_flags & TIOCPKT_START) {
+                pty_scroll_lock_changed(false);
+        }
+
+        auto const max_bytes = pty_read_budget();
+        auto bytes = m_input_bytes;
+        while (bytes < max_bytes) {
+                auto chunk = m_pty_reader->pop();
+                if (!chunk)
+                        break;
+
+                bytes += chunk->len;
+                m_incoming_queue.push(std::move(chunk));
+        }
+
+        _vte_debug_print (VTE_DEBUG_IO, "pulled %" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT " bytes from reader thread\n",
+                          bytes - m_input_bytes, max_bytes);
+        g_scheduler.charge(m_scheduler_node, bytes - m_input_bytes);
+        m_input_bytes = bytes;
+
+        if (!m_pty_reader->empty())
+                return;
+
+        /* The reader thread exits on error too, so treat that like EOF */
+        if (auto err = m_pty_reader->error()) {
+                /* Translators: %s is replaced with error message returned by strerror(). */
+                g_warning (_("Error reading from child: " "%s."),
+                           g_strerror (err));
+        } else if (!m_pty_reader->eof()) {
+                return;
+        }
+
+        /* Note that this destroys m_pty_reader */
+        pty_channel_eof();
+}
+
+/*
+ * Terminal::stop_pty_reader:
+ *
+ * Stops the PTY reader thread, if any, keeping all the data it
+ * has already read.
+ */
+void
+Terminal::stop_pty_reader()
+{
+        if (!m_pty_reader)
+                return;
+
+        m_pty_reader->stop();
+        while (auto chunk = m_pty_reader->pop()) {
+                m_input_bytes += chunk->len;
+                m_incoming_queue.push(std::move(chunk));
+        }
+
+        m_pty_reader.reset();
+}
+
+/* Releases the incoming data chunks kept beyond the pool's budget */
+void
+Terminal::trim_chunk_pool()
+{
+        auto const n_released = m_chunk_pool.trim();
+        if (n_released == 0)
+                return;
+
+        _VTE_DEBUG_IF(VTE_DEBUG_IO) {
+                auto const stats = m_chunk_pool.stats();
+                g_printerr("Chunk pool: released %" G_GSIZE_FORMAT " slabs, "
+                           "%" G_GSIZE_FORMAT " bytes kept (peak %" G_GSIZE_FORMAT "), "
+                           "%" G_GSIZE_FORMAT " chunks in flight (peak %" G_GSIZE_FORMAT "), "
+                           "%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " reused, "
+                           "%" G_GUINT64_FORMAT " slab allocations\n",
+                           n_released,
+                           stats.memory_size(), stats.peak_slabs * vte::base::ChunkPool::k_slab_size,
+                           stats.in_flight, stats.peak_in_flight,
+                           stats.n_reused, stats.n_gets,
+                           stats.n_slab_allocs);
+        }
+}
+
 /*
  * Terminal::feed:
  * @data: (array length=length) (element-type guint8): a string in the terminal's current encoding
@@ -3985,7 +4785,7 @@ Terminal::feed(char const* data,
                         chunk = achunk.get();
         }
         if (chunk == nullptr) {
-                m_incoming_queue.push(vte::base::Chunk::get());
+                m_incoming_queue.push(m_chunk_pool.get());
                 chunk = m_incoming_queue.back().get();
         }
 
@@ -4002,7 +4802,7 @@ Terminal::feed(char const* data,
                 data += len;
 
                 /* Get another chunk for the remaining data */
-                m_incoming_queue.push(vte::base::Chunk::get());
+                m_incoming_queue.push(m_chunk_pool.get());
                 chunk = m_incoming_queue.back().get();
         } while (true);
 
@@ -7565,6 +8365,77 @@ Terminal::screen_set_size(VteScreen *screen_,
 		screen_->scroll_delta = new_scroll_delta;
 }
 
+static gboolean
+vte_terminal_rewrap_cb(vte::terminal::Terminal* that)
+{
+        return that->rewrap_step() ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/* Start rewrapping in the background the scrollback rows that rewrapping
+ * the normal screen on resize left with the old wrapping. */
+void
+Terminal::start_rewrap()
+{
+        if (m_rewrap_tag != 0 || !m_normal_screen.row_data->rewrap_pending())
+                return;
+
+        m_rewrap_tag = g_idle_add_full(G_PRIORITY_LOW,
+                                       (GSourceFunc)vte_terminal_rewrap_cb,
+                                       this,
+                                       nullptr);
+}
+
+void
+Terminal::stop_rewrap()
+{
+        if (m_rewrap_tag == 0)
+                return;
+
+        g_source_remove(m_rewrap_tag);
+        m_rewrap_tag = 0;
+}
+
+/* Rewrap for a while; returns whether there's more to do. When done, the
+ * rows above the split are replaced, and if the rows below had to move down
+ * to make room, so do the deltas, the cursor and the selection. */
+bool
+Terminal::rewrap_step()
+{
+        auto ring = m_normal_screen.row_data;
+        vte::base::Ring::row_t split, shift;
+
+        if (!ring->rewrap_step(g_get_monotonic_time() + VTE_REWRAP_STEP_TIME * 1000, &split, &shift)) {
+                return true;
+        }
+
+        m_rewrap_tag = 0;
+
+        m_normal_screen.insert_delta += shift;
+        m_normal_screen.cursor.row += shift;
+        if (m_screen == &m_normal_screen) {
+                if (!m_selection_resolved.empty()) {
+                        if (m_selection_resolved.start_row() < (long) split)
+                                deselect_all();
+                        else
+                                m_selection_resolved.set({ m_selection_resolved.start_row() + (long) shift,
+                                                           m_selection_resolved.start_column() },
+                                                         { m_selection_resolved.end_row() + (long) shift,
+                                                           m_selection_resolved.end_column() });
+                }
+
+                match_contents_clear();
+                queue_adjustment_value_changed(MAX(m_screen->scroll_delta + shift, ring->delta()));
+                adjust_adjustments_full();
+                invalidate_all();
+        } else {
+                m_normal_screen.scroll_delta += shift;
+        }
+
+        update_scrollback_usage();
+
+        return false;
+}
+
 void
 Terminal::set_size(long columns,
                              long rows)
@@ -7602,6 +8473,7 @@ Terminal::set_size(long columns,
 
 		/* Resize the normal screen and (if rewrapping is enabled) rewrap it even if the alternate screen is visible: bug 415277 */
 		screen_set_size(&m_normal_screen, old_columns, old_rows, m_rewrap_on_resize);
+                start_rewrap();
 		/* Resize the alternate screen if it's the current one, but never rewrap it: bug 336238 comment 60 */
 		if (m_screen == &m_alternate_screen)
 			screen_set_size(&m_alternate_screen, old_columns, old_rows, false);
@@ -7645,7 +8517,13 @@ Terminal::vadjustment_value_changed()
 	if (!_vte_double_equal(dy, 0)) {
 		_vte_debug_print(VTE_DEBUG_ADJ,
 			    "Scrolling by %f\n", dy);
-                invalidate_all();
+                if (m_frame_valid && !m_invalidated_all) {
+                        /* Move the frame along at the next update */
+                        m_frame_scrolled = true;
+                        add_update_timeout(this);
+                } else {
+                        invalidate_all();
+                }
                 match_contents_clear();
 		emit_text_scrolled(dy);
 		queue_contents_changed();
@@ -7731,6 +8609,7 @@ Terminal::Terminal(vte::platform::Widget* w,
                                            FALSE /* clear */,
                                            sizeof(cairo_rectangle_int_t),
                                            32 /* preallocated size */);
+        m_frame_damage = cairo_region_create();
 
 	/* Set an adjustment for the application to use to control scrolling. */
         m_vadjustment = nullptr;
@@ -7778,7 +8657,6 @@ Terminal::Terminal(vte::platform::Widget* w,
 	/* Set up I/O encodings. */
         g_assert_true(m_using_utf8);
         m_utf8_ambiguous_width = VTE_DEFAULT_UTF8_AMBIGUOUS_WIDTH;
-	m_max_input_bytes = VTE_MAX_INPUT_READ;
 	m_cursor_blink_tag = 0;
         m_text_blink_tag = 0;
 	m_outgoing = _vte_byte_array_new();
@@ -7875,6 +8753,10 @@ Terminal::Terminal(vte::platform::Widget* w,
         m_padding = default_padding;
         update_view_extents();
 
+        /* Count the scrollback against the budget of all terminals, as the most recently viewed */
+        g_scrollback_budget.add(m_scrollback_budget_node);
+        update_scrollback_usage();
+
 #ifdef VTE_DEBUG
         if (g_test_flags != 0) {
                 static char const warning[] = "\e[1m\e[31mWARNING:\e[39m Test mode enabled. This is insecure!\e[0m\n\e[G";
@@ -8026,6 +8908,7 @@ Terminal::widget_unrealize()
 		m_draw = NULL;
 	}
 	m_fontdirty = TRUE;
+        drop_frame();
 
 	/* Unmap the widget if it hasn't been already. */
         // FIXMEchpe this can't happen
@@ -8089,6 +8972,10 @@ Terminal::~Terminal()
 
         /* Stop processing input. */
         stop_processing(this);
+        remove_frame_watchdog();
+        stop_rewrap();
+
+        g_scrollback_budget.remove(m_scrollback_budget_node);
 
 	/* Free the draw structure. */
 	if (m_draw != NULL) {
@@ -8185,6 +9072,9 @@ Terminal::~Terminal()
 
         /* Update rects */
         g_array_free(m_update_rects, TRUE /* free segment */);
+
+        drop_frame();
+        cairo_region_destroy(m_frame_damage);
 }
 
 void
@@ -8521,6 +9411,23 @@ Terminal::draw_cells(struct _vte_draw_text_request *items,
                                            attr & VTE_ATTR_ITALIC));
 }
 
+/* Draw a string of characters of a style run. */
+void
+Terminal::draw_cells(struct _vte_draw_text_request *items,
+                     gssize n,
+                     StyleRun const& style,
+                     int column_width,
+                     int row_height)
+{
+        uint32_t const attr_mask = m_allow_bold ? ~0 : ~VTE_ATTR_BOLD_MASK;
+
+        draw_cells(items, n,
+                   style.fore, style.back, style.deco, FALSE, FALSE,
+                   style.attr & attr_mask,
+                   style.hyperlink, style.hilite,
+                   column_width, row_height);
+}
+
 /* FIXME: we don't have a way to tell GTK+ what the default text attributes
  * should be, so for now at least it's assuming white-on-black is the norm and
  * is using "black-on-white" to signify "inverse".  Pick up on that state and
@@ -8790,6 +9697,8 @@ void
 Terminal::draw_rows(VteScreen *screen_,
                               vte::grid::row_t start_row,
                               vte::grid::row_t end_row,
+                              vte::grid::column_t start_column,
+                              vte::grid::column_t end_column,
                               gint start_y,
                               gint column_width,
                               gint row_height)
@@ -8798,19 +9707,39 @@ Terminal::draw_rows(VteScreen *screen_,
         vte::grid::row_t row;
         vte::grid::column_t i, j, col;
         long y;
-        guint fore, nfore, back, nback, deco, ndeco;
-        gboolean hyperlink = FALSE, nhyperlink, hilite = FALSE, nhilite;
-        gboolean selected;
-        uint32_t attr = 0, nattr;
 	guint item_count;
 	const VteCell *cell;
 	VteRowData const* row_data;
 
         auto const column_count = m_column_count;
-        uint32_t const attr_mask = m_allow_bold ? ~0 : ~VTE_ATTR_BOLD_MASK;
 
         items = g_newa (struct _vte_draw_text_request, column_count);
 
+        m_cells_painted += (end_row - start_row) * (end_column - start_column);
+
+        /* Resolve the style runs of each row once, for both passes below.
+         * The text starts at the character covering the first column, which
+         * may begin to its left if it's wide or followed by spacing marks. */
+        m_style_runs.clear();
+        m_style_run_rows.clear();
+        for (row = start_row; row < end_row; row++) {
+		row_data = find_row_data(row);
+
+                col = start_column;
+                if (row_data != nullptr) {
+                        for (; col > 0; col--) {
+                                cell = _vte_row_data_get (row_data, col);
+                                if (cell == NULL ||
+                                    !(cell->attr.fragment() || g_unichar_ismark (_vte_unistr_get_base (cell->c))))
+                                        break;
+                        }
+                }
+
+                m_style_run_rows.push_back(m_style_runs.size());
+                resolve_style_runs(row, row_data, col, end_column);
+        }
+        m_style_run_rows.push_back(m_style_runs.size());
+
         /* Paint the background.
          * Do it first for all the cells we're about to paint, before drawing the glyphs,
          * so that overflowing bits of a glyph (to the right or downwards) won't be
@@ -8818,29 +9747,19 @@ Terminal::draw_rows(VteScreen *screen_,
          * background or any other attribute.
          * Process each row independently. */
         for (row = start_row, y = start_y; row < end_row; row++, y += row_height) {
-		row_data = find_row_data(row);
-                i = j = 0;
-                /* Walk the line.
-                 * Locate runs of identical bg colors within a row, and paint each run as a single rectangle. */
-                do {
-                        /* Get the first cell's contents. */
-                        cell = row_data ? _vte_row_data_get (row_data, i) : nullptr;
-                        /* Find the colors for this cell. */
-                        selected = cell_is_selected(i, row);
-                        determine_colors(cell, selected, &fore, &back, &deco);
-
-                        while (++j < column_count) {
-                                /* Retrieve the next cell. */
-                                cell = row_data ? _vte_row_data_get (row_data, j) : nullptr;
-                                /* Resolve attributes to colors where possible and
-                                 * compare visual attributes to the first character
-                                 * in this chunk. */
-                                selected = cell_is_selected(j, row);
-                                determine_colors(cell, selected, &nfore, &nback, &ndeco);
-                                if (nback != back) {
-                                        break;
-                                }
-                        }
+                /* Walk the runs.
+                 * Merge runs of identical bg colors within a row, and paint each as a single rectangle. */
+                auto run = m_style_runs.cbegin() + m_style_run_rows[row - start_row];
+                auto const runs_end = m_style_runs.cbegin() + m_style_run_rows[row - start_row + 1];
+                while (run->start + run->len <= start_column)
+                        ++run;
+                while (run != runs_end) {
+                        auto const back = run->back;
+                        i = MAX(run->start, start_column);
+                        do {
+                                j = run->start + run->len;
+                        } while (++run != runs_end && run->back == back);
+
                         if (back != VTE_DEFAULT_BG) {
                                 vte::color::rgb bg;
                                 rgb_from_index<8, 8, 8>(back, bg);
@@ -8851,10 +9770,7 @@ Terminal::draw_rows(VteScreen *screen_,
                                                           row_height,
                                                           &bg, VTE_DRAW_OPAQUE);
                         }
-                        /* We'll need to continue at the first cell which didn't
-                         * match the first one in this set. */
-                        i = j;
-                } while (i < column_count);
+                }
         }
 
 
@@ -8866,10 +9782,14 @@ Terminal::draw_rows(VteScreen *screen_,
                         continue;
                 }
 
+                auto run = m_style_runs.cbegin() + m_style_run_rows[row - start_row];
+                col = run->start;
+
                 /* Walk the line.
-                 * Locate runs of identical attributes within a row, and draw each run using a single draw_cells() call. */
+                 * Draw each run of cells of the same style using a single draw_cells() call. */
+                StyleRun const* style = nullptr;
                 item_count = 0;
-                for (col = 0; col < column_count; ) {
+                while (col < end_column) {
                         /* Get the character cell's contents. */
                         cell = _vte_row_data_get (row_data, col);
                         if (cell == NULL) {
@@ -8877,13 +9797,15 @@ Terminal::draw_rows(VteScreen *screen_,
                                 break;
                         }
 
-                        nhyperlink = (m_allow_hyperlink && cell->attr.hyperlink_idx != 0);
+                        while (run->start + run->len <= col)
+                                ++run;
+
                         if (cell->c == 0 ||
                                 ((cell->c == ' ' || cell->c == '\t') &&  // FIXME '\t' is newly added now, double check
                                  cell->attr.has_none(VTE_ATTR_UNDERLINE_MASK |
                                                      VTE_ATTR_STRIKETHROUGH_MASK |
                                                      VTE_ATTR_OVERLINE_MASK) &&
-                                 !nhyperlink) ||
+                                 !run->hyperlink) ||
                             cell->attr.fragment() ||
                             cell->attr.invisible()) {
                                 /* Skip empty or fragment cell. */
@@ -8891,33 +9813,10 @@ Terminal::draw_rows(VteScreen *screen_,
                                 continue;
                         }
 
-                        /* Find the colors for this cell. */
-                        nattr = cell->attr.attr;
-                        selected = cell_is_selected(col, row);
-                        determine_colors(cell, selected, &nfore, &nback, &ndeco);
-
-                        nhilite = (nhyperlink && cell->attr.hyperlink_idx == m_hyperlink_hover_idx) ||
-                                  (!nhyperlink && m_match != nullptr && m_match_span.contains(row, col));
-
                         /* See if it no longer fits the run. */
-                        if (item_count > 0 &&
-                                   (((attr ^ nattr) & (VTE_ATTR_BOLD_MASK |
-                                                       VTE_ATTR_ITALIC_MASK |
-                                                       VTE_ATTR_UNDERLINE_MASK |
-                                                       VTE_ATTR_STRIKETHROUGH_MASK |
-                                                       VTE_ATTR_OVERLINE_MASK |
-                                                       VTE_ATTR_BLINK_MASK |
-                                                       VTE_ATTR_INVISIBLE_MASK)) ||  // FIXME or just simply "attr != nattr"?
-                                    fore != nfore ||
-                                    back != nback ||
-                                    deco != ndeco ||
-                                    hyperlink != nhyperlink ||
-                                    hilite != nhilite)) {
+                        if (item_count > 0 && !style->same_style(*run)) {
                                 /* Draw the completed run of cells and start a new one. */
-                                draw_cells(items, item_count,
-                                           fore, back, deco, FALSE, FALSE,
-                                           attr & attr_mask,
-                                           hyperlink, hilite,
+                                draw_cells(items, item_count, *style,
                                            column_width, row_height);
                                 item_count = 0;
                         }
@@ -8944,12 +9843,7 @@ Terminal::draw_rows(VteScreen *screen_,
                                 }
                         }
 
-                        attr = nattr;
-                        fore = nfore;
-                        back = nback;
-                        deco = ndeco;
-                        hyperlink = nhyperlink;
-                        hilite = nhilite;
+                        style = &*run;
 
                         g_assert_cmpint (item_count, <, column_count);
                         items[item_count].c = c;
@@ -8964,10 +9858,7 @@ Terminal::draw_rows(VteScreen *screen_,
 
                 /* Draw the last run of cells in the row. */
                 if (item_count > 0) {
-                        draw_cells(items, item_count,
-                                   fore, back, deco, FALSE, FALSE,
-                                   attr & attr_mask,
-                                   hyperlink, hilite,
+                        draw_cells(items, item_count, *style,
                                    column_width, row_height);
                 }
         }
@@ -9011,6 +9902,7 @@ void
 Terminal::paint_area(GdkRectangle const* area)
 {
         vte::grid::row_t row, row_stop;
+        vte::grid::column_t col, col_stop;
 
         row = pixel_to_row(MAX(0, area->y));
         /* Both the value given by MIN() and row_stop are exclusive.
@@ -9021,22 +9913,27 @@ Terminal::paint_area(GdkRectangle const* area)
 	if (row_stop <= row) {
 		return;
 	}
+        col = MAX(0, area->x / m_cell_width);
+        col_stop = MIN(howmany(area->x + area->width, m_cell_width), m_column_count);
+        if (col_stop <= col)
+                return;
 	_vte_debug_print (VTE_DEBUG_UPDATES,
 			"paint_area"
 			"	(%d,%d)x(%d,%d) pixels,"
 			" (%ld,%ld)x(%ld,%ld) cells"
 			" [(%ld,%ld)x(%ld,%ld) pixels]\n",
 			area->x, area->y, area->width, area->height,
-                        0L, row, m_column_count, row_stop - row,
-                        0L,
+                        col, row, col_stop - col, row_stop - row,
+                        col * m_cell_width,
 			row * m_cell_height,
-                        m_column_count * m_cell_width,
+                        (col_stop - col) * m_cell_width,
 			(row_stop - row) * m_cell_height);
 
 	/* Now we're ready to draw the text.  Iterate over the rows we
 	 * need to draw. */
 	draw_rows(m_screen,
 			      row, row_stop,
+                              col, col_stop,
 			      row_to_pixel(row),
 			      m_cell_width,
 			      m_cell_height);
@@ -9276,11 +10173,144 @@ Terminal::paint_im_preedit_string()
 	}
 }
 
+/* Brings the frame up to date for drawing with @cr: moves what scrolled
+ * and repaints the damage, or all of it if it isn't valid. */
+void
+Terminal::paint_frame(cairo_t* cr)
+{
+        int const allocated_width = get_allocated_width();
+        int const allocated_height = get_allocated_height();
+        double scale_x, scale_y;
+
+        auto const target = cairo_get_target(cr);
+        cairo_surface_get_device_scale(target, &scale_x, &scale_y);
+        if (m_frame_surface == nullptr ||
+            m_frame_width != allocated_width ||
+            m_frame_height != allocated_height ||
+            !_vte_double_equal(m_frame_scale_x, scale_x) ||
+            !_vte_double_equal(m_frame_scale_y, scale_y)) {
+                drop_frame();
+                m_frame_surface = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA,
+                                                               allocated_width, allocated_height);
+                m_frame_width = allocated_width;
+                m_frame_height = allocated_height;
+                m_frame_scale_x = scale_x;
+                m_frame_scale_y = scale_y;
+        }
+
+        cairo_region_t* damage;
+        bool const full = !m_frame_valid;
+        if (!full) {
+                for (auto const& shift : m_frame_shifts) {
+                        /* Copy the part of the band that stays in it through a
+                         * group the size of that part, since the frame can't be
+                         * both the source and the destination. */
+                        auto frame_cr = cairo_create(m_frame_surface);
+                        cairo_set_operator(frame_cr, CAIRO_OPERATOR_SOURCE);
+                        cairo_rectangle(frame_cr, 0, m_padding.top + MAX(shift.y, shift.y + shift.dy),
+                                        allocated_width, shift.height - ABS(shift.dy));
+                        cairo_clip(frame_cr);
+                        cairo_push_group_with_content(frame_cr, CAIRO_CONTENT_COLOR_ALPHA);
+                        cairo_set_source_surface(frame_cr, m_frame_surface, 0, shift.dy);
+                        cairo_paint(frame_cr);
+                        cairo_pop_group_to_source(frame_cr);
+                        cairo_paint(frame_cr);
+                        cairo_destroy(frame_cr);
+                }
+                damage = m_frame_damage;
+        } else {
+                cairo_rectangle_int_t rect = { -m_padding.left, -m_padding.top, allocated_width, allocated_height };
+                damage = cairo_region_create_rectangle(&rect);
+                cairo_region_destroy(m_frame_damage);
+        }
+        m_frame_damage = cairo_region_create();
+        m_frame_shifts.clear();
+
+        if (!cairo_region_is_empty(damage)) {
+                auto frame_cr = cairo_create(m_frame_surface);
+                _vte_draw_set_cairo(m_draw, frame_cr);
+
+                /* Only repaint the damage */
+                cairo_region_translate(damage, m_padding.left, m_padding.top);
+                gdk_cairo_region(frame_cr, damage);
+                cairo_clip(frame_cr);
+                cairo_region_translate(damage, -m_padding.left, -m_padding.top);
+
+                if (G_LIKELY(m_clear_background)) {
+                        _vte_draw_clear (m_draw, 0, 0,
+                                         allocated_width, allocated_height,
+                                         get_color(VTE_DEFAULT_BG), m_background_alpha);
+                } else {
+                        cairo_save(frame_cr);
+                        cairo_set_operator(frame_cr, CAIRO_OPERATOR_CLEAR);
+                        cairo_paint(frame_cr);
+                        cairo_restore(frame_cr);
+                }
+
+                /* Clip vertically, for the sake of smooth scrolling. We want the top and bottom paddings to be unused.
+                 * Don't clip horizontally so that antialiasing can legally overflow to the right padding. */
+                cairo_rectangle(frame_cr, 0, m_padding.top, allocated_width, allocated_height - m_padding.top - m_padding.bottom);
+                cairo_clip(frame_cr);
+
+                cairo_translate(frame_cr, m_padding.left, m_padding.top);
+
+                cairo_rectangle_int_t *rectangles;
+                int n, n_rectangles;
+                n_rectangles = cairo_region_num_rectangles (damage);
+                rectangles = g_new(cairo_rectangle_int_t, n_rectangles);
+                for (n = 0; n < n_rectangles; n++) {
+                        cairo_region_get_rectangle (damage, n, &rectangles[n]);
+                }
+
+                /* don't bother to enlarge an invalidate all */
+                if (!full) {
+                        cairo_region_t *rr = cairo_region_create ();
+                        /* Expand the rectangles so that they cover whole cells,
+                         * to avoid overlapping XY bands.
+                         * This also takes in the cells around the damage, so
+                         * that their text is drawn too, clipped to the damage,
+                         * and any of its ink reaching into the damage is kept.
+                         */
+                        for (n = 0; n < n_rectangles; n++) {
+                                expand_rectangle(rectangles[n]);
+                                cairo_region_union_rectangle(rr, &rectangles[n]);
+                        }
+                        g_free(rectangles);
+
+                        n_rectangles = cairo_region_num_rectangles (rr);
+                        rectangles = g_new (cairo_rectangle_int_t, n_rectangles);
+                        for (n = 0; n < n_rectangles; n++) {
+                                cairo_region_get_rectangle(rr, n, &rectangles[n]);
+                        }
+                        cairo_region_destroy(rr);
+                }
+
+                /* and now paint them */
+                for (n = 0; n < n_rectangles; n++) {
+                        paint_area(&rectangles[n]);
+                }
+                g_free (rectangles);
+
+                _vte_draw_set_cairo(m_draw, NULL);
+                cairo_destroy(frame_cr);
+        }
+        cairo_region_destroy(damage);
+
+        if (full) {
+                /* The shadow is of what's painted now */
+                auto const first_row = first_displayed_row();
+                auto const last_row = last_displayed_row();
+                m_damage_grid.set_view(first_row, scroll_delta_pixel(), m_column_count,
+                                       MAX(last_row - first_row + 1, 0));
+                m_damage_grid.invalidate();
+                m_frame_valid = true;
+        }
+}
+
 void
 Terminal::widget_draw(cairo_t *cr)
 {
         cairo_rectangle_int_t clip_rect;
-        cairo_region_t *region;
         int allocated_width, allocated_height;
         int extra_area_for_cursor;
         bool text_blink_enabled_now;
@@ -9289,69 +10319,20 @@ Terminal::widget_draw(cairo_t *cr)
         if (!gdk_cairo_get_clip_rectangle (cr, &clip_rect))
                 return;
 
+        auto const draw_start_time = g_get_monotonic_time();
+
+        /* The scrollback of the terminals viewed last is reclaimed first */
+        g_scrollback_budget.viewed(m_scrollback_budget_node);
+
         _vte_debug_print(VTE_DEBUG_LIFECYCLE, "vte_terminal_draw()\n");
         _vte_debug_print (VTE_DEBUG_WORK, "+");
         _vte_debug_print (VTE_DEBUG_UPDATES, "Draw (%d,%d)x(%d,%d)\n",
                           clip_rect.x, clip_rect.y,
                           clip_rect.width, clip_rect.height);
 
-        region = vte_cairo_get_clip_region (cr);
-        if (region == NULL)
-                return;
-
         allocated_width = get_allocated_width();
         allocated_height = get_allocated_height();
 
-	/* Designate the start of the drawing operation and clear the area. */
-	_vte_draw_set_cairo(m_draw, cr);
-
-        if (G_LIKELY(m_clear_background)) {
-                _vte_draw_clear (m_draw, 0, 0,
-                                 allocated_width, allocated_height,
-                                 get_color(VTE_DEFAULT_BG), m_background_alpha);
-        }
-
-        /* Clip vertically, for the sake of smooth scrolling. We want the top and bottom paddings to be unused.
-         * Don't clip horizontally so that antialiasing can legally overflow to the right padding. */
-        cairo_save(cr);
-        cairo_rectangle(cr, 0, m_padding.top, allocated_width, allocated_height - m_padding.top - m_padding.bottom);
-        cairo_clip(cr);
-
-        cairo_translate(cr, m_padding.left, m_padding.top);
-
-        /* Transform to view coordinates */
-        cairo_region_translate(region, -m_padding.left, -m_padding.top);
-
-        cairo_rectangle_int_t *rectangles;
-        int n, n_rectangles;
-        n_rectangles = cairo_region_num_rectangles (region);
-        rectangles = g_new(cairo_rectangle_int_t, n_rectangles);
-        for (n = 0; n < n_rectangles; n++) {
-                cairo_region_get_rectangle (region, n, &rectangles[n]);
-        }
-
-        /* don't bother to enlarge an invalidate all */
-        if (!(n_rectangles == 1
-              && rectangles[0].width == allocated_width
-              && rectangles[0].height == allocated_height)) {
-                cairo_region_t *rr = cairo_region_create ();
-                /* Expand the rectangles so that they cover whole cells,
-                 * to avoid overlapping XY bands.
-                 */
-                for (n = 0; n < n_rectangles; n++) {
-                        expand_rectangle(rectangles[n]);
-                        cairo_region_union_rectangle(rr, &rectangles[n]);
-                }
-                g_free(rectangles);
-
-                n_rectangles = cairo_region_num_rectangles (rr);
-                rectangles = g_new (cairo_rectangle_int_t, n_rectangles);
-                for (n = 0; n < n_rectangles; n++) {
-                        cairo_region_get_rectangle(rr, n, &rectangles[n]);
-                }
-                cairo_region_destroy(rr);
-        }
-
         /* Whether blinking text should be visible now */
         m_text_blink_state = true;
         text_blink_enabled_now = m_text_blink_mode & (m_has_focus ? VTE_TEXT_BLINK_FOCUSED : VTE_TEXT_BLINK_UNFOCUSED);
@@ -9363,11 +10344,25 @@ Terminal::widget_draw(cairo_t *cr)
         /* Painting will flip this if it encounters any cell with blink attribute */
         m_text_to_blink = false;
 
-        /* and now paint them */
-        for (n = 0; n < n_rectangles; n++) {
-                paint_area(&rectangles[n]);
-        }
-        g_free (rectangles);
+        m_cells_painted = 0;
+
+        /* Paint the cells into the frame, and copy it onto the area GTK asks for */
+        paint_frame(cr);
+
+        cairo_save(cr);
+        cairo_set_operator(cr, G_LIKELY(m_clear_background) ? CAIRO_OPERATOR_SOURCE : CAIRO_OPERATOR_OVER);
+        cairo_set_source_surface(cr, m_frame_surface, 0, 0);
+        cairo_paint(cr);
+        cairo_restore(cr);
+
+	/* Draw what isn't part of the frame on top of it. */
+	_vte_draw_set_cairo(m_draw, cr);
+
+        cairo_save(cr);
+        cairo_rectangle(cr, 0, m_padding.top, allocated_width, allocated_height - m_padding.top - m_padding.bottom);
+        cairo_clip(cr);
+
+        cairo_translate(cr, m_padding.left, m_padding.top);
 
 	paint_im_preedit_string();
 
@@ -9389,8 +10384,6 @@ Terminal::widget_draw(cairo_t *cr)
 	/* Done with various structures. */
 	_vte_draw_set_cairo(m_draw, NULL);
 
-        cairo_region_destroy (region);
-
         /* If painting encountered any cell with blink attribute, we might need to set up a timer.
          * Blinking is implemented using a one-shot (not repeating) timer that keeps getting reinstalled
          * here as long as blinking cells are encountered during (re)painting. This way there's no need
@@ -9405,47 +10398,11 @@ Terminal::widget_draw(cairo_t *cr)
                                                       NULL);
 
         m_invalidated_all = FALSE;
-}
-
-/* Handle an expose event by painting the exposed area. */
-static cairo_region_t *
-vte_cairo_get_clip_region (cairo_t *cr)
-{
-        cairo_rectangle_list_t *list;
-        cairo_region_t *region;
-        int i;
 
-        list = cairo_copy_clip_rectangle_list (cr);
-        if (list->status == CAIRO_STATUS_CLIP_NOT_REPRESENTABLE) {
-                cairo_rectangle_int_t clip_rect;
-
-                cairo_rectangle_list_destroy (list);
-
-                if (!gdk_cairo_get_clip_rectangle (cr, &clip_rect))
-                        return NULL;
-                return cairo_region_create_rectangle (&clip_rect);
-        }
+        _vte_debug_print(VTE_DEBUG_UPDATES,
+                         "Painted %" G_GSIZE_FORMAT " cells.\n", m_cells_painted);
 
-
-        region = cairo_region_create ();
-        for (i = list->num_rectangles - 1; i >= 0; --i) {
-                cairo_rectangle_t *rect = &list->rectangles[i];
-                cairo_rectangle_int_t clip_rect;
-
-                clip_rect.x = floor (rect->x);
-                clip_rect.y = floor (rect->y);
-                clip_rect.width = ceil (rect->x + rect->width) - clip_rect.x;
-                clip_rect.height = ceil (rect->y + rect->height) - clip_rect.y;
-
-                if (cairo_region_union_rectangle (region, &clip_rect) != CAIRO_STATUS_SUCCESS) {
-                        cairo_region_destroy (region);
-                        region = NULL;
-                        break;
-                }
-        }
-
-        cairo_rectangle_list_destroy (list);
-        return region;
+        m_input_budget.draw_sample(g_get_monotonic_time() - draw_start_time);
 }
 
 void
@@ -9819,6 +10776,8 @@ Terminal::set_scrollback_lines(long lines)
 	queue_adjustment_value_changed(scroll_delta);
 	adjust_adjustments_full();
 
+        update_scrollback_usage();
+
         return true;
 }
 
@@ -9985,6 +10944,7 @@ Terminal::set_pty(VtePty *new_pty)
         if (m_pty != nullptr) {
                 disconnect_pty_read();
                 disconnect_pty_write();
+                stop_pty_reader();
 
                 if (m_pty_channel != nullptr) {
                         g_io_channel_unref (m_pty_channel);
@@ -10103,8 +11063,17 @@ remove_process_timeout_source(void)
         process_timeout_tag = 0;
 }
 
+/* Whether any active terminal is driven by the timeouts rather than by its frame clock */
+static bool
+have_timer_driven_terminals(void)
+{
+        return g_scheduler.any_of([](vte::terminal::Terminal const* that) {
+                        return !that->uses_frame_clock();
+                });
+}
+
 static void
-add_update_timeout(vte::terminal::Terminal* that)
+add_update_timer(void)
 {
 	if (update_timeout_tag == 0) {
 		_vte_debug_print (VTE_DEBUG_TIMEOUT,
@@ -10118,31 +11087,50 @@ add_update_timeout(vte::terminal::Terminal* that)
 	if (!in_process_timeout) {
                 remove_process_timeout_source();
         }
-	if (that->m_active_terminals_link == nullptr) {
+}
+
+static void
+add_update_timeout(vte::terminal::Terminal* that)
+{
+	if (!that->is_processing()) {
 		_vte_debug_print (VTE_DEBUG_TIMEOUT,
 				"Adding terminal to active list\n");
-		that->m_active_terminals_link = g_active_terminals =
-			g_list_prepend(g_active_terminals, that);
+                g_scheduler.add(that->m_scheduler_node);
 	}
+
+        /* While mapped, updates are paced by the frame clock; otherwise fall back to the timeouts */
+        if (!that->add_frame_tick())
+                add_update_timer();
 }
 
 void
 Terminal::reset_update_rects()
 {
         g_array_set_size(m_update_rects, 0);
+        m_damaged_rows.clear();
+        m_damage_grid.invalidate();
+        /* Without the damage, the frame has to be repainted in full */
+        m_frame_scrolls.clear();
+        m_frame_scrolled = false;
+        m_frame_valid = false;
 	m_invalidated_all = FALSE;
 }
 
 static bool
 remove_from_active_list(vte::terminal::Terminal* that)
 {
-	if (that->m_active_terminals_link == nullptr ||
-            that->m_update_rects->len != 0)
+	if (!that->is_processing() ||
+            that->m_update_rects->len != 0 ||
+            !that->m_damaged_rows.empty() ||
+            !that->m_frame_scrolls.empty() ||
+            that->m_frame_scrolled)
                 return false;
 
         _vte_debug_print(VTE_DEBUG_TIMEOUT, "Removing terminal from active list\n");
-        g_active_terminals = g_list_delete_link(g_active_terminals, that->m_active_terminals_link);
-        that->m_active_terminals_link = nullptr;
+        g_scheduler.remove(that->m_scheduler_node);
+
+        /* The terminal has gone idle; free up memory used to capture incoming data */
+        that->trim_chunk_pool();
         return true;
 }
 
@@ -10152,7 +11140,7 @@ stop_processing(vte::terminal::Terminal* that)
         if (!remove_from_active_list(that))
                 return;
 
-        if (g_active_terminals != nullptr)
+        if (have_timer_driven_terminals())
                 return;
 
         if (!in_process_timeout) {
@@ -10178,8 +11166,10 @@ add_process_timeout(vte::terminal::Terminal* that)
 {
 	_vte_debug_print(VTE_DEBUG_TIMEOUT,
 			"Adding terminal to active list\n");
-	that->m_active_terminals_link = g_active_terminals =
-		g_list_prepend(g_active_terminals, that);
+        g_scheduler.add(that->m_scheduler_node);
+        if (that->add_frame_tick())
+                return;
+
 	if (update_timeout_tag == 0 &&
 			process_timeout_tag == 0) {
 		_vte_debug_print(VTE_DEBUG_TIMEOUT,
@@ -10301,20 +11291,19 @@ Terminal::emit_pending_signals()
         g_object_thaw_notify(object);
 }
 
-void
-Terminal::time_process_incoming()
-{
-	g_timer_reset(process_timer);
-	process_incoming();
-	auto elapsed = g_timer_elapsed(process_timer, NULL) * 1000;
-	gssize target = VTE_MAX_PROCESS_TIME / elapsed * m_input_bytes;
-	m_max_input_bytes = (m_max_input_bytes + target) / 2;
-}
-
 bool
 Terminal::process(bool emit_adj_changed)
 {
-        if (m_pty_channel) {
+        /* Start this terminal's turn; focused and visible terminals get a larger share */
+        g_scheduler.set_weight(m_scheduler_node,
+                               m_has_focus ? VTE_SCHEDULER_WEIGHT_FOCUSED :
+                               gtk_widget_get_mapped(m_widget) ? VTE_SCHEDULER_WEIGHT_MAPPED : 1);
+        g_scheduler.replenish(m_scheduler_node, m_input_budget.max_bytes());
+
+        if (m_pty_reader) {
+                pty_reader_pull();
+                connect_pty_read();
+        } else if (m_pty_channel) {
                 if (m_pty_input_active ||
                     m_pty_input_source == 0) {
                         m_pty_input_active = false;
@@ -10327,12 +11316,7 @@ Terminal::process(bool emit_adj_changed)
 
         bool is_active = !m_incoming_queue.empty();
         if (is_active) {
-                if (VTE_MAX_PROCESS_TIME) {
-                        time_process_incoming();
-                } else {
-                        process_incoming();
-                }
-                m_input_bytes = 0;
+                process_incoming(m_input_budget.deadline(g_get_monotonic_time()));
         } else
                 emit_pending_signals();
 
@@ -10345,7 +11329,6 @@ Terminal::process(bool emit_adj_changed)
 static gboolean
 process_timeout (gpointer data)
 {
-	GList *l, *next;
 	gboolean again;
 
         G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
@@ -10356,30 +11339,30 @@ process_timeout (gpointer data)
 
 	_vte_debug_print (VTE_DEBUG_WORK, "<");
 	_vte_debug_print (VTE_DEBUG_TIMEOUT,
-                          "Process timeout:  %d active\n",
-                          g_list_length(g_active_terminals));
+                          "Process timeout:  %" G_GSIZE_FORMAT " active\n",
+                          g_scheduler.size());
 
-	for (l = g_active_terminals; l != NULL; l = next) {
-		auto that = reinterpret_cast<vte::terminal::Terminal*>(l->data);
-		bool active;
-
-		next = l->next;
+        auto first = g_scheduler.first();
+        g_scheduler.for_each([first](vte::terminal::Terminal* that) {
+                if (that->uses_frame_clock())
+                        return;
 
-		if (l != g_active_terminals) {
+		if (that != first) {
 			_vte_debug_print (VTE_DEBUG_WORK, "T");
 		}
 
                 // FIXMEchpe find out why we don't emit_adjustment_changed() here!!
-                active = that->process(false);
+                auto const active = that->process(false);
 
 		if (!active) {
                         remove_from_active_list(that);
 		}
-	}
+        });
+        g_scheduler.rotate();
 
 	_vte_debug_print (VTE_DEBUG_WORK, ">");
 
-	if (g_active_terminals != nullptr && update_timeout_tag == 0) {
+	if (update_timeout_tag == 0 && have_timer_driven_terminals()) {
 		again = TRUE;
 	} else {
 		_vte_debug_print(VTE_DEBUG_TIMEOUT,
@@ -10399,9 +11382,6 @@ process_timeout (gpointer data)
 		 * at full tilt and making us run to keep up...
 		 */
 		g_usleep (0);
-	} else if (update_timeout_tag == 0) {
-		/* otherwise free up memory used to capture incoming data */
-                vte::base::Chunk::prune();
 	}
 
 	return again;
@@ -10413,16 +11393,21 @@ Terminal::invalidate_dirty_rects_and_process_updates()
         if (G_UNLIKELY(!widget_realized()))
                 return false;
 
-	if (G_UNLIKELY (!m_update_rects->len))
+	if (G_UNLIKELY (!m_update_rects->len && m_damaged_rows.empty() &&
+                        m_frame_scrolls.empty() && !m_frame_scrolled))
 		return false;
 
         auto region = cairo_region_create();
+        /* Move the frame first, since the damage is where the text is now */
+        scroll_frame(region);
         auto n_rects = m_update_rects->len;
         for (guint i = 0; i < n_rects; i++) {
                 cairo_rectangle_int_t *rect = &g_array_index(m_update_rects, cairo_rectangle_int_t, i);
                 cairo_region_union_rectangle(region, rect);
+                cairo_region_union_rectangle(m_frame_damage, rect);
 	}
         g_array_set_size(m_update_rects, 0);
+        invalidate_damaged_rows(region);
 	m_invalidated_all = false;
 
         auto allocation = get_allocated_rect();
@@ -10440,7 +11425,6 @@ Terminal::invalidate_dirty_rects_and_process_updates()
 static gboolean
 update_repeat_timeout (gpointer data)
 {
-	GList *l, *next;
 	bool again;
 
         G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
@@ -10451,25 +11435,25 @@ update_repeat_timeout (gpointer data)
 
 	_vte_debug_print (VTE_DEBUG_WORK, "[");
 	_vte_debug_print (VTE_DEBUG_TIMEOUT,
-                          "Repeat timeout:  %d active\n",
-                          g_list_length(g_active_terminals));
+                          "Repeat timeout:  %" G_GSIZE_FORMAT " active\n",
+                          g_scheduler.size());
 
-	for (l = g_active_terminals; l != NULL; l = next) {
-		auto that = reinterpret_cast<vte::terminal::Terminal*>(l->data);
-
-                next = l->next;
+        auto first = g_scheduler.first();
+        g_scheduler.for_each([first](vte::terminal::Terminal* that) {
+                if (that->uses_frame_clock())
+                        return;
 
-		if (l != g_active_terminals) {
+		if (that != first) {
 			_vte_debug_print (VTE_DEBUG_WORK, "T");
 		}
 
                 that->process(true);
 
-		again = that->invalidate_dirty_rects_and_process_updates();
-		if (!again) {
+		if (!that->invalidate_dirty_rects_and_process_updates()) {
                         remove_from_active_list(that);
 		}
-	}
+        });
+        g_scheduler.rotate();
 
 	_vte_debug_print (VTE_DEBUG_WORK, "]");
 
@@ -10478,7 +11462,7 @@ update_repeat_timeout (gpointer data)
          * reinstall a new one because we need to delay by the amount of time
          * it took to repaint the screen: bug 730732.
 	 */
-	if (g_active_terminals == nullptr) {
+	if (!have_timer_driven_terminals()) {
 		_vte_debug_print(VTE_DEBUG_TIMEOUT,
 				"Stopping update timeout\n");
 		update_timeout_tag = 0;
@@ -10503,9 +11487,6 @@ update_repeat_timeout (gpointer data)
 		 * at full tilt and making us run to keep up...
 		 */
 		g_usleep (0);
-	} else {
-		/* otherwise free up memory used to capture incoming data */
-                vte::base::Chunk::prune();
 	}
 
         return FALSE;  /* If we need to go again, we already have a new timer for that. */
@@ -10514,8 +11495,6 @@ update_repeat_timeout (gpointer data)
 static gboolean
 update_timeout (gpointer data)
 {
-	GList *l, *next;
-
         G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
 	gdk_threads_enter();
         G_GNUC_END_IGNORE_DEPRECATIONS;
@@ -10524,24 +11503,25 @@ update_timeout (gpointer data)
 
 	_vte_debug_print (VTE_DEBUG_WORK, "{");
 	_vte_debug_print (VTE_DEBUG_TIMEOUT,
-                          "Update timeout:  %d active\n",
-                          g_list_length(g_active_terminals));
+                          "Update timeout:  %" G_GSIZE_FORMAT " active\n",
+                          g_scheduler.size());
 
         remove_process_timeout_source();
 
-	for (l = g_active_terminals; l != NULL; l = next) {
-		auto that = reinterpret_cast<vte::terminal::Terminal*>(l->data);
-
-                next = l->next;
+        auto first = g_scheduler.first();
+        g_scheduler.for_each([first](vte::terminal::Terminal* that) {
+                if (that->uses_frame_clock())
+                        return;
 
-		if (l != g_active_terminals) {
+		if (that != first) {
 			_vte_debug_print (VTE_DEBUG_WORK, "T");
 		}
 
                 that->process(true);
 
                 that->invalidate_dirty_rects_and_process_updates();
-	}
+        });
+        g_scheduler.rotate();
 
 	_vte_debug_print (VTE_DEBUG_WORK, "}");
 
@@ -10561,6 +11541,176 @@ update_timeout (gpointer data)
 	return FALSE;
 }
 
+static gboolean
+frame_tick_cb(GtkWidget* widget,
+              GdkFrameClock* frame_clock,
+              gpointer data)
+{
+        auto that = reinterpret_cast<vte::terminal::Terminal*>(data);
+        return that->frame_tick(frame_clock) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/*
+ * Terminal::add_frame_tick:
+ *
+ * Drives processing and updates of this terminal from the frame clock
+ * while the widget is mapped: each frame, the incoming data is processed
+ * in the time left until the frame is drawn, and the dirty rects are
+ * invalidated once, to be painted in that same frame.
+ *
+ * Returns: %true if the terminal uses the frame clock, %false if it has
+ *   to be driven by the timeouts instead
+ */
+bool
+Terminal::add_frame_tick()
+{
+        if (m_frame_tick_id == 0) {
+                if (!gtk_widget_get_mapped(m_widget))
+                        return false;
+
+                _vte_debug_print(VTE_DEBUG_TIMEOUT, "Adding frame clock tick\n");
+                m_frame_tick_id = gtk_widget_add_tick_callback(m_widget, frame_tick_cb, this, nullptr);
+                m_last_frame_tick = g_get_monotonic_time();
+        }
+
+        add_frame_watchdog();
+        return true;
+}
+
+void
+Terminal::remove_frame_tick()
+{
+        remove_frame_watchdog();
+
+        if (m_frame_tick_id == 0)
+                return;
+
+        _vte_debug_print(VTE_DEBUG_TIMEOUT, "Removing frame clock tick\n");
+        gtk_widget_remove_tick_callback(m_widget, m_frame_tick_id);
+        m_frame_tick_id = 0;
+}
+
+static gboolean
+frame_watchdog_cb(gpointer data)
+{
+        auto that = reinterpret_cast<vte::terminal::Terminal*>(data);
+        return that->frame_watchdog() ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/*
+ * Terminal::add_frame_watchdog:
+ *
+ * The frame clock may stop ticking while the widget is mapped, e.g. when
+ * the surface is occluded or minimized. Reading and processing the input
+ * must not stop with it, so while the terminal is processing, a timeout
+ * checks every frame time whether the clock still ticks, and if it has
+ * missed VTE_FRAME_STALL_FRAMES frames, does the work itself.
+ */
+void
+Terminal::add_frame_watchdog()
+{
+        if (m_frame_watchdog_tag != 0)
+                return;
+
+        auto const interval = std::max(guint(m_input_budget.frame_time()), 1u);
+        m_frame_watchdog_tag = g_timeout_add(interval, frame_watchdog_cb, this);
+}
+
+void
+Terminal::remove_frame_watchdog()
+{
+        if (m_frame_watchdog_tag == 0)
+                return;
+
+        g_source_remove(m_frame_watchdog_tag);
+        m_frame_watchdog_tag = 0;
+}
+
+bool
+Terminal::frame_watchdog()
+{
+        auto const stall_time = gint64(VTE_FRAME_STALL_FRAMES * m_input_budget.frame_time() * 1000.);
+        if (is_processing() &&
+            g_get_monotonic_time() - m_last_frame_tick < stall_time)
+                return true;
+
+        if (is_processing()) {
+                _vte_debug_print(VTE_DEBUG_TIMEOUT, "Frame clock stalled, processing from timeout\n");
+
+                /* Nothing gets painted until the clock ticks again, but
+                 * flush the damage so that it doesn't pile up meanwhile.
+                 */
+                auto const active = process(true);
+                auto const invalidated = invalidate_dirty_rects_and_process_updates();
+                if (active || invalidated || !remove_from_active_list(this))
+                        return true;
+        }
+
+        /* Idle; the next input re-arms the watchdog, see add_frame_tick() */
+        m_frame_watchdog_tag = 0;
+        return false;
+}
+
+bool
+Terminal::frame_tick(GdkFrameClock* frame_clock)
+{
+        m_last_frame_tick = g_get_monotonic_time();
+
+        if (!is_processing()) {
+                _vte_debug_print(VTE_DEBUG_TIMEOUT, "Removing frame clock tick\n");
+                m_frame_tick_id = 0;
+                remove_frame_watchdog();
+                return false;
+        }
+
+        /* Budget the processing time by the display's refresh rate */
+        gint64 refresh_interval = 0;
+        gdk_frame_clock_get_refresh_info(frame_clock,
+                                         gdk_frame_clock_get_frame_time(frame_clock),
+                                         &refresh_interval, nullptr);
+        if (refresh_interval > 0)
+                m_input_budget.set_frame_time(refresh_interval / 1000.);
+
+        _vte_debug_print (VTE_DEBUG_WORK, "|");
+
+        auto const active = process(true);
+        auto const invalidated = invalidate_dirty_rects_and_process_updates();
+        if (!active && !invalidated && remove_from_active_list(this)) {
+                _vte_debug_print(VTE_DEBUG_TIMEOUT, "Removing frame clock tick\n");
+                m_frame_tick_id = 0;
+                remove_frame_watchdog();
+                return false;
+        }
+
+        return true;
+}
+
+void
+Terminal::widget_map()
+{
+        /* Take over from the timeouts; they stop by themselves once no
+         * terminal needs them anymore.
+         */
+        if (is_processing())
+                add_frame_tick();
+}
+
+void
+Terminal::widget_unmap()
+{
+        /* Don't hold on to the frame while not shown, e.g. in a hidden tab */
+        drop_frame();
+
+        if (m_frame_tick_id == 0)
+                return;
+
+        remove_frame_tick();
+
+        /* Hand over to the timeouts */
+        if (is_processing())
+                add_update_timer();
+}
+
 bool
 Terminal::write_contents_sync (GOutputStream *stream,
                                          VteWriteFlags flags,
@@ -10829,6 +11979,32 @@ Terminal::search_find (bool backward)
 	return match_found;
 }
 
+/*
+ * Terminal::set_enable_input_thread:
+ * @setting: whether to read from the PTY on a separate thread
+ *
+ * Returns: %true iff the setting changed
+ */
+bool
+Terminal::set_enable_input_thread(bool setting)
+{
+        if (setting == m_enable_input_thread)
+                return false;
+
+        m_enable_input_thread = setting;
+
+        if (m_pty_channel != nullptr) {
+                disconnect_pty_read();
+                stop_pty_reader();
+                connect_pty_read();
+
+                if (!m_incoming_queue.empty())
+                        start_processing();
+        }
+
+        return true;
+}
+
 /*
  * Terminal::set_input_enabled:
  * @enabled: whether to enable user input
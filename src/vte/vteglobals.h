@@ -31,6 +31,10 @@ char *vte_get_user_shell(void);
 _VTE_PUBLIC
 const char *vte_get_features (void);
 
+_VTE_PUBLIC
+void vte_set_scrollback_budget(gsize memory,
+                               gsize disk);
+
 #define VTE_TEST_FLAGS_NONE (G_GUINT64_CONSTANT(0))
 #define VTE_TEST_FLAGS_ALL (~G_GUINT64_CONSTANT(0))
 
@@ -301,6 +301,12 @@ void vte_terminal_set_scrollback_lines(VteTerminal *terminal,
 _VTE_PUBLIC
 glong vte_terminal_get_scrollback_lines(VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
 
+/* Retrieve how much memory and disk the contents take. */
+_VTE_PUBLIC
+void vte_terminal_get_scrollback_usage(VteTerminal *terminal,
+                                       gsize *memory,
+                                       gsize *disk) _VTE_GNUC_NONNULL(1);
+
 /* Set or retrieve the current font. */
 _VTE_PUBLIC
 void vte_terminal_set_font(VteTerminal *terminal,
@@ -462,6 +468,12 @@ void vte_terminal_set_input_enabled (VteTerminal *terminal,
 _VTE_PUBLIC
 gboolean vte_terminal_get_input_enabled (VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
 
+_VTE_PUBLIC
+void vte_terminal_set_enable_input_thread(VteTerminal *terminal,
+                                          gboolean enabled) _VTE_GNUC_NONNULL(1);
+_VTE_PUBLIC
+gboolean vte_terminal_get_enable_input_thread(VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
+
 /* rarely useful functions */
 _VTE_PUBLIC
 void vte_terminal_set_clear_background(VteTerminal* terminal,
@@ -82,10 +82,16 @@
 #define VTE_CHILD_INPUT_PRIORITY	G_PRIORITY_DEFAULT_IDLE
 #define VTE_CHILD_OUTPUT_PRIORITY	G_PRIORITY_HIGH
 #define VTE_MAX_INPUT_READ		0x1000
+#define VTE_SCHEDULER_WEIGHT_FOCUSED	4
+#define VTE_SCHEDULER_WEIGHT_MAPPED	2
+#define VTE_CHUNK_POOL_BUDGET		0x10000 /* Memory kept for incoming data while idle */
 #define VTE_DISPLAY_TIMEOUT		10
 #define VTE_UPDATE_TIMEOUT		15
 #define VTE_UPDATE_REPEAT_TIMEOUT	30
-#define VTE_MAX_PROCESS_TIME		100
+#define VTE_FRAME_TIME			16 /* ms */
+#define VTE_MIN_PROCESS_TIME		4 /* ms */
+#define VTE_FRAME_STALL_FRAMES		4 /* frames without a tick before processing falls back to a timer */
+#define VTE_REWRAP_STEP_TIME		4 /* ms; of background rewrapping per idle */
 #define VTE_CELL_BBOX_SLACK		1
 #define VTE_DEFAULT_UTF8_AMBIGUOUS_WIDTH 1
 
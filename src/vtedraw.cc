@@ -23,6 +23,11 @@
 #include <string.h>
 #include <sys/param.h> /* howmany() */
 
+#ifdef VTE_GLYPH_ATLAS
+#include <unordered_map>
+#include <vector>
+#endif
+
 #include <glib.h>
 #include <gtk/gtk.h>
 
@@ -69,8 +74,9 @@ _vte_double_equal(double a,
  *   - A font_info keeps uses unistr_font_info structs that represent all
  *     information needed to quickly draw a single vteunistr.  The font_info
  *     creates those unistr_font_info structs on demand and caches them
- *     indefinitely.  It uses a direct array for the ASCII range and a hash
- *     table for the rest.
+ *     indefinitely.  It uses a two-level direct-mapped table for the BMP,
+ *     allocated a page at a time, and a flat hash table with open addressing
+ *     for the rest (characters beyond the BMP and combining sequences).
  *
  *
  * Fast rendering of unistrs:
@@ -184,12 +190,6 @@ struct unistr_info {
 	union unistr_font_info ufi;
 };
 
-static struct unistr_info *
-unistr_info_create (void)
-{
-	return g_slice_new0 (struct unistr_info);
-}
-
 static void
 unistr_info_finish (struct unistr_info *uinfo)
 {
@@ -220,12 +220,22 @@ unistr_info_finish (struct unistr_info *uinfo)
 	}
 }
 
-static void
-unistr_info_destroy (struct unistr_info *uinfo)
-{
-	unistr_info_finish (uinfo);
-	g_slice_free (struct unistr_info, uinfo);
-}
+/* The BMP is cached in pages of UNISTR_INFO_PAGE_SIZE characters, allocated
+ * when first used.  The other vteunistrs are looked up in a hash table with
+ * linear probing, kept at most half full, whose slots index the unistr_infos
+ * kept in chunks of UNISTR_INFO_CHUNK_SIZE.  Either way, a unistr_info stays
+ * where it is for as long as its font_info lives.
+ */
+#define UNISTR_INFO_PAGE_BITS (8)
+#define UNISTR_INFO_PAGE_SIZE (1 << UNISTR_INFO_PAGE_BITS)
+#define UNISTR_INFO_N_PAGES (0x10000 >> UNISTR_INFO_PAGE_BITS)
+#define UNISTR_INFO_CHUNK_SIZE (64)
+#define UNISTR_INFO_MIN_SLOTS (64)
+
+struct unistr_slot {
+	vteunistr c; /* 0 if the slot is free, since 0 is in the BMP */
+	guint32 index;
+};
 
 struct font_info {
 	/* lifecycle */
@@ -236,8 +246,11 @@ struct font_info {
 	PangoLayout *layout;
 
 	/* cache of character info */
-	struct unistr_info ascii_unistr_info[128];
-	GHashTable *other_unistr_info;
+	struct unistr_info *bmp_unistr_info[UNISTR_INFO_N_PAGES];
+	struct unistr_slot *other_unistr_slots;
+	guint other_unistr_mask; /* number of slots - 1, or 0 if none */
+	guint n_other_unistr_info;
+	struct unistr_info **other_unistr_info; /* chunks */
 
         /* cell metrics as taken from the font, not yet scaled by cell_{width,height}_scale */
 	gint width, height, ascent;
@@ -252,25 +265,131 @@ struct font_info {
 };
 
 
+/* The memory taken by @info and its cache of character info, in bytes */
+static gsize
+font_info_get_memory (struct font_info *info)
+{
+	gsize memory = sizeof (struct font_info);
+	guint n_chunks = howmany (info->n_other_unistr_info, UNISTR_INFO_CHUNK_SIZE);
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (info->bmp_unistr_info); i++) {
+		if (info->bmp_unistr_info[i] != NULL)
+			memory += UNISTR_INFO_PAGE_SIZE * sizeof (struct unistr_info);
+	}
+	if (info->other_unistr_slots != NULL)
+		memory += (info->other_unistr_mask + 1) * sizeof (struct unistr_slot);
+	memory += n_chunks * (sizeof (struct unistr_info *) +
+			      UNISTR_INFO_CHUNK_SIZE * sizeof (struct unistr_info));
+
+	return memory;
+}
+
+static inline guint
+unistr_hash (vteunistr c)
+{
+	/* Combining sequences are consecutive, so mix all bits into the low ones */
+	c ^= c >> 16;
+	c *= 0x45d9f3bu;
+	c ^= c >> 16;
+	return c;
+}
+
+static void
+font_info_insert_other_unistr_slot (struct font_info *info,
+				    vteunistr         c,
+				    guint32           index)
+{
+	guint i;
+
+	for (i = unistr_hash (c) & info->other_unistr_mask;
+	     info->other_unistr_slots[i].c != 0;
+	     i = (i + 1) & info->other_unistr_mask)
+		;
+
+	info->other_unistr_slots[i].c = c;
+	info->other_unistr_slots[i].index = index;
+}
+
+static void
+font_info_grow_other_unistr_slots (struct font_info *info)
+{
+	struct unistr_slot *old_slots = info->other_unistr_slots;
+	guint n_old_slots = old_slots ? info->other_unistr_mask + 1 : 0;
+	guint n_slots = MAX (2 * n_old_slots, UNISTR_INFO_MIN_SLOTS);
+	guint i;
+
+	info->other_unistr_slots = g_new0 (struct unistr_slot, n_slots);
+	info->other_unistr_mask = n_slots - 1;
+
+	for (i = 0; i < n_old_slots; i++) {
+		if (old_slots[i].c != 0)
+			font_info_insert_other_unistr_slot (info, old_slots[i].c, old_slots[i].index);
+	}
+	g_free (old_slots);
+
+	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
+			  "vtepangocairo: %p grew unistr table to %u slots, "
+			  "%" G_GSIZE_FORMAT " bytes\n",
+			  info, n_slots, font_info_get_memory (info));
+}
+
+static inline struct unistr_info *
+font_info_other_unistr_info (struct font_info *info,
+			     guint32           index)
+{
+	return &info->other_unistr_info[index / UNISTR_INFO_CHUNK_SIZE][index % UNISTR_INFO_CHUNK_SIZE];
+}
+
 static struct unistr_info *
-font_info_find_unistr_info (struct font_info    *info,
-			    vteunistr            c)
+font_info_find_other_unistr_info (struct font_info *info,
+				  vteunistr         c)
 {
-	struct unistr_info *uinfo;
+	guint32 index;
+	guint i;
+
+	if (G_LIKELY (info->other_unistr_slots != NULL)) {
+		for (i = unistr_hash (c) & info->other_unistr_mask;
+		     info->other_unistr_slots[i].c != 0;
+		     i = (i + 1) & info->other_unistr_mask) {
+			if (info->other_unistr_slots[i].c == c)
+				return font_info_other_unistr_info (info, info->other_unistr_slots[i].index);
+		}
+	}
 
-	if (G_LIKELY (c < G_N_ELEMENTS (info->ascii_unistr_info)))
-		return &info->ascii_unistr_info[c];
+	if (info->other_unistr_slots == NULL ||
+	    2 * (info->n_other_unistr_info + 1) > info->other_unistr_mask + 1)
+		font_info_grow_other_unistr_slots (info);
+
+	index = info->n_other_unistr_info++;
+	if (index % UNISTR_INFO_CHUNK_SIZE == 0) {
+		info->other_unistr_info = g_renew (struct unistr_info *,
+						   info->other_unistr_info,
+						   index / UNISTR_INFO_CHUNK_SIZE + 1);
+		info->other_unistr_info[index / UNISTR_INFO_CHUNK_SIZE] =
+			g_new0 (struct unistr_info, UNISTR_INFO_CHUNK_SIZE);
+	}
+	font_info_insert_other_unistr_slot (info, c, index);
 
-	if (G_UNLIKELY (info->other_unistr_info == NULL))
-		info->other_unistr_info = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) unistr_info_destroy);
+	return font_info_other_unistr_info (info, index);
+}
 
-	uinfo = (struct unistr_info *)g_hash_table_lookup (info->other_unistr_info, GINT_TO_POINTER (c));
-	if (G_LIKELY (uinfo))
-		return uinfo;
+static struct unistr_info *
+font_info_find_unistr_info (struct font_info    *info,
+			    vteunistr            c)
+{
+	struct unistr_info *page;
 
-	uinfo = unistr_info_create ();
-	g_hash_table_insert (info->other_unistr_info, GINT_TO_POINTER (c), uinfo);
-	return uinfo;
+	if (G_LIKELY (c < 0x10000)) {
+		page = info->bmp_unistr_info[c >> UNISTR_INFO_PAGE_BITS];
+		if (G_UNLIKELY (page == NULL)) {
+			page = g_new0 (struct unistr_info, UNISTR_INFO_PAGE_SIZE);
+			info->bmp_unistr_info[c >> UNISTR_INFO_PAGE_BITS] = page;
+		}
+		return &page[c & (UNISTR_INFO_PAGE_SIZE - 1)];
+	}
+
+	return font_info_find_other_unistr_info (info, c);
 }
 
 
@@ -436,28 +555,38 @@ font_info_allocate (PangoContext *context)
 static void
 font_info_free (struct font_info *info)
 {
-	vteunistr i;
+	guint i, j;
 
 #ifdef VTE_DEBUG
 	_vte_debug_print (VTE_DEBUG_PANGOCAIRO,
-			  "vtepangocairo: %p freeing font_info.  coverages %d = %d + %d + %d\n",
+			  "vtepangocairo: %p freeing font_info.  coverages %d = %d + %d + %d, "
+			  "%" G_GSIZE_FORMAT " bytes\n",
 			  info,
 			  info->coverage_count[0],
 			  info->coverage_count[1],
 			  info->coverage_count[2],
-			  info->coverage_count[3]);
+			  info->coverage_count[3],
+			  font_info_get_memory (info));
 #endif
 
 	g_string_free (info->string, TRUE);
 	g_object_unref (info->layout);
 
-	for (i = 0; i < G_N_ELEMENTS (info->ascii_unistr_info); i++)
-		unistr_info_finish (&info->ascii_unistr_info[i]);
-		
-	if (info->other_unistr_info) {
-		g_hash_table_destroy (info->other_unistr_info);
+	for (i = 0; i < G_N_ELEMENTS (info->bmp_unistr_info); i++) {
+		if (info->bmp_unistr_info[i] == NULL)
+			continue;
+		for (j = 0; j < UNISTR_INFO_PAGE_SIZE; j++)
+			unistr_info_finish (&info->bmp_unistr_info[i][j]);
+		g_free (info->bmp_unistr_info[i]);
 	}
 
+	for (i = 0; i < info->n_other_unistr_info; i++)
+		unistr_info_finish (font_info_other_unistr_info (info, i));
+	for (i = 0; i < howmany (info->n_other_unistr_info, UNISTR_INFO_CHUNK_SIZE); i++)
+		g_free (info->other_unistr_info[i]);
+	g_free (info->other_unistr_info);
+	g_free (info->other_unistr_slots);
+
 	g_slice_free (struct font_info, info);
 }
 
@@ -749,6 +878,293 @@ guint _vte_draw_get_style(gboolean bold, gboolean italic) {
 	return style;
 }
 
+#ifdef VTE_GLYPH_ATLAS
+
+/*
+ * Glyph atlas:
+ *
+ * Instead of handing every COVERAGE_USE_CAIRO_GLYPH glyph to cairo_show_glyphs()
+ * on every repaint, each glyph is rasterised once into a slot of an A8 image
+ * surface, and the cells are then painted by masking the text colour with their
+ * glyph's slot.
+ *
+ * The slots are all the same size: two cells wide plus a cell of margin on either
+ * side for overhanging (italic) glyphs, and a quarter cell of margin above and
+ * below. When the atlas is full, the least recently used slot is reused.
+ *
+ * A glyph is keyed by its scaled font, its index, and the subpixel position of its
+ * origin on the target, in GLYPH_ATLAS_SUBPIXEL_BUCKETS steps. Since cells are on
+ * whole pixels, that's normally bucket 0.
+ *
+ * Glyphs that cairo renders in colour (emoji) or with subpixel antialiasing, and
+ * glyphs whose ink doesn't fit a slot, can't be drawn from an alpha mask; their
+ * slot is kept empty, and they are still drawn with cairo_show_glyphs().
+ *
+ * The atlas is dropped when the fonts change, and rebuilt when the device scale
+ * of the target changes.
+ */
+
+#define GLYPH_ATLAS_SIZE 1024 /* device pixels per side */
+#define GLYPH_ATLAS_SUBPIXEL_BUCKETS 4
+
+struct glyph_atlas_key {
+	cairo_scaled_font_t *scaled_font;
+	unsigned int glyph_index;
+	unsigned int bucket;
+
+	bool operator==(glyph_atlas_key const& other) const
+	{
+		return scaled_font == other.scaled_font &&
+			glyph_index == other.glyph_index &&
+			bucket == other.bucket;
+	}
+};
+
+struct glyph_atlas_key_hash {
+	size_t operator()(glyph_atlas_key const& key) const
+	{
+		return std::hash<void*>()(key.scaled_font) ^
+			(size_t(key.glyph_index) * GLYPH_ATLAS_SUBPIXEL_BUCKETS + key.bucket) * size_t(0x9e3779b97f4a7c15ull);
+	}
+};
+
+struct glyph_atlas_slot {
+	glyph_atlas_key key;
+	/* The slot's part of the atlas, or NULL if the glyph isn't drawn from the atlas */
+	cairo_surface_t *surface;
+	/* The LRU list, most recently used first */
+	int prev, next;
+	bool used;
+};
+
+struct glyph_atlas {
+	cairo_surface_t *surface;
+	/* Scratch surface the size of a slot to rasterise glyphs into */
+	cairo_surface_t *scratch;
+	double scale_x, scale_y;
+	/* In device pixels */
+	int slot_width, slot_height;
+	int origin_x, origin_y;
+	int columns;
+
+	std::vector<glyph_atlas_slot> slots;
+	int mru, lru;
+	std::unordered_map<glyph_atlas_key, int, glyph_atlas_key_hash> map;
+
+	guint64 hits, misses, evictions;
+};
+
+static struct glyph_atlas *
+glyph_atlas_new (struct font_info *font,
+		 double scale_x,
+		 double scale_y)
+{
+	auto atlas = new glyph_atlas{};
+	int n_slots;
+
+	atlas->scale_x = scale_x;
+	atlas->scale_y = scale_y;
+	atlas->origin_x = (int) ceil (font->width * scale_x);
+	atlas->origin_y = (int) ceil (font->height * scale_y / 4) + (int) ceil (font->ascent * scale_y);
+	atlas->slot_width = 4 * atlas->origin_x;
+	atlas->slot_height = (int) ceil (font->height * scale_y) + 2 * (int) ceil (font->height * scale_y / 4);
+
+	atlas->columns = MAX (1, GLYPH_ATLAS_SIZE / atlas->slot_width);
+	n_slots = atlas->columns * MAX (1, GLYPH_ATLAS_SIZE / atlas->slot_height);
+
+	atlas->surface = cairo_image_surface_create (CAIRO_FORMAT_A8,
+						     atlas->columns * atlas->slot_width,
+						     (n_slots / atlas->columns) * atlas->slot_height);
+	cairo_surface_set_device_scale (atlas->surface, scale_x, scale_y);
+	atlas->scratch = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+						     atlas->slot_width, atlas->slot_height);
+	cairo_surface_set_device_scale (atlas->scratch, scale_x, scale_y);
+
+	atlas->slots.resize (n_slots);
+	for (int i = 0; i < n_slots; i++) {
+		atlas->slots[i].prev = i - 1;
+		atlas->slots[i].next = i + 1 < n_slots ? i + 1 : -1;
+	}
+	atlas->mru = 0;
+	atlas->lru = n_slots - 1;
+	atlas->map.reserve (n_slots);
+
+	_vte_debug_print (VTE_DEBUG_DRAW,
+			  "New glyph atlas of %d slots of %dx%d pixels\n",
+			  n_slots, atlas->slot_width, atlas->slot_height);
+
+	return atlas;
+}
+
+static void
+glyph_atlas_free (struct glyph_atlas *atlas)
+{
+	if (atlas == NULL)
+		return;
+
+	_vte_debug_print (VTE_DEBUG_DRAW,
+			  "Glyph atlas: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " evictions\n",
+			  atlas->hits, atlas->misses, atlas->evictions);
+
+	for (auto& slot : atlas->slots) {
+		if (slot.surface != NULL)
+			cairo_surface_destroy (slot.surface);
+	}
+	cairo_surface_destroy (atlas->scratch);
+	cairo_surface_destroy (atlas->surface);
+	delete atlas;
+}
+
+static void
+glyph_atlas_touch (struct glyph_atlas *atlas,
+		   int i)
+{
+	auto& slot = atlas->slots[i];
+
+	if (atlas->mru == i)
+		return;
+
+	/* Unlink */
+	atlas->slots[slot.prev].next = slot.next;
+	if (slot.next != -1)
+		atlas->slots[slot.next].prev = slot.prev;
+	else
+		atlas->lru = slot.prev;
+
+	/* Link at the front */
+	slot.prev = -1;
+	slot.next = atlas->mru;
+	atlas->slots[atlas->mru].prev = i;
+	atlas->mru = i;
+}
+
+/* Whether cairo renders the glyph in the scratch surface with anything but the source colour */
+static bool
+glyph_atlas_scratch_has_color (struct glyph_atlas *atlas)
+{
+	unsigned char *data;
+	int stride;
+
+	cairo_surface_flush (atlas->scratch);
+	data = cairo_image_surface_get_data (atlas->scratch);
+	stride = cairo_image_surface_get_stride (atlas->scratch);
+
+	/* The glyph was drawn in opaque black, so premultiplied that leaves only alpha */
+	for (int y = 0; y < atlas->slot_height; y++) {
+		auto row = (guint32 const*) (data + y * stride);
+		for (int x = 0; x < atlas->slot_width; x++) {
+			if (row[x] & 0x00ffffffu)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+glyph_atlas_render (struct glyph_atlas *atlas,
+		    struct glyph_atlas_slot *slot,
+		    int i)
+{
+	cairo_font_options_t *options;
+	cairo_text_extents_t extents;
+	cairo_glyph_t glyph;
+	cairo_t *cr;
+	double slot_width = atlas->slot_width / atlas->scale_x;
+	double slot_height = atlas->slot_height / atlas->scale_y;
+	bool usable;
+
+	glyph.index = slot->key.glyph_index;
+	glyph.x = (atlas->origin_x + (double) slot->key.bucket / GLYPH_ATLAS_SUBPIXEL_BUCKETS) / atlas->scale_x;
+	glyph.y = atlas->origin_y / atlas->scale_y;
+
+	options = cairo_font_options_create ();
+	cairo_scaled_font_get_font_options (slot->key.scaled_font, options);
+	usable = cairo_font_options_get_antialias (options) != CAIRO_ANTIALIAS_SUBPIXEL;
+	cairo_font_options_destroy (options);
+
+	if (usable) {
+		cairo_scaled_font_glyph_extents (slot->key.scaled_font, &glyph, 1, &extents);
+		usable = glyph.x + extents.x_bearing >= 0 &&
+			glyph.x + extents.x_bearing + extents.width <= slot_width &&
+			glyph.y + extents.y_bearing >= 0 &&
+			glyph.y + extents.y_bearing + extents.height <= slot_height;
+	}
+
+	if (usable) {
+		cr = cairo_create (atlas->scratch);
+		cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+		cairo_paint (cr);
+		cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+		cairo_set_source_rgb (cr, 0, 0, 0);
+		cairo_set_scaled_font (cr, slot->key.scaled_font);
+		cairo_show_glyphs (cr, &glyph, 1);
+		cairo_destroy (cr);
+
+		usable = !glyph_atlas_scratch_has_color (atlas);
+	}
+
+	if (!usable)
+		return;
+
+	slot->surface = cairo_surface_create_for_rectangle (atlas->surface,
+							    (i % atlas->columns) * slot_width,
+							    (i / atlas->columns) * slot_height,
+							    slot_width, slot_height);
+	cairo_surface_set_device_scale (slot->surface, atlas->scale_x, atlas->scale_y);
+
+	/* Copy the alpha over */
+	cr = cairo_create (slot->surface);
+	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface (cr, atlas->scratch, 0, 0);
+	cairo_paint (cr);
+	cairo_destroy (cr);
+}
+
+/* Returns the slot of the glyph, rasterising it if necessary; its surface is NULL
+ * if the glyph has to be drawn with cairo_show_glyphs().
+ */
+static struct glyph_atlas_slot *
+glyph_atlas_lookup (struct glyph_atlas *atlas,
+		    cairo_scaled_font_t *scaled_font,
+		    unsigned int glyph_index,
+		    unsigned int bucket)
+{
+	glyph_atlas_key key{scaled_font, glyph_index, bucket};
+	int i;
+
+	auto it = atlas->map.find (key);
+	if (it != atlas->map.end ()) {
+		atlas->hits++;
+		glyph_atlas_touch (atlas, it->second);
+		return &atlas->slots[it->second];
+	}
+
+	atlas->misses++;
+
+	i = atlas->lru;
+	auto slot = &atlas->slots[i];
+	if (slot->used) {
+		atlas->evictions++;
+		atlas->map.erase (slot->key);
+		if (slot->surface != NULL) {
+			cairo_surface_destroy (slot->surface);
+			slot->surface = NULL;
+		}
+	}
+
+	slot->key = key;
+	slot->used = true;
+	atlas->map.emplace (key, i);
+	glyph_atlas_touch (atlas, i);
+
+	glyph_atlas_render (atlas, slot, i);
+
+	return slot;
+}
+
+#endif /* VTE_GLYPH_ATLAS */
+
 struct _vte_draw {
 	struct font_info *fonts[4];
         /* cell metrics, already adjusted by cell_{width,height}_scale */
@@ -759,6 +1175,10 @@ struct _vte_draw {
 
         /* Cache the undercurl's rendered look. */
         cairo_surface_t *undercurl_surface;
+
+#ifdef VTE_GLYPH_ATLAS
+        struct glyph_atlas *atlas;
+#endif
 };
 
 struct _vte_draw *
@@ -774,6 +1194,24 @@ _vte_draw_new (void)
 	return draw;
 }
 
+/* The memory taken by the fonts of @draw and their caches of character
+ * info, in bytes; fonts shared with other draws are counted in full. */
+gsize
+_vte_draw_get_font_memory (struct _vte_draw *draw)
+{
+	gsize memory = 0;
+	gint style;
+
+	/* Count every font only once */
+	for (style = 3; style >= 0; style--) {
+		if (draw->fonts[style] != NULL &&
+			(style == 0 || draw->fonts[style] != draw->fonts[style-1]))
+			memory += font_info_get_memory (draw->fonts[style]);
+	}
+
+	return memory;
+}
+
 void
 _vte_draw_free (struct _vte_draw *draw)
 {
@@ -794,6 +1232,11 @@ _vte_draw_free (struct _vte_draw *draw)
                 draw->undercurl_surface = NULL;
         }
 
+#ifdef VTE_GLYPH_ATLAS
+        glyph_atlas_free (draw->atlas);
+        draw->atlas = NULL;
+#endif
+
 	g_slice_free (struct _vte_draw, draw);
 }
 
@@ -918,6 +1361,12 @@ _vte_draw_set_text_font (struct _vte_draw *draw,
                 cairo_surface_destroy (draw->undercurl_surface);
                 draw->undercurl_surface = NULL;
         }
+
+#ifdef VTE_GLYPH_ATLAS
+        /* Likewise the glyphs */
+        glyph_atlas_free (draw->atlas);
+        draw->atlas = NULL;
+#endif
 }
 
 void
@@ -1462,6 +1911,10 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 	int n_cr_glyphs = 0;
 	cairo_glyph_t cr_glyphs[MAX_RUN_LENGTH];
 	struct font_info *font = draw->fonts[style];
+#ifdef VTE_GLYPH_ATLAS
+	cairo_matrix_t matrix;
+	struct glyph_atlas *atlas = NULL;
+#endif
 
 	g_return_if_fail (font != NULL);
 
@@ -1469,6 +1922,26 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 	_vte_draw_set_source_color_alpha (draw, color, alpha);
 	cairo_set_operator (draw->cr, CAIRO_OPERATOR_OVER);
 
+#ifdef VTE_GLYPH_ATLAS
+	/* The atlas only holds glyphs rendered upright at their size */
+	cairo_get_matrix (draw->cr, &matrix);
+	if (_vte_double_equal (matrix.xx, 1.) && _vte_double_equal (matrix.yy, 1.) &&
+	    _vte_double_equal (matrix.xy, 0.) && _vte_double_equal (matrix.yx, 0.)) {
+		double scale_x, scale_y;
+
+		cairo_surface_get_device_scale (cairo_get_group_target (draw->cr), &scale_x, &scale_y);
+		if (draw->atlas != NULL &&
+		    (!_vte_double_equal (draw->atlas->scale_x, scale_x) ||
+		     !_vte_double_equal (draw->atlas->scale_y, scale_y))) {
+			glyph_atlas_free (draw->atlas);
+			draw->atlas = NULL;
+		}
+		if (draw->atlas == NULL)
+			draw->atlas = glyph_atlas_new (draw->fonts[VTE_DRAW_NORMAL], scale_x, scale_y);
+		atlas = draw->atlas;
+	}
+#endif
+
 	for (i = 0; i < n_requests; i++) {
 		vteunistr c = requests[i].c;
 		struct unistr_info *uinfo = font_info_get_unistr_info (font, c);
@@ -1503,6 +1976,27 @@ _vte_draw_text_internal (struct _vte_draw *draw,
 						       ufi->using_pango_glyph_string.glyph_string);
 			break;
 		case COVERAGE_USE_CAIRO_GLYPH:
+#ifdef VTE_GLYPH_ATLAS
+			if (atlas != NULL) {
+				double device_x = (x + matrix.x0) * atlas->scale_x;
+				double device_y = (y + matrix.y0) * atlas->scale_y;
+				double pixel_x = floor (device_x);
+				unsigned int bucket = (unsigned int) ((device_x - pixel_x) * GLYPH_ATLAS_SUBPIXEL_BUCKETS);
+				struct glyph_atlas_slot *slot;
+
+				slot = glyph_atlas_lookup (atlas,
+							   ufi->using_cairo_glyph.scaled_font,
+							   ufi->using_cairo_glyph.glyph_index,
+							   MIN (bucket, GLYPH_ATLAS_SUBPIXEL_BUCKETS - 1u));
+				if (slot->surface != NULL) {
+					/* Put the slot on whole device pixels */
+					cairo_mask_surface (draw->cr, slot->surface,
+							    (pixel_x - atlas->origin_x) / atlas->scale_x - matrix.x0,
+							    (round (device_y) - atlas->origin_y) / atlas->scale_y - matrix.y0);
+					break;
+				}
+			}
+#endif
 			if (last_scaled_font != ufi->using_cairo_glyph.scaled_font || n_cr_glyphs == MAX_RUN_LENGTH) {
 				if (n_cr_glyphs) {
 					cairo_set_scaled_font (draw->cr, last_scaled_font);
@@ -51,6 +51,7 @@ guint _vte_draw_get_style(gboolean bold, gboolean italic);
 /* Create and destroy a draw structure. */
 struct _vte_draw *_vte_draw_new(void);
 void _vte_draw_free(struct _vte_draw *draw);
+gsize _vte_draw_get_font_memory(struct _vte_draw *draw);
 
 void _vte_draw_set_cairo(struct _vte_draw *draw,
                          cairo_t *cr);
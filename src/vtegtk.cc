@@ -109,7 +109,6 @@ _vte_terminal_get_impl(VteTerminal *terminal)
 
 guint signals[LAST_SIGNAL];
 GParamSpec *pspecs[LAST_PROP];
-GTimer *process_timer;
 uint64_t g_test_flags = 0;
 
 static bool
@@ -490,6 +489,9 @@ vte_terminal_get_property (GObject *object,
                 case PROP_DELETE_BINDING:
                         g_value_set_enum (value, impl->m_delete_binding);
                         break;
+                case PROP_ENABLE_INPUT_THREAD:
+                        g_value_set_boolean (value, vte_terminal_get_enable_input_thread (terminal));
+                        break;
                 case PROP_ENCODING:
                         g_value_set_string (value, vte_terminal_get_encoding (terminal));
                         break;
@@ -597,6 +599,9 @@ vte_terminal_set_property (GObject *object,
                 case PROP_DELETE_BINDING:
                         vte_terminal_set_delete_binding (terminal, (VteEraseBinding)g_value_get_enum (value));
                         break;
+                case PROP_ENABLE_INPUT_THREAD:
+                        vte_terminal_set_enable_input_thread (terminal, g_value_get_boolean (value));
+                        break;
                 case PROP_ENCODING:
                         vte_terminal_set_encoding (terminal, g_value_get_string (value), NULL);
                         break;
@@ -1444,6 +1449,19 @@ vte_terminal_class_init(VteTerminalClass *klass)
                                    VTE_ERASE_AUTO,
                                    (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY));
 
+        /**
+         * VteTerminal:enable-input-thread:
+         *
+         * Controls whether the terminal reads the output of its child on a
+         * separate thread, so that a busy main loop does not stall the child.
+         *
+         * Since: 0.58
+         */
+        pspecs[PROP_ENABLE_INPUT_THREAD] =
+                g_param_spec_boolean ("enable-input-thread", NULL, NULL,
+                                      FALSE,
+                                      (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY));
+
         /**
          * VteTerminal:font-scale:
          *
@@ -1662,8 +1680,6 @@ vte_terminal_class_init(VteTerminalClass *klass)
 	gtk_binding_entry_skip(binding_set, GDK_KEY_KP_F1, GDK_CONTROL_MASK);
 	gtk_binding_entry_skip(binding_set, GDK_KEY_KP_F1, GDK_SHIFT_MASK);
 
-        process_timer = g_timer_new();
-
         klass->priv = G_TYPE_CLASS_GET_PRIVATE (klass, VTE_TYPE_TERMINAL, VteTerminalClassPrivate);
 
         klass->priv->style_provider = GTK_STYLE_PROVIDER (gtk_css_provider_new ());
@@ -1794,6 +1810,30 @@ vte_set_test_flags(guint64 flags)
 #endif
 }
 
+/**
+ * vte_set_scrollback_budget:
+ * @memory: the maximum number of bytes of memory, or 0 for no limit
+ * @disk: the maximum number of bytes of disk, or 0 for no limit
+ *
+ * Sets how much memory and disk the scrollback of all terminals may take
+ * together. When output makes the scrollback exceed either limit, the
+ * oldest scrollback of the least recently viewed terminals is dropped
+ * until it fits again, in addition to the limit each terminal has on its
+ * number of scrollback lines.
+ *
+ * The rows of the screen itself are counted, but are never dropped.
+ *
+ * See also vte_terminal_get_scrollback_usage().
+ *
+ * Since: 0.58
+ */
+void
+vte_set_scrollback_budget(gsize memory,
+                          gsize disk)
+{
+        vte::terminal::Terminal::set_scrollback_budget(memory, disk);
+}
+
 /* VteTerminal public API */
 
 /**
@@ -3597,6 +3637,45 @@ vte_terminal_set_delete_binding(VteTerminal *terminal,
                 g_object_notify_by_pspec(G_OBJECT(terminal), pspecs[PROP_DELETE_BINDING]);
 }
 
+/**
+ * vte_terminal_set_enable_input_thread:
+ * @terminal: a #VteTerminal
+ * @enabled: whether to read from the child on a separate thread
+ *
+ * Controls whether the terminal reads the output of its child on a
+ * separate thread. The data is still processed on the main thread,
+ * but reading no longer depends on the main loop being idle, so
+ * a busy user interface does not make the child block on a full
+ * PTY buffer.
+ *
+ * Since: 0.58
+ */
+void
+vte_terminal_set_enable_input_thread(VteTerminal *terminal,
+                                     gboolean enabled)
+{
+        g_return_if_fail(VTE_IS_TERMINAL(terminal));
+
+        if (IMPL(terminal)->set_enable_input_thread(enabled != FALSE))
+                g_object_notify_by_pspec(G_OBJECT(terminal), pspecs[PROP_ENABLE_INPUT_THREAD]);
+}
+
+/**
+ * vte_terminal_get_enable_input_thread:
+ * @terminal: a #VteTerminal
+ *
+ * Returns: %TRUE if the terminal reads from its child on a separate thread
+ *
+ * Since: 0.58
+ */
+gboolean
+vte_terminal_get_enable_input_thread(VteTerminal *terminal)
+{
+        g_return_val_if_fail(VTE_IS_TERMINAL(terminal), FALSE);
+
+        return IMPL(terminal)->m_enable_input_thread;
+}
+
 /**
  * vte_terminal_get_encoding:
  * @terminal: a #VteTerminal
@@ -4136,6 +4215,33 @@ vte_terminal_get_scrollback_lines(VteTerminal *terminal)
         return IMPL(terminal)->m_scrollback_lines;
 }
 
+/**
+ * vte_terminal_get_scrollback_usage:
+ * @terminal: a #VteTerminal
+ * @memory: (out) (optional): a location to store the number of bytes of memory, or %NULL
+ * @disk: (out) (optional): a location to store the number of bytes of disk, or %NULL
+ *
+ * Gets how much memory and disk the contents of @terminal take, including
+ * its scrollback; this is what is counted against the limits set with
+ * vte_set_scrollback_budget().
+ *
+ * Since: 0.58
+ */
+void
+vte_terminal_get_scrollback_usage(VteTerminal *terminal,
+                                  gsize *memory,
+                                  gsize *disk)
+{
+        g_return_if_fail(VTE_IS_TERMINAL(terminal));
+
+        size_t memory_usage, disk_usage;
+        IMPL(terminal)->get_scrollback_usage(&memory_usage, &disk_usage);
+        if (memory)
+                *memory = memory_usage;
+        if (disk)
+                *disk = disk_usage;
+}
+
 /**
  * vte_terminal_set_scroll_on_keystroke:
  * @terminal: a #VteTerminal
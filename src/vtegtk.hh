@@ -76,6 +76,7 @@ enum {
         PROP_CURRENT_DIRECTORY_URI,
         PROP_CURRENT_FILE_URI,
         PROP_DELETE_BINDING,
+        PROP_ENABLE_INPUT_THREAD,
         PROP_ENCODING,
         PROP_FONT_DESC,
         PROP_FONT_SCALE,
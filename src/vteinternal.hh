@@ -36,11 +36,18 @@
 #include "vteregexinternal.hh"
 
 #include "chunk.hh"
+#include "damage-grid.hh"
+#include "input-budget.hh"
+#include "pty-reader.hh"
+#include "scheduler.hh"
+#include "scrollback-budget.hh"
 #include "utf8.hh"
 
 #include <list>
+#include <memory>
 #include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
 typedef enum {
@@ -327,11 +334,22 @@ public:
         pid_t m_pty_pid{-1};           /* pid of child process */
         VteReaper *m_reaper;
 
+        /* Pool the chunks of incoming data are taken from. It must outlive
+         * m_incoming_queue and m_pty_reader, which hold chunks from it.
+         */
+        vte::base::ChunkPool m_chunk_pool{VTE_CHUNK_POOL_BUDGET};
+
 	/* Queue of chunks of data read from the PTY.
          * Chunks are inserted at the back, and processed from the front.
          */
         std::queue<vte::base::Chunk::unique_type, std::list<vte::base::Chunk::unique_type>> m_incoming_queue;
 
+        /* If non-nullptr, the PTY is read on a separate thread, and the chunks
+         * it reads are moved into m_incoming_queue when processing.
+         */
+        std::unique_ptr<vte::base::PtyReader> m_pty_reader{};
+        bool m_enable_input_thread{false};
+
         vte::base::UTF8Decoder m_utf8_decoder;
         bool m_using_utf8{true};
         const char *m_encoding;            /* the pty's encoding */
@@ -342,13 +360,92 @@ public:
          */
         GArray *m_update_rects;
         gboolean m_invalidated_all;       /* pending refresh of entire terminal */
-        /* If non-nullptr, contains the GList element for @this in g_active_terminals
-         * and means that this terminal is processing data.
+        /* Rows invalidated since the last update, inclusive, in absolute rows.
+         * Which of their cells to repaint is found out at the update, by
+         * diffing them against m_damage_grid.
+         */
+        std::vector<std::pair<vte::grid::row_t, vte::grid::row_t>> m_damaged_rows;
+        /* A changed cell also damages a cell on each side, for glyphs
+         * overhanging their cells */
+        vte::base::DamageGrid m_damage_grid{1};
+        std::vector<vte::base::DamageGrid::Cell> m_damage_cells;
+        /* Number of cells painted in the current frame */
+        size_t m_cells_painted{0};
+
+        /* A run of cells of a row that are painted alike */
+        struct StyleRun {
+                /* The attributes that make cells paint differently, besides their colours */
+                static constexpr uint32_t const k_attr_mask =
+                        VTE_ATTR_BOLD_MASK |
+                        VTE_ATTR_ITALIC_MASK |
+                        VTE_ATTR_UNDERLINE_MASK |
+                        VTE_ATTR_STRIKETHROUGH_MASK |
+                        VTE_ATTR_OVERLINE_MASK |
+                        VTE_ATTR_BLINK_MASK |
+                        VTE_ATTR_INVISIBLE_MASK;
+
+                vte::grid::column_t start;
+                vte::grid::column_t len;
+                guint fore, back, deco;
+                uint32_t attr;
+                bool hyperlink;
+                bool hilite;
+
+                inline bool same_style(StyleRun const& other) const noexcept
+                {
+                        return ((attr ^ other.attr) & k_attr_mask) == 0 &&
+                                fore == other.fore &&
+                                back == other.back &&
+                                deco == other.deco &&
+                                hyperlink == other.hyperlink &&
+                                hilite == other.hilite;
+                }
+        };
+        /* The runs of the rows being painted or diffed, see resolve_style_runs(),
+         * and where each row's runs begin in them when painting */
+        std::vector<StyleRun> m_style_runs;
+        std::vector<size_t> m_style_run_rows;
+
+        /* The cells as last painted, the size of the allocation. Each draw
+         * repaints just its damage, and copies it onto the widget; the
+         * cursor and the preedit text are painted over that.
          */
-        GList *m_active_terminals_link;
-        // FIXMEchpe should these two be g[s]size ?
+        cairo_surface_t* m_frame_surface{nullptr};
+        int m_frame_width{0};
+        int m_frame_height{0};
+        double m_frame_scale_x{0.};
+        double m_frame_scale_y{0.};
+        bool m_frame_valid{false};
+        /* What to repaint in the frame at the next draw, in view coordinates */
+        cairo_region_t* m_frame_damage{nullptr};
+        /* Scrolling region scrolls since the last update, in absolute rows */
+        struct FrameScroll {
+                vte::grid::row_t start, end, amount;
+        };
+        std::vector<FrameScroll> m_frame_scrolls;
+        /* Band of the frame to move by dy pixels at the next draw, in view coordinates */
+        struct FrameShift {
+                int y, height, dy;
+        };
+        std::vector<FrameShift> m_frame_shifts;
+        bool m_frame_scrolled{false};
+        /* Membership in the scheduler's set of active terminals; if scheduled,
+         * this terminal is processing data.
+         */
+        vte::base::Scheduler<Terminal>::Node m_scheduler_node{this};
+        /* The frame clock tick callback driving processing and updates while
+         * mapped, or 0 if they are driven by the timeouts.
+         */
+        guint m_frame_tick_id{0};
+        /* Keeps processing going while the frame clock doesn't tick, e.g. for
+         * an occluded surface; see frame_watchdog().
+         */
+        guint m_frame_watchdog_tag{0};
+        gint64 m_last_frame_tick{0};
         size_t m_input_bytes;
-        glong m_max_input_bytes;
+        vte::terminal::InputBudget m_input_budget{};
+        /* What the scrollback takes, counted against the budget of all terminals */
+        vte::base::ScrollbackBudget<Terminal>::Node m_scrollback_budget_node{this};
 
 	/* Output data queue. */
         VteByteArray *m_outgoing; /* pending input characters */
@@ -414,6 +511,8 @@ public:
         gboolean m_text_inserted_flag;
         gboolean m_text_deleted_flag;
         gboolean m_rewrap_on_resize;
+        /* The idle source rewrapping what a resize left for later, or 0 */
+        guint m_rewrap_tag{0};
 
 	/* Scrolling options. */
         gboolean m_scroll_on_output;
@@ -599,6 +698,9 @@ public:
                                        bool fill);
         /* inline */ VteRowData* ring_append(bool fill);
         /* inline */ void ring_remove(vte::grid::row_t position);
+        void ring_rotate_region(vte::grid::row_t start,
+                                vte::grid::row_t end /* inclusive */,
+                                vte::grid::row_t n);
         inline VteRowData const* find_row_data(vte::grid::row_t row) const;
         inline VteRowData* find_row_data_writable(vte::grid::row_t row) const;
         inline VteCell const* find_charcell(vte::grid::column_t col,
@@ -625,16 +727,44 @@ public:
         void cursor_down(bool explicit_sequence);
         void drop_scrollback();
 
+        static void set_scrollback_budget(size_t memory,
+                                          size_t disk);
+        void get_scrollback_usage(size_t* memory,
+                                  size_t* disk) const;
+        void update_scrollback_usage();
+        void reclaim_scrollback(size_t memory,
+                                size_t disk);
+
         void restore_cursor(VteScreen *screen__);
         void save_cursor(VteScreen *screen__);
 
         void insert_char(gunichar c,
                          bool insert,
                          bool invalidate_now);
+        template<typename T>
+        void insert_chars(T const* chars,
+                          size_t n_chars);
 
         void invalidate_row(vte::grid::row_t row);
         void invalidate_rows(vte::grid::row_t row_start,
                              vte::grid::row_t row_end /* inclusive */);
+        void invalidate_row_fully(vte::grid::row_t row);
+        void invalidate_rows_fully(vte::grid::row_t row_start,
+                                   vte::grid::row_t row_end /* inclusive */);
+        void invalidate_damaged_rows(cairo_region_t* region);
+        void resolve_damage_cells(vte::grid::row_t row);
+        void resolve_style_runs(vte::grid::row_t row,
+                                VteRowData const* row_data,
+                                vte::grid::column_t start_column,
+                                vte::grid::column_t end_column);
+        void queue_frame_scroll(vte::grid::row_t start,
+                                vte::grid::row_t end,
+                                vte::grid::row_t amount);
+        void scroll_frame(cairo_region_t* region);
+        void shift_frame_damage(int y,
+                                int height,
+                                int dy);
+        void drop_frame();
         void invalidate(vte::grid::span const& s);
         void invalidate_symmetrical_difference(vte::grid::span const& a, vte::grid::span const& b, bool block);
         void invalidate_match_span();
@@ -642,12 +772,19 @@ public:
 
         void reset_update_rects();
         bool invalidate_dirty_rects_and_process_updates();
-        void time_process_incoming();
-        void process_incoming();
+        void process_incoming(gint64 deadline = G_MAXINT64);
         bool process(bool emit_adj_changed);
-        inline bool is_processing() const { return m_active_terminals_link != nullptr; }
+        inline bool is_processing() const { return m_scheduler_node.is_scheduled(); }
         void start_processing();
 
+        inline bool uses_frame_clock() const { return m_frame_tick_id != 0; }
+        bool add_frame_tick();
+        void remove_frame_tick();
+        bool frame_tick(GdkFrameClock* frame_clock);
+        void add_frame_watchdog();
+        void remove_frame_watchdog();
+        bool frame_watchdog();
+
         gssize get_preedit_width(bool left_only);
         gssize get_preedit_length(bool left_only);
 
@@ -715,6 +852,8 @@ public:
         void widget_constructed();
         void widget_realize();
         void widget_unrealize();
+        void widget_map();
+        void widget_unmap();
         void widget_style_updated();
         void widget_focus_in(GdkEventFocus *event);
         void widget_focus_out(GdkEventFocus *event);
@@ -738,6 +877,7 @@ public:
                                 int blink_timeout) noexcept;
 
         void expand_rectangle(cairo_rectangle_int_t& rect) const;
+        void paint_frame(cairo_t* cr);
         void paint_area(GdkRectangle const* area);
         void paint_cursor();
         void paint_im_preedit_string();
@@ -753,6 +893,11 @@ public:
                         bool hilite,
                         int column_width,
                         int row_height);
+        void draw_cells(struct _vte_draw_text_request *items,
+                        gssize n,
+                        StyleRun const& style,
+                        int column_width,
+                        int row_height);
         void fudge_pango_colors(GSList *attributes,
                                 VteCell *cells,
                                 gsize n);
@@ -770,7 +915,9 @@ public:
                                         int height);
         void draw_rows(VteScreen *screen,
                        vte::grid::row_t start_row,
-                       long row_count,
+                       vte::grid::row_t end_row,
+                       vte::grid::column_t start_column,
+                       vte::grid::column_t end_column,
                        gint start_y,
                        gint column_width,
                        gint row_height);
@@ -789,8 +936,13 @@ public:
         void pty_scroll_lock_changed(bool locked);
 
         void pty_channel_eof();
+        size_t pty_read_budget() const;
         bool pty_io_read(GIOChannel *channel,
                          GIOCondition condition);
+        bool pty_reader_notify();
+        void pty_reader_pull();
+        void stop_pty_reader();
+        void trim_chunk_pool();
         bool pty_io_write(GIOChannel *channel,
                           GIOCondition condition);
 
@@ -935,6 +1087,9 @@ public:
                              long old_columns,
                              long old_rows,
                              bool do_rewrap);
+        void start_rewrap();
+        void stop_rewrap();
+        bool rewrap_step();
 
         void vadjustment_value_changed();
 
@@ -1135,6 +1290,7 @@ public:
         bool set_cursor_shape(VteCursorShape shape);
         bool set_cursor_style(VteCursorStyle style);
         bool set_delete_binding(VteEraseBinding binding);
+        bool set_enable_input_thread(bool setting);
         bool set_encoding(char const* codeset);
         bool set_font_desc(PangoFontDescription const* desc);
         bool set_font_scale(double scale);
@@ -1307,7 +1463,6 @@ public:
 } // namespace terminal
 } // namespace vte
 
-extern GTimer *process_timer;
 
 vte::terminal::Terminal* _vte_terminal_get_impl(VteTerminal *terminal);
 
@@ -101,6 +101,17 @@ _vte_row_data_fini (VteRowData *row)
 	row->cells = NULL;
 }
 
+/* The heap memory taken by the row's cell array, if any */
+gsize
+_vte_row_data_get_memory_size (const VteRowData *row)
+{
+	VteCells *cells = _vte_cells_for_cell_array (row->cells);
+	if (!cells)
+		return 0;
+
+	return G_STRUCT_OFFSET (VteCells, cells) + cells->alloc_len * sizeof (cells->cells[0]);
+}
+
 static inline gboolean
 _vte_row_data_ensure (VteRowData *row, gulong len)
 {
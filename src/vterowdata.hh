@@ -80,5 +80,6 @@ void _vte_row_data_remove (VteRowData *row, gulong col);
 void _vte_row_data_fill (VteRowData *row, const VteCell *cell, gulong len);
 void _vte_row_data_shrink (VteRowData *row, gulong max_len);
 guint16 _vte_row_data_nonempty_length (const VteRowData *row);
+gsize _vte_row_data_get_memory_size (const VteRowData *row);
 
 G_END_DECLS
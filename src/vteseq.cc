@@ -360,22 +360,10 @@ Terminal::scroll_text(vte::grid::row_t scroll_amount)
                 end = start + m_row_count - 1;
 	}
 
-        while (_vte_ring_next(m_screen->row_data) <= end)
-                ring_append(false);
-
-	if (scroll_amount > 0) {
-		for (auto i = 0; i < scroll_amount; i++) {
-                        ring_remove(end);
-                        ring_insert(start, true);
-		}
-	} else {
-		for (auto i = 0; i < -scroll_amount; i++) {
-                        ring_remove(start);
-                        ring_insert(end, true);
-		}
-	}
+        ring_rotate_region(start, end, scroll_amount);
 
 	/* Update the display. */
+        queue_frame_scroll(start, end, scroll_amount);
         invalidate_rows(start, end);
 
 	/* Adjust the scrollbars if necessary. */
@@ -1268,7 +1256,7 @@ Terminal::erase_in_line(vte::parser::Sequence const& seq)
 void
 Terminal::insert_lines(vte::grid::row_t param)
 {
-        vte::grid::row_t end, i;
+        vte::grid::row_t end;
 
 	/* Find the region we're messing with. */
         auto row = m_screen->cursor.row;
@@ -1284,14 +1272,12 @@ Terminal::insert_lines(vte::grid::row_t param)
         auto limit = end - row + 1;
         param = MIN (param, limit);
 
-	for (i = 0; i < param; i++) {
-		/* Clear a line off the end of the region and add one to the
-		 * top of the region. */
-                ring_remove(end);
-                ring_insert(row, true);
-	}
+	/* Clear lines off the end of the region and add them to the
+	 * top of the region. */
+        ring_rotate_region(row, end, param);
         m_screen->cursor.col = 0;
 	/* Update the display. */
+        queue_frame_scroll(row, end, param);
         invalidate_rows(row, end);
 	/* Adjust the scrollbars if necessary. */
         adjust_adjustments();
@@ -1302,7 +1288,7 @@ Terminal::insert_lines(vte::grid::row_t param)
 void
 Terminal::delete_lines(vte::grid::row_t param)
 {
-        vte::grid::row_t end, i;
+        vte::grid::row_t end;
 
 	/* Find the region we're messing with. */
         auto row = m_screen->cursor.row;
@@ -1318,15 +1304,12 @@ Terminal::delete_lines(vte::grid::row_t param)
         auto limit = end - row + 1;
         param = MIN (param, limit);
 
-	/* Clear them from below the current cursor. */
-	for (i = 0; i < param; i++) {
-		/* Insert a line at the end of the region and remove one from
-		 * the top of the region. */
-                ring_remove(row);
-                ring_insert(end, true);
-	}
+	/* Clear them from below the current cursor, inserting lines at
+	 * the end of the region. */
+        ring_rotate_region(row, end, -param);
         m_screen->cursor.col = 0;
 	/* Update the display. */
+        queue_frame_scroll(row, end, -param);
         invalidate_rows(row, end);
 	/* Adjust the scrollbars if necessary. */
         adjust_adjustments();
@@ -6707,9 +6690,9 @@ Terminal::RI(vte::parser::Sequence const& seq)
         if (m_screen->cursor.row == start) {
 		/* If we're at the top of the scrolling region, add a
 		 * line at the top to scroll the bottom off. */
-		ring_remove(end);
-		ring_insert(start, true);
+		ring_rotate_region(start, end, 1);
 		/* Update the display. */
+                queue_frame_scroll(start, end, 1);
                 invalidate_rows(start, end);
 	} else {
 		/* Otherwise, just move the cursor up. */
@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "vtestream-codec.h"
+
+#include <climits>
+#include <memory>
+
+#include <zlib.h>
+
+#ifdef WITH_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+/* Zlib */
+
+static gsize
+zlib_compress (int level,
+               char *dst,
+               gsize dstlen,
+               char const* src,
+               gsize srclen)
+{
+        auto dstlen_ulongf = uLongf(dstlen);
+        if (compress2 ((Bytef *) dst, &dstlen_ulongf, (Bytef const*) src, srclen,
+                       level != 0 ? CLAMP(level, Z_BEST_SPEED, Z_BEST_COMPRESSION) : Z_BEST_SPEED) != Z_OK)
+                return 0;
+
+        return dstlen_ulongf;
+}
+
+static gsize
+zlib_uncompress (char *dst,
+                 gsize dstlen,
+                 char const* src,
+                 gsize srclen)
+{
+        auto dstlen_ulongf = uLongf(dstlen);
+        if (uncompress ((Bytef *) dst, &dstlen_ulongf, (Bytef const*) src, srclen) != Z_OK)
+                return 0;
+
+        return dstlen_ulongf;
+}
+
+/* LZ4: negative levels are accelerations of the fast compressor, levels above
+ * 1 select the high compression one. */
+
+#ifdef WITH_LZ4
+
+static gsize
+lz4_compress (int level,
+              char *dst,
+              gsize dstlen,
+              char const* src,
+              gsize srclen)
+{
+        int const srcsize = MIN(srclen, gsize(INT_MAX));
+        int const dstsize = MIN(dstlen, gsize(INT_MAX));
+        int rv;
+
+        if (level > 1)
+                rv = LZ4_compress_HC (src, dst, srcsize, dstsize, MIN(level, LZ4HC_CLEVEL_MAX));
+        else
+                rv = LZ4_compress_fast (src, dst, srcsize, dstsize, level < 0 ? -level : 1);
+
+        return rv > 0 ? gsize(rv) : 0;
+}
+
+static gsize
+lz4_uncompress (char *dst,
+                gsize dstlen,
+                char const* src,
+                gsize srclen)
+{
+        auto const rv = LZ4_decompress_safe (src, dst,
+                                             MIN(srclen, gsize(INT_MAX)),
+                                             MIN(dstlen, gsize(INT_MAX)));
+        return rv > 0 ? gsize(rv) : 0;
+}
+
+#endif /* WITH_LZ4 */
+
+/* Zstandard: the contexts are kept around per thread, since allocating them
+ * costs about as much as compressing a block. */
+
+#ifdef WITH_ZSTD
+
+struct ZstdCCtxDeleter {
+        void operator()(ZSTD_CCtx* cctx) { ZSTD_freeCCtx(cctx); }
+};
+
+struct ZstdDCtxDeleter {
+        void operator()(ZSTD_DCtx* dctx) { ZSTD_freeDCtx(dctx); }
+};
+
+static thread_local std::unique_ptr<ZSTD_CCtx, ZstdCCtxDeleter> zstd_cctx;
+static thread_local std::unique_ptr<ZSTD_DCtx, ZstdDCtxDeleter> zstd_dctx;
+
+static gsize
+zstd_compress (int level,
+               char *dst,
+               gsize dstlen,
+               char const* src,
+               gsize srclen)
+{
+        if (!zstd_cctx)
+                zstd_cctx.reset(ZSTD_createCCtx());
+
+        auto const rv = ZSTD_compressCCtx (zstd_cctx.get(), dst, dstlen, src, srclen,
+                                           level != 0 ? MIN(level, ZSTD_maxCLevel()) : 1);
+        return ZSTD_isError(rv) ? 0 : rv;
+}
+
+static gsize
+zstd_uncompress (char *dst,
+                 gsize dstlen,
+                 char const* src,
+                 gsize srclen)
+{
+        if (!zstd_dctx)
+                zstd_dctx.reset(ZSTD_createDCtx());
+
+        auto const rv = ZSTD_decompressDCtx (zstd_dctx.get(), dst, dstlen, src, srclen);
+        return ZSTD_isError(rv) ? 0 : rv;
+}
+
+#endif /* WITH_ZSTD */
+
+gboolean
+_vte_stream_codec_is_available (VteStreamCodec codec)
+{
+        switch (codec) {
+        case VTE_STREAM_CODEC_ZLIB:
+        case VTE_STREAM_CODEC_NONE:
+                return TRUE;
+#ifdef WITH_LZ4
+        case VTE_STREAM_CODEC_LZ4:
+                return TRUE;
+#endif
+#ifdef WITH_ZSTD
+        case VTE_STREAM_CODEC_ZSTD:
+                return TRUE;
+#endif
+        default:
+                return FALSE;
+        }
+}
+
+const char *
+_vte_stream_codec_get_name (VteStreamCodec codec)
+{
+        switch (codec) {
+        case VTE_STREAM_CODEC_ZLIB: return "zlib";
+        case VTE_STREAM_CODEC_LZ4:  return "lz4";
+        case VTE_STREAM_CODEC_ZSTD: return "zstd";
+        case VTE_STREAM_CODEC_NONE: return "none";
+        default:                    return "unknown";
+        }
+}
+
+gsize
+_vte_stream_codec_compress_bound (VteStreamCodec codec,
+                                  gsize len)
+{
+        switch (codec) {
+        case VTE_STREAM_CODEC_ZLIB:
+                return compressBound (len);
+#ifdef WITH_LZ4
+        case VTE_STREAM_CODEC_LZ4:
+                return LZ4_compressBound (MIN(len, gsize(INT_MAX)));
+#endif
+#ifdef WITH_ZSTD
+        case VTE_STREAM_CODEC_ZSTD:
+                return ZSTD_compressBound (len);
+#endif
+        default:
+                return len;
+        }
+}
+
+gsize
+_vte_stream_codec_compress (VteStreamCodec codec,
+                            int level,
+                            char *dst,
+                            gsize dstlen,
+                            const char *src,
+                            gsize srclen)
+{
+        switch (codec) {
+        case VTE_STREAM_CODEC_ZLIB:
+                return zlib_compress (level, dst, dstlen, src, srclen);
+#ifdef WITH_LZ4
+        case VTE_STREAM_CODEC_LZ4:
+                return lz4_compress (level, dst, dstlen, src, srclen);
+#endif
+#ifdef WITH_ZSTD
+        case VTE_STREAM_CODEC_ZSTD:
+                return zstd_compress (level, dst, dstlen, src, srclen);
+#endif
+        default:
+                return 0;
+        }
+}
+
+gsize
+_vte_stream_codec_uncompress (VteStreamCodec codec,
+                              char *dst,
+                              gsize dstlen,
+                              const char *src,
+                              gsize srclen)
+{
+        switch (codec) {
+        case VTE_STREAM_CODEC_ZLIB:
+                return zlib_uncompress (dst, dstlen, src, srclen);
+#ifdef WITH_LZ4
+        case VTE_STREAM_CODEC_LZ4:
+                return lz4_uncompress (dst, dstlen, src, srclen);
+#endif
+#ifdef WITH_ZSTD
+        case VTE_STREAM_CODEC_ZSTD:
+                return zstd_uncompress (dst, dstlen, src, srclen);
+#endif
+        default:
+                return 0;
+        }
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The compression used for the blocks of the scrollback streams.
+ *
+ * The values of the compressing codecs are recorded in the header of each
+ * block, so that a stream can be read back no matter which codec each of
+ * its blocks was written with; do not renumber them. Zlib is 0 so that its
+ * blocks look exactly like they did before the codec was selectable.
+ */
+typedef enum {
+        VTE_STREAM_CODEC_ZLIB = 0,
+        VTE_STREAM_CODEC_LZ4  = 1,
+        VTE_STREAM_CODEC_ZSTD = 2,
+        VTE_STREAM_CODEC_NONE = 3,
+} VteStreamCodec;
+
+#define VTE_STREAM_CODEC_N_CODECS (VTE_STREAM_CODEC_NONE + 1)
+
+gboolean _vte_stream_codec_is_available (VteStreamCodec codec);
+const char *_vte_stream_codec_get_name (VteStreamCodec codec);
+
+/* The size of the buffer needed to compress @len bytes, which might be
+ * more than @len since incompressible data grows. */
+gsize _vte_stream_codec_compress_bound (VteStreamCodec codec, gsize len);
+
+/* Returns the compressed size, or 0 if the data could not be compressed
+ * into @dstlen bytes. @level 0 selects the codec's default level, which
+ * favours speed over ratio. */
+gsize _vte_stream_codec_compress (VteStreamCodec codec, int level,
+                                  char *dst, gsize dstlen,
+                                  const char *src, gsize srclen);
+
+/* Returns the uncompressed size, or 0 if @src is not valid data of @codec,
+ * or does not uncompress into @dstlen bytes. */
+gsize _vte_stream_codec_uncompress (VteStreamCodec codec,
+                                    char *dst, gsize dstlen,
+                                    const char *src, gsize srclen);
+
+G_END_DECLS
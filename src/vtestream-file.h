@@ -70,7 +70,8 @@
  *   requests are batched up until there's a complete block to be compressed,
  *   encrypted and written to disk. Read requests are answered by reading,
  *   decrypting and uncompressing possibly more underlying blocks, and sped up
- *   by caching the result.
+ *   by keeping the most recently used ones decoded. The complete blocks are
+ *   compressed, encrypted and written by a background thread.
  *
  * Design discussions: https://bugzilla.gnome.org/show_bug.cgi?id=738601
  */
@@ -82,13 +83,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <zlib.h>
+
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #ifdef WITH_GNUTLS
 # include <gnutls/gnutls.h>
 # include <gnutls/crypto.h>
 #endif
 
+#include "vtestream-codec.h"
 #include "vteutils.h"
 
 G_BEGIN_DECLS
@@ -121,6 +126,30 @@ typedef guint8 _vte_overwrite_counter_t;
 #define VTE_OVERWRITE_COUNTER_SIZE sizeof(_vte_overwrite_counter_t)
 #define VTE_BOA_BLOCKSIZE (VTE_SNAKE_BLOCKSIZE - VTE_BLOCK_DATALENGTH_SIZE - VTE_OVERWRITE_COUNTER_SIZE - VTE_CIPHER_TAG_SIZE)
 
+/* The top 4 bits of the data length record the codec the block was compressed with. */
+#define VTE_BLOCK_CODEC_SHIFT      (8 * VTE_BLOCK_DATALENGTH_SIZE - 4)
+#define VTE_BLOCK_DATALENGTH_MASK  ((((_vte_block_datalength_t) 1) << VTE_BLOCK_CODEC_SHIFT) - 1)
+
+G_STATIC_ASSERT (VTE_BOA_BLOCKSIZE <= VTE_BLOCK_DATALENGTH_MASK);
+G_STATIC_ASSERT (VTE_STREAM_CODEC_N_CODECS <= 16);
+
+/* The codec for the unit tests is fixed, since they check the exact contents of the blocks */
+#if defined VTESTREAM_MAIN || !defined VTE_STREAM_CODEC_DEFAULT
+# undef VTE_STREAM_CODEC_DEFAULT
+# undef VTE_STREAM_CODEC_LEVEL
+# define VTE_STREAM_CODEC_DEFAULT VTE_STREAM_CODEC_ZLIB
+# define VTE_STREAM_CODEC_LEVEL   0
+#endif
+
+/* The snake maps the file in windows of this many blocks, a multiple of the page size */
+#ifndef VTESTREAM_MAIN
+# define VTE_SNAKE_MAP_WINDOW_BLOCKS 256
+#else
+# define VTE_SNAKE_MAP_WINDOW_BLOCKS 65536
+#endif
+#define VTE_SNAKE_MAP_WINDOW_SIZE ((gsize) VTE_SNAKE_MAP_WINDOW_BLOCKS * VTE_SNAKE_BLOCKSIZE)
+#define VTE_SNAKE_MAP_WINDOWS 4
+
 #define OFFSET_BOA_TO_SNAKE(x) ((x) / VTE_BOA_BLOCKSIZE * VTE_SNAKE_BLOCKSIZE)
 #define ALIGN_BOA(x) ((x) / VTE_BOA_BLOCKSIZE * VTE_BOA_BLOCKSIZE)
 #define MOD_BOA(x)   ((x) % VTE_BOA_BLOCKSIZE)
@@ -334,6 +363,13 @@ _file_write (int fd, const char *data, gsize len, gsize offset)
  * (N) tu....opqrs
  *
  * and so on...
+ *
+ * Blocks are written with pwrite(). They can be read with pread(), or, if the
+ * snake maps the file, straight out of the mapping, sparing a system call and
+ * a copy per block. The file is mapped in a few large windows, mapped again as
+ * the reads move elsewhere. A block is only read from a mapping once the file
+ * is known to extend past it, since touching a mapping beyond the end of the
+ * file faults; holes read back as zeros either way.
  */
 
 typedef struct _VteSnake {
@@ -347,6 +383,14 @@ typedef struct _VteSnake {
                 gsize fd_head;  /* FD's physical head offset. One of these four is redundant, nevermind. */
         } segment[3];           /* At most 3 segments, [0] at the tail. */
         gsize tail, head;       /* These are redundant too, for convenience. */
+
+        gsize fd_size;          /* The size the file is known to have at least. */
+        gboolean use_mmap;
+        struct {
+                char *addr;     /* NULL if not mapped. */
+                gsize fd_offset;
+        } map[VTE_SNAKE_MAP_WINDOWS];
+        guint map_next;         /* The window to replace next. */
 } VteSnake;
 #define VTE_SNAKE_SEGMENTS(s) ((s)->state == 4 ? 2 : (s)->state)
 
@@ -367,11 +411,34 @@ static GType _vte_snake_get_type (void);
 
 G_DEFINE_TYPE (VteSnake, _vte_snake, G_TYPE_OBJECT)
 
+/* Whether the snakes created from now on read through mappings */
+#if defined HAVE_MMAP && defined VTE_STREAM_MMAP
+static gboolean snake_use_mmap = TRUE;
+#else
+static gboolean snake_use_mmap = FALSE;
+#endif
+
 static void
 _vte_snake_init (VteSnake *snake)
 {
         snake->fd = -1;
         snake->state = 1;
+        snake->use_mmap = snake_use_mmap;
+}
+
+static void
+_vte_snake_unmap (VteSnake *snake)
+{
+#ifdef HAVE_MMAP
+        int i;
+
+        for (i = 0; i < VTE_SNAKE_MAP_WINDOWS; i++) {
+                if (snake->map[i].addr != NULL) {
+                        munmap (snake->map[i].addr, VTE_SNAKE_MAP_WINDOW_SIZE);
+                        snake->map[i].addr = NULL;
+                }
+        }
+#endif
 }
 
 static void
@@ -379,6 +446,7 @@ _vte_snake_finalize (GObject *object)
 {
         VteSnake *snake = (VteSnake *) object;
 
+        _vte_snake_unmap (snake);
         _file_close (snake->fd);
 
         G_OBJECT_CLASS (_vte_snake_parent_class)->finalize(object);
@@ -404,6 +472,8 @@ _vte_snake_reset (VteSnake *snake, gsize offset)
 
         if (G_LIKELY (offset >= snake->head)) {
                 _file_reset (snake->fd);
+                _vte_snake_unmap (snake);
+                snake->fd_size = 0;
                 snake->segment[0].st_tail = snake->segment[0].st_head = snake->tail = snake->head = offset;
                 snake->segment[0].fd_tail = snake->segment[0].fd_head = 0;
                 snake->state = 1;
@@ -448,6 +518,54 @@ _vte_snake_read (VteSnake *snake, gsize offset, char *data)
         return (_file_read (snake->fd, data, VTE_SNAKE_BLOCKSIZE, fd_offset) == VTE_SNAKE_BLOCKSIZE);
 }
 
+/*
+ * Returns the VTE_SNAKE_BLOCKSIZE bytes of the block at offset within the mapped file,
+ * or NULL if the snake doesn't map the file or couldn't map that part; _vte_snake_read()
+ * is the fallback then. The block stays mapped until the next snake operation.
+ */
+static const char *
+_vte_snake_map_block (VteSnake *snake, gsize offset)
+{
+#ifdef HAVE_MMAP
+        gsize fd_offset, window;
+        void *addr;
+        guint i;
+
+        g_assert_cmpuint (offset % VTE_SNAKE_BLOCKSIZE, ==, 0);
+
+        if (!snake->use_mmap || G_UNLIKELY (offset < snake->tail || offset >= snake->head))
+                return NULL;
+
+        fd_offset = _vte_snake_offset_map(snake, offset);
+        if (G_UNLIKELY (fd_offset + VTE_SNAKE_BLOCKSIZE > snake->fd_size))
+                return NULL;
+
+        window = fd_offset / VTE_SNAKE_MAP_WINDOW_SIZE * VTE_SNAKE_MAP_WINDOW_SIZE;
+        for (i = 0; i < VTE_SNAKE_MAP_WINDOWS; i++) {
+                if (snake->map[i].addr != NULL && snake->map[i].fd_offset == window)
+                        return snake->map[i].addr + (fd_offset - window);
+        }
+
+        i = snake->map_next;
+        snake->map_next = (i + 1) % VTE_SNAKE_MAP_WINDOWS;
+        if (snake->map[i].addr != NULL)
+                munmap (snake->map[i].addr, VTE_SNAKE_MAP_WINDOW_SIZE);
+
+        /* The window may extend past the end of the file, only the part before it is read */
+        addr = mmap (NULL, VTE_SNAKE_MAP_WINDOW_SIZE, PROT_READ, MAP_SHARED, snake->fd, window);
+        if (G_UNLIKELY (addr == MAP_FAILED)) {
+                snake->map[i].addr = NULL;
+                return NULL;
+        }
+
+        snake->map[i].addr = (char *) addr;
+        snake->map[i].fd_offset = window;
+        return snake->map[i].addr + (fd_offset - window);
+#else
+        return NULL;
+#endif
+}
+
 /*
  * offset is either within the stream (overwrite data), or at its head (append data).
  * data is at most VTE_SNAKE_BLOCKSIZE bytes large; if shorter then the remaining amount is skipped.
@@ -494,7 +612,8 @@ _vte_snake_write (VteSnake *snake, gsize offset, const char *data, gsize len)
                 if (snake->state != 2) {
                         /* Grow the file with sparse blocks to make sure that later pread() can
                          * read back a whole block, even if we are about to write a shorter one. */
-                        _file_try_truncate (snake->fd, fd_offset + VTE_SNAKE_BLOCKSIZE);
+                        if (_file_try_truncate (snake->fd, fd_offset + VTE_SNAKE_BLOCKSIZE))
+                                snake->fd_size = fd_offset + VTE_SNAKE_BLOCKSIZE;
 #ifdef VTESTREAM_MAIN
                         /* For convenient unit testing only: fill with dots. */
                         _file_try_punch_hole (snake->fd, fd_offset, VTE_SNAKE_BLOCKSIZE);
@@ -529,9 +648,10 @@ _vte_snake_advance_tail (VteSnake *snake, gsize offset)
 
         while (offset > snake->segment[0].st_tail) {
                 if (offset < snake->segment[0].st_head) {
-                        /* Drop some (but not all) bytes from the first segment. */
-                        _file_try_punch_hole (snake->fd, snake->segment[0].fd_tail, offset - snake->tail);
-                        snake->segment[0].fd_tail += offset - snake->tail;
+                        /* Drop some (but not all) bytes from the first segment.
+                         * Not relative to snake->tail, that's stale if a whole segment was dropped already. */
+                        _file_try_punch_hole (snake->fd, snake->segment[0].fd_tail, offset - snake->segment[0].st_tail);
+                        snake->segment[0].fd_tail += offset - snake->segment[0].st_tail;
                         snake->segment[0].st_tail = snake->tail = offset;
                         return;
                 } else {
@@ -543,6 +663,7 @@ _vte_snake_advance_tail (VteSnake *snake, gsize offset)
                         case 2:
                                 snake->segment[0] = snake->segment[1];
                                 _file_try_truncate (snake->fd, snake->segment[0].fd_head);
+                                snake->fd_size = MIN(snake->fd_size, snake->segment[0].fd_head);
                                 snake->state = 1;
                                 break;
                         case 3:
@@ -622,9 +743,11 @@ _vte_snake_class_init (VteSnakeClass *klass)
  *                       boa block 65512(7)
  *
  * Structure of the block that we give to the snake:
- * - 0..4 (0..1): The length of the compressed and encrypted Data, that is D-8 (D-2) [VTE_BLOCK_DATALENGTH_SIZE bytes]
+ * - 0..4 (0..1): The length of the compressed and encrypted Data, that is D-8 (D-2), in the low bits,
+ *   and the VteStreamCodec it was compressed with in the top 4 bits [VTE_BLOCK_DATALENGTH_SIZE bytes]
  * - 4..8 (1..2): Overwrite counter [VTE_OVERWRITE_COUNTER_SIZE bytes]
  * - 8..D (2..D): The compressed and encrypted Data [<= VTE_BOA_BLOCKSIZE bytes]
+ *   (Data that doesn't compress is stored as is, its length is then VTE_BOA_BLOCKSIZE and its codec 0.)
  * - D..T: Encryption verification Tag [VTE_CIPHER_TAG_SIZE bytes]
  * - T..64k (T..10): Area not written to the file, most of that leaving sparse FS blocks (dots for unit testing)
  */
@@ -650,6 +773,8 @@ typedef struct _VteBoa {
         gnutls_cipher_hd_t cipher_hd;
         VteIv iv;
 #endif
+        VteStreamCodec codec;
+        int level;
         int compressBound;
 } VteBoa;
 
@@ -701,60 +826,60 @@ _vte_boa_encrypt (VteBoa *boa, gsize offset, guint32 overwrite_counter, char *da
 #endif
 }
 
-/* Decrypt: data is len bytes of data + VTE_CIPHER_TAG_SIZE more bytes of tag. Returns FALSE on tag mismatch. */
-static gboolean
-_vte_boa_decrypt (VteBoa *boa, gsize offset, guint32 overwrite_counter, char *data, unsigned int len)
+/* Decrypt: src is len bytes of data + VTE_CIPHER_TAG_SIZE more bytes of tag. The data is decrypted to
+ * dst, which may be the same as src. Returns the decrypted data, which is src itself if there's no
+ * encryption, or NULL on tag mismatch. */
+static const char *
+_vte_boa_decrypt (VteBoa *boa, gsize offset, guint32 overwrite_counter, const char *src, char *dst, unsigned int len)
 {
         unsigned char tag[VTE_CIPHER_TAG_SIZE];
         unsigned int i, j;
         guint8 faulty = 0;
+        const char *data = src;
 
 #ifndef VTESTREAM_MAIN
 # ifdef WITH_GNUTLS
         boa->iv.offset = offset;
         boa->iv.overwrite_counter = overwrite_counter;
         gnutls_cipher_set_iv (boa->cipher_hd, &boa->iv, VTE_CIPHER_IV_SIZE);
-        gnutls_cipher_decrypt (boa->cipher_hd, data, len);
+        gnutls_cipher_decrypt2 (boa->cipher_hd, src, len, dst, len);
         gnutls_cipher_tag (boa->cipher_hd, tag, VTE_CIPHER_TAG_SIZE);
+        data = dst;
 # endif
 #else
         /* Fake decryption for unit testing; see above. */
         for (i = 0; i < len; i++) {
-                unsigned char c = data[i];
+                unsigned char c = src[i];
                 if (c >= 0x40) c ^= 0x20;
-                data[i] = c;
+                dst[i] = c;
         }
         *tag = (((offset / VTE_BOA_BLOCKSIZE) & 037) << 3) | (overwrite_counter & 007);
+        data = dst;
 #endif
 
         /* Constant time tag verification: 738601#c66 */
         for (i = 0, j = len; i < VTE_CIPHER_TAG_SIZE; i++, j++) {
-                faulty |= tag[i] ^ data[j];
+                faulty |= tag[i] ^ src[j];
         }
-        return !faulty;
+        return faulty ? NULL : data;
 }
 
 static int
-_vte_boa_compressBound (unsigned int len)
+_vte_boa_compressBound (VteStreamCodec codec, unsigned int len)
 {
 #ifndef VTESTREAM_MAIN
-        return compressBound(len);
+        return _vte_stream_codec_compress_bound(codec, len);
 #else
         return 2 * len;
 #endif
 }
 
-/* Compress; returns the compressed size which might be bigger than the original. */
+/* Compress; returns the compressed size which might be bigger than the original, or 0 on failure. */
 static unsigned int
-_vte_boa_compress (char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+_vte_boa_compress (VteStreamCodec codec, int level, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
 {
 #ifndef VTESTREAM_MAIN
-        uLongf dstlen_ulongf = dstlen;
-        unsigned int z_ret;
-
-        z_ret = compress2 ((Bytef *) dst, &dstlen_ulongf, (const Bytef *) src, srclen, 1);
-        g_assert_cmpuint (z_ret, ==, Z_OK);
-        return dstlen_ulongf;
+        return _vte_stream_codec_compress (codec, level, dst, dstlen, src, srclen);
 #else
         /* Fake compression for unit testing:
          * Each char gets prefixed by a repetition count. This prefix is omitted if it would be the
@@ -764,6 +889,7 @@ _vte_boa_compress (char *dst, unsigned int dstlen, const char *src, unsigned int
          *      Mississippi <-> 1Mi2s1i2s1i2p1i
          *      bookkeeper <-> 1b2oke1per
          * The uncompressed string shouldn't contain digits, or more than 9 consecutive identical chars.
+         * All the codecs use this same fake.
          */
         unsigned int len = 0, prevrepeat = 0;
         while (srclen) {
@@ -782,20 +908,17 @@ _vte_boa_compress (char *dst, unsigned int dstlen, const char *src, unsigned int
 #endif
 }
 
-/* Uncompress; returns the uncompressed size. */
+/* Uncompress; returns the uncompressed size, or 0 on failure. */
 static unsigned int
-_vte_boa_uncompress (char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
+_vte_boa_uncompress (VteStreamCodec codec, char *dst, unsigned int dstlen, const char *src, unsigned int srclen)
 {
 #ifndef VTESTREAM_MAIN
-        uLongf dstlen_ulongf = dstlen;
-        unsigned int z_ret;
-
-        z_ret = uncompress ((Bytef *) dst, &dstlen_ulongf, (const Bytef *) src, srclen);
-        g_assert_cmpuint (z_ret, ==, Z_OK);
-        return dstlen_ulongf;
+        return _vte_stream_codec_uncompress (codec, dst, dstlen, src, srclen);
 #else
         /* Fake decompression for unit testing; see above. */
         unsigned int len = 0, repeat = 0;
+        if (codec >= VTE_STREAM_CODEC_NONE)
+                return 0;
         while (srclen) {
                 unsigned char c = *src;
                 if (c >= '0' && c <= '9') {
@@ -840,7 +963,29 @@ _vte_boa_init (VteBoa *boa)
         explicit_bzero(&boa->iv, sizeof(boa->iv));
 #endif
 
-        boa->compressBound = _vte_boa_compressBound(VTE_BOA_BLOCKSIZE);
+        boa->codec = VTE_STREAM_CODEC_DEFAULT;
+        boa->level = VTE_STREAM_CODEC_LEVEL;
+        boa->compressBound = _vte_boa_compressBound(boa->codec, VTE_BOA_BLOCKSIZE);
+}
+
+/* Selects the codec for the blocks written from now on. The blocks already
+ * written remain readable, as each of them records its own codec. */
+static void
+_vte_boa_set_codec (VteBoa *boa, VteStreamCodec codec, int level)
+{
+#ifndef VTESTREAM_MAIN
+        if (!_vte_stream_codec_is_available (codec)) {
+                g_warning ("Scrollback compression codec %s is not available, using %s instead",
+                           _vte_stream_codec_get_name (codec),
+                           _vte_stream_codec_get_name (VTE_STREAM_CODEC_DEFAULT));
+                codec = VTE_STREAM_CODEC_DEFAULT;
+                level = VTE_STREAM_CODEC_LEVEL;
+        }
+#endif
+
+        boa->codec = codec;
+        boa->level = level;
+        boa->compressBound = _vte_boa_compressBound(codec, VTE_BOA_BLOCKSIZE);
 }
 
 static void
@@ -884,34 +1029,48 @@ _vte_boa_reset (VteBoa *boa, gsize offset)
 static gboolean
 _vte_boa_read_with_overwrite_counter (VteBoa *boa, gsize offset, char *data, _vte_overwrite_counter_t *overwrite_counter)
 {
-        _vte_block_datalength_t compressed_len;
+        _vte_block_datalength_t header, compressed_len;
+        VteStreamCodec codec;
         char *buf = g_newa(char, VTE_SNAKE_BLOCKSIZE);
+        const char *block, *plain;
 
         g_assert_cmpuint (offset % VTE_BOA_BLOCKSIZE, ==, 0);
 
-        /* Read */
-        if (G_UNLIKELY (!_vte_snake_read (&boa->parent, OFFSET_BOA_TO_SNAKE(offset), buf)))
-                return FALSE;
+        /* Read, straight out of the mapped file if possible; decrypting then copies it out */
+        block = _vte_snake_map_block (&boa->parent, OFFSET_BOA_TO_SNAKE(offset));
+        if (block == NULL) {
+                if (G_UNLIKELY (!_vte_snake_read (&boa->parent, OFFSET_BOA_TO_SNAKE(offset), buf)))
+                        return FALSE;
+                block = buf;
+        }
 
-        compressed_len = *((_vte_block_datalength_t *) buf);
-        *overwrite_counter = *((_vte_overwrite_counter_t *) (buf + VTE_BLOCK_DATALENGTH_SIZE));
+        memcpy (&header, block, VTE_BLOCK_DATALENGTH_SIZE);
+        compressed_len = header & VTE_BLOCK_DATALENGTH_MASK;
+        codec = (VteStreamCodec) (header >> VTE_BLOCK_CODEC_SHIFT);
+        memcpy (overwrite_counter, block + VTE_BLOCK_DATALENGTH_SIZE, VTE_OVERWRITE_COUNTER_SIZE);
 
         /* We could have read an empty block due to a previous disk full. Treat that as an error too. Perform other sanity checks. */
         if (G_UNLIKELY (compressed_len <= 0 || compressed_len > VTE_BOA_BLOCKSIZE || *overwrite_counter <= 0))
                 return FALSE;
 
         /* Decrypt, bail out on tag mismatch */
-        if (G_UNLIKELY (!_vte_boa_decrypt (boa, offset, *overwrite_counter, buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, compressed_len)))
+        plain = _vte_boa_decrypt (boa, offset, *overwrite_counter,
+                                  block + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE,
+                                  buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE,
+                                  compressed_len);
+        if (G_UNLIKELY (plain == NULL))
                 return FALSE;
 
         /* Uncompress, or copy if wasn't compressable */
         if (G_LIKELY (data != NULL)) {
                 if (G_UNLIKELY (compressed_len >= VTE_BOA_BLOCKSIZE)) {
-                        memcpy (data, buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, VTE_BOA_BLOCKSIZE);
+                        memcpy (data, plain, VTE_BOA_BLOCKSIZE);
                 } else {
                         unsigned int uncompressed_len;
-                        uncompressed_len = _vte_boa_uncompress(data, VTE_BOA_BLOCKSIZE, buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, compressed_len);
-                        g_assert_cmpuint (uncompressed_len, ==, VTE_BOA_BLOCKSIZE);
+                        /* This also fails if the codec isn't compiled in */
+                        uncompressed_len = _vte_boa_uncompress(codec, data, VTE_BOA_BLOCKSIZE, plain, compressed_len);
+                        if (G_UNLIKELY (uncompressed_len != VTE_BOA_BLOCKSIZE))
+                                return FALSE;
                 }
         }
         return TRUE;
@@ -924,22 +1083,50 @@ _vte_boa_read (VteBoa *boa, gsize offset, char *data)
         return _vte_boa_read_with_overwrite_counter (boa, offset, data, &overwrite_counter);
 }
 
+/* The helper buffer for writing a block should be large enough to contain a whole snake block,
+ * and also large enough to compress data that actually grows bigger during compression. */
+#define VTE_BOA_WRITE_BUFSIZE(boa) MAX(VTE_SNAKE_BLOCKSIZE, \
+                                       VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE + (boa)->compressBound)
+
 /*
- * offset is either within the stream (overwrite data), or at its head (append data).
- * data is VTE_BOA_BLOCKSIZE bytes large.
+ * The first half of _vte_boa_write(): compresses the VTE_BOA_BLOCKSIZE bytes at data (or copies them
+ * if uncompressable) to buf, after the room for the header, and returns the data length field of the header.
+ * This only looks at the codec of the boa, and so can run concurrently with the other boa methods.
+ */
+static _vte_block_datalength_t
+_vte_boa_compress_block (VteBoa *boa, char *buf, const char *data)
+{
+        unsigned int compressed_len;
+        VteStreamCodec codec = boa->codec;
+
+        /* Compress, or copy if uncompressable */
+        if (G_LIKELY (codec != VTE_STREAM_CODEC_NONE))
+                compressed_len = _vte_boa_compress (codec, boa->level,
+                                                    buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, boa->compressBound,
+                                                    data, VTE_BOA_BLOCKSIZE);
+        else
+                compressed_len = VTE_BOA_BLOCKSIZE;
+        if (G_UNLIKELY (compressed_len == 0 || compressed_len >= VTE_BOA_BLOCKSIZE)) {
+                memcpy (buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, data, VTE_BOA_BLOCKSIZE);
+                compressed_len = VTE_BOA_BLOCKSIZE;
+                codec = (VteStreamCodec) 0;
+        }
+
+        return (_vte_block_datalength_t) (compressed_len | ((unsigned int) codec << VTE_BLOCK_CODEC_SHIFT));
+}
+
+/*
+ * The second half of _vte_boa_write(): encrypts and writes the block that _vte_boa_compress_block()
+ * placed in buf.
  */
 static void
-_vte_boa_write (VteBoa *boa, gsize offset, const char *data)
+_vte_boa_write_compressed (VteBoa *boa, gsize offset, char *buf, _vte_block_datalength_t header)
 {
         /* The overwrite counter is 1-based.  This is to make sure that the IV is never 0: 738601#c88,
            to make sure that an empty block (e.g. after a previous write failure) is always invalid,
            and to make unit testing easier */
         _vte_overwrite_counter_t overwrite_counter = 1;
-
-        /* The helper buffer should be large enough to contain a whole snake block,
-         * and also large enough to compress data that actually grows bigger during compression. */
-        char *buf = g_newa(char, MAX(VTE_SNAKE_BLOCKSIZE,
-                                     VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE + boa->compressBound));
+        unsigned int compressed_len = header & VTE_BLOCK_DATALENGTH_MASK;
 
         g_assert_cmpuint (offset, >=, boa->tail);
         g_assert_cmpuint (offset, <=, boa->head);
@@ -964,17 +1151,7 @@ _vte_boa_write (VteBoa *boa, gsize offset, const char *data)
                 overwrite_counter++;
         }
 
-        _vte_block_datalength_t compressed_len;
-
-        /* Compress, or copy if uncompressable */
-        compressed_len = _vte_boa_compress (buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, boa->compressBound,
-                                            data, VTE_BOA_BLOCKSIZE);
-        if (G_UNLIKELY (compressed_len >= VTE_BOA_BLOCKSIZE)) {
-                memcpy (buf + VTE_BLOCK_DATALENGTH_SIZE + VTE_OVERWRITE_COUNTER_SIZE, data, VTE_BOA_BLOCKSIZE);
-                compressed_len = VTE_BOA_BLOCKSIZE;
-        }
-
-        *((_vte_block_datalength_t *) buf) = (_vte_block_datalength_t) compressed_len;
+        *((_vte_block_datalength_t *) buf) = header;
         *((_vte_overwrite_counter_t *) (buf + VTE_BLOCK_DATALENGTH_SIZE)) = (_vte_overwrite_counter_t) overwrite_counter;
 
         /* Encrypt */
@@ -988,6 +1165,20 @@ _vte_boa_write (VteBoa *boa, gsize offset, const char *data)
         }
 }
 
+/*
+ * offset is either within the stream (overwrite data), or at its head (append data).
+ * data is VTE_BOA_BLOCKSIZE bytes large.
+ */
+static void
+_vte_boa_write (VteBoa *boa, gsize offset, const char *data)
+{
+        char *buf = g_newa(char, VTE_BOA_WRITE_BUFSIZE(boa));
+        _vte_block_datalength_t header;
+
+        header = _vte_boa_compress_block (boa, buf, data);
+        _vte_boa_write_compressed (boa, offset, buf, header);
+}
+
 static void
 _vte_boa_advance_tail (VteBoa *boa, gsize offset)
 {
@@ -1031,25 +1222,90 @@ _vte_boa_class_init (VteBoaClass *klass)
 
 /*
  * VteFileStream: Implement buffering/caching on top of VteBoa.
+ *
+ * Completed blocks are handed over to a writer thread, shared by all the streams, which
+ * compresses, encrypts and writes them to the file, so that appending never waits for these.
+ * The operations that modify the boa (writing a block, advancing the tail and resetting) are
+ * queued per stream and carried out by the writer in order. Until a block is written it is
+ * read back from the queue; the written blocks are read from the boa, which the boa_lock
+ * guards against the writer.
+ *
+ * The blocks read are cached decoded, the least recently used one giving way to a new one once
+ * the stream has as many as it's allowed. Scrolling back and searching revisit the same few
+ * blocks over and over, and decoding one costs far more than copying out of it. To bound the
+ * memory of many terminals, a stream only caches more than one block while all the caches
+ * together stay within a global limit.
  */
 
+typedef enum {
+        VTE_FILE_STREAM_OP_WRITE,
+        VTE_FILE_STREAM_OP_ADVANCE_TAIL,
+        VTE_FILE_STREAM_OP_RESET,
+} VteFileStreamOpType;
+
+typedef struct _VteFileStreamOp {
+        VteFileStreamOpType type;
+        gsize offset;
+        /* VTE_BOA_BLOCKSIZE bytes to write, NULL for the other operations */
+        char *data;
+} VteFileStreamOp;
+
+/* The number of blocks a stream can have waiting for the writer before appending waits for it */
+#define VTE_FILE_STREAM_MAX_PENDING_WRITES 8
+
+typedef struct _VteFileStreamCacheBlock {
+        /* Offset of the cached block, always a multiple of block size.
+         * Use a value of 1 (or anything that's not a multiple of block size)
+         * to denote if no block is cached. */
+        gsize offset;
+        /* When it was last read, in reads of the stream; 0 if never */
+        guint64 last_used;
+        char *data;
+} VteFileStreamCacheBlock;
+
+/* The number of decoded blocks a stream caches by default */
+#define VTE_FILE_STREAM_CACHE_BLOCKS 4
+/* The default limit of the memory all the read caches take together */
+#define VTE_FILE_STREAM_CACHE_LIMIT (32 * 1024 * 1024)
+
 typedef struct _VteFileStream {
         GObject parent;
 
         VteBoa *boa;
+        GMutex boa_lock;
 
-        char *rbuf;
-        /* Offset of the cached record, always a multiple of block size.
-         * Use a value of 1 (or anything that's not a multiple of block size)
-         * to denote if no record is cached. */
-        gsize rbuf_offset;
+        /* The read cache; blocks are allocated as needed, up to cache_size */
+        VteFileStreamCacheBlock *cache;
+        guint cache_size;
+        guint n_cache_blocks;
+        guint64 cache_clock;
+        VteStreamCacheStats cache_stats;
 
         char *wbuf;
         gsize wbuf_len;
 
         gsize head, tail;
+
+        /* Whether the boa is written by the writer thread, rather than synchronously */
+        gboolean async;
+
+        /* The following are protected by the writer_lock */
+        GQueue ops;  /* of VteFileStreamOp, oldest first */
+        guint n_pending_writes;
+        gboolean busy;       /* the writer is carrying out the first of the ops */
+        gboolean scheduled;  /* in writer_streams */
 } VteFileStream;
 
+static GMutex writer_lock;
+static GCond writer_work_cond;  /* a stream was added to writer_streams */
+static GCond writer_done_cond;  /* the writer has carried out an operation */
+static GQueue writer_streams = G_QUEUE_INIT;
+static GThread *writer_thread;
+
+/* The memory taken by the read caches of all the streams, and its limit */
+static gsize cache_bytes;
+static gsize cache_limit = VTE_FILE_STREAM_CACHE_LIMIT;
+
 typedef VteStreamClass VteFileStreamClass;
 
 static GType _vte_file_stream_get_type (void);
@@ -1063,24 +1319,287 @@ _vte_file_stream_new (void)
 	return (VteStream *) g_object_new (VTE_TYPE_FILE_STREAM, NULL);
 }
 
+VteStream *
+_vte_file_stream_new_with_codec (VteStreamCodec codec, int level)
+{
+        VteFileStream *stream = (VteFileStream *) g_object_new (VTE_TYPE_FILE_STREAM, NULL);
+
+        _vte_boa_set_codec (stream->boa, codec, level);
+        return (VteStream *) stream;
+}
+
 static void
 _vte_file_stream_init (VteFileStream *stream)
 {
         stream->boa = (VteBoa *)g_object_new (VTE_TYPE_BOA, NULL);
+        g_mutex_init (&stream->boa_lock);
 
-        stream->rbuf = (char *)g_malloc(VTE_BOA_BLOCKSIZE);
         stream->wbuf = (char *)g_malloc(VTE_BOA_BLOCKSIZE);
-        stream->rbuf_offset = 1;  /* Invalidate */
+
+        stream->cache_size = VTE_FILE_STREAM_CACHE_BLOCKS;
+        stream->cache = g_new0 (VteFileStreamCacheBlock, stream->cache_size);
+
+        /* The unit tests check the file right after each operation */
+#ifndef VTESTREAM_MAIN
+        stream->async = TRUE;
+#endif
+        g_queue_init (&stream->ops);
+}
+
+static void
+_vte_file_stream_op_free (VteFileStreamOp *op)
+{
+        g_free (op->data);
+        g_free (op);
+}
+
+/* Carries out op on the boa, on the writer thread or, for a synchronous stream, right away. */
+static void
+_vte_file_stream_run_op (VteFileStream *stream, VteFileStreamOp *op)
+{
+        char *buf;
+        _vte_block_datalength_t header;
+
+        switch (op->type) {
+        case VTE_FILE_STREAM_OP_WRITE:
+                /* Compressing doesn't need the lock, so reads don't wait for it */
+                buf = g_newa(char, VTE_BOA_WRITE_BUFSIZE(stream->boa));
+                header = _vte_boa_compress_block (stream->boa, buf, op->data);
+
+                g_mutex_lock (&stream->boa_lock);
+                _vte_boa_write_compressed (stream->boa, op->offset, buf, header);
+                g_mutex_unlock (&stream->boa_lock);
+                break;
+        case VTE_FILE_STREAM_OP_ADVANCE_TAIL:
+                g_mutex_lock (&stream->boa_lock);
+                _vte_boa_advance_tail (stream->boa, op->offset);
+                g_mutex_unlock (&stream->boa_lock);
+                break;
+        case VTE_FILE_STREAM_OP_RESET:
+                g_mutex_lock (&stream->boa_lock);
+                _vte_boa_reset (stream->boa, op->offset);
+                g_mutex_unlock (&stream->boa_lock);
+                break;
+        }
+}
+
+/* The writer thread: carries out the operations of the streams, one at a time from each in turn. */
+static gpointer
+_vte_file_stream_writer_run (gpointer data G_GNUC_UNUSED)
+{
+        g_mutex_lock (&writer_lock);
+        for (;;) {
+                VteFileStream *stream;
+                VteFileStreamOp *op;
+
+                while (g_queue_is_empty (&writer_streams))
+                        g_cond_wait (&writer_work_cond, &writer_lock);
+
+                stream = (VteFileStream *) g_queue_pop_head (&writer_streams);
+                stream->scheduled = FALSE;
+                stream->busy = TRUE;
+                op = (VteFileStreamOp *) g_queue_peek_head (&stream->ops);
+                g_mutex_unlock (&writer_lock);
+
+                _vte_file_stream_run_op (stream, op);
+
+                g_mutex_lock (&writer_lock);
+                g_queue_pop_head (&stream->ops);
+                if (op->type == VTE_FILE_STREAM_OP_WRITE)
+                        stream->n_pending_writes--;
+                stream->busy = FALSE;
+                if (!g_queue_is_empty (&stream->ops)) {
+                        g_queue_push_tail (&writer_streams, stream);
+                        stream->scheduled = TRUE;
+                }
+                g_cond_broadcast (&writer_done_cond);
+                g_mutex_unlock (&writer_lock);
+
+                _vte_file_stream_op_free (op);
+
+                g_mutex_lock (&writer_lock);
+        }
+
+        return NULL;
+}
+
+/* Queues an operation on the boa, taking ownership of data. */
+static void
+_vte_file_stream_queue_op (VteFileStream *stream, VteFileStreamOpType type, gsize offset, char *data)
+{
+        VteFileStreamOp *op = g_new (VteFileStreamOp, 1);
+
+        op->type = type;
+        op->offset = offset;
+        op->data = data;
+
+        if (!stream->async) {
+                _vte_file_stream_run_op (stream, op);
+                _vte_file_stream_op_free (op);
+                return;
+        }
+
+        g_mutex_lock (&writer_lock);
+
+        if (G_UNLIKELY (writer_thread == NULL))
+                writer_thread = g_thread_new ("vte-stream", _vte_file_stream_writer_run, NULL);
+
+        if (type == VTE_FILE_STREAM_OP_WRITE) {
+                /* Don't let the queue grow without bounds if the disk can't keep up */
+                while (stream->n_pending_writes >= VTE_FILE_STREAM_MAX_PENDING_WRITES)
+                        g_cond_wait (&writer_done_cond, &writer_lock);
+                stream->n_pending_writes++;
+        }
+
+        g_queue_push_tail (&stream->ops, op);
+        if (!stream->scheduled && !stream->busy) {
+                g_queue_push_tail (&writer_streams, stream);
+                stream->scheduled = TRUE;
+                g_cond_signal (&writer_work_cond);
+        }
+
+        g_mutex_unlock (&writer_lock);
+}
+
+/* Reads the block at the aligned offset, from the queue if it's yet to be written. */
+static gboolean
+_vte_file_stream_read_block (VteFileStream *stream, gsize offset, char *data)
+{
+        gboolean ret;
+
+        if (stream->async) {
+                GList *l;
+
+                g_mutex_lock (&writer_lock);
+                /* The latest write of the block is the one that counts */
+                for (l = stream->ops.tail; l != NULL; l = l->prev) {
+                        VteFileStreamOp *op = (VteFileStreamOp *) l->data;
+                        if (op->type == VTE_FILE_STREAM_OP_WRITE && op->offset == offset) {
+                                memcpy (data, op->data, VTE_BOA_BLOCKSIZE);
+                                g_mutex_unlock (&writer_lock);
+                                return TRUE;
+                        }
+                }
+                g_mutex_unlock (&writer_lock);
+        }
+
+        g_mutex_lock (&stream->boa_lock);
+        ret = _vte_boa_read (stream->boa, offset, data);
+        g_mutex_unlock (&stream->boa_lock);
+        return ret;
+}
+
+/* Frees the cached blocks, and resizes the cache to hold at most size of them. */
+static void
+_vte_file_stream_cache_clear (VteFileStream *stream, guint size)
+{
+        guint i;
+
+        for (i = 0; i < stream->n_cache_blocks; i++)
+                g_free (stream->cache[i].data);
+        cache_bytes -= stream->n_cache_blocks * VTE_BOA_BLOCKSIZE;
+        stream->n_cache_blocks = 0;
+
+        if (size != stream->cache_size) {
+                g_free (stream->cache);
+                stream->cache = g_new0 (VteFileStreamCacheBlock, size);
+                stream->cache_size = size;
+        }
+}
+
+/* Drops the cached blocks at the aligned offsets from start up to end. */
+static void
+_vte_file_stream_cache_invalidate (VteFileStream *stream, gsize start, gsize end)
+{
+        guint i;
+
+        for (i = 0; i < stream->n_cache_blocks; i++) {
+                VteFileStreamCacheBlock *block = &stream->cache[i];
+                if (block->offset != 1 && block->offset >= start && block->offset < end) {
+                        block->offset = 1;  /* Invalidate */
+                        block->last_used = 0;
+                }
+        }
+}
+
+/* Returns the decoded block at the aligned offset, reading it into the cache if needed,
+ * or NULL if it can't be read. */
+static const char *
+_vte_file_stream_cache_get (VteFileStream *stream, gsize offset)
+{
+        VteFileStreamCacheBlock *block = NULL;
+        guint i;
+
+        for (i = 0; i < stream->n_cache_blocks; i++) {
+                VteFileStreamCacheBlock *b = &stream->cache[i];
+                if (b->offset == offset) {
+                        b->last_used = ++stream->cache_clock;
+                        stream->cache_stats.hits++;
+                        return b->data;
+                }
+                if (block == NULL || b->last_used < block->last_used)
+                        block = b;
+        }
+
+        stream->cache_stats.misses++;
+
+        /* Take a new block while allowed to, otherwise replace the least recently used one */
+        if (block == NULL ||
+            (stream->n_cache_blocks < stream->cache_size &&
+             block->last_used != 0 &&
+             cache_bytes + VTE_BOA_BLOCKSIZE <= cache_limit)) {
+                block = &stream->cache[stream->n_cache_blocks++];
+                block->data = (char *)g_malloc(VTE_BOA_BLOCKSIZE);
+                cache_bytes += VTE_BOA_BLOCKSIZE;
+        } else if (block->last_used != 0) {
+                stream->cache_stats.evictions++;
+        }
+
+        if (G_UNLIKELY (!_vte_file_stream_read_block (stream, offset, block->data))) {
+                block->offset = 1;  /* Invalidate */
+                block->last_used = 0;
+                return NULL;
+        }
+
+        block->offset = offset;
+        block->last_used = ++stream->cache_clock;
+        return block->data;
+}
+
+/* Hands the write buffer, a complete block, over to be written at the aligned offset. */
+static void
+_vte_file_stream_write_block (VteFileStream *stream, gsize offset)
+{
+        if (stream->async) {
+                _vte_file_stream_queue_op (stream, VTE_FILE_STREAM_OP_WRITE, offset, stream->wbuf);
+                stream->wbuf = (char *)g_malloc(VTE_BOA_BLOCKSIZE);
+        } else {
+                _vte_boa_write (stream->boa, offset, stream->wbuf);
+        }
 }
 
 static void
 _vte_file_stream_finalize (GObject *object)
 {
         VteFileStream *stream = (VteFileStream *) object;
+        VteFileStreamOp *op;
+
+        /* Drop the operations that the writer hasn't started, and wait for the one it has */
+        g_mutex_lock (&writer_lock);
+        while (stream->busy)
+                g_cond_wait (&writer_done_cond, &writer_lock);
+        if (stream->scheduled)
+                g_queue_remove (&writer_streams, stream);
+        g_mutex_unlock (&writer_lock);
+
+        while ((op = (VteFileStreamOp *) g_queue_pop_head (&stream->ops)) != NULL)
+                _vte_file_stream_op_free (op);
 
-        g_free(stream->rbuf);
+        _vte_file_stream_cache_clear (stream, stream->cache_size);
+        g_free(stream->cache);
         g_free(stream->wbuf);
         g_object_unref (stream->boa);
+        g_mutex_clear (&stream->boa_lock);
 
         G_OBJECT_CLASS (_vte_file_stream_parent_class)->finalize(object);
 }
@@ -1095,7 +1614,7 @@ _vte_file_stream_reset (VteStream *astream, gsize offset)
          * to catch if this expectation is broken within a block. */
         g_assert_cmpuint (offset, >=, stream->head);
 
-        _vte_boa_reset (stream->boa, offset_aligned);
+        _vte_file_stream_queue_op (stream, VTE_FILE_STREAM_OP_RESET, offset_aligned, NULL);
         stream->tail = stream->head = offset;
 
         /* When resetting at a non-aligned offset, initial bytes of the write buffer
@@ -1109,7 +1628,7 @@ _vte_file_stream_reset (VteStream *astream, gsize offset)
 #endif
 
         stream->wbuf_len = MOD_BOA(offset);
-        stream->rbuf_offset = 1;  /* Invalidate */
+        _vte_file_stream_cache_invalidate (stream, 0, G_MAXSIZE);
 }
 
 static gboolean
@@ -1134,13 +1653,10 @@ _vte_file_stream_read (VteStream *astream, gsize offset, char *data, gsize len)
 
         while (len && offset < ALIGN_BOA(stream->head)) {
                 gsize l = MIN(VTE_BOA_BLOCKSIZE - MOD_BOA(offset), len);
-                gsize offset_aligned = ALIGN_BOA(offset);
-                if (offset_aligned != stream->rbuf_offset) {
-                        if (G_UNLIKELY (!_vte_boa_read (stream->boa, offset_aligned, stream->rbuf)))
-                                return FALSE;
-                        stream->rbuf_offset = offset_aligned;
-                }
-                memcpy(data, stream->rbuf + MOD_BOA(offset), l);
+                const char *block = _vte_file_stream_cache_get (stream, ALIGN_BOA(offset));
+                if (G_UNLIKELY (block == NULL))
+                        return FALSE;
+                memcpy(data, block + MOD_BOA(offset), l);
                 offset += l; data += l; len -= l;
         }
         if (len) {
@@ -1160,7 +1676,7 @@ _vte_file_stream_append (VteStream *astream, const char *data, gsize len)
                 memcpy(stream->wbuf + stream->wbuf_len, data, l);
                 stream->wbuf_len += l; data += l; len -= l;
                 if (stream->wbuf_len == VTE_BOA_BLOCKSIZE) {
-                        _vte_boa_write (stream->boa, ALIGN_BOA(stream->head), stream->wbuf);
+                        _vte_file_stream_write_block (stream, ALIGN_BOA(stream->head));
                         stream->wbuf_len = 0;
                 }
                 stream->head += l;
@@ -1183,14 +1699,12 @@ _vte_file_stream_truncate (VteStream *astream, gsize offset)
                  * intact, that is, read back the new partial last block to
                  * the write cache. */
                 gsize offset_aligned = ALIGN_BOA(offset);
-                if (G_UNLIKELY (!_vte_boa_read (stream->boa, offset_aligned, stream->wbuf))) {
+                if (G_UNLIKELY (!_vte_file_stream_read_block (stream, offset_aligned, stream->wbuf))) {
                         /* what now? */
                         memset(stream->wbuf, 0, VTE_BOA_BLOCKSIZE);
                 }
 
-                if (stream->rbuf_offset >= offset_aligned) {
-                        stream->rbuf_offset = 1;  /* Invalidate */
-                }
+                _vte_file_stream_cache_invalidate (stream, offset_aligned, G_MAXSIZE);
         }
         stream->wbuf_len = MOD_BOA(offset);
 	stream->head = offset;
@@ -1204,8 +1718,11 @@ _vte_file_stream_advance_tail (VteStream *astream, gsize offset)
         g_assert_cmpuint (offset, >=, stream->tail);
         g_assert_cmpuint (offset, <=, stream->head);
 
-        if (ALIGN_BOA(offset) > ALIGN_BOA(stream->tail))
-                _vte_boa_advance_tail (stream->boa, ALIGN_BOA(offset));
+        if (ALIGN_BOA(offset) > ALIGN_BOA(stream->tail)) {
+                _vte_file_stream_queue_op (stream, VTE_FILE_STREAM_OP_ADVANCE_TAIL, ALIGN_BOA(offset), NULL);
+                /* Make room for the blocks that can still be read */
+                _vte_file_stream_cache_invalidate (stream, 0, ALIGN_BOA(offset));
+        }
 
         stream->tail = offset;
 }
@@ -1226,6 +1743,28 @@ _vte_file_stream_head (VteStream *astream)
 	return stream->head;
 }
 
+void
+_vte_file_stream_set_cache_size (VteStream *astream, guint n_blocks)
+{
+	VteFileStream *stream = (VteFileStream *) astream;
+
+        _vte_file_stream_cache_clear (stream, MAX(n_blocks, 1));
+}
+
+void
+_vte_file_stream_get_cache_stats (VteStream *astream, VteStreamCacheStats *stats)
+{
+	VteFileStream *stream = (VteFileStream *) astream;
+
+        *stats = stream->cache_stats;
+}
+
+void
+_vte_file_stream_set_cache_limit (gsize limit)
+{
+        cache_limit = limit;
+}
+
 static void
 _vte_file_stream_class_init (VteFileStreamClass *klass)
 {
@@ -1262,9 +1801,10 @@ G_END_DECLS
         g_assert (memcmp(__buf, __contents, strlen(__contents)) == 0); \
 } while (0)
 
-/* Check for the snake's state, tail, head and contents */
+/* Check for the snake's state, tail, head and contents, read and mapped if it maps the file */
 #define assert_snake(__snake, __state, __tail, __head, __contents) do { \
         char __buf[VTE_SNAKE_BLOCKSIZE]; \
+        const char *__block; \
         int __i; \
         g_assert_cmpuint (__snake->state, ==, __state); \
         g_assert_cmpuint (__snake->tail, ==, __tail); \
@@ -1273,6 +1813,10 @@ G_END_DECLS
         for (__i = __tail; __i < __head; __i += VTE_SNAKE_BLOCKSIZE) { \
                 g_assert (_vte_snake_read (__snake, __i, __buf)); \
                 g_assert (memcmp(__buf, __contents + __i - __tail, VTE_SNAKE_BLOCKSIZE) == 0); \
+                __block = _vte_snake_map_block (__snake, __i); \
+                g_assert ((__block != NULL) == __snake->use_mmap); \
+                if (__block != NULL) \
+                        g_assert (memcmp(__block, __contents + __i - __tail, VTE_SNAKE_BLOCKSIZE) == 0); \
         } \
 } while (0)
 
@@ -1299,6 +1843,16 @@ G_END_DECLS
         g_assert (memcmp(__buf, __contents, __head - __tail) == 0); \
 } while (0)
 
+/* Check whether the stream's read cache has the block at the offset */
+#define assert_cached(__stream, __offset, __cached) do { \
+        gboolean __found = FALSE; \
+        guint __i; \
+        for (__i = 0; __i < __stream->n_cache_blocks; __i++) \
+                if (__stream->cache[__i].offset == __offset) \
+                        __found = TRUE; \
+        g_assert_cmpint (__found, ==, __cached); \
+} while (0)
+
 /* Test the fake encryption/decryption and compression/decompression routines.
  * It usually doesn't make too much sense to test something that's part of the test infrastructure,
  * but if anything goes wrong we'd better catch it here rather than in the way more complicated tests. */
@@ -1314,51 +1868,56 @@ test_fakes (void)
         g_assert(strncmp (buf, "ABCDxyz1234!!!\056", 15) == 0);
 
         /* Decrypt */
-        g_assert_true(_vte_boa_decrypt (boa, 35, 6, buf, 14));
+        g_assert_true(_vte_boa_decrypt (boa, 35, 6, buf, buf, 14) == buf);
         g_assert(strncmp (buf, "abcdXYZ1234!!!", 14) == 0);
 
         /* Encrypt again */
         _vte_boa_encrypt (boa, 35, 6, buf, 14);
         g_assert(strncmp (buf, "ABCDxyz1234!!!\056", 15) == 0);
 
+        /* Decrypt to another buffer */
+        g_assert_true(_vte_boa_decrypt (boa, 35, 6, buf, buf2, 14) == buf2);
+        g_assert(strncmp (buf2, "abcdXYZ1234!!!", 14) == 0);
+        g_assert(strncmp (buf, "ABCDxyz1234!!!\056", 15) == 0);
+
         /* Decrypting with corrupted tag should fail */
         buf[14]++;
-        g_assert_false(_vte_boa_decrypt (boa, 35, 6, buf, 14));
+        g_assert_true(_vte_boa_decrypt (boa, 35, 6, buf, buf, 14) == NULL);
 
         /* Compress, but becomes bigger */
         strcpy(buf, "abcdef");
-        g_assert_cmpuint(_vte_boa_compress (buf2, 100, buf, 6), ==, 7);
+        g_assert_cmpuint(_vte_boa_compress (VTE_STREAM_CODEC_ZLIB, 0, buf2, 100, buf, 6), ==, 7);
         g_assert(strncmp (buf2, "1abcdef", 7) == 0);
 
         /* Uncompress */
         strcpy(buf, "1abcdef");
-        g_assert_cmpuint(_vte_boa_uncompress (buf2, 100, buf, 7), ==, 6);
+        g_assert_cmpuint(_vte_boa_uncompress (VTE_STREAM_CODEC_ZLIB, buf2, 100, buf, 7), ==, 6);
         g_assert(strncmp (buf2, "abcdef", 6) == 0);
 
         /* Compress, becomes smaller */
         strcpy(buf, "www");
-        g_assert_cmpuint(_vte_boa_compress (buf2, 100, buf, 3), ==, 2);
+        g_assert_cmpuint(_vte_boa_compress (VTE_STREAM_CODEC_ZLIB, 0, buf2, 100, buf, 3), ==, 2);
         g_assert(strncmp (buf2, "3w", 2) == 0);
 
         /* Uncompress */
         strcpy(buf, "3w");
-        g_assert_cmpuint(_vte_boa_uncompress (buf2, 100, buf, 2), ==, 3);
+        g_assert_cmpuint(_vte_boa_uncompress (VTE_STREAM_CODEC_ZLIB, buf2, 100, buf, 2), ==, 3);
         g_assert(strncmp (buf2, "www", 3) == 0);
 
         /* Compress, remains the same size */
         strcpy(buf, "zebraaa");
-        g_assert_cmpuint(_vte_boa_compress (buf2, 100, buf, 7), ==, 7);
+        g_assert_cmpuint(_vte_boa_compress (VTE_STREAM_CODEC_ZLIB, 0, buf2, 100, buf, 7), ==, 7);
         g_assert(strncmp (buf2, "1zebr3a", 7) == 0);
 
         /* Uncompress */
         strcpy(buf, "1zebr3a");
-        g_assert_cmpuint(_vte_boa_uncompress (buf2, 100, buf, 7), ==, 7);
+        g_assert_cmpuint(_vte_boa_uncompress (VTE_STREAM_CODEC_ZLIB, buf2, 100, buf, 7), ==, 7);
         g_assert(strncmp (buf2, "zebraaa", 7) == 0);
 
         /* Trying to uncompress the original does *not* give back the same contents.
          * This will be important below. */
         strcpy(buf, "zebraaa");
-        g_assert_cmpuint(_vte_boa_uncompress (buf2, 100, buf, 7), ==, 0);
+        g_assert_cmpuint(_vte_boa_uncompress (VTE_STREAM_CODEC_ZLIB, buf2, 100, buf, 7), ==, 0);
 
         g_object_unref (boa);
 }
@@ -1533,6 +2092,34 @@ test_boa (void)
         g_object_unref (boa);
 }
 
+/* Each block records the codec it was written with */
+static void
+test_boa_codec (void)
+{
+        VteBoa *boa = (VteBoa *)g_object_new (VTE_TYPE_BOA, NULL);
+        VteSnake *snake = (VteSnake *) &boa->parent;
+        char buf[VTE_SNAKE_BLOCKSIZE];
+
+        _vte_boa_write (boa, 0, "axolotl");
+        _vte_boa_set_codec (boa, VTE_STREAM_CODEC_LZ4, 0);
+        _vte_boa_write (boa, 7, "beeeeee");
+        _vte_boa_set_codec (boa, VTE_STREAM_CODEC_NONE, 0);
+        _vte_boa_write (boa, 14, "cheeeee");
+        _vte_boa_set_codec (boa, VTE_STREAM_CODEC_ZSTD, 0);
+        _vte_boa_write (boa, 21, "deeeeer");
+        assert_file (snake->fd, "\007\001AXOLOTL\001" "\024\0011B6E\011..." "\007\001CHEEEEE\021" "\046\0011D5E1R\031.");
+        assert_boa (boa, 0, 28, "axolotl" "beeeeee" "cheeeee" "deeeeer");
+
+        /* A block with an unknown codec can't be read */
+        _vte_snake_read (snake, 30, buf);
+        buf[0] = (15 << VTE_BLOCK_CODEC_SHIFT) | (buf[0] & VTE_BLOCK_DATALENGTH_MASK);
+        _vte_snake_write (snake, 30, buf, VTE_SNAKE_BLOCKSIZE);
+        g_assert_false (_vte_boa_read (boa, 21, buf));
+        g_assert_true (_vte_boa_read (boa, 14, buf));
+
+        g_object_unref (boa);
+}
+
 #define stream_append(as, str) _vte_stream_append((as), (str), strlen(str))
 
 static void
@@ -1594,12 +2181,12 @@ test_stream (void)
 
         /* Test that the read cache is invalidated on truncate */
         _vte_stream_read (astream, 12, buf, 2);
-        g_assert_cmpuint (stream->rbuf_offset, ==, 7);
+        assert_cached (stream, 7, TRUE);
         _vte_stream_truncate (astream, 13);
-        g_assert_cmpuint (stream->rbuf_offset, ==, 1);
+        assert_cached (stream, 7, FALSE);
         stream_append (astream, "z" "cat");
         _vte_stream_read (astream, 12, buf, 2);
-        g_assert_cmpuint (stream->rbuf_offset, ==, 7);
+        assert_cached (stream, 7, TRUE);
         buf[2] = '\0';
         g_assert_cmpstr (buf, ==, "ez");
         assert_file (snake->fd, "\007\001AXOLOTL\001" "\006\0031B5E1Z\013.");
@@ -1758,6 +2345,222 @@ test_stream (void)
         g_object_unref (astream);
 }
 
+/* The read cache keeps the most recently read blocks, within the global limit */
+static void
+test_stream_cache (void)
+{
+        VteStreamCacheStats stats;
+        char buf[8];
+
+        VteStream *astream = _vte_file_stream_new();
+        VteFileStream *stream = (VteFileStream *) astream;
+        VteStream *astream2 = _vte_file_stream_new();
+        VteFileStream *stream2 = (VteFileStream *) astream2;
+
+        /* Five blocks and a bit */
+        stream_append (astream, "axolotl" "beeeeee" "cheetah" "dodododo" "eeeeel" "ferret");
+        _vte_file_stream_set_cache_size (astream, 2);
+
+        g_assert (_vte_stream_read (astream, 0, buf, 7));
+        g_assert (_vte_stream_read (astream, 8, buf, 2));
+        g_assert (_vte_stream_read (astream, 10, buf, 2));
+        g_assert (_vte_stream_read (astream, 3, buf, 2));
+        g_assert (_vte_stream_read (astream, 5, buf, 2));
+        _vte_file_stream_get_cache_stats (astream, &stats);
+        g_assert_cmpuint (stats.hits, ==, 3);
+        g_assert_cmpuint (stats.misses, ==, 2);
+        g_assert_cmpuint (stats.evictions, ==, 0);
+        g_assert_cmpuint (stream->n_cache_blocks, ==, 2);
+
+        /* The least recently read block gives way */
+        g_assert (_vte_stream_read (astream, 14, buf, 7));
+        assert_cached (stream, 0, TRUE);
+        assert_cached (stream, 7, FALSE);
+        assert_cached (stream, 14, TRUE);
+        g_assert (_vte_stream_read (astream, 0, buf, 1));
+        g_assert (_vte_stream_read (astream, 21, buf, 1));
+        assert_cached (stream, 0, TRUE);
+        assert_cached (stream, 14, FALSE);
+        assert_cached (stream, 21, TRUE);
+        _vte_file_stream_get_cache_stats (astream, &stats);
+        g_assert_cmpuint (stats.hits, ==, 4);
+        g_assert_cmpuint (stats.misses, ==, 4);
+        g_assert_cmpuint (stats.evictions, ==, 2);
+
+        /* A read spanning blocks goes through the cache too */
+        g_assert (_vte_stream_read (astream, 19, buf, 8));
+        g_assert (memcmp (buf, "ahdodo" "do", 8) == 0);
+        g_assert (_vte_stream_read (astream, 30, buf, 6));
+        g_assert (memcmp (buf, "eeeelf", 6) == 0);
+        assert_cached (stream, 14, FALSE);
+        assert_cached (stream, 21, TRUE);
+        assert_cached (stream, 28, TRUE);
+
+        /* Blocks that went past the tail are dropped, and their room reused */
+        _vte_stream_advance_tail (astream, 29);
+        assert_cached (stream, 21, FALSE);
+        assert_cached (stream, 28, TRUE);
+        stream_append (astream, "s");
+        g_assert (_vte_stream_read (astream, 35, buf, 7));
+        g_assert (memcmp (buf, "ferrets", 7) == 0);
+        assert_cached (stream, 28, TRUE);
+        assert_cached (stream, 35, TRUE);
+        _vte_file_stream_get_cache_stats (astream, &stats);
+        g_assert_cmpuint (stats.evictions, ==, 4);
+        g_assert_cmpuint (stream->n_cache_blocks, ==, 2);
+
+        /* Resetting drops all of them */
+        _vte_stream_reset (astream, 45);
+        assert_cached (stream, 28, FALSE);
+        assert_cached (stream, 35, FALSE);
+
+        /* Beyond the global limit, a stream caches a single block */
+        _vte_file_stream_set_cache_limit (cache_bytes);
+        stream_append (astream2, "axolotl" "beeeeee" "cheetah");
+        g_assert (_vte_stream_read (astream2, 0, buf, 1));
+        g_assert (_vte_stream_read (astream2, 7, buf, 1));
+        g_assert_cmpuint (stream2->n_cache_blocks, ==, 1);
+        assert_cached (stream2, 0, FALSE);
+        assert_cached (stream2, 7, TRUE);
+        _vte_file_stream_set_cache_limit (VTE_FILE_STREAM_CACHE_LIMIT);
+        g_assert (_vte_stream_read (astream2, 0, buf, 1));
+        g_assert_cmpuint (stream2->n_cache_blocks, ==, 2);
+
+        g_object_unref (astream);
+        g_object_unref (astream2);
+        g_assert_cmpuint (cache_bytes, ==, 0);
+}
+
+/* The memory stream reads back what was written, whether compressing or not */
+static void
+test_mem_stream (void)
+{
+        const char *words[] = { "axolotl", "beeeeeeeeeeeeeeeeeeeeeee", "cheetah", "dodo", "eeeeeeeeeeeeeeeeeel", "ferret" };
+        VteStreamCodec codecs[] = { VTE_STREAM_CODEC_NONE, VTE_STREAM_CODEC_ZLIB };
+        char expected[5000], buf[100];
+        gsize tail, head, len, offset;
+        int round;
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS(codecs); i++) {
+                VteStream *astream = _vte_mem_stream_new (codecs[i], 0);
+                VteMemStream *stream = (VteMemStream *) astream;
+                gboolean compressed = FALSE;
+                guint j;
+
+                tail = head = 0;
+                for (round = 0; round < 300; round++) {
+                        const char *word = words[round % G_N_ELEMENTS(words)];
+
+                        stream_append (astream, word);
+                        g_assert_cmpuint (head + strlen(word), <, sizeof(expected));
+                        memcpy (expected + head, word, strlen(word));
+                        head += strlen(word);
+
+                        if (round % 7 == 6)
+                                _vte_stream_truncate (astream, head = MAX(tail + 9, head) - 9);
+                        if (round % 5 == 4)
+                                _vte_stream_advance_tail (astream, tail = MAX(tail + 40, head) - 40);
+                        if (round % 100 == 50) {
+                                head += 3;
+                                tail = head;
+                                _vte_stream_reset (astream, head);
+                        }
+
+                        g_assert_cmpuint (_vte_stream_tail (astream), ==, tail);
+                        g_assert_cmpuint (_vte_stream_head (astream), ==, head);
+
+                        /* Read back everything between the tail and the head, in pieces of any size */
+                        for (offset = tail; offset < head; offset += len) {
+                                len = MIN(head - offset, sizeof(buf));
+                                len = MIN(len, 1 + (offset * 7 + round) % 37);
+                                g_assert (_vte_stream_read (astream, offset, buf, len));
+                                g_assert (memcmp (buf, expected + offset, len) == 0);
+                        }
+                        g_assert_false (_vte_stream_read (astream, head, buf, 1));
+                        if (tail > 0)
+                                g_assert_false (_vte_stream_read (astream, tail - 1, buf, 1));
+
+                        /* Only the blocks from the tail's on are kept */
+                        g_assert_cmpuint (stream->blocks_offset, ==, ALIGN_MEM(tail));
+                        g_assert_cmpuint (stream->blocks_offset + stream->blocks->len * VTE_MEM_STREAM_BLOCKSIZE, ==, ALIGN_MEM(head));
+                        for (j = 0; j < stream->blocks->len; j++)
+                                if (g_array_index (stream->blocks, VteMemStreamBlock, j).len < VTE_MEM_STREAM_BLOCKSIZE)
+                                        compressed = TRUE;
+                }
+
+                /* The long runs of the same letter compress */
+                g_assert_cmpint (compressed, ==, codecs[i] != VTE_STREAM_CODEC_NONE);
+
+                g_object_unref (astream);
+        }
+}
+
+/* Waits for the writer thread to carry out all the queued operations of the stream */
+static void
+stream_flush (VteFileStream *stream)
+{
+        g_mutex_lock (&writer_lock);
+        while (!g_queue_is_empty (&stream->ops))
+                g_cond_wait (&writer_done_cond, &writer_lock);
+        g_mutex_unlock (&writer_lock);
+}
+
+/* Writing on the writer thread gives the same results as writing synchronously */
+static void
+test_stream_async (void)
+{
+        const char *words[] = { "axolotl", "bee", "cheetah", "dodo", "eeeeel", "ferret", "gnu", "hamster" };
+        VteStream *astream[2];
+        VteFileStream *stream[2];
+        char buf[2][100], file[2][1000];
+        ssize_t filesize[2];
+        gsize tail, head, len;
+        int i, round;
+
+        for (i = 0; i < 2; i++) {
+                astream[i] = _vte_file_stream_new();
+                stream[i] = (VteFileStream *) astream[i];
+                stream[i]->async = (i == 1);
+        }
+
+        for (round = 0; round < 300; round++) {
+                for (i = 0; i < 2; i++) {
+                        stream_append (astream[i], words[round % G_N_ELEMENTS(words)]);
+
+                        tail = _vte_stream_tail (astream[i]);
+                        head = _vte_stream_head (astream[i]);
+                        if (round % 7 == 6)
+                                _vte_stream_truncate (astream[i], head = MAX(tail + 5, head) - 5);
+                        if (round % 5 == 4)
+                                _vte_stream_advance_tail (astream[i], MAX(tail + 30, head) - 30);
+                        if (round == 150)
+                                _vte_stream_reset (astream[i], head + 3);
+                }
+
+                /* Read back the latest blocks, probably still queued for the writer */
+                tail = _vte_stream_tail (astream[0]);
+                head = _vte_stream_head (astream[0]);
+                g_assert_cmpuint (_vte_stream_tail (astream[1]), ==, tail);
+                g_assert_cmpuint (_vte_stream_head (astream[1]), ==, head);
+                len = MIN(head - tail, sizeof(buf[0]));
+                for (i = 0; i < 2; i++)
+                        g_assert (_vte_stream_read (astream[i], head - len, buf[i], len));
+                g_assert (memcmp (buf[0], buf[1], len) == 0);
+        }
+
+        /* Once the writer is done, the files are the same too */
+        stream_flush (stream[1]);
+        for (i = 0; i < 2; i++)
+                filesize[i] = pread (stream[i]->boa->parent.fd, file[i], sizeof(file[i]), 0);
+        g_assert_cmpint (filesize[0], >, 0);
+        g_assert_cmpint (filesize[0], ==, filesize[1]);
+        g_assert (memcmp (file[0], file[1], filesize[0]) == 0);
+
+        for (i = 0; i < 2; i++)
+                g_object_unref (astream[i]);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -1765,7 +2568,22 @@ main (int argc, char **argv)
 
         test_snake();
         test_boa();
+        test_boa_codec();
+        test_stream();
+        test_stream_cache();
+        test_mem_stream();
+        test_stream_async();
+
+#ifdef HAVE_MMAP
+        /* Again, reading the files through mappings */
+        snake_use_mmap = TRUE;
+        test_snake();
+        test_boa();
+        test_boa_codec();
         test_stream();
+        test_stream_cache();
+        test_stream_async();
+#endif
 
         printf("vtestream-file tests passed :)\n");
         return 0;
@@ -0,0 +1,347 @@
+/*
+ * Copyright © 2019 VTE contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * VteMemStream keeps the stream in memory, for where the temporary file
+ * would live in memory anyway (a tmpfs), or the memory is there to spare.
+ *
+ * Like VteFileStream, it collects the appended data in a write buffer until
+ * there's a complete block, then compresses it (unless the codec is
+ * VTE_STREAM_CODEC_NONE, or the block doesn't get smaller) and keeps it in
+ * a list of blocks, which advancing the tail frees from the front. There's
+ * no encryption, since the data never leaves the process, and no system
+ * call: the blocks are plain heap allocations, and an uncompressed one is
+ * the write buffer it was filled in, read straight out of it.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "vtestream-codec.h"
+
+G_BEGIN_DECLS
+
+#ifndef VTESTREAM_MAIN
+# define VTE_MEM_STREAM_BLOCKSIZE 65536
+#else
+/* Smaller sizes for unit testing */
+# define VTE_MEM_STREAM_BLOCKSIZE 16
+#endif
+
+#define ALIGN_MEM(x) (((x) / VTE_MEM_STREAM_BLOCKSIZE) * VTE_MEM_STREAM_BLOCKSIZE)
+#define MOD_MEM(x) ((x) % VTE_MEM_STREAM_BLOCKSIZE)
+
+typedef struct _VteMemStreamBlock {
+        /* VTE_MEM_STREAM_BLOCKSIZE bytes, or fewer if compressed */
+        char *data;
+        gsize len;
+} VteMemStreamBlock;
+
+typedef struct _VteMemStream {
+        GObject parent;
+
+        VteStreamCodec codec;
+        int level;
+        /* Scratch space to compress a block into */
+        char *cbuf;
+        gsize cbuf_len;
+
+        /* The complete blocks from the one holding the tail on, of VteMemStreamBlock */
+        GArray *blocks;
+        /* Offset of the first of the blocks, always a multiple of block size */
+        gsize blocks_offset;
+
+        char *rbuf;
+        /* Offset of the block uncompressed into rbuf, always a multiple of block size.
+         * Use a value of 1 (or anything that's not a multiple of block size)
+         * to denote if no block is there. */
+        gsize rbuf_offset;
+
+        char *wbuf;
+        gsize wbuf_len;
+
+        gsize head, tail;
+} VteMemStream;
+
+typedef VteStreamClass VteMemStreamClass;
+
+static GType _vte_mem_stream_get_type (void);
+#define VTE_TYPE_MEM_STREAM _vte_mem_stream_get_type ()
+
+G_DEFINE_TYPE (VteMemStream, _vte_mem_stream, VTE_TYPE_STREAM)
+
+VteStream *
+_vte_mem_stream_new (VteStreamCodec codec, int level)
+{
+        VteMemStream *stream = (VteMemStream *) g_object_new (VTE_TYPE_MEM_STREAM, NULL);
+
+        if (G_UNLIKELY (!_vte_stream_codec_is_available (codec))) {
+                g_warning ("Scrollback codec %s is not available, not compressing",
+                           _vte_stream_codec_get_name (codec));
+                codec = VTE_STREAM_CODEC_NONE;
+        }
+
+        stream->codec = codec;
+        stream->level = level;
+        if (codec != VTE_STREAM_CODEC_NONE) {
+                stream->cbuf_len = _vte_stream_codec_compress_bound (codec, VTE_MEM_STREAM_BLOCKSIZE);
+                stream->cbuf = (char *)g_malloc(stream->cbuf_len);
+        }
+
+        return (VteStream *) stream;
+}
+
+static void
+_vte_mem_stream_block_clear (gpointer data)
+{
+        VteMemStreamBlock *block = (VteMemStreamBlock *) data;
+
+        g_free (block->data);
+}
+
+static void
+_vte_mem_stream_init (VteMemStream *stream)
+{
+        stream->codec = VTE_STREAM_CODEC_NONE;
+
+        stream->blocks = g_array_new (FALSE, FALSE, sizeof (VteMemStreamBlock));
+        g_array_set_clear_func (stream->blocks, _vte_mem_stream_block_clear);
+
+        stream->rbuf = (char *)g_malloc(VTE_MEM_STREAM_BLOCKSIZE);
+        stream->wbuf = (char *)g_malloc(VTE_MEM_STREAM_BLOCKSIZE);
+        stream->rbuf_offset = 1;  /* Invalidate */
+}
+
+static void
+_vte_mem_stream_finalize (GObject *object)
+{
+        VteMemStream *stream = (VteMemStream *) object;
+
+        g_array_free (stream->blocks, TRUE);
+        g_free (stream->cbuf);
+        g_free (stream->rbuf);
+        g_free (stream->wbuf);
+
+        G_OBJECT_CLASS (_vte_mem_stream_parent_class)->finalize(object);
+}
+
+/* Returns the complete block at the aligned offset */
+static inline VteMemStreamBlock *
+_vte_mem_stream_block (VteMemStream *stream, gsize offset)
+{
+        return &g_array_index (stream->blocks, VteMemStreamBlock,
+                               (offset - stream->blocks_offset) / VTE_MEM_STREAM_BLOCKSIZE);
+}
+
+/* Returns the uncompressed data of the block at the aligned offset, or NULL if it's corrupt */
+static const char *
+_vte_mem_stream_block_data (VteMemStream *stream, gsize offset)
+{
+        VteMemStreamBlock *block = _vte_mem_stream_block (stream, offset);
+
+        if (block->len == VTE_MEM_STREAM_BLOCKSIZE)
+                return block->data;
+
+        if (offset != stream->rbuf_offset) {
+                if (G_UNLIKELY (_vte_stream_codec_uncompress (stream->codec,
+                                                              stream->rbuf, VTE_MEM_STREAM_BLOCKSIZE,
+                                                              block->data, block->len) != VTE_MEM_STREAM_BLOCKSIZE)) {
+                        stream->rbuf_offset = 1;  /* Invalidate */
+                        return NULL;
+                }
+                stream->rbuf_offset = offset;
+        }
+        return stream->rbuf;
+}
+
+/* Moves the write buffer, a complete block, to the end of the blocks */
+static void
+_vte_mem_stream_store_block (VteMemStream *stream)
+{
+        VteMemStreamBlock block;
+        gsize len = 0;
+
+        if (stream->codec != VTE_STREAM_CODEC_NONE)
+                len = _vte_stream_codec_compress (stream->codec, stream->level,
+                                                  stream->cbuf, stream->cbuf_len,
+                                                  stream->wbuf, VTE_MEM_STREAM_BLOCKSIZE);
+
+        if (len > 0 && len < VTE_MEM_STREAM_BLOCKSIZE) {
+                block.data = (char *)g_memdup (stream->cbuf, len);
+                block.len = len;
+        } else {
+                /* Keep it as is, no need to copy */
+                block.data = stream->wbuf;
+                block.len = VTE_MEM_STREAM_BLOCKSIZE;
+                stream->wbuf = (char *)g_malloc(VTE_MEM_STREAM_BLOCKSIZE);
+        }
+
+        g_array_append_val (stream->blocks, block);
+}
+
+static void
+_vte_mem_stream_reset (VteStream *astream, gsize offset)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        g_assert_cmpuint (offset, >=, stream->head);
+
+        g_array_set_size (stream->blocks, 0);
+        stream->blocks_offset = ALIGN_MEM(offset);
+        stream->tail = stream->head = offset;
+
+        /* Like VteFileStream, fill the unused start of the block with zeros,
+         * or dashes for unit testing. */
+#ifndef VTESTREAM_MAIN
+        memset(stream->wbuf, 0, MOD_MEM(offset));
+#else
+        memset(stream->wbuf, '-', MOD_MEM(offset));
+#endif
+
+        stream->wbuf_len = MOD_MEM(offset);
+        stream->rbuf_offset = 1;  /* Invalidate */
+}
+
+static gboolean
+_vte_mem_stream_read (VteStream *astream, gsize offset, char *data, gsize len)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        /* Out of bounds request, see _vte_file_stream_read() */
+        if (G_UNLIKELY (offset < stream->tail || offset + len > stream->head || offset + len < offset)) {
+                if (G_LIKELY (offset + len <= stream->tail || offset >= stream->head))
+                        return FALSE;
+                g_assert_not_reached();
+        }
+
+        while (len && offset < ALIGN_MEM(stream->head)) {
+                gsize l = MIN(VTE_MEM_STREAM_BLOCKSIZE - MOD_MEM(offset), len);
+                const char *block = _vte_mem_stream_block_data (stream, ALIGN_MEM(offset));
+                if (G_UNLIKELY (block == NULL))
+                        return FALSE;
+                memcpy(data, block + MOD_MEM(offset), l);
+                offset += l; data += l; len -= l;
+        }
+        if (len) {
+                g_assert_cmpuint (MOD_MEM(offset) + len, <=, stream->wbuf_len);
+                memcpy(data, stream->wbuf + MOD_MEM(offset), len);
+        }
+        return TRUE;
+}
+
+static void
+_vte_mem_stream_append (VteStream *astream, const char *data, gsize len)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        while (len) {
+                gsize l = MIN(VTE_MEM_STREAM_BLOCKSIZE - stream->wbuf_len, len);
+                memcpy(stream->wbuf + stream->wbuf_len, data, l);
+                stream->wbuf_len += l; data += l; len -= l;
+                if (stream->wbuf_len == VTE_MEM_STREAM_BLOCKSIZE) {
+                        _vte_mem_stream_store_block (stream);
+                        stream->wbuf_len = 0;
+                }
+                stream->head += l;
+        }
+}
+
+static void
+_vte_mem_stream_truncate (VteStream *astream, gsize offset)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        g_assert_cmpuint (offset, >=, stream->tail);
+        g_assert_cmpuint (offset, <=, stream->head);
+
+        if (offset < ALIGN_MEM(stream->head)) {
+                /* Move the new partial last block back to the write buffer */
+                gsize offset_aligned = ALIGN_MEM(offset);
+                const char *block = _vte_mem_stream_block_data (stream, offset_aligned);
+                if (G_LIKELY (block != NULL))
+                        memcpy(stream->wbuf, block, VTE_MEM_STREAM_BLOCKSIZE);
+                else
+                        memset(stream->wbuf, 0, VTE_MEM_STREAM_BLOCKSIZE);
+
+                g_array_set_size (stream->blocks,
+                                  (offset_aligned - stream->blocks_offset) / VTE_MEM_STREAM_BLOCKSIZE);
+
+                if (stream->rbuf_offset >= offset_aligned) {
+                        stream->rbuf_offset = 1;  /* Invalidate */
+                }
+        }
+        stream->wbuf_len = MOD_MEM(offset);
+        stream->head = offset;
+}
+
+static void
+_vte_mem_stream_advance_tail (VteStream *astream, gsize offset)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+        guint n;
+
+        g_assert_cmpuint (offset, >=, stream->tail);
+        g_assert_cmpuint (offset, <=, stream->head);
+
+        /* Free the blocks entirely before the new tail; the one in the
+         * write buffer isn't among them. */
+        n = MIN((ALIGN_MEM(offset) - stream->blocks_offset) / VTE_MEM_STREAM_BLOCKSIZE,
+                stream->blocks->len);
+        if (n > 0) {
+                g_array_remove_range (stream->blocks, 0, n);
+                stream->blocks_offset += n * VTE_MEM_STREAM_BLOCKSIZE;
+                if (stream->rbuf_offset < stream->blocks_offset)
+                        stream->rbuf_offset = 1;  /* Invalidate */
+        }
+
+        stream->tail = offset;
+}
+
+static gsize
+_vte_mem_stream_tail (VteStream *astream)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        return stream->tail;
+}
+
+static gsize
+_vte_mem_stream_head (VteStream *astream)
+{
+        VteMemStream *stream = (VteMemStream *) astream;
+
+        return stream->head;
+}
+
+static void
+_vte_mem_stream_class_init (VteMemStreamClass *klass)
+{
+        GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+        gobject_class->finalize = _vte_mem_stream_finalize;
+
+        klass->reset = _vte_mem_stream_reset;
+        klass->read = _vte_mem_stream_read;
+        klass->append = _vte_mem_stream_append;
+        klass->truncate = _vte_mem_stream_truncate;
+        klass->advance_tail = _vte_mem_stream_advance_tail;
+        klass->tail = _vte_mem_stream_tail;
+        klass->head = _vte_mem_stream_head;
+}
+
+G_END_DECLS
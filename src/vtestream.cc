@@ -30,4 +30,5 @@
  */
 
 #include "vtestream-base.h"
+#include "vtestream-mem.h"
 #include "vtestream-file.h"
@@ -24,6 +24,8 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include "vtestream-codec.h"
+
 G_BEGIN_DECLS
 
 typedef struct _VteStream VteStream;
@@ -41,6 +43,31 @@ gsize _vte_stream_head (VteStream *stream);
 VteStream *
 _vte_file_stream_new (void);
 
+VteStream *
+_vte_file_stream_new_with_codec (VteStreamCodec codec, int level);
+
+/* Keeps the stream in memory rather than in a file; compressed with @codec
+ * if it's not VTE_STREAM_CODEC_NONE, and not encrypted. */
+VteStream *
+_vte_mem_stream_new (VteStreamCodec codec, int level);
+
+/* The file streams keep the blocks they read decoded, to answer reads of
+ * nearby offsets without decrypting and uncompressing them again. */
+
+typedef struct {
+        guint64 hits;
+        guint64 misses;
+        guint64 evictions;
+} VteStreamCacheStats;
+
+/* Sets the number of blocks @stream caches at most, and empties its cache. */
+void _vte_file_stream_set_cache_size (VteStream *stream, guint n_blocks);
+void _vte_file_stream_get_cache_stats (VteStream *stream, VteStreamCacheStats *stats);
+
+/* Sets the memory the caches of all the streams may take together; each
+ * stream still caches one block beyond it. */
+void _vte_file_stream_set_cache_limit (gsize limit);
+
 G_END_DECLS
 
 #endif
@@ -189,6 +189,8 @@ Widget::map() noexcept
 {
         if (m_event_window)
                 gdk_window_show_unraised(m_event_window);
+
+        m_terminal->widget_map();
 }
 
 void
@@ -334,6 +336,8 @@ Widget::size_allocate(GtkAllocation* allocation) noexcept
 void
 Widget::unmap() noexcept
 {
+        m_terminal->widget_unmap();
+
         if (m_event_window)
                 gdk_window_hide(m_event_window);
 }